@@ -0,0 +1,57 @@
+/* Бенчмарки кодеков шины server-radio
+ *
+ * Разбор метаданных radio.uplink_frame (zserver_parse_tx_frame_metadata)
+ * в JSON и бинарном формате. Сокетов server-radio тут нет: свой zmq контекст
+ * он создает сам, так что inproc к нему не подключиться.
+ */
+
+#include <cstdlib>
+
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#include <log.h>
+#include "server-zmq.h"
+}
+
+#include "fixtures.hpp"
+
+
+static void _parse_tx_frame_metadata(benchmark::State & state, bool binary)
+{
+	const gbus_fixture & fixture = gbus_bench_fixture(gbus_fixture_kind::uplink_frame, binary);
+
+	msg_cookie_t cookie = 0;
+	for (auto _: state)
+	{
+		const int rc = zserver_parse_tx_frame_metadata(fixture.metadata.data(), fixture.metadata.size(), &cookie);
+		if (rc < 0)
+		{
+			state.SkipWithError("unable to parse fixture");
+			break;
+		}
+
+		benchmark::DoNotOptimize(cookie);
+	}
+
+	state.SetLabel(binary ? "binary" : "json");
+	state.SetBytesProcessed(state.iterations() * fixture.metadata.size());
+}
+
+
+BENCHMARK_CAPTURE(_parse_tx_frame_metadata, json, false);
+BENCHMARK_CAPTURE(_parse_tx_frame_metadata, binary, true);
+
+
+int main(int argc, char ** argv)
+{
+	log_set_level(LOG_ERROR);
+
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return EXIT_FAILURE;
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,259 @@
+/* Бенчмарки кодеков шины server-tun
+ *
+ * zmq_server подключается по inproc к сокетам бенчмарка. Приём
+ * (recv_downlink_packet) идет из пачек uslp.downlink_sdu, заранее
+ * отправленных в его SUB сокет с остановленным таймером. Отправка
+ * (send_uplink_packet) - в приёмник, который вычерпывается так же пачками.
+ * Пакеты уходят в zmq без копирования из буферов packet_pool.
+ *
+ * Каждый бенчмарк есть в вариантах с JSON и бинарными метаданными.
+ * Формат исходящих метаданных zmq_server берет из окружения.
+ *
+ * Сжатие заголовков меряется отдельно, без шины: сжатие и восстановление
+ * потока маленьких UDP и TCP пакетов. Счетчик ratio - во сколько раз
+ * пакеты с заголовками стали короче.
+ */
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include <benchmark/benchmark.h>
+
+#include <zmq.hpp>
+
+#include <gbus_meta.h>
+
+#include "log.hpp"
+#include "zmq_server.hpp"
+#include "header_compression.hpp"
+
+#include "fixtures.hpp"
+#include "inproc.hpp"
+
+
+#define ITS_GBUS_BENCH_BPCS_ENDPOINT "inproc://gbus-bench-bpcs"
+#define ITS_GBUS_BENCH_BSCP_ENDPOINT "inproc://gbus-bench-bscp"
+
+
+static bool _bpcs_readable(zmq_server & server)
+{
+	zmq::pollitem_t items[] = { { server.bpcs_socket().handle(), 0, ZMQ_POLLIN, 0 } };
+	zmq::poll(items, 1, std::chrono::milliseconds(0));
+	return items[0].revents & ZMQ_POLLIN;
+}
+
+
+//! Открытие zmq_server на сокетах бенчмарка с нужным форматом метаданных
+static void _open_server(zmq_server & server, bool binary)
+{
+	if (binary)
+		setenv(GBUS_META_FORMAT_ENV_KEY, GBUS_META_FORMAT_BINARY, 1);
+	else
+		unsetenv(GBUS_META_FORMAT_ENV_KEY);
+
+	setenv("ITS_GBUS_BPCS_ENDPOINT", ITS_GBUS_BENCH_BPCS_ENDPOINT, 1);
+	setenv("ITS_GBUS_BSCP_ENDPOINT", ITS_GBUS_BENCH_BSCP_ENDPOINT, 1);
+
+	server.set_uplink_channel(ITS_GBUS_BENCH_SC_ID, ITS_GBUS_BENCH_VCHANNEL_ID, ITS_GBUS_BENCH_MAP_ID);
+	server.set_downlink_channel(ITS_GBUS_BENCH_SC_ID, ITS_GBUS_BENCH_VCHANNEL_ID, ITS_GBUS_BENCH_MAP_ID);
+	server.open();
+}
+
+
+static void _recv_downlink_packet(benchmark::State & state, bool binary)
+{
+	const gbus_fixture & fixture = gbus_bench_fixture(gbus_fixture_kind::downlink_sdu, binary);
+
+	zmq::context_t ctx;
+	inproc_source source(ctx, ITS_GBUS_BENCH_BPCS_ENDPOINT);
+	inproc_sink sink(ctx, ITS_GBUS_BENCH_BSCP_ENDPOINT);
+
+	zmq_server server(&ctx);
+	_open_server(server, binary);
+
+	downlink_packet packet;
+	source.wait_joined(fixture,
+			[&server]() { return _bpcs_readable(server); },
+			[&server, &packet]() { server.recv_downlink_packet(packet); }
+	);
+
+	for (auto _: state)
+	{
+		source.feed(state, fixture);
+		server.recv_downlink_packet(packet);
+		benchmark::DoNotOptimize(packet);
+	}
+
+	server.close();
+	state.SetLabel(binary ? "binary" : "json");
+	state.SetBytesProcessed(state.iterations() * (fixture.metadata.size() + fixture.payload.size()));
+}
+
+
+static void _send_uplink_packet(benchmark::State & state, bool binary)
+{
+	// Пейлоад фикстуры с EPP заголовком, zmq_server рисует заголовок сам
+	const std::string & payload = gbus_bench_fixture(gbus_fixture_kind::uplink_sdu_request, false).payload;
+	const std::string ip_packet = payload.substr(std::min<size_t>(4, payload.size()));
+
+	// Отправка забирает буфер, так что на каждой итерации берем новый из пула
+	// и копируем в него пакет - так же, как его прочел бы из туннеля сервер
+	packet_pool pool(ip_packet.size(), 1024);
+	uplink_packet packet;
+	packet.proto = 0x0800;
+	packet.flags = 0;
+	const auto fill_packet = [&pool, &packet, &ip_packet]() {
+		packet.buffer = pool.acquire();
+		std::memcpy(packet.buffer->data(), ip_packet.data(), ip_packet.size());
+		packet.buffer->size = ip_packet.size();
+	};
+
+	zmq::context_t ctx;
+	inproc_source source(ctx, ITS_GBUS_BENCH_BPCS_ENDPOINT);
+	inproc_sink sink(ctx, ITS_GBUS_BENCH_BSCP_ENDPOINT);
+
+	zmq_server server(&ctx);
+	_open_server(server, binary);
+	sink.wait_joined([&server, &packet, &fill_packet]() {
+		fill_packet();
+		server.send_uplink_packet(packet);
+	});
+
+	for (auto _: state)
+	{
+		fill_packet();
+		server.send_uplink_packet(packet);
+		sink.sent(state);
+	}
+
+	server.close();
+	state.SetLabel(binary ? "binary" : "json");
+	state.SetBytesProcessed(state.iterations() * ip_packet.size());
+}
+
+
+//! IPv4 пакет потока: UDP или TCP с опцией timestamps, как шлет Linux
+static std::vector<uint8_t> _flow_packet(uint8_t protocol, size_t payload_size, uint16_t ip_id, uint32_t tcp_seq)
+{
+	const size_t l4_size = 17 == protocol ? 8 : 32;
+	std::vector<uint8_t> retval(20 + l4_size + payload_size, 0x5A);
+	uint8_t * ip = retval.data();
+	const auto put16 = [](uint8_t * p, size_t value) { p[0] = value >> 8; p[1] = value & 0xFF; };
+
+	ip[0] = 0x45;
+	ip[1] = 0;
+	put16(ip + 2, retval.size());
+	put16(ip + 4, ip_id);
+	put16(ip + 6, 0x4000);
+	ip[8] = 64;
+	ip[9] = protocol;
+	const uint8_t addresses[] = { 10, 0, 0, 1, 10, 0, 0, 2 };
+	std::memcpy(ip + 12, addresses, sizeof(addresses));
+
+	uint32_t sum = 0;
+	for (size_t i = 0; i < 20; i += 2)
+		sum += ip[i] << 8 | ip[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	put16(ip + 10, ~sum & 0xFFFF);
+
+	uint8_t * l4 = ip + 20;
+	put16(l4, 14550);
+	put16(l4 + 2, 14555);
+	if (17 == protocol)
+	{
+		put16(l4 + 4, l4_size + payload_size);
+		put16(l4 + 6, 0xBEEF ^ ip_id);
+	}
+	else
+	{
+		put16(l4 + 4, tcp_seq >> 16);
+		put16(l4 + 6, tcp_seq & 0xFFFF);
+		std::memset(l4 + 8, 0, 4);
+		l4[12] = (l4_size / 4) << 4;
+		l4[13] = 0x18; // PSH ACK
+		put16(l4 + 14, 502);
+		put16(l4 + 16, 0xBEEF ^ ip_id);
+		put16(l4 + 18, 0);
+		// NOP NOP timestamps
+		const uint8_t options[] = { 1, 1, 8, 10 };
+		std::memcpy(l4 + 20, options, sizeof(options));
+		put16(l4 + 24, ip_id);
+		put16(l4 + 26, ip_id);
+		std::memset(l4 + 28, 0, 4);
+	}
+
+	return retval;
+}
+
+
+static void _header_compression(benchmark::State & state, uint8_t protocol)
+{
+	const size_t payload_size = state.range(0);
+	header_compressor compressor(32, std::chrono::milliseconds(2000));
+	header_decompressor decompressor;
+	packet_pool pool(1500, 16);
+
+	uint16_t ip_id = 0;
+	uint32_t tcp_seq = 1000;
+	size_t bytes_in = 0;
+	size_t bytes_out = 0;
+	for (auto _: state)
+	{
+		state.PauseTiming();
+		const std::vector<uint8_t> packet = _flow_packet(protocol, payload_size, ip_id++, tcp_seq);
+		tcp_seq += payload_size;
+		packet_buffer_ptr buffer = pool.acquire();
+		std::memcpy(buffer->data(), packet.data(), packet.size());
+		buffer->size = packet.size();
+		state.ResumeTiming();
+
+		compressor.compress(*buffer, std::chrono::steady_clock::now());
+
+		hc_header header;
+		const uint8_t * payload;
+		size_t restored_payload_size;
+		if (!decompressor.decompress(buffer->data(), buffer->size, header, payload, restored_payload_size))
+		{
+			state.SkipWithError("decompression failed");
+			break;
+		}
+
+		benchmark::DoNotOptimize(header);
+		bytes_in += packet.size();
+		bytes_out += buffer->size;
+	}
+
+	state.SetLabel(17 == protocol ? "udp" : "tcp");
+	state.counters["ratio"] = bytes_out ? static_cast<double>(bytes_in) / bytes_out : 0;
+}
+
+
+BENCHMARK_CAPTURE(_recv_downlink_packet, json, false);
+BENCHMARK_CAPTURE(_recv_downlink_packet, binary, true);
+BENCHMARK_CAPTURE(_send_uplink_packet, json, false);
+BENCHMARK_CAPTURE(_send_uplink_packet, binary, true);
+BENCHMARK_CAPTURE(_header_compression, udp, 17)->Arg(16)->Arg(64)->Arg(150);
+BENCHMARK_CAPTURE(_header_compression, tcp, 6)->Arg(16)->Arg(64)->Arg(150);
+
+
+int main(int argc, char ** argv)
+{
+	// Сервер пишет в лог на каждый пакет, нам это мерять не нужно
+	setenv("ITS_LOG_LEVEL", "error", 0);
+	setup_log();
+
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return EXIT_FAILURE;
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+
+	shutdown_log();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,300 @@
+/* Бенчмарки кодеков шины server-uslp
+ *
+ * Разбор входящих сообщений (uslp.uplink_sdu_request, radio.downlink_frame,
+ * radio.uplink_state) идет через bus_io::parse_message прямо из zmq буферов,
+ * без сокетов. Отправка - через все перегрузки bus_io::send_message в PUB
+ * сокет, подключенный по inproc к приёмнику бенчмарка. Приёмник вычерпывается
+ * пачками с остановленным таймером, так что в замер идет сериализация
+ * и отправка в сокет, но не приём.
+ *
+ * Каждый бенчмарк есть в вариантах с JSON и бинарными метаданными.
+ *
+ * Отдельно мерится сборка и разбор топиков с номером канала через topic_table
+ * против прежних stringstream и boost::split (так же топик собирал и server-tun
+ * на каждый аплинк пакет).
+ */
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstdlib>
+
+#include <benchmark/benchmark.h>
+
+#include <zmq.hpp>
+
+#include <boost/algorithm/string.hpp>
+
+#include <ccsds/uslp/events.hpp>
+
+#include "log.hpp"
+#include "stats.hpp"
+#include "bus_io.hpp"
+#include "topic_table.hpp"
+
+#include "fixtures.hpp"
+#include "inproc.hpp"
+
+
+#define ITS_GBUS_BENCH_BSCP_ENDPOINT "inproc://gbus-bench-bscp"
+//! Сколько событий в пачке - столько частей у SDU в 200 байтовых фреймах
+#define ITS_GBUS_BENCH_EVENT_BATCH_SIZE (8)
+
+
+static const ccsds::uslp::gmapid_t _bench_gmapid(
+		ITS_GBUS_BENCH_SC_ID, ITS_GBUS_BENCH_VCHANNEL_ID, ITS_GBUS_BENCH_MAP_ID
+);
+
+
+static void _parse_message(benchmark::State & state, gbus_fixture_kind kind, bool binary)
+{
+	const gbus_fixture & fixture = gbus_bench_fixture(kind, binary);
+	const zmq::message_t topic_msg(fixture.topic.data(), fixture.topic.size());
+	const zmq::message_t metadata_msg(fixture.metadata.data(), fixture.metadata.size());
+
+	// Сокеты не подключены, bus_io тут только для разбора
+	zmq::context_t ctx;
+	bus_io io(ctx);
+	bus_input_message message;
+	for (auto _: state)
+	{
+		// parse_message забирает пейлоад себе, так что он каждый раз новый -
+		// как и при приёме из сокета
+		zmq::message_t payload_msg(fixture.payload.data(), fixture.payload.size());
+		if (!io.parse_message(topic_msg, metadata_msg, payload_msg, message))
+		{
+			state.SkipWithError("unable to parse fixture");
+			break;
+		}
+
+		benchmark::DoNotOptimize(message);
+	}
+
+	state.SetLabel(binary ? "binary" : "json");
+	state.SetBytesProcessed(state.iterations() * (fixture.metadata.size() + fixture.payload.size()));
+}
+
+
+template <typename MESSAGE>
+static void _send_message(benchmark::State & state, MESSAGE (*make_message)(), bool binary)
+{
+	const MESSAGE message = make_message();
+
+	zmq::context_t ctx;
+	inproc_sink sink(ctx, ITS_GBUS_BENCH_BSCP_ENDPOINT);
+
+	bus_io io(ctx);
+	io.binary_metadata(binary);
+	io.connect_bscp(ITS_GBUS_BENCH_BSCP_ENDPOINT);
+	sink.wait_joined([&io, &message]() { io.send_message(message); });
+
+	for (auto _: state)
+	{
+		io.send_message(message);
+		sink.sent(state);
+	}
+
+	io.close();
+	state.SetLabel(binary ? "binary" : "json");
+	state.SetItemsProcessed(state.iterations());
+}
+
+
+static std::vector<uint8_t> _fixture_payload(gbus_fixture_kind kind)
+{
+	const std::string & payload = gbus_bench_fixture(kind, false).payload;
+	return std::vector<uint8_t>(payload.begin(), payload.end());
+}
+
+
+static sdu_downlink _make_sdu_downlink()
+{
+	sdu_downlink retval;
+	retval.gmapid = _bench_gmapid;
+	retval.qos = ccsds::uslp::qos_t::EXPEDITED;
+	retval.flags = ccsds::uslp::acceptor_event_map_sdu::MAPP;
+	retval.data = _fixture_payload(gbus_fixture_kind::downlink_sdu);
+	return retval;
+}
+
+
+static sdu_uplink_event _make_sdu_uplink_event()
+{
+	sdu_uplink_event retval;
+	retval.gmapid = _bench_gmapid;
+	retval.part_cookie.cookie = 1234;
+	retval.part_cookie.part_no = 0;
+	retval.part_cookie.final = true;
+	retval.event_kind = sdu_uplink_event::event_kind_t::sdu_radiated;
+	return retval;
+}
+
+
+static radio_uplink_frame _make_radio_uplink_frame()
+{
+	radio_uplink_frame retval;
+	retval.frame_cookie = 1234;
+	retval.data = _fixture_payload(gbus_fixture_kind::uplink_frame);
+	return retval;
+}
+
+
+static uplink_queue_state _make_uplink_queue_state()
+{
+	uplink_queue_state retval;
+	for (const uint8_t map_id: {0, 1})
+	{
+		uplink_queue_state::map_queue queue{};
+		queue.gmapid = ccsds::uslp::gmapid_t(ITS_GBUS_BENCH_SC_ID, ITS_GBUS_BENCH_VCHANNEL_ID, map_id);
+		queue.sdus = 3;
+		queue.bytes = 300;
+		queue.max_sdus = 64;
+		queue.stacked_sdus = 1;
+		retval.queues.push_back(queue);
+	}
+
+	return retval;
+}
+
+
+static sdu_uplink_event_batch _make_sdu_uplink_event_batch()
+{
+	sdu_uplink_event_batch retval;
+	for (uint16_t part_no = 0; part_no < ITS_GBUS_BENCH_EVENT_BATCH_SIZE; part_no++)
+	{
+		sdu_uplink_event event = _make_sdu_uplink_event();
+		event.part_cookie.part_no = part_no;
+		event.part_cookie.final = (part_no + 1 == ITS_GBUS_BENCH_EVENT_BATCH_SIZE);
+		retval.events.push_back(std::move(event));
+	}
+
+	return retval;
+}
+
+
+//! BENCHMARK_CAPTURE не умеет шаблоны, поэтому отправка регистрируется из main
+template <typename MESSAGE>
+static void _register_send_message(const std::string & name, MESSAGE (*make_message)(), bool binary)
+{
+	benchmark::RegisterBenchmark(("_send_message/" + name).c_str(),
+			[make_message, binary](benchmark::State & state) { _send_message(state, make_message, binary); }
+	);
+}
+
+
+static uslp_stats::report _make_stats_report()
+{
+	uslp_stats stats;
+	stats.downlink_sources({"radio", "sdr"});
+	stats.count(uslp_stats::counter_t::bus_messages_received, 1000);
+	stats.count(uslp_stats::counter_t::downlink_frames_received, 500);
+	stats.count(0, uslp_stats::source_counter_t::frames, 500);
+	stats.count(1, uslp_stats::source_counter_t::frames, 450);
+	return stats.take_report();
+}
+
+
+//! Прежняя сборка топика, для сравнения
+static std::string _stringstream_topic(const std::string & base, const ccsds::uslp::gmapid_t & gmapid)
+{
+	std::stringstream stream;
+	stream << base << "."
+		<< static_cast<int>(gmapid.sc_id()) << "."
+		<< static_cast<int>(gmapid.vchannel_id()) << "."
+		<< static_cast<int>(gmapid.map_id())
+	;
+	return stream.str();
+}
+
+
+//! Прежний разбор топика, для сравнения
+static ccsds::uslp::gmapid_t _split_topic(std::string_view topic)
+{
+	std::vector<std::string> parts;
+	boost::algorithm::split(parts, topic, boost::is_any_of("."), boost::token_compress_on);
+	return ccsds::uslp::gmapid_t(
+			std::stoi(parts[parts.size()-3], 0, 0),
+			std::stoi(parts[parts.size()-2], 0, 0),
+			std::stoi(parts[parts.size()-1], 0, 0)
+	);
+}
+
+
+static void _topic_encode_stringstream(benchmark::State & state)
+{
+	for (auto _: state)
+	{
+		const std::string topic = _stringstream_topic(ITS_GBUS_TOPIC_DOWNLINK_SDU, _bench_gmapid);
+		benchmark::DoNotOptimize(topic.data());
+	}
+}
+
+
+static void _topic_encode_table(benchmark::State & state)
+{
+	topic_table topics(ITS_GBUS_TOPIC_DOWNLINK_SDU);
+	topics.intern(ITS_GBUS_BENCH_SC_ID, ITS_GBUS_BENCH_VCHANNEL_ID);
+	for (auto _: state)
+	{
+		const std::string_view topic = topics.topic(_bench_gmapid);
+		benchmark::DoNotOptimize(topic.data());
+	}
+}
+
+
+static void _topic_decode_split(benchmark::State & state)
+{
+	const std::string & topic = gbus_bench_fixture(gbus_fixture_kind::uplink_sdu_request, false).topic;
+	for (auto _: state)
+		benchmark::DoNotOptimize(_split_topic(topic));
+}
+
+
+static void _topic_decode_parse(benchmark::State & state)
+{
+	const std::string & topic = gbus_bench_fixture(gbus_fixture_kind::uplink_sdu_request, false).topic;
+	for (auto _: state)
+		benchmark::DoNotOptimize(topic_table::parse(topic));
+}
+
+
+BENCHMARK(_topic_encode_stringstream);
+BENCHMARK(_topic_encode_table);
+BENCHMARK(_topic_decode_split);
+BENCHMARK(_topic_decode_parse);
+
+BENCHMARK_CAPTURE(_parse_message, uplink_sdu_request_json, gbus_fixture_kind::uplink_sdu_request, false);
+BENCHMARK_CAPTURE(_parse_message, uplink_sdu_request_binary, gbus_fixture_kind::uplink_sdu_request, true);
+BENCHMARK_CAPTURE(_parse_message, downlink_frame_json, gbus_fixture_kind::downlink_frame, false);
+BENCHMARK_CAPTURE(_parse_message, downlink_frame_binary, gbus_fixture_kind::downlink_frame, true);
+BENCHMARK_CAPTURE(_parse_message, uplink_state_json, gbus_fixture_kind::uplink_state, false);
+BENCHMARK_CAPTURE(_parse_message, uplink_state_binary, gbus_fixture_kind::uplink_state, true);
+
+
+int main(int argc, char ** argv)
+{
+	// Сервер много пишет в лог на каждое сообщение, нам это мерять не нужно
+	setenv("ITS_LOG_LEVEL", "error", 0);
+	setup_log();
+
+	_register_send_message("sdu_downlink_json", &_make_sdu_downlink, false);
+	_register_send_message("sdu_downlink_binary", &_make_sdu_downlink, true);
+	_register_send_message("sdu_uplink_event_json", &_make_sdu_uplink_event, false);
+	_register_send_message("sdu_uplink_event_binary", &_make_sdu_uplink_event, true);
+	_register_send_message("radio_uplink_frame_json", &_make_radio_uplink_frame, false);
+	_register_send_message("radio_uplink_frame_binary", &_make_radio_uplink_frame, true);
+	// Эти три всегда уходят в JSON
+	_register_send_message("uplink_queue_state", &_make_uplink_queue_state, false);
+	_register_send_message("sdu_uplink_event_batch", &_make_sdu_uplink_event_batch, false);
+	_register_send_message("stats", &_make_stats_report, false);
+
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return EXIT_FAILURE;
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+
+	shutdown_log();
+	return EXIT_SUCCESS;
+}
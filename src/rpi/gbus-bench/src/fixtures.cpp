@@ -0,0 +1,291 @@
+#include "fixtures.hpp"
+
+#include <map>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <iostream>
+#include <string_view>
+
+#include <gbus_meta.h>
+
+#include "zmq_log.hpp"
+
+
+//! Размер фрейма радио по умолчанию, как у server-uslp
+#define ITS_GBUS_BENCH_FRAME_SIZE (200)
+//! Размер IP пакета в SDU - типичный MAVLink поверх UDP
+#define ITS_GBUS_BENCH_IP_PACKET_SIZE (96)
+
+
+typedef std::pair<gbus_fixture_kind, bool> fixture_key_t;
+typedef std::map<fixture_key_t, gbus_fixture> fixtures_t;
+
+
+static bool _starts_with(std::string_view value, std::string_view prefix)
+{
+	return value.size() >= prefix.size() && value.substr(0, prefix.size()) == prefix;
+}
+
+
+static bool _ends_with(std::string_view value, std::string_view suffix)
+{
+	return value.size() >= suffix.size() && value.substr(value.size() - suffix.size()) == suffix;
+}
+
+
+static std::string _binary_meta(gbus_meta_t meta)
+{
+	meta.time_s = 1700000000;
+	meta.time_us = 123456;
+
+	std::array<uint8_t, GBUS_META_MAX_SIZE> buffer;
+	const size_t size = gbus_meta_encode(&meta, buffer.data(), buffer.size());
+	return std::string(buffer.begin(), buffer.begin() + size);
+}
+
+
+//! Байты, похожие на содержимое фрейма, но одинаковые от запуска к запуску
+static std::string _filler(size_t size, uint32_t seed)
+{
+	std::string retval(size, '\0');
+	for (auto & c: retval)
+	{
+		seed = seed * 1103515245 + 12345;
+		c = static_cast<char>(seed >> 16);
+	}
+
+	return retval;
+}
+
+
+//! USLP фрейм в том виде, в каком его отдает радио
+static std::string _uslp_frame()
+{
+	std::string retval = _filler(ITS_GBUS_BENCH_FRAME_SIZE, 1);
+	// Основной заголовок: версия 0xC, SCID 0x42, VCID 0, полный заголовок,
+	// длина фрейма и однобайтовый номер фрейма в VC
+	const uint8_t header[] = {
+			0xC0, 0x04, 0x20, 0x00,
+			0x00, ITS_GBUS_BENCH_FRAME_SIZE - 1,
+			0x01, 0x11
+	};
+	retval.replace(0, sizeof(header), reinterpret_cast<const char*>(header), sizeof(header));
+	return retval;
+}
+
+
+//! IP пакет, завернутый в EPP пакет с четырехбайтовым заголовком
+static std::string _epp_ip_packet()
+{
+	const size_t packet_size = 4 + ITS_GBUS_BENCH_IP_PACKET_SIZE;
+	// Версия 7, протокол IPE (2), длина длины 2 (4 байта заголовка)
+	const uint8_t header[] = {
+			0xEA, 0x00,
+			static_cast<uint8_t>(packet_size >> 8), static_cast<uint8_t>(packet_size)
+	};
+
+	std::string retval(reinterpret_cast<const char*>(header), sizeof(header));
+	std::string ip = _filler(ITS_GBUS_BENCH_IP_PACKET_SIZE, 2);
+	ip[0] = 0x45;
+	retval += ip;
+	return retval;
+}
+
+
+static std::string _channel_topic(const char * prefix)
+{
+	return std::string(prefix) + "."
+			+ std::to_string(ITS_GBUS_BENCH_SC_ID) + "."
+			+ std::to_string(ITS_GBUS_BENCH_VCHANNEL_ID) + "."
+			+ std::to_string(ITS_GBUS_BENCH_MAP_ID)
+	;
+}
+
+
+//! Фикстуры по мотивам сообщений из логов брокера
+static fixtures_t _builtin_fixtures()
+{
+	fixtures_t retval;
+
+	{
+		const std::string topic = _channel_topic("uslp.uplink_sdu_request");
+		const std::string payload = _epp_ip_packet();
+		retval[{gbus_fixture_kind::uplink_sdu_request, false}] = gbus_fixture{
+			topic,
+			"{\"cookie\":1234,\"extra\":{\"flags\":0,\"proto\":2048},\"map_id\":1,"
+			"\"qos\":\"expedited\",\"sc_id\":66,\"vchannel_id\":0}",
+			payload
+		};
+
+		gbus_meta_t meta{};
+		meta.type = GBUS_META_UPLINK_SDU_REQUEST;
+		meta.body.uplink_sdu_request.sc_id = ITS_GBUS_BENCH_SC_ID;
+		meta.body.uplink_sdu_request.vchannel_id = ITS_GBUS_BENCH_VCHANNEL_ID;
+		meta.body.uplink_sdu_request.map_id = ITS_GBUS_BENCH_MAP_ID;
+		meta.body.uplink_sdu_request.qos = GBUS_META_QOS_EXPEDITED;
+		meta.body.uplink_sdu_request.cookie = 1234;
+		retval[{gbus_fixture_kind::uplink_sdu_request, true}] = gbus_fixture{topic, _binary_meta(meta), payload};
+	}
+
+	{
+		const std::string topic = "radio.downlink_frame";
+		const std::string payload = _uslp_frame();
+		retval[{gbus_fixture_kind::downlink_frame, false}] = gbus_fixture{
+			topic,
+			"{ \"time_s\": 1700000000, \"time_us\": 123456, \"checksum_valid\": true, "
+			"\"cookie\": 4242, \"frame_no\": 17, \"rssi_pkt\": -87, \"snr_pkt\": 9, \"rssi_signal\": -90 }",
+			payload
+		};
+
+		gbus_meta_t meta{};
+		meta.type = GBUS_META_DOWNLINK_FRAME;
+		meta.body.downlink_frame.cookie = 4242;
+		meta.body.downlink_frame.frame_no = 17;
+		meta.body.downlink_frame.flags = GBUS_META_DF_CHECKSUM_VALID | GBUS_META_DF_CHECKSUM_KNOWN
+				| GBUS_META_DF_FRAME_NO_VALID;
+		meta.body.downlink_frame.rssi_pkt = -87;
+		meta.body.downlink_frame.snr_pkt = 9;
+		meta.body.downlink_frame.rssi_signal = -90;
+		retval[{gbus_fixture_kind::downlink_frame, true}] = gbus_fixture{topic, _binary_meta(meta), payload};
+	}
+
+	{
+		const std::string topic = "radio.uplink_state";
+		retval[{gbus_fixture_kind::uplink_state, false}] = gbus_fixture{
+			topic,
+			"{ \"time_s\": 1700000000, \"time_us\": 123456, \"cookie_in_wait\": 1235, "
+			"\"cookie_in_progress\": 1234, \"cookie_sent\": 1233, \"cookie_dropped\": null }",
+			""
+		};
+
+		gbus_meta_t meta{};
+		meta.type = GBUS_META_UPLINK_STATE;
+		meta.body.uplink_state.cookie_in_wait = 1235;
+		meta.body.uplink_state.cookie_in_progress = 1234;
+		meta.body.uplink_state.cookie_sent = 1233;
+		retval[{gbus_fixture_kind::uplink_state, true}] = gbus_fixture{topic, _binary_meta(meta), ""};
+	}
+
+	{
+		const std::string topic = _channel_topic("uslp.downlink_sdu");
+		const std::string payload = _epp_ip_packet();
+		retval[{gbus_fixture_kind::downlink_sdu, false}] = gbus_fixture{
+			topic,
+			"{\"flags\":[\"mapp\"],\"map_id\":1,\"qos\":\"expedited\",\"sc_id\":66,\"vchannel_id\":0}",
+			payload
+		};
+
+		gbus_meta_t meta{};
+		meta.type = GBUS_META_DOWNLINK_SDU;
+		meta.body.downlink_sdu.sc_id = ITS_GBUS_BENCH_SC_ID;
+		meta.body.downlink_sdu.vchannel_id = ITS_GBUS_BENCH_VCHANNEL_ID;
+		meta.body.downlink_sdu.map_id = ITS_GBUS_BENCH_MAP_ID;
+		meta.body.downlink_sdu.qos = GBUS_META_QOS_EXPEDITED;
+		meta.body.downlink_sdu.flags = GBUS_META_SDU_FLAG_MAPP;
+		retval[{gbus_fixture_kind::downlink_sdu, true}] = gbus_fixture{topic, _binary_meta(meta), payload};
+	}
+
+	{
+		const std::string topic = "radio.uplink_frame";
+		const std::string payload = _uslp_frame();
+		retval[{gbus_fixture_kind::uplink_frame, false}] = gbus_fixture{topic, "{\"cookie\":1234}", payload};
+
+		gbus_meta_t meta{};
+		meta.type = GBUS_META_UPLINK_FRAME;
+		meta.body.uplink_frame.cookie = 1234;
+		retval[{gbus_fixture_kind::uplink_frame, true}] = gbus_fixture{topic, _binary_meta(meta), payload};
+	}
+
+	return retval;
+}
+
+
+//! Вид сообщения по топику из лога. false, если такие сообщения бенчмаркам не нужны
+static bool _kind_from_topic(std::string_view topic, gbus_fixture_kind & kind)
+{
+	if (_starts_with(topic, "uslp.uplink_sdu_request"))
+		kind = gbus_fixture_kind::uplink_sdu_request;
+	else if (_starts_with(topic, "uslp.downlink_sdu"))
+		kind = gbus_fixture_kind::downlink_sdu;
+	else if (_starts_with(topic, "uslp."))
+		return false;
+	else if (_ends_with(topic, ".downlink_frame"))
+		kind = gbus_fixture_kind::downlink_frame;
+	else if (_ends_with(topic, ".uplink_state"))
+		kind = gbus_fixture_kind::uplink_state;
+	else if (_ends_with(topic, ".uplink_frame"))
+		kind = gbus_fixture_kind::uplink_frame;
+	else
+		return false;
+
+	return true;
+}
+
+
+//! Замена встроенных фикстур первыми подходящими сообщениями из лога
+static void _load_log_fixtures(const std::string & path, fixtures_t & fixtures)
+{
+	zmq_log_reader reader(path);
+	zmq_log_record record;
+
+	std::map<fixture_key_t, bool> replaced;
+	while (replaced.size() < fixtures.size() && reader.read(record))
+	{
+		if (record.parts.size() < 2)
+			continue;
+
+		gbus_fixture_kind kind;
+		if (!_kind_from_topic(record.parts[0], kind))
+			continue;
+
+		const std::string & metadata = record.parts[1];
+		const bool binary = gbus_meta_is_binary(metadata.data(), metadata.size());
+		const fixture_key_t key(kind, binary);
+		if (replaced.count(key))
+			continue;
+
+		auto & fixture = fixtures.at(key);
+		fixture.metadata = metadata;
+		fixture.payload = record.parts.size() > 2 ? record.parts[2] : std::string();
+		replaced[key] = true;
+	}
+
+	std::clog << "gbus-bench: " << replaced.size() << " of " << fixtures.size() << " "
+			<< "fixtures are taken from \"" << path << "\"" << std::endl;
+}
+
+
+static fixtures_t _make_fixtures()
+{
+	fixtures_t retval = _builtin_fixtures();
+
+	const char * log_path = std::getenv(ITS_GBUS_BENCH_LOG_KEY);
+	if (log_path && *log_path)
+		_load_log_fixtures(log_path, retval);
+
+	return retval;
+}
+
+
+const gbus_fixture & gbus_bench_fixture(gbus_fixture_kind kind, bool binary)
+{
+	static const fixtures_t fixtures = _make_fixtures();
+	return fixtures.at(fixture_key_t(kind, binary));
+}
+
+
+const char * to_string(gbus_fixture_kind kind)
+{
+	switch (kind)
+	{
+	case gbus_fixture_kind::uplink_sdu_request: return "uplink_sdu_request";
+	case gbus_fixture_kind::downlink_frame: return "downlink_frame";
+	case gbus_fixture_kind::uplink_state: return "uplink_state";
+	case gbus_fixture_kind::downlink_sdu: return "downlink_sdu";
+	case gbus_fixture_kind::uplink_frame: return "uplink_frame";
+	};
+
+	return "<unknown>";
+}
@@ -0,0 +1,48 @@
+#ifndef ITS_GBUS_BENCH_SRC_FIXTURES_HPP_
+#define ITS_GBUS_BENCH_SRC_FIXTURES_HPP_
+
+
+#include <string>
+
+
+//! Путь к .zmq-log файлу брокера, из которого берутся фикстуры
+#define ITS_GBUS_BENCH_LOG_KEY "ITS_GBUS_BENCH_LOG"
+
+//! Канал, в котором ходят встроенные фикстуры
+#define ITS_GBUS_BENCH_SC_ID (0x42)
+#define ITS_GBUS_BENCH_VCHANNEL_ID (0x00)
+#define ITS_GBUS_BENCH_MAP_ID (0x01)
+
+
+//! Сообщение шины для бенчмарков: части в том виде, в каком они идут по сокету
+struct gbus_fixture
+{
+	std::string topic;
+	std::string metadata;
+	std::string payload;
+};
+
+
+//! Какие сообщения шины бывают в фикстурах
+enum class gbus_fixture_kind
+{
+	uplink_sdu_request,		//!< uslp.uplink_sdu_request.* от server-tun
+	downlink_frame,			//!< radio.downlink_frame от server-radio
+	uplink_state,			//!< radio.uplink_state от server-radio
+	downlink_sdu,			//!< uslp.downlink_sdu.* для server-tun
+	uplink_frame,			//!< radio.uplink_frame для server-radio
+};
+
+
+//! Фикстура сообщения указанного вида с метаданными в JSON или бинарном формате
+/*! Если в ITS_GBUS_BENCH_LOG указан лог брокера, метаданные и пейлоад берутся
+ *  из первого подходящего сообщения в нем. Топик при этом остается встроенным,
+ *  чтобы сообщение попало в подписки бенчмарков. Если подходящего сообщения
+ *  в логе нет - остается встроенная фикстура, снятая с реального трафика */
+const gbus_fixture & gbus_bench_fixture(gbus_fixture_kind kind, bool binary);
+
+//! Название вида фикстуры для вывода бенчмарков
+const char * to_string(gbus_fixture_kind kind);
+
+
+#endif /* ITS_GBUS_BENCH_SRC_FIXTURES_HPP_ */
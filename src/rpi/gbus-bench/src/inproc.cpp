@@ -0,0 +1,123 @@
+#include "inproc.hpp"
+
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+
+
+//! Сколько ждать, пока сокеты кода под бенчмарком соединятся с нашими
+#define ITS_GBUS_BENCH_JOIN_TIMEOUT std::chrono::seconds(5)
+#define ITS_GBUS_BENCH_JOIN_POLL std::chrono::milliseconds(10)
+
+
+inproc_sink::inproc_sink(zmq::context_t & ctx, const std::string & endpoint)
+	: _socket(ctx, zmq::socket_type::sub)
+{
+	_socket.set(zmq::sockopt::rcvhwm, 0);
+	_socket.set(zmq::sockopt::subscribe, "");
+	_socket.bind(endpoint);
+}
+
+
+void inproc_sink::wait_joined(const std::function<void()> & send_probe)
+{
+	const auto deadline = std::chrono::steady_clock::now() + ITS_GBUS_BENCH_JOIN_TIMEOUT;
+	while (std::chrono::steady_clock::now() < deadline)
+	{
+		send_probe();
+
+		zmq::pollitem_t items[] = { { _socket.handle(), 0, ZMQ_POLLIN, 0 } };
+		zmq::poll(items, 1, ITS_GBUS_BENCH_JOIN_POLL);
+		if (items[0].revents & ZMQ_POLLIN)
+		{
+			_drain();
+			_received = 0;
+			return;
+		}
+	}
+
+	throw std::runtime_error("publisher under benchmark did not join the sink");
+}
+
+
+void inproc_sink::sent(benchmark::State & state)
+{
+	if (++_pending < ITS_GBUS_BENCH_DRAIN_BATCH)
+		return;
+
+	state.PauseTiming();
+	_drain();
+	state.ResumeTiming();
+}
+
+
+void inproc_sink::_drain()
+{
+	zmq::message_t part;
+	while (_socket.recv(part, zmq::recv_flags::dontwait))
+	{
+		if (!part.more())
+			_received++;
+	}
+
+	_pending = 0;
+}
+
+
+inproc_source::inproc_source(zmq::context_t & ctx, const std::string & endpoint)
+	: _socket(ctx, zmq::socket_type::pub)
+{
+	_socket.set(zmq::sockopt::sndhwm, 0);
+	_socket.bind(endpoint);
+}
+
+
+void inproc_source::wait_joined(
+		const gbus_fixture & fixture,
+		const std::function<bool()> & readable,
+		const std::function<void()> & consume
+)
+{
+	const auto deadline = std::chrono::steady_clock::now() + ITS_GBUS_BENCH_JOIN_TIMEOUT;
+	while (std::chrono::steady_clock::now() < deadline)
+	{
+		send(fixture);
+		if (!readable())
+		{
+			std::this_thread::sleep_for(ITS_GBUS_BENCH_JOIN_POLL);
+			continue;
+		}
+
+		while (readable())
+			consume();
+
+		return;
+	}
+
+	throw std::runtime_error("subscriber under benchmark did not join the source");
+}
+
+
+void inproc_source::send(const gbus_fixture & fixture)
+{
+	_socket.send(zmq::const_buffer(fixture.topic.data(), fixture.topic.size()), zmq::send_flags::sndmore);
+	_socket.send(zmq::const_buffer(fixture.metadata.data(), fixture.metadata.size()), zmq::send_flags::sndmore);
+	_socket.send(zmq::const_buffer(fixture.payload.data(), fixture.payload.size()));
+}
+
+
+void inproc_source::feed(benchmark::State & state, const gbus_fixture & fixture)
+{
+	if (_queued > 0)
+	{
+		_queued--;
+		return;
+	}
+
+	state.PauseTiming();
+	for (size_t i = 0; i < ITS_GBUS_BENCH_DRAIN_BATCH; i++)
+		send(fixture);
+
+	_queued = ITS_GBUS_BENCH_DRAIN_BATCH - 1;
+	state.ResumeTiming();
+}
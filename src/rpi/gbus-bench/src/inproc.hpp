@@ -0,0 +1,76 @@
+#ifndef ITS_GBUS_BENCH_SRC_INPROC_HPP_
+#define ITS_GBUS_BENCH_SRC_INPROC_HPP_
+
+
+#include <string>
+#include <functional>
+
+#include <zmq.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include "fixtures.hpp"
+
+
+//! Через сколько отправленных сообщений вычерпывать приёмник
+/*! Меньше sndhwm, иначе PUB начнет молча выбрасывать сообщения */
+#define ITS_GBUS_BENCH_DRAIN_BATCH (256)
+
+
+//! Приёмник исходящих сообщений кода под бенчмарком
+/*! SUB сокет, подписанный на всё, к которому подключается PUB сокет кода */
+class inproc_sink
+{
+public:
+	inproc_sink(zmq::context_t & ctx, const std::string & endpoint);
+
+	//! Ожидание, пока PUB кода увидит подписку
+	/*! send_probe отправляет что-нибудь через код под бенчмарком, пока это
+	 *  что-нибудь не дойдет до приёмника. Иначе первые сообщения теряются */
+	void wait_joined(const std::function<void()> & send_probe);
+
+	//! Учет отправленного сообщения. Раз в ITS_GBUS_BENCH_DRAIN_BATCH сообщений
+	//! приёмник вычерпывается с остановленным таймером
+	void sent(benchmark::State & state);
+
+	//! Сколько сообщений (не частей) вычерпано
+	size_t received() const { return _received; }
+
+private:
+	void _drain();
+
+	zmq::socket_t _socket;
+	size_t _pending = 0;
+	size_t _received = 0;
+};
+
+
+//! Источник входящих сообщений для кода под бенчмарком
+/*! PUB сокет, к которому подключается SUB сокет кода */
+class inproc_source
+{
+public:
+	inproc_source(zmq::context_t & ctx, const std::string & endpoint);
+
+	//! Ожидание, пока подписка кода дойдет до источника
+	/*! Источник шлет фикстуру, пока readable не скажет, что код её видит.
+	 *  Дошедшие пробные сообщения код потом забирает через consume */
+	void wait_joined(
+			const gbus_fixture & fixture,
+			const std::function<bool()> & readable,
+			const std::function<void()> & consume
+	);
+
+	void send(const gbus_fixture & fixture);
+
+	//! Подача фикстуры перед её приёмом кодом. Раз в ITS_GBUS_BENCH_DRAIN_BATCH
+	//! сообщений источник отправляет следующую пачку с остановленным таймером
+	void feed(benchmark::State & state, const gbus_fixture & fixture);
+
+private:
+	zmq::socket_t _socket;
+	size_t _queued = 0;
+};
+
+
+#endif /* ITS_GBUS_BENCH_SRC_INPROC_HPP_ */
@@ -0,0 +1,428 @@
+#ifndef ITS_GBUS_COMMON_GBUS_META_H_
+#define ITS_GBUS_COMMON_GBUS_META_H_
+
+/*! Бинарный формат метаданных сообщений шины
+ *
+ *  Альтернатива JSON метаданным для частых сообщений. Формат определяется
+ *  по первому байту метаданных: JSON всегда начинается с '{' (или пробела),
+ *  бинарные метаданные начинаются с GBUS_META_MAGIC. Поэтому получатели могут
+ *  принимать оба формата одновременно, а отправители переходят на бинарный формат
+ *  только по явной настройке.
+ *
+ *  Все числа little-endian. Сначала идет заголовок фиксированного размера:
+ *    uint8_t  magic    - GBUS_META_MAGIC
+ *    uint8_t  version  - GBUS_META_VERSION
+ *    uint16_t type     - gbus_meta_type_t
+ *    uint32_t time_us  - дробная часть времени формирования сообщения (мкс)
+ *    uint64_t time_s   - целая часть времени формирования сообщения (POSIX)
+ *  и за ним тело фиксированного для каждого типа размера (см. gbus_meta_encode).
+ *  Подробности в doc/topics.md
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+
+#define GBUS_META_MAGIC			(0xB7)
+#define GBUS_META_VERSION		(1)
+#define GBUS_META_HEADER_SIZE	(16)
+
+//! Размер буфера, в который гарантированно влезут метаданные любого типа
+#define GBUS_META_MAX_SIZE		(GBUS_META_HEADER_SIZE + 32 + GBUS_META_MAX_COMMENT_SIZE)
+//! Максимальная длина комментария события SDU в бинарном формате
+#define GBUS_META_MAX_COMMENT_SIZE (256)
+
+//! Имя переменной окружения, в которой указывается формат исходящих метаданных
+#define GBUS_META_FORMAT_ENV_KEY "ITS_GBUS_METADATA_FORMAT"
+//! Значение переменной окружения для бинарного формата
+#define GBUS_META_FORMAT_BINARY "binary"
+
+
+//! Тип сообщения, описываемого метаданными
+typedef enum gbus_meta_type_t
+{
+	GBUS_META_UPLINK_FRAME = 1,			//!< radio.uplink_frame
+	GBUS_META_UPLINK_STATE = 2,			//!< radio.uplink_state
+	GBUS_META_DOWNLINK_FRAME = 3,		//!< radio.downlink_frame
+	GBUS_META_UPLINK_SDU_REQUEST = 4,	//!< uslp.uplink_sdu_request.*
+	GBUS_META_UPLINK_SDU_EVENT = 5,		//!< uslp.uplink_sdu_event.*
+	GBUS_META_DOWNLINK_SDU = 6,			//!< uslp.downlink_sdu.*
+} gbus_meta_type_t;
+
+
+//! Значения qos в бинарном формате
+#define GBUS_META_QOS_EXPEDITED				(0)
+#define GBUS_META_QOS_SEQUENCE_CONTROLLED	(1)
+
+//! Флаги radio.downlink_frame
+#define GBUS_META_DF_CHECKSUM_VALID		(1 << 0)	//!< контрольная сумма сошлась
+#define GBUS_META_DF_CHECKSUM_KNOWN		(1 << 1)	//!< контрольная сумма проверялась (иначе null)
+#define GBUS_META_DF_FRAME_NO_VALID		(1 << 2)	//!< номер фрейма известен (иначе null)
+
+//! События uslp.uplink_sdu_event
+#define GBUS_META_SDU_ACCEPTED			(0)
+#define GBUS_META_SDU_REJECTED			(1)
+#define GBUS_META_SDU_SENT_TO_RADIO		(2)
+#define GBUS_META_SDU_RADIATED			(3)
+#define GBUS_META_SDU_RADIATION_FAILED	(4)
+#define GBUS_META_SDU_EXPIRED			(5)
+
+//! Максимальный срок жизни SDU в бинарном формате (мс), под него 24 бита
+#define GBUS_META_MAX_TTL_MS			(0xFFFFFF)
+
+//! Флаги uslp.downlink_sdu
+#define GBUS_META_SDU_FLAG_MAPA			(1 << 0)
+#define GBUS_META_SDU_FLAG_MAPP			(1 << 1)
+#define GBUS_META_SDU_FLAG_INCOMPLETE	(1 << 2)
+#define GBUS_META_SDU_FLAG_IDLE			(1 << 3)
+#define GBUS_META_SDU_FLAG_CORRUPTED	(1 << 4)
+#define GBUS_META_SDU_FLAG_STRAY		(1 << 5)
+
+
+//! radio.uplink_frame
+typedef struct gbus_meta_uplink_frame_t
+{
+	uint64_t cookie;
+} gbus_meta_uplink_frame_t;
+
+
+//! radio.uplink_state. Нулевая кука означает null
+typedef struct gbus_meta_uplink_state_t
+{
+	uint64_t cookie_in_wait;
+	uint64_t cookie_in_progress;
+	uint64_t cookie_sent;
+	uint64_t cookie_dropped;
+} gbus_meta_uplink_state_t;
+
+
+//! radio.downlink_frame
+typedef struct gbus_meta_downlink_frame_t
+{
+	uint64_t cookie;
+	uint16_t frame_no;
+	uint8_t flags;
+	int8_t rssi_pkt;
+	int8_t snr_pkt;
+	int8_t rssi_signal;
+} gbus_meta_downlink_frame_t;
+
+
+//! uslp.uplink_sdu_request.*
+typedef struct gbus_meta_uplink_sdu_request_t
+{
+	uint64_t cookie;
+	uint16_t sc_id;
+	uint8_t vchannel_id;
+	uint8_t map_id;
+	uint8_t qos;
+	//! Срок жизни SDU от приёма сервером (мс). Ноль - бессрочно
+	/*! Больше GBUS_META_MAX_TTL_MS при кодировании урезается до него */
+	uint32_t ttl_ms;
+} gbus_meta_uplink_sdu_request_t;
+
+
+//! uslp.uplink_sdu_event.*
+typedef struct gbus_meta_uplink_sdu_event_t
+{
+	uint64_t cookie;
+	uint16_t part_no;
+	bool is_final_part;
+	uint8_t event;
+	uint16_t sc_id;
+	uint8_t vchannel_id;
+	uint8_t map_id;
+	//! Комментарий. Не обязательно заканчивается нулем
+	/*! После gbus_meta_decode указывает внутрь разобранного буфера */
+	const char * comment;
+	uint16_t comment_size;
+} gbus_meta_uplink_sdu_event_t;
+
+
+//! uslp.downlink_sdu.*
+typedef struct gbus_meta_downlink_sdu_t
+{
+	uint16_t sc_id;
+	uint8_t vchannel_id;
+	uint8_t map_id;
+	uint8_t qos;
+	uint32_t flags;
+} gbus_meta_downlink_sdu_t;
+
+
+//! Метаданные сообщения целиком
+typedef struct gbus_meta_t
+{
+	gbus_meta_type_t type;
+	uint64_t time_s;
+	uint32_t time_us;
+
+	union
+	{
+		gbus_meta_uplink_frame_t uplink_frame;
+		gbus_meta_uplink_state_t uplink_state;
+		gbus_meta_downlink_frame_t downlink_frame;
+		gbus_meta_uplink_sdu_request_t uplink_sdu_request;
+		gbus_meta_uplink_sdu_event_t uplink_sdu_event;
+		gbus_meta_downlink_sdu_t downlink_sdu;
+	} body;
+} gbus_meta_t;
+
+
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+
+
+static inline void _gbus_meta_put_u16(uint8_t * buffer, uint16_t value)
+{
+	buffer[0] = (uint8_t)(value >> 0);
+	buffer[1] = (uint8_t)(value >> 8);
+}
+
+
+static inline void _gbus_meta_put_u32(uint8_t * buffer, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		buffer[i] = (uint8_t)(value >> (8*i));
+}
+
+
+static inline void _gbus_meta_put_u64(uint8_t * buffer, uint64_t value)
+{
+	for (int i = 0; i < 8; i++)
+		buffer[i] = (uint8_t)(value >> (8*i));
+}
+
+
+static inline uint16_t _gbus_meta_get_u16(const uint8_t * buffer)
+{
+	return (uint16_t)(buffer[0] | (buffer[1] << 8));
+}
+
+
+static inline uint32_t _gbus_meta_get_u32(const uint8_t * buffer)
+{
+	uint32_t retval = 0;
+	for (int i = 0; i < 4; i++)
+		retval |= (uint32_t)buffer[i] << (8*i);
+	return retval;
+}
+
+
+static inline uint64_t _gbus_meta_get_u64(const uint8_t * buffer)
+{
+	uint64_t retval = 0;
+	for (int i = 0; i < 8; i++)
+		retval |= (uint64_t)buffer[i] << (8*i);
+	return retval;
+}
+
+
+//! Размер тела метаданных указанного типа без переменной части. 0 для неизвестного типа
+static inline size_t gbus_meta_body_size(gbus_meta_type_t type)
+{
+	switch (type)
+	{
+	case GBUS_META_UPLINK_FRAME: return 8;
+	case GBUS_META_UPLINK_STATE: return 32;
+	case GBUS_META_DOWNLINK_FRAME: return 16;
+	case GBUS_META_UPLINK_SDU_REQUEST: return 16;
+	case GBUS_META_UPLINK_SDU_EVENT: return 18;
+	case GBUS_META_DOWNLINK_SDU: return 12;
+	};
+
+	return 0;
+}
+
+
+//! Похожи ли указанные метаданные на бинарные
+static inline bool gbus_meta_is_binary(const void * data, size_t data_size)
+{
+	return data_size > 0 && ((const uint8_t*)data)[0] == GBUS_META_MAGIC;
+}
+
+
+//! Запись метаданных в буфер
+/*! Возвращает количество записанных байт или 0, если буфер мал или тип неизвестен */
+static inline size_t gbus_meta_encode(const gbus_meta_t * meta, uint8_t * buffer, size_t buffer_size)
+{
+	const size_t body_size = gbus_meta_body_size(meta->type);
+	if (0 == body_size)
+		return 0;
+
+	size_t total_size = GBUS_META_HEADER_SIZE + body_size;
+	if (GBUS_META_UPLINK_SDU_EVENT == meta->type)
+		total_size += meta->body.uplink_sdu_event.comment_size;
+
+	if (total_size > buffer_size)
+		return 0;
+
+	memset(buffer, 0x00, total_size);
+	buffer[0] = GBUS_META_MAGIC;
+	buffer[1] = GBUS_META_VERSION;
+	_gbus_meta_put_u16(buffer + 2, (uint16_t)meta->type);
+	_gbus_meta_put_u32(buffer + 4, meta->time_us);
+	_gbus_meta_put_u64(buffer + 8, meta->time_s);
+
+	uint8_t * const body = buffer + GBUS_META_HEADER_SIZE;
+	switch (meta->type)
+	{
+	case GBUS_META_UPLINK_FRAME: {
+		const gbus_meta_uplink_frame_t * m = &meta->body.uplink_frame;
+		_gbus_meta_put_u64(body + 0, m->cookie);
+		} break;
+
+	case GBUS_META_UPLINK_STATE: {
+		const gbus_meta_uplink_state_t * m = &meta->body.uplink_state;
+		_gbus_meta_put_u64(body + 0, m->cookie_in_wait);
+		_gbus_meta_put_u64(body + 8, m->cookie_in_progress);
+		_gbus_meta_put_u64(body + 16, m->cookie_sent);
+		_gbus_meta_put_u64(body + 24, m->cookie_dropped);
+		} break;
+
+	case GBUS_META_DOWNLINK_FRAME: {
+		const gbus_meta_downlink_frame_t * m = &meta->body.downlink_frame;
+		_gbus_meta_put_u64(body + 0, m->cookie);
+		_gbus_meta_put_u16(body + 8, m->frame_no);
+		body[10] = m->flags;
+		body[11] = (uint8_t)m->rssi_pkt;
+		body[12] = (uint8_t)m->snr_pkt;
+		body[13] = (uint8_t)m->rssi_signal;
+		} break;
+
+	case GBUS_META_UPLINK_SDU_REQUEST: {
+		const gbus_meta_uplink_sdu_request_t * m = &meta->body.uplink_sdu_request;
+		_gbus_meta_put_u64(body + 0, m->cookie);
+		_gbus_meta_put_u16(body + 8, m->sc_id);
+		body[10] = m->vchannel_id;
+		body[11] = m->map_id;
+		body[12] = m->qos;
+		// Старшие биты просто отрезать нельзя: 0x1000000 превратился бы в ноль,
+		// то есть в бессрочный SDU. Поэтому слишком долгий срок урезается до максимума
+		const uint32_t ttl_ms = m->ttl_ms > GBUS_META_MAX_TTL_MS ? GBUS_META_MAX_TTL_MS : m->ttl_ms;
+		body[13] = (uint8_t)(ttl_ms >> 0);
+		body[14] = (uint8_t)(ttl_ms >> 8);
+		body[15] = (uint8_t)(ttl_ms >> 16);
+		} break;
+
+	case GBUS_META_UPLINK_SDU_EVENT: {
+		const gbus_meta_uplink_sdu_event_t * m = &meta->body.uplink_sdu_event;
+		_gbus_meta_put_u64(body + 0, m->cookie);
+		_gbus_meta_put_u16(body + 8, m->part_no);
+		body[10] = m->is_final_part ? 1 : 0;
+		body[11] = m->event;
+		_gbus_meta_put_u16(body + 12, m->sc_id);
+		body[14] = m->vchannel_id;
+		body[15] = m->map_id;
+		_gbus_meta_put_u16(body + 16, m->comment_size);
+		if (m->comment_size)
+			memcpy(body + 18, m->comment, m->comment_size);
+		} break;
+
+	case GBUS_META_DOWNLINK_SDU: {
+		const gbus_meta_downlink_sdu_t * m = &meta->body.downlink_sdu;
+		_gbus_meta_put_u16(body + 0, m->sc_id);
+		body[2] = m->vchannel_id;
+		body[3] = m->map_id;
+		body[4] = m->qos;
+		_gbus_meta_put_u32(body + 8, m->flags);
+		} break;
+	};
+
+	return total_size;
+}
+
+
+//! Разбор бинарных метаданных
+/*! Возвращает 0 при успехе
+ *  -1 если это не бинарные метаданные или версия формата не поддерживается
+ *  -2 если тип сообщения неизвестен
+ *  -3 если размер буфера не соответствует типу */
+static inline int gbus_meta_decode(const uint8_t * buffer, size_t buffer_size, gbus_meta_t * meta)
+{
+	if (buffer_size < GBUS_META_HEADER_SIZE)
+		return -3;
+
+	if (buffer[0] != GBUS_META_MAGIC || buffer[1] != GBUS_META_VERSION)
+		return -1;
+
+	const gbus_meta_type_t type = (gbus_meta_type_t)_gbus_meta_get_u16(buffer + 2);
+	const size_t body_size = gbus_meta_body_size(type);
+	if (0 == body_size)
+		return -2;
+
+	if (buffer_size < GBUS_META_HEADER_SIZE + body_size)
+		return -3;
+
+	memset(meta, 0x00, sizeof(*meta));
+	meta->type = type;
+	meta->time_us = _gbus_meta_get_u32(buffer + 4);
+	meta->time_s = _gbus_meta_get_u64(buffer + 8);
+
+	const uint8_t * const body = buffer + GBUS_META_HEADER_SIZE;
+	switch (type)
+	{
+	case GBUS_META_UPLINK_FRAME: {
+		gbus_meta_uplink_frame_t * m = &meta->body.uplink_frame;
+		m->cookie = _gbus_meta_get_u64(body + 0);
+		} break;
+
+	case GBUS_META_UPLINK_STATE: {
+		gbus_meta_uplink_state_t * m = &meta->body.uplink_state;
+		m->cookie_in_wait = _gbus_meta_get_u64(body + 0);
+		m->cookie_in_progress = _gbus_meta_get_u64(body + 8);
+		m->cookie_sent = _gbus_meta_get_u64(body + 16);
+		m->cookie_dropped = _gbus_meta_get_u64(body + 24);
+		} break;
+
+	case GBUS_META_DOWNLINK_FRAME: {
+		gbus_meta_downlink_frame_t * m = &meta->body.downlink_frame;
+		m->cookie = _gbus_meta_get_u64(body + 0);
+		m->frame_no = _gbus_meta_get_u16(body + 8);
+		m->flags = body[10];
+		m->rssi_pkt = (int8_t)body[11];
+		m->snr_pkt = (int8_t)body[12];
+		m->rssi_signal = (int8_t)body[13];
+		} break;
+
+	case GBUS_META_UPLINK_SDU_REQUEST: {
+		gbus_meta_uplink_sdu_request_t * m = &meta->body.uplink_sdu_request;
+		m->cookie = _gbus_meta_get_u64(body + 0);
+		m->sc_id = _gbus_meta_get_u16(body + 8);
+		m->vchannel_id = body[10];
+		m->map_id = body[11];
+		m->qos = body[12];
+		m->ttl_ms = (uint32_t)body[13] | ((uint32_t)body[14] << 8) | ((uint32_t)body[15] << 16);
+		} break;
+
+	case GBUS_META_UPLINK_SDU_EVENT: {
+		gbus_meta_uplink_sdu_event_t * m = &meta->body.uplink_sdu_event;
+		m->cookie = _gbus_meta_get_u64(body + 0);
+		m->part_no = _gbus_meta_get_u16(body + 8);
+		m->is_final_part = body[10] != 0;
+		m->event = body[11];
+		m->sc_id = _gbus_meta_get_u16(body + 12);
+		m->vchannel_id = body[14];
+		m->map_id = body[15];
+		m->comment_size = _gbus_meta_get_u16(body + 16);
+		if (buffer_size < GBUS_META_HEADER_SIZE + body_size + m->comment_size)
+			return -3;
+		m->comment = (const char *)(body + 18);
+		} break;
+
+	case GBUS_META_DOWNLINK_SDU: {
+		gbus_meta_downlink_sdu_t * m = &meta->body.downlink_sdu;
+		m->sc_id = _gbus_meta_get_u16(body + 0);
+		m->vchannel_id = body[2];
+		m->map_id = body[3];
+		m->qos = body[4];
+		m->flags = _gbus_meta_get_u32(body + 8);
+		} break;
+	};
+
+	return 0;
+}
+
+
+#endif /* ITS_GBUS_COMMON_GBUS_META_H_ */
@@ -0,0 +1,144 @@
+#ifndef ITS_GBUS_COMMON_GBUS_TOPIC_H_
+#define ITS_GBUS_COMMON_GBUS_TOPIC_H_
+
+/*! Топики сообщений шины с номером канала
+ *
+ *  Топики сообщений USLP стека заканчиваются номером канала:
+ *  <база>.<sc_id>.<vchannel_id>.<map_id>, например uslp.downlink_sdu.66.0.1.
+ *  Здесь их сборка и разбор без printf, scanf и выделения памяти.
+ *  Подробности в doc/topics.md
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+
+//! Сколько максимум добавляет к базе топика номер канала: ".65535.255.255"
+#define GBUS_TOPIC_CHANNEL_SUFFIX_MAX_SIZE (14)
+
+
+static inline size_t _gbus_topic_put_uint(char * buffer, uint32_t value)
+{
+	char digits[10];
+	size_t count = 0;
+	do
+	{
+		digits[count++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value);
+
+	for (size_t i = 0; i < count; i++)
+		buffer[i] = digits[count - i - 1];
+
+	return count;
+}
+
+
+//! Число из части топика. Как strtol с основанием 0: 0x - hex, ведущий 0 - oct
+static inline bool _gbus_topic_get_uint(const char * begin, const char * end, uint32_t max, uint32_t * value)
+{
+	uint32_t base = 10;
+	if (end - begin > 2 && '0' == begin[0] && ('x' == begin[1] || 'X' == begin[1]))
+	{
+		base = 16;
+		begin += 2;
+	}
+	else if (end - begin > 1 && '0' == begin[0])
+	{
+		base = 8;
+		begin += 1;
+	}
+
+	if (begin == end)
+		return false;
+
+	uint32_t retval = 0;
+	for (const char * it = begin; it != end; it++)
+	{
+		uint32_t digit;
+		if (*it >= '0' && *it <= '9')
+			digit = *it - '0';
+		else if (*it >= 'a' && *it <= 'f')
+			digit = *it - 'a' + 10;
+		else if (*it >= 'A' && *it <= 'F')
+			digit = *it - 'A' + 10;
+		else
+			return false;
+
+		if (digit >= base)
+			return false;
+
+		retval = retval * base + digit;
+		if (retval > max)
+			return false;
+	}
+
+	*value = retval;
+	return true;
+}
+
+
+//! Сборка топика base.sc_id.vchannel_id.map_id в buffer (без завершающего нуля)
+/*! Возвращает размер топика или 0, если он не влезает в буфер */
+static inline size_t gbus_topic_format_channel(
+		char * buffer, size_t buffer_size,
+		const char * base, size_t base_size,
+		uint16_t sc_id, uint8_t vchannel_id, uint8_t map_id
+)
+{
+	if (buffer_size < base_size + GBUS_TOPIC_CHANNEL_SUFFIX_MAX_SIZE)
+		return 0;
+
+	memcpy(buffer, base, base_size);
+	size_t size = base_size;
+
+	buffer[size++] = '.';
+	size += _gbus_topic_put_uint(buffer + size, sc_id);
+	buffer[size++] = '.';
+	size += _gbus_topic_put_uint(buffer + size, vchannel_id);
+	buffer[size++] = '.';
+	size += _gbus_topic_put_uint(buffer + size, map_id);
+	return size;
+}
+
+
+//! Номер канала из трех последних частей топика
+/*! Части разделены точками, несколько точек подряд считаются одной.
+ *  Возвращает 0 или -1, если номера канала в конце топика нет */
+static inline int gbus_topic_parse_channel(
+		const char * topic, size_t topic_size,
+		uint16_t * sc_id, uint8_t * vchannel_id, uint8_t * map_id
+)
+{
+	static const uint32_t max_values[3] = { 0xFFFF, 0xFF, 0xFF };
+	uint32_t values[3];
+
+	const char * end = topic + topic_size;
+	for (int part = 2; part >= 0; part--)
+	{
+		const char * begin = end;
+		while (begin != topic && '.' != begin[-1])
+			begin--;
+
+		if (!_gbus_topic_get_uint(begin, end, max_values[part], &values[part]))
+			return -1;
+
+		// Ко следующей части, пропуская все точки перед этой
+		end = begin;
+		while (end != topic && '.' == end[-1])
+			end--;
+
+		if (part > 0 && end == begin)
+			return -1; // Частей меньше трех
+	}
+
+	*sc_id = (uint16_t)values[0];
+	*vchannel_id = (uint8_t)values[1];
+	*map_id = (uint8_t)values[2];
+	return 0;
+}
+
+
+#endif /* ITS_GBUS_COMMON_GBUS_TOPIC_H_ */
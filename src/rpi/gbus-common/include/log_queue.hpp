@@ -0,0 +1,213 @@
+#ifndef ITS_GBUS_COMMON_LOG_QUEUE_HPP_
+#define ITS_GBUS_COMMON_LOG_QUEUE_HPP_
+
+
+#include <mutex>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <condition_variable>
+
+#include <boost/log/core/record_view.hpp>
+
+
+//! Очередь записей лога для boost::log::sinks::asynchronous_sink
+/*! Кольцо фиксированного размера без блокировок: писать в него может сколько
+ *  угодно потоков, а разгребает его один поток синка. Писатель не трогает
+ *  мьютекс, если поток синка не спит. Если кольцо переполнено, запись
+ *  либо выкидывается (с подсчетом выкинутых), либо писатель ждет места.
+ *
+ *  Когда кольцо опустело, поток синка перед сном зовет idle_handler -
+ *  так накопленные записи сбрасываются в поток вывода одной пачкой */
+template <size_t CAPACITY>
+class log_ring_queue
+{
+	static_assert(CAPACITY && 0 == (CAPACITY & (CAPACITY - 1)), "capacity should be a power of two");
+
+public:
+	//! Выкидывать ли записи при переполнении. Иначе писатель ждет
+	void drop_on_overflow(bool value) { _drop_on_overflow.store(value, std::memory_order_relaxed); }
+	bool drop_on_overflow() const { return _drop_on_overflow.load(std::memory_order_relaxed); }
+
+	//! Сколько записей было выкинуто из-за переполнения
+	uint64_t dropped_records() const { return _dropped_records.load(std::memory_order_relaxed); }
+
+	//! Вызывается в потоке синка, когда очередь опустела
+	void idle_handler(std::function<void()> handler) { _idle_handler = std::move(handler); }
+
+protected:
+	typedef boost::log::record_view record_view;
+
+	log_ring_queue()
+	{
+		for (size_t i = 0; i < CAPACITY; i++)
+			_slots[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	template <typename ARGS>
+	explicit log_ring_queue(const ARGS &): log_ring_queue() {}
+
+	void enqueue(const record_view & rec)
+	{
+		while (!_try_push(rec))
+		{
+			if (drop_on_overflow())
+			{
+				_dropped_records.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			// Поток синка не спит, пока в очереди что-то есть, так что место скоро будет
+			std::this_thread::yield();
+		}
+
+		_wake_consumer();
+	}
+
+	bool try_enqueue(const record_view & rec)
+	{
+		if (!_try_push(rec))
+			return false;
+
+		_wake_consumer();
+		return true;
+	}
+
+	bool try_dequeue_ready(record_view & rec)
+	{
+		return _try_pop(rec);
+	}
+
+	bool try_dequeue(record_view & rec)
+	{
+		return _try_pop(rec);
+	}
+
+	//! Ожидание очередной записи. false, если ожидание прервано
+	bool dequeue_ready(record_view & rec)
+	{
+		while (true)
+		{
+			if (_try_pop(rec))
+				return true;
+
+			if (_idle_handler)
+				_idle_handler();
+
+			std::unique_lock<std::mutex> lock(_wakeup_mutex);
+			if (_interruption_requested)
+			{
+				_interruption_requested = false;
+				return false;
+			}
+
+			_consumer_sleeping.store(true, std::memory_order_relaxed);
+			// Барьер в паре с барьером писателя: либо мы увидим его запись,
+			// либо он увидит, что мы спим
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (_empty())
+				_wakeup.wait(lock);
+
+			_consumer_sleeping.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	void interrupt_dequeue()
+	{
+		std::lock_guard<std::mutex> lock(_wakeup_mutex);
+		_interruption_requested = true;
+		_wakeup.notify_one();
+	}
+
+private:
+	//! Ячейка кольца. Номер в ней говорит, чья сейчас очередь её трогать
+	struct slot_t
+	{
+		std::atomic<size_t> seq;
+		record_view rec;
+	};
+
+	static constexpr size_t _mask = CAPACITY - 1;
+
+	bool _try_push(const record_view & rec)
+	{
+		size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+		while (true)
+		{
+			slot_t & slot = _slots[pos & _mask];
+			const size_t seq = slot.seq.load(std::memory_order_acquire);
+			const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (0 == diff)
+			{
+				// Ячейка свободна, пробуем её занять
+				if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					slot.rec = rec;
+					slot.seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				// Читатель еще не забрал то, что лежит здесь с прошлого круга
+				return false;
+			}
+			else
+			{
+				// Кто-то успел занять ячейку раньше нас
+				pos = _enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool _try_pop(record_view & rec)
+	{
+		// Читатель один, так что за позицию чтения ни с кем не бьемся
+		const size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+		slot_t & slot = _slots[pos & _mask];
+		if (slot.seq.load(std::memory_order_acquire) != pos + 1)
+			return false;
+
+		rec.swap(slot.rec);
+		slot.rec.reset();
+		_dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+		slot.seq.store(pos + CAPACITY, std::memory_order_release);
+		return true;
+	}
+
+	bool _empty() const
+	{
+		const size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+		return _slots[pos & _mask].seq.load(std::memory_order_acquire) != pos + 1;
+	}
+
+	void _wake_consumer()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (_consumer_sleeping.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<std::mutex> lock(_wakeup_mutex);
+			_wakeup.notify_one();
+		}
+	}
+
+	std::array<slot_t, CAPACITY> _slots;
+	alignas(64) std::atomic<size_t> _enqueue_pos = {0};
+	alignas(64) std::atomic<size_t> _dequeue_pos = {0};
+
+	alignas(64) std::atomic<bool> _consumer_sleeping = {false};
+	std::atomic<bool> _drop_on_overflow = {true};
+	std::atomic<uint64_t> _dropped_records = {0};
+
+	std::mutex _wakeup_mutex;
+	std::condition_variable _wakeup;
+	bool _interruption_requested = false;
+
+	std::function<void()> _idle_handler;
+};
+
+
+#endif /* ITS_GBUS_COMMON_LOG_QUEUE_HPP_ */
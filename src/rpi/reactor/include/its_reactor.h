@@ -0,0 +1,145 @@
+#ifndef ITS_REACTOR_ITS_REACTOR_H_
+#define ITS_REACTOR_ITS_REACTOR_H_
+
+/*! Цикл событий серверов на epoll
+ *
+ *  Один поток ждет сразу всего: готовности обычных дескрипторов (tun, прерывания
+ *  радио), сообщений в zmq сокетах и срабатывания таймеров, и зовет на каждое
+ *  событие свой колбек. Пока событий нет - поток спит в epoll_wait, а не
+ *  опрашивает все по очереди.
+ *
+ *  zmq сокеты ждутся через их ZMQ_FD. Этот дескриптор срабатывает по фронту:
+ *  он говорит только о том, что состояние сокета могло измениться, а есть ли
+ *  в сокете сообщение - знает только ZMQ_EVENTS. Поэтому после каждого
+ *  пробуждения колбек сокета зовется, пока ZMQ_EVENTS говорит, что в сокете
+ *  есть сообщение (но не больше ITS_REACTOR_ZMQ_BUDGET раз, чтобы один сокет
+ *  не заморил остальных). Колбек должен забрать из сокета хотя бы одно сообщение.
+ *
+ *  Таймеры сделаны на timerfd, так что срабатывают тем же путем, что и дескрипторы.
+ *
+ *  Реактор не потокобезопасен и как и zmq сокеты живет в одном потоке.
+ *  Функции возвращают 0 (или номер наблюдения) при успехе и -errno при ошибке.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <sys/epoll.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+//! Сколько всего наблюдений может быть в одном реакторе
+#define ITS_REACTOR_MAX_WATCHES		(16)
+//! Сколько раз подряд колбек zmq сокета зовется за одно пробуждение
+#define ITS_REACTOR_ZMQ_BUDGET		(64)
+
+
+struct its_reactor_t;
+typedef struct its_reactor_t its_reactor_t;
+
+
+//! Колбек готовности дескриптора. events - маска EPOLLIN, EPOLLOUT и прочих
+typedef void (*its_reactor_fd_cb_t)(its_reactor_t * reactor, int fd, uint32_t events, void * arg);
+//! Колбек zmq сокета: в сокете есть сообщение
+typedef void (*its_reactor_zmq_cb_t)(its_reactor_t * reactor, void * socket, void * arg);
+//! Колбек таймера
+typedef void (*its_reactor_timer_cb_t)(its_reactor_t * reactor, int watch, void * arg);
+
+
+typedef enum its_reactor_watch_kind_t
+{
+	ITS_REACTOR_WATCH_NONE = 0,
+	ITS_REACTOR_WATCH_FD,
+	ITS_REACTOR_WATCH_ZMQ,
+	ITS_REACTOR_WATCH_TIMER,
+} its_reactor_watch_kind_t;
+
+
+//! То, за чем реактор следит
+typedef struct its_reactor_watch_t
+{
+	its_reactor_watch_kind_t kind;
+	//! Дескриптор: свой, ZMQ_FD сокета или timerfd таймера
+	int fd;
+	//! События, которых ждем на дескрипторе (для ITS_REACTOR_WATCH_FD)
+	uint32_t events;
+	//! zmq сокет (для ITS_REACTOR_WATCH_ZMQ)
+	void * socket;
+	//! Выключенные наблюдения колбеков не получают
+	bool enabled;
+
+	union
+	{
+		its_reactor_fd_cb_t fd;
+		its_reactor_zmq_cb_t zmq;
+		its_reactor_timer_cb_t timer;
+	} cb;
+	void * arg;
+} its_reactor_watch_t;
+
+
+struct its_reactor_t
+{
+	int epoll_fd;
+	its_reactor_watch_t watches[ITS_REACTOR_MAX_WATCHES];
+	//! В каком-то zmq сокете могут быть сообщения, а фронта ZMQ_FD уже не будет
+	/*! Тогда следующее ожидание не спит */
+	bool zmq_pending;
+	//! Просьба завершить its_reactor_run()
+	volatile bool stop_requested;
+};
+
+
+int its_reactor_init(its_reactor_t * reactor);
+
+void its_reactor_deinit(its_reactor_t * reactor);
+
+
+//! Наблюдение за дескриптором. Возвращает номер наблюдения
+int its_reactor_add_fd(its_reactor_t * reactor, int fd, uint32_t events, its_reactor_fd_cb_t cb, void * arg);
+
+//! Наблюдение за приходом сообщений в zmq сокет. Возвращает номер наблюдения
+/*! cb может быть NULL - тогда сокет только будит its_reactor_run_once(), а сообщения
+ *  забирает тот, кто его зовет. Забирать нужно все, пока ZMQ_EVENTS говорит о POLLIN:
+ *  о тех, что останутся в сокете, ZMQ_FD снова уже не сработает */
+int its_reactor_add_zmq(its_reactor_t * reactor, void * socket, its_reactor_zmq_cb_t cb, void * arg);
+
+//! Таймер. Создается остановленным, запускается its_reactor_timer_set(). Возвращает номер наблюдения
+int its_reactor_add_timer(its_reactor_t * reactor, its_reactor_timer_cb_t cb, void * arg);
+
+//! Запуск таймера через delay_us и затем каждые period_us (ноль - однократно)
+/*! Нулевой delay_us останавливает таймер */
+int its_reactor_timer_set(its_reactor_t * reactor, int watch, uint64_t delay_us, uint64_t period_us);
+
+//! Включение и выключение наблюдения без его удаления
+/*! Выключенный zmq сокет копит сообщения, они будут отданы после включения */
+int its_reactor_enable(its_reactor_t * reactor, int watch, bool enabled);
+
+//! Удаление наблюдения. Дескриптор наблюдения за fd не закрывается
+int its_reactor_remove(its_reactor_t * reactor, int watch);
+
+
+//! Одно ожидание событий и вызов их колбеков
+/*! timeout_ms - сколько ждать, если событий нет. -1 - бесконечно.
+ *  Возвращает число вызванных колбеков. Прерывание сигналом - не ошибка */
+int its_reactor_run_once(its_reactor_t * reactor, int timeout_ms);
+
+//! Цикл событий до its_reactor_stop()
+int its_reactor_run(its_reactor_t * reactor);
+
+//! Завершение its_reactor_run() после текущей итерации. Можно звать из колбеков и сигналов
+/*! Вычерпывание zmq сокетов в текущей итерации тоже прекращается, пока флаг
+ *  не сбросят (это делает its_reactor_run() при запуске) */
+void its_reactor_stop(its_reactor_t * reactor);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ITS_REACTOR_ITS_REACTOR_H_ */
@@ -0,0 +1,174 @@
+#ifndef ITS_REACTOR_ITS_REACTOR_HPP_
+#define ITS_REACTOR_ITS_REACTOR_HPP_
+
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <utility>
+#include <exception>
+#include <functional>
+#include <system_error>
+
+#include "its_reactor.h"
+
+
+//! Обертка над its_reactor_t для C++ серверов
+/*! Обработчики - std::function. Исключение из обработчика не идет через
+ *  C код реактора: оно запоминается, реактор останавливается, и исключение
+ *  выбрасывается из run_once() уже после возврата из its_reactor_run_once().
+ *  Ошибки самого реактора - std::system_error */
+class reactor
+{
+public:
+	typedef std::function<void(int fd, uint32_t events)> fd_handler_t;
+	typedef std::function<void()> zmq_handler_t;
+	typedef std::function<void()> timer_handler_t;
+
+	reactor()
+	{
+		_check(its_reactor_init(&_reactor), "unable to init reactor");
+	}
+
+	~reactor()
+	{
+		its_reactor_deinit(&_reactor);
+	}
+
+	reactor(const reactor &) = delete;
+	reactor & operator=(const reactor &) = delete;
+
+	int add_fd(int fd, uint32_t events, fd_handler_t handler)
+	{
+		auto slot = _make_slot();
+		slot->fd = std::move(handler);
+		const int watch = its_reactor_add_fd(&_reactor, fd, events, &reactor::_fd_trampoline, slot.get());
+		return _store_slot(watch, std::move(slot), "unable to add fd to reactor");
+	}
+
+	//! Без обработчика сокет только будит run_once(), см. its_reactor_add_zmq()
+	int add_zmq(void * socket, zmq_handler_t handler = zmq_handler_t())
+	{
+		auto slot = _make_slot();
+		const its_reactor_zmq_cb_t cb = handler ? &reactor::_zmq_trampoline : nullptr;
+		slot->zmq = std::move(handler);
+		const int watch = its_reactor_add_zmq(&_reactor, socket, cb, slot.get());
+		return _store_slot(watch, std::move(slot), "unable to add zmq socket to reactor");
+	}
+
+	int add_timer(timer_handler_t handler)
+	{
+		auto slot = _make_slot();
+		slot->timer = std::move(handler);
+		const int watch = its_reactor_add_timer(&_reactor, &reactor::_timer_trampoline, slot.get());
+		return _store_slot(watch, std::move(slot), "unable to add timer to reactor");
+	}
+
+	//! Нулевой delay останавливает таймер, нулевой period - однократный таймер
+	void set_timer(int watch, std::chrono::microseconds delay, std::chrono::microseconds period)
+	{
+		_check(its_reactor_timer_set(&_reactor, watch, delay.count(), period.count()), "unable to set timer");
+	}
+
+	void enable(int watch, bool enabled)
+	{
+		_check(its_reactor_enable(&_reactor, watch, enabled), "unable to enable reactor watch");
+	}
+
+	void remove(int watch)
+	{
+		_check(its_reactor_remove(&_reactor, watch), "unable to remove reactor watch");
+		// Наблюдение могут удалять из его же обработчика, поэтому не сразу
+		_removed_slots.push_back(std::move(_slots[watch]));
+	}
+
+	//! Одно ожидание событий и вызов обработчиков. Возвращает число вызовов
+	/*! Отрицательный таймаут - ждать бесконечно */
+	int run_once(std::chrono::milliseconds timeout)
+	{
+		_reactor.stop_requested = false;
+		const int called = its_reactor_run_once(&_reactor, static_cast<int>(timeout.count()));
+		_removed_slots.clear();
+		if (_error)
+			std::rethrow_exception(std::exchange(_error, nullptr));
+
+		return _check(called, "reactor wait failed");
+	}
+
+private:
+	//! То, что уходит в C код как arg колбека
+	struct slot_t
+	{
+		reactor * self;
+		fd_handler_t fd;
+		zmq_handler_t zmq;
+		timer_handler_t timer;
+	};
+
+	static int _check(int rc, const char * what)
+	{
+		if (rc < 0)
+			throw std::system_error(std::error_code(-rc, std::system_category()), what);
+
+		return rc;
+	}
+
+	std::unique_ptr<slot_t> _make_slot()
+	{
+		std::unique_ptr<slot_t> retval(new slot_t());
+		retval->self = this;
+		return retval;
+	}
+
+	int _store_slot(int watch, std::unique_ptr<slot_t> slot, const char * what)
+	{
+		_check(watch, what);
+		_slots[watch] = std::move(slot);
+		return watch;
+	}
+
+	template <typename CALLABLE>
+	void _call(CALLABLE && callable)
+	{
+		// После первого исключения остальные события этой итерации пропускаем
+		if (_error)
+			return;
+
+		try
+		{
+			callable();
+		}
+		catch (...)
+		{
+			_error = std::current_exception();
+			its_reactor_stop(&_reactor);
+		}
+	}
+
+	static void _fd_trampoline(its_reactor_t *, int fd, uint32_t events, void * arg)
+	{
+		slot_t * const slot = static_cast<slot_t*>(arg);
+		slot->self->_call([slot, fd, events]() { slot->fd(fd, events); });
+	}
+
+	static void _zmq_trampoline(its_reactor_t *, void *, void * arg)
+	{
+		slot_t * const slot = static_cast<slot_t*>(arg);
+		slot->self->_call([slot]() { slot->zmq(); });
+	}
+
+	static void _timer_trampoline(its_reactor_t *, int, void * arg)
+	{
+		slot_t * const slot = static_cast<slot_t*>(arg);
+		slot->self->_call([slot]() { slot->timer(); });
+	}
+
+	its_reactor_t _reactor;
+	std::array<std::unique_ptr<slot_t>, ITS_REACTOR_MAX_WATCHES> _slots;
+	std::vector<std::unique_ptr<slot_t>> _removed_slots;
+	std::exception_ptr _error;
+};
+
+
+#endif /* ITS_REACTOR_ITS_REACTOR_HPP_ */
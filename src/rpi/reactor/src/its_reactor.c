@@ -0,0 +1,327 @@
+#include "its_reactor.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/timerfd.h>
+
+#include <zmq.h>
+
+
+//! Свободное место под наблюдение
+static int _alloc_watch(its_reactor_t * reactor)
+{
+	for (int i = 0; i < ITS_REACTOR_MAX_WATCHES; i++)
+	{
+		if (ITS_REACTOR_WATCH_NONE == reactor->watches[i].kind)
+			return i;
+	}
+
+	return -ENOSPC;
+}
+
+
+static its_reactor_watch_t * _get_watch(its_reactor_t * reactor, int watch)
+{
+	if (watch < 0 || watch >= ITS_REACTOR_MAX_WATCHES)
+		return NULL;
+
+	its_reactor_watch_t * retval = &reactor->watches[watch];
+	if (ITS_REACTOR_WATCH_NONE == retval->kind)
+		return NULL;
+
+	return retval;
+}
+
+
+static int _epoll_ctl(its_reactor_t * reactor, int op, int watch, uint32_t events)
+{
+	struct epoll_event event;
+	memset(&event, 0x00, sizeof(event));
+	event.events = events;
+	event.data.u32 = (uint32_t)watch;
+
+	int rc = epoll_ctl(reactor->epoll_fd, op, reactor->watches[watch].fd, &event);
+	if (rc < 0)
+		return -errno;
+
+	return 0;
+}
+
+
+//! Регистрация уже заполненного наблюдения в epoll
+static int _add_watch(its_reactor_t * reactor, int watch)
+{
+	its_reactor_watch_t * const w = &reactor->watches[watch];
+	w->enabled = true;
+
+	int rc = _epoll_ctl(reactor, EPOLL_CTL_ADD, watch, w->events);
+	if (0 != rc)
+	{
+		memset(w, 0x00, sizeof(*w));
+		return rc;
+	}
+
+	return watch;
+}
+
+
+//! Вызов колбеков zmq сокетов, пока в них есть сообщения
+static int _serve_zmq(its_reactor_t * reactor)
+{
+	int called = 0;
+	reactor->zmq_pending = false;
+	for (int i = 0; i < ITS_REACTOR_MAX_WATCHES; i++)
+	{
+		its_reactor_watch_t * const w = &reactor->watches[i];
+		// Без колбека сокет только будит, сообщения заберут после run_once
+		if (ITS_REACTOR_WATCH_ZMQ == w->kind && !w->cb.zmq)
+			continue;
+
+		size_t served = 0;
+		// Колбек может выключить или удалить наблюдение, поэтому проверяем каждый раз
+		while (ITS_REACTOR_WATCH_ZMQ == w->kind && w->enabled)
+		{
+			int events = 0;
+			size_t events_size = sizeof(events);
+			int rc = zmq_getsockopt(w->socket, ZMQ_EVENTS, &events, &events_size);
+			if (rc < 0 || !(events & ZMQ_POLLIN))
+				break;
+
+			if (served == ITS_REACTOR_ZMQ_BUDGET || reactor->stop_requested)
+			{
+				// Остальное в следующий раз, не засыпая
+				reactor->zmq_pending = true;
+				break;
+			}
+
+			w->cb.zmq(reactor, w->socket, w->arg);
+			served++;
+		}
+
+		called += served;
+	}
+
+	return called;
+}
+
+
+int its_reactor_init(its_reactor_t * reactor)
+{
+	memset(reactor, 0x00, sizeof(*reactor));
+
+	reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (reactor->epoll_fd < 0)
+		return -errno;
+
+	return 0;
+}
+
+
+void its_reactor_deinit(its_reactor_t * reactor)
+{
+	for (int i = 0; i < ITS_REACTOR_MAX_WATCHES; i++)
+	{
+		if (ITS_REACTOR_WATCH_NONE != reactor->watches[i].kind)
+			its_reactor_remove(reactor, i);
+	}
+
+	if (reactor->epoll_fd >= 0)
+		close(reactor->epoll_fd);
+
+	reactor->epoll_fd = -1;
+}
+
+
+int its_reactor_add_fd(its_reactor_t * reactor, int fd, uint32_t events, its_reactor_fd_cb_t cb, void * arg)
+{
+	const int watch = _alloc_watch(reactor);
+	if (watch < 0)
+		return watch;
+
+	its_reactor_watch_t * const w = &reactor->watches[watch];
+	w->kind = ITS_REACTOR_WATCH_FD;
+	w->fd = fd;
+	w->events = events;
+	w->cb.fd = cb;
+	w->arg = arg;
+	return _add_watch(reactor, watch);
+}
+
+
+int its_reactor_add_zmq(its_reactor_t * reactor, void * socket, its_reactor_zmq_cb_t cb, void * arg)
+{
+	const int watch = _alloc_watch(reactor);
+	if (watch < 0)
+		return watch;
+
+	int fd = -1;
+	size_t fd_size = sizeof(fd);
+	int rc = zmq_getsockopt(socket, ZMQ_FD, &fd, &fd_size);
+	if (rc < 0)
+		return -errno;
+
+	its_reactor_watch_t * const w = &reactor->watches[watch];
+	w->kind = ITS_REACTOR_WATCH_ZMQ;
+	w->fd = fd;
+	w->events = EPOLLIN;
+	w->socket = socket;
+	w->cb.zmq = cb;
+	w->arg = arg;
+
+	// В сокете уже могут лежать сообщения, о которых ZMQ_FD не скажет
+	reactor->zmq_pending = true;
+	return _add_watch(reactor, watch);
+}
+
+
+int its_reactor_add_timer(its_reactor_t * reactor, its_reactor_timer_cb_t cb, void * arg)
+{
+	const int watch = _alloc_watch(reactor);
+	if (watch < 0)
+		return watch;
+
+	const int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	its_reactor_watch_t * const w = &reactor->watches[watch];
+	w->kind = ITS_REACTOR_WATCH_TIMER;
+	w->fd = fd;
+	w->events = EPOLLIN;
+	w->cb.timer = cb;
+	w->arg = arg;
+
+	const int rc = _add_watch(reactor, watch);
+	if (rc < 0)
+		close(fd);
+
+	return rc;
+}
+
+
+int its_reactor_timer_set(its_reactor_t * reactor, int watch, uint64_t delay_us, uint64_t period_us)
+{
+	its_reactor_watch_t * const w = _get_watch(reactor, watch);
+	if (!w || ITS_REACTOR_WATCH_TIMER != w->kind)
+		return -EINVAL;
+
+	struct itimerspec spec;
+	memset(&spec, 0x00, sizeof(spec));
+	spec.it_value.tv_sec = delay_us / 1000000;
+	spec.it_value.tv_nsec = (delay_us % 1000000) * 1000;
+	spec.it_interval.tv_sec = period_us / 1000000;
+	spec.it_interval.tv_nsec = (period_us % 1000000) * 1000;
+
+	int rc = timerfd_settime(w->fd, 0, &spec, NULL);
+	if (rc < 0)
+		return -errno;
+
+	return 0;
+}
+
+
+int its_reactor_enable(its_reactor_t * reactor, int watch, bool enabled)
+{
+	its_reactor_watch_t * const w = _get_watch(reactor, watch);
+	if (!w)
+		return -EINVAL;
+
+	if (w->enabled == enabled)
+		return 0;
+
+	// ZMQ_FD выключенного сокета тоже снимаем с epoll, иначе несчитанный
+	// фронт будет будить реактор раз за разом
+	w->enabled = enabled;
+	const int rc = _epoll_ctl(reactor, EPOLL_CTL_MOD, watch, enabled ? w->events : 0);
+
+	// ZMQ_FD о накопленных за это время сообщениях уже не скажет, проверим сокет сами
+	if (enabled && ITS_REACTOR_WATCH_ZMQ == w->kind)
+		reactor->zmq_pending = true;
+
+	return rc;
+}
+
+
+int its_reactor_remove(its_reactor_t * reactor, int watch)
+{
+	its_reactor_watch_t * const w = _get_watch(reactor, watch);
+	if (!w)
+		return -EINVAL;
+
+	const int rc = _epoll_ctl(reactor, EPOLL_CTL_DEL, watch, 0);
+	if (ITS_REACTOR_WATCH_TIMER == w->kind)
+		close(w->fd);
+
+	memset(w, 0x00, sizeof(*w));
+	return rc;
+}
+
+
+int its_reactor_run_once(its_reactor_t * reactor, int timeout_ms)
+{
+	struct epoll_event events[ITS_REACTOR_MAX_WATCHES];
+	if (reactor->zmq_pending)
+		timeout_ms = 0;
+
+	const int ready = epoll_wait(reactor->epoll_fd, events, ITS_REACTOR_MAX_WATCHES, timeout_ms);
+	if (ready < 0)
+	{
+		// Сигнал просто будит
+		if (EINTR == errno)
+			return 0;
+
+		return -errno;
+	}
+
+	int called = 0;
+	for (int i = 0; i < ready; i++)
+	{
+		const int watch = (int)events[i].data.u32;
+		its_reactor_watch_t * const w = &reactor->watches[watch];
+		// Предыдущий колбек мог выключить или удалить это наблюдение
+		if (!w->enabled)
+			continue;
+
+		if (ITS_REACTOR_WATCH_FD == w->kind)
+		{
+			w->cb.fd(reactor, w->fd, events[i].events, w->arg);
+			called++;
+		}
+		else if (ITS_REACTOR_WATCH_TIMER == w->kind)
+		{
+			uint64_t expirations;
+			if (read(w->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+				continue; // Таймер успели перезапустить
+
+			w->cb.timer(reactor, watch, w->arg);
+			called++;
+		}
+		// zmq сокеты проверяются ниже все, а не только сработавшие
+	}
+
+	// После любых колбеков, так как те могли трогать сокеты
+	called += _serve_zmq(reactor);
+	return called;
+}
+
+
+int its_reactor_run(its_reactor_t * reactor)
+{
+	reactor->stop_requested = false;
+	while (!reactor->stop_requested)
+	{
+		const int rc = its_reactor_run_once(reactor, -1);
+		if (rc < 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+
+void its_reactor_stop(its_reactor_t * reactor)
+{
+	reactor->stop_requested = true;
+}
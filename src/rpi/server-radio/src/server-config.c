@@ -77,7 +77,7 @@ int server_config_load(server_config_t * config)
 	config->tx_state_report_period_ms = 500;
 	config->rssi_report_period_ms = 50;
 	config->radio_stats_report_period_ms = 2000;
-	config->poll_timeout_ms = 1;
+	config->poll_timeout_ms = 100;
 
 	config->extract_frame_number = true;
 
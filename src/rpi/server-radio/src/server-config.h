@@ -39,6 +39,8 @@ typedef struct server_config_t
 	//! Насколько часто сервер будет публиковать состояние радио
 	uint32_t radio_stats_report_period_ms;
 	//! Период проверки завешения RX или TX режима на радио
+	/*! Завершение будит прерывание радио, так что это только страховка
+		на случай потерянного прерывания */
 	uint32_t poll_timeout_ms;
 
 	//! Использовать ли первый байт пейлоада как номер фрейма
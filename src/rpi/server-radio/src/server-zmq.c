@@ -7,6 +7,7 @@
 #include <zmq.h>
 #include <log.h>
 #include <jsmin.h>
+#include <gbus_meta.h>
 
 
 #include "server.h"
@@ -58,6 +59,56 @@ static struct timestamp_t _get_world_time(void)
 }
 
 
+//! Заготовка бинарных метаданных с текущим временем
+static gbus_meta_t _make_binary_meta(gbus_meta_type_t type)
+{
+	gbus_meta_t retval;
+	memset(&retval, 0x00, sizeof(retval));
+
+	const timestamp_t now = _get_world_time();
+	retval.type = type;
+	retval.time_s = now.seconds;
+	retval.time_us = now.microseconds;
+	return retval;
+}
+
+
+//! Отправка уже закодированного в буфер сообщения
+static int _send_message(
+		zserver_t * zserver, const char * topic,
+		const void * meta, size_t meta_size,
+		const void * data, size_t data_size
+)
+{
+	const bool have_data = data != NULL;
+	int rc = zmq_send(zserver->pub_socket, topic, strlen(topic), ZMQ_SNDMORE | ZMQ_DONTWAIT);
+	if (rc < 0)
+	{
+		log_error("unable to send %s topic: %d: %s", topic, errno, strerror(errno));
+		return -1;
+	}
+
+	rc = zmq_send(zserver->pub_socket, meta, meta_size, (have_data ? ZMQ_SNDMORE : 0) | ZMQ_DONTWAIT);
+	if (rc < 0)
+	{
+		log_error("unable to send %s metadata: %d: %s", topic, errno, strerror(errno));
+		return -2;
+	}
+
+	if (!have_data)
+		return 0;
+
+	rc = zmq_send(zserver->pub_socket, data, data_size, ZMQ_DONTWAIT);
+	if (rc < 0)
+	{
+		log_error("unable to send %s data: %d: %s", topic, errno, strerror(errno));
+		return -3;
+	}
+
+	return 0;
+}
+
+
 //! Разбор метаданных входящего TX фрейма
 static int _parse_tx_pa_power_metadata(
 		const char * json_buffer, size_t buffer_size, int8_t * pa_power
@@ -118,11 +169,25 @@ static int _parse_tx_pa_power_metadata(
 }
 
 
-//! Разбор метаданных входящего TX фрейма
-static int _parse_tx_frame_metadata(
+int zserver_parse_tx_frame_metadata(
 		const char * json_buffer, size_t buffer_size, msg_cookie_t * msg_cookie
 )
 {
+	// Метаданные могут быть и в бинарном формате
+	if (gbus_meta_is_binary(json_buffer, buffer_size))
+	{
+		gbus_meta_t meta;
+		int rc = gbus_meta_decode((const uint8_t *)json_buffer, buffer_size, &meta);
+		if (0 != rc || GBUS_META_UPLINK_FRAME != meta.type)
+		{
+			log_error("invalid binary tx frame metadata: %d", rc);
+			return -1;
+		}
+
+		*msg_cookie = meta.body.uplink_frame.cookie;
+		return 0;
+	}
+
 	jsmn_parser parser;
 	jsmn_init(&parser);
 
@@ -204,6 +269,11 @@ int zserver_init(zserver_t * zserver)
 		return -1;
 	}
 
+	const char * meta_format = getenv(GBUS_META_FORMAT_ENV_KEY);
+	zserver->binary_meta = meta_format && 0 == strcmp(meta_format, GBUS_META_FORMAT_BINARY);
+	if (zserver->binary_meta)
+		log_info("using binary metadata for tx state and rx frames");
+
 	zserver->zmq = zmq_ctx_new();
 	if (!zserver->zmq)
 		goto bad_exit;
@@ -432,7 +502,7 @@ int zserver_recv_tx_packet(
 			}
 
 			memcpy(json_buffer, zmq_msg_data(&msg), msg_size);
-			rc = _parse_tx_frame_metadata(json_buffer, msg_size, &cookie);
+			rc = zserver_parse_tx_frame_metadata(json_buffer, msg_size, &cookie);
 			if (rc < 0)
 			{
 				// Сообщение об ошибке уже написали
@@ -505,6 +575,21 @@ int zserver_send_tx_buffers_state(
 			cookie_dropped
 	);
 
+	if (zserver->binary_meta)
+	{
+		// В бинарном формате null и так изображается нулем
+		gbus_meta_t meta = _make_binary_meta(GBUS_META_UPLINK_STATE);
+		meta.body.uplink_state.cookie_in_wait = cookie_wait;
+		meta.body.uplink_state.cookie_in_progress = cookie_in_progress;
+		meta.body.uplink_state.cookie_sent = cookie_sent;
+		meta.body.uplink_state.cookie_dropped = cookie_dropped;
+
+		uint8_t meta_buffer[GBUS_META_MAX_SIZE];
+		const size_t meta_size = gbus_meta_encode(&meta, meta_buffer, sizeof(meta_buffer));
+		rc = _send_message(zserver, ITS_GBUS_TOPIC_UPLINK_STATE, meta_buffer, meta_size, NULL, 0);
+		return rc < 0 ? 3 : 0;
+	}
+
 	// Формируем пакет
 	// Протокол требует от нас писать null там где нули
 	// Поэтому... придется сперва перекинуть в текст те числа, которые не null
@@ -648,6 +733,32 @@ int zserver_send_rx_packet(
 	int rc;
 	log_debug("sending rx data");
 
+	if (zserver->binary_meta)
+	{
+		gbus_meta_t meta = _make_binary_meta(GBUS_META_DOWNLINK_FRAME);
+		gbus_meta_downlink_frame_t * m = &meta.body.downlink_frame;
+		m->cookie = packet_cookie;
+		m->flags = GBUS_META_DF_CHECKSUM_KNOWN;
+		if (crc_valid)
+			m->flags |= GBUS_META_DF_CHECKSUM_VALID;
+		if (packet_no != NULL)
+		{
+			m->flags |= GBUS_META_DF_FRAME_NO_VALID;
+			m->frame_no = *packet_no;
+		}
+		m->rssi_pkt = rssi_pkt;
+		m->snr_pkt = snr_pkt;
+		m->rssi_signal = signal_rssi_pkt;
+
+		uint8_t meta_buffer[GBUS_META_MAX_SIZE];
+		const size_t meta_size = gbus_meta_encode(&meta, meta_buffer, sizeof(meta_buffer));
+		rc = _send_message(
+				zserver, ITS_GBUS_TOPIC_DOWNLINK_FRAME,
+				meta_buffer, meta_size, packet_data, packet_data_size
+		);
+		return rc < 0 ? 2 : 0;
+	}
+
 	timestamp_t now;
 	now = _get_world_time();
 
@@ -19,6 +19,8 @@ typedef struct zserver_t
 	void * zmq;
 	void * sub_socket;
 	void * pub_socket;
+	//! Слать ли метаданные tx состояния и rx фреймов в бинарном формате вместо JSON
+	bool binary_meta;
 } zserver_t;
 
 typedef enum get_message_type_t {
@@ -42,6 +44,13 @@ int zserver_recv_tx_packet(
 );
 
 
+//! Разбор метаданных входящего TX фрейма (JSON или бинарных)
+/*! Отдельно от zserver_recv_tx_packet, чтобы его можно было гонять в бенчмарках */
+int zserver_parse_tx_frame_metadata(
+	const char * json_buffer, size_t buffer_size, msg_cookie_t * msg_cookie
+);
+
+
 int zserver_send_tx_buffers_state(
 	zserver_t * zserver,
 	msg_cookie_t cookie_wait, msg_cookie_t cookie_in_progress,
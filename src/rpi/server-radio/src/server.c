@@ -1,6 +1,5 @@
 #include "server.h"
 
-#include <poll.h>
 #include <unistd.h>
 
 #include <errno.h>
@@ -442,71 +441,32 @@ static void _report_radio_stats(server_t * server)
 
 static void _do_periodic_jobs(server_t * server)
 {
-	int rc;
-
-	// Проверяем не прислали ли нам чего
-	zmq_pollitem_t pollitems[1] = {
-			{
-					.socket = server->zserver.sub_socket,
-					.events = ZMQ_POLLIN
-			}
-	};
-
-	rc = zmq_poll(pollitems, 1, 0);
-	if (rc >= 0)
-	{
-		if (pollitems[0].revents & ZMQ_POLLIN)
-			_load_tx(server);
-	}
-	else
-	{
-		log_error("network poll failed! %d", rc);
-	}
-
-	// Дальше занимаемся сбором всякой статитистики и отправкой её на шину сообщений
-	int64_t time_since_last_report;
-
-	time_since_last_report = _timespec_diff_ms_now(&server->rssi_last_report_timepoint);
-	if (time_since_last_report >= server->config.rssi_report_period_ms)
-	{
-		_report_rssi(server);
-		server->rssi_last_report_timepoint = _timespec_now();
-	}
-
-	time_since_last_report = _timespec_diff_ms_now(&server->tx_state_last_report_timepoint);
-	if (server->tx_cookies_updated || time_since_last_report >= server->config.tx_state_report_period_ms)
-	{
+	// Периодические отчеты шлют таймеры реактора, а об изменениях
+	// в очереди отправки сообщаем сразу
+	if (server->tx_cookies_updated)
 		_report_tx_state(server);
-		server->tx_state_last_report_timepoint = _timespec_now();
-	}
-
-	time_since_last_report = _timespec_diff_ms_now(&server->radio_stats_last_report_timepoint);
-	if (time_since_last_report >= server->config.radio_stats_report_period_ms)
-	{
-		_report_radio_stats(server);
-		server->radio_stats_last_report_timepoint = _timespec_now();
-	}
 }
 
 
-static int _sleep_poll_radio_interrupt(server_t * server, uint32_t timeout_ms)
+static int _sleep_wait_events(server_t * server, uint32_t timeout_ms)
 {
 	int rc;
-	sx126x_drv_t * const radio = &server->radio;
-	int radio_interrupt_fd = sx126x_brd_rpi_get_event_fd(radio->api.board);
 
-	struct pollfd pfd = { .fd = radio_interrupt_fd, .events = POLLIN};
-	rc = poll(&pfd, 1, timeout_ms);
-	if (rc < 0)
+	// Пока в отправном буфере ждет фрейм, следующий не забираем.
+	// Он полежит в очереди сокета и не затрет тот, что уже ждет отправки
+	rc = its_reactor_enable(&server->reactor, server->reactor_tx_watch, 0 == server->tx_cookie_wait);
+	if (0 != rc)
 	{
-		log_fatal("radio poll failed. rc: %d, errno: %d", rc, errno);
+		log_fatal("unable to toggle network watch: %d", rc);
 		return rc;
 	}
 
-	if (pfd.revents & POLLIN)
+	// Спим до прерывания радио, сообщения с шины или времени отчета
+	rc = its_reactor_run_once(&server->reactor, timeout_ms);
+	if (rc < 0)
 	{
-		// Интеррупт был, нужно его почистить
-		sx126x_brd_rpi_cleanup_event(radio->api.board);
+		log_fatal("events wait failed: %d", rc);
+		return rc;
 	}
 
 	return 0;
@@ -546,8 +506,8 @@ static int _wait_for_rx(server_t * server, bool * got_packet)
 		// Работаем над фоновыми задачами
 		_do_periodic_jobs(server);
 
-		// Чуток поспим с условим проснуться по прерыванию
-		rc = _sleep_poll_radio_interrupt(server, poll_timeout);
+		// Поспим до какого-нибудь события
+		rc = _sleep_wait_events(server, poll_timeout);
 		if (0 != rc)
 			return rc;
 
@@ -643,7 +603,6 @@ static int _wait_for_tx(server_t * server, bool * succeed)
 {
 	int rc;
 	sx126x_drv_t * const radio = &server->radio;
-	int radio_interrput_fd = sx126x_brd_rpi_get_event_fd(radio->api.board);
 
 	const int poll_timeout = server->config.poll_timeout_ms;
 	const uint32_t watchdog_limit = server->config.tx_watchdog_ms;
@@ -655,8 +614,8 @@ static int _wait_for_tx(server_t * server, bool * succeed)
 		// Работаем над фоновыми задачами
 		_do_periodic_jobs(server);
 
-		// Чуток поспим с условим проснуться по прерыванию
-		rc = _sleep_poll_radio_interrupt(server, poll_timeout);
+		// Поспим до какого-нибудь события
+		rc = _sleep_wait_events(server, poll_timeout);
 		if (0 != rc)
 			return rc;
 
@@ -830,6 +789,112 @@ begin_rx:
 }
 
 
+static void _on_radio_interrupt(its_reactor_t * reactor, int fd, uint32_t events, void * arg)
+{
+	(void)reactor; (void)fd; (void)events;
+	server_t * const server = (server_t *)arg;
+
+	// Интеррупт был, нужно его почистить. Само событие заберет драйвер
+	sx126x_brd_rpi_cleanup_event(server->radio.api.board);
+}
+
+
+static void _on_tx_message(its_reactor_t * reactor, void * socket, void * arg)
+{
+	(void)socket;
+	server_t * const server = (server_t *)arg;
+
+	_load_tx(server);
+
+	// Фрейм занял отправной буфер, остальное пусть ждет в сокете
+	if (0 != server->tx_cookie_wait)
+		its_reactor_enable(reactor, server->reactor_tx_watch, false);
+}
+
+
+static void _on_rssi_timer(its_reactor_t * reactor, int watch, void * arg)
+{
+	(void)reactor; (void)watch;
+	_report_rssi((server_t *)arg);
+}
+
+
+static void _on_tx_state_timer(its_reactor_t * reactor, int watch, void * arg)
+{
+	(void)reactor; (void)watch;
+	_report_tx_state((server_t *)arg);
+}
+
+
+static void _on_radio_stats_timer(its_reactor_t * reactor, int watch, void * arg)
+{
+	(void)reactor; (void)watch;
+	_report_radio_stats((server_t *)arg);
+}
+
+
+//! Таймер отчета с периодом period_ms. Нулевой период - без отчета
+static int _add_report_timer(server_t * server, uint32_t period_ms, its_reactor_timer_cb_t cb)
+{
+	its_reactor_t * const reactor = &server->reactor;
+
+	const int watch = its_reactor_add_timer(reactor, cb, server);
+	if (watch < 0 || 0 == period_ms)
+		return watch;
+
+	const uint64_t period_us = (uint64_t)period_ms * 1000;
+	const int rc = its_reactor_timer_set(reactor, watch, period_us, period_us);
+	if (0 != rc)
+		return rc;
+
+	return watch;
+}
+
+
+static int _reactor_ctor(server_t * server)
+{
+	int rc;
+	its_reactor_t * const reactor = &server->reactor;
+	const server_config_t * const config = &server->config;
+
+	rc = its_reactor_init(reactor);
+	if (0 != rc)
+		return rc;
+
+	const int radio_fd = sx126x_brd_rpi_get_event_fd(server->radio.api.board);
+	rc = its_reactor_add_fd(reactor, radio_fd, EPOLLIN, _on_radio_interrupt, server);
+	if (rc < 0)
+		goto bad_exit;
+	server->reactor_radio_watch = rc;
+
+	rc = its_reactor_add_zmq(reactor, server->zserver.sub_socket, _on_tx_message, server);
+	if (rc < 0)
+		goto bad_exit;
+	server->reactor_tx_watch = rc;
+
+	rc = _add_report_timer(server, config->rssi_report_period_ms, _on_rssi_timer);
+	if (rc < 0)
+		goto bad_exit;
+	server->reactor_rssi_watch = rc;
+
+	rc = _add_report_timer(server, config->tx_state_report_period_ms, _on_tx_state_timer);
+	if (rc < 0)
+		goto bad_exit;
+	server->reactor_tx_state_watch = rc;
+
+	rc = _add_report_timer(server, config->radio_stats_report_period_ms, _on_radio_stats_timer);
+	if (rc < 0)
+		goto bad_exit;
+	server->reactor_radio_stats_watch = rc;
+
+	return 0;
+
+bad_exit:
+	its_reactor_deinit(reactor);
+	return rc;
+}
+
+
 int server_ctor(server_t * server, const server_config_t * config)
 {
 	int rc;
@@ -852,12 +917,22 @@ int server_ctor(server_t * server, const server_config_t * config)
 		return 2;
 	}
 
+	rc = _reactor_ctor(server);
+	if (0 != rc)
+	{
+		log_fatal("reactor ctor failed: %d", rc);
+		_radio_dtor(server);
+		zserver_deinit(&server->zserver);
+		return 3;
+	}
+
 	return 0;
 }
 
 
 void server_dtor(server_t * server)
 {
+	its_reactor_deinit(&server->reactor);
 	zserver_deinit(&server->zserver);
 	_radio_dtor(server);
 }
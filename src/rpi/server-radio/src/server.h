@@ -9,6 +9,8 @@
 
 #include "sx126x_drv.h"
 
+#include <its_reactor.h>
+
 #include "server-zmq.h"
 #include "server-config.h"
 
@@ -53,9 +55,13 @@ typedef struct server_t
 
 	uint16_t radio_errors;
 
-	struct timespec rssi_last_report_timepoint;
-	struct timespec radio_stats_last_report_timepoint;
-	struct timespec tx_state_last_report_timepoint;
+	//! Ожидание прерываний радио, сообщений шины и таймеров отчетов
+	its_reactor_t reactor;
+	int reactor_radio_watch;
+	int reactor_tx_watch;
+	int reactor_rssi_watch;
+	int reactor_tx_state_watch;
+	int reactor_radio_stats_watch;
 
 	volatile sig_atomic_t stop_requested;
 
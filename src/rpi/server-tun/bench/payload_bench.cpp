@@ -0,0 +1,349 @@
+/* Бенчмарк сжатия данных пакетов словарями на записанном трафике
+ *
+ * Читает .zmq-log файлы брокера и вынимает из uslp.uplink_sdu_request
+ * и uslp.downlink_sdu IP пакеты, которые server-tun отправлял и получал
+ * как есть (EPP протокол IPE). Пакеты раскладываются по порту сервиса -
+ * меньшему из портов источника и назначения, так что запросы и ответы
+ * попадают к одному словарю.
+ *
+ * С --train словари обучаются на первой половине пакетов каждого порта
+ * и пишутся в указанный каталог, а проверяются на второй половине.
+ * С --dict проверяются готовые словари на всех пакетах.
+ *
+ * Проверка идет через те же payload_compressor и payload_decompressor,
+ * что в сервере: на каждый порт печатается степень сжатия пакетов целиком
+ * (с заголовками и шимом), доля пакетов, которым сжатие не помогло,
+ * и сколько микросекунд уходит на сжатие и распаковку пакета.
+ */
+
+#include <map>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include <boost/program_options.hpp>
+
+#include <zdict.h>
+#include <ccsds/epp/epp_header.hpp>
+
+#include "log.hpp"
+#include "ip_header.hpp"
+#include "tun_link.hpp"
+#include "packet_pool.hpp"
+#include "payload_compression.hpp"
+
+#include "zmq_log.hpp"
+
+
+static auto _slg = build_source("payload-bench");
+
+
+#define BENCH_TOPIC_DOWNLINK_SDU "uslp.downlink_sdu"
+#define BENCH_TOPIC_UPLINK_SDU_REQUEST "uslp.uplink_sdu_request"
+
+
+//! Записанные пакеты одного порта
+struct port_corpus
+{
+	std::vector<std::string> packets;
+	size_t bytes = 0;
+};
+
+
+//! Итоги проверки одного порта
+struct port_result
+{
+	size_t packets = 0;
+	size_t compressed = 0;
+	size_t bytes_in = 0;
+	size_t bytes_out = 0;
+	double compress_us = 0;
+	double decompress_us = 0;
+	size_t mismatches = 0;
+};
+
+
+static bool _starts_with(const std::string & string, const char * prefix)
+{
+	return 0 == string.compare(0, std::strlen(prefix), prefix);
+}
+
+
+static void _load_logs(const std::vector<std::string> & paths, std::map<uint16_t, port_corpus> & corpus)
+{
+	zmq_log_record record;
+	for (const auto & path: paths)
+	{
+		zmq_log_reader reader(path);
+		LOG(info) << "loading " << path << " (format version " << reader.version() << ")";
+		while (reader.read(record))
+		{
+			if (record.parts.size() < 3)
+				continue;
+
+			const std::string & topic = record.parts[0];
+			if (!_starts_with(topic, BENCH_TOPIC_DOWNLINK_SDU) && !_starts_with(topic, BENCH_TOPIC_UPLINK_SDU_REQUEST))
+				continue;
+
+			const std::string & sdu = record.parts[2];
+			if (sdu.empty())
+				continue;
+
+			const uint8_t * data = reinterpret_cast<const uint8_t*>(sdu.data());
+			if (ccsds::epp::header_t::probe_header_size(data[0]) <= 0)
+				continue;
+
+			ccsds::epp::header_t header;
+			header.read(data, sdu.size());
+			if (TUN_IPE_EPP_PROTOCOL_ID != static_cast<int>(header.protocol_id) || header.size() + header.payload_size() != sdu.size())
+				continue;
+
+			const uint8_t * packet = data + header.size();
+			const size_t packet_size = header.payload_size();
+			if (0 == ipv4_transport_header_size(packet, packet_size))
+				continue;
+
+			const uint8_t * l4 = packet + IPV4_HEADER_SIZE;
+			const uint16_t port = std::min(ip_get16(l4), ip_get16(l4 + 2));
+			auto & port_packets = corpus[port];
+			port_packets.packets.emplace_back(reinterpret_cast<const char*>(packet), packet_size);
+			port_packets.bytes += packet_size;
+		}
+	}
+}
+
+
+//! Обучение словарей на первой половине пакетов каждого порта
+/*! Пакеты, на которых учились, из корпуса убираются */
+static std::vector<payload_dictionary> _train(
+		std::map<uint16_t, port_corpus> & corpus, const std::string & directory,
+		size_t dictionary_size, size_t min_samples
+)
+{
+	// Номеров на все порты может не хватить, так что словари получают
+	// порты с самым большим трафиком
+	std::vector<uint16_t> ports;
+	for (const auto & item: corpus)
+	{
+		if (item.second.packets.size() >= min_samples)
+			ports.push_back(item.first);
+	}
+	std::sort(ports.begin(), ports.end(), [&corpus](uint16_t left, uint16_t right) {
+		return corpus[left].bytes > corpus[right].bytes;
+	});
+	if (ports.size() > PC_MAX_DICTIONARIES)
+		ports.resize(PC_MAX_DICTIONARIES);
+
+	std::vector<payload_dictionary> retval;
+	for (const uint16_t port: ports)
+	{
+		auto & packets = corpus[port].packets;
+		const size_t train_count = packets.size() / 2;
+
+		std::string samples;
+		std::vector<size_t> sample_sizes;
+		for (size_t i = 0; i < train_count; i++)
+		{
+			const uint8_t * packet = reinterpret_cast<const uint8_t*>(packets[i].data());
+			const size_t header_size = ipv4_transport_header_size(packet, packets[i].size());
+			samples.append(packets[i], header_size, std::string::npos);
+			sample_sizes.push_back(packets[i].size() - header_size);
+		}
+		packets.erase(packets.begin(), packets.begin() + train_count);
+
+		std::vector<char> dictionary(dictionary_size);
+		const size_t rc = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(),
+				samples.data(), sample_sizes.data(), static_cast<unsigned>(sample_sizes.size()));
+		if (ZDICT_isError(rc))
+		{
+			LOG(warning) << "unable to train dictionary for port " << port << ": " << ZDICT_getErrorName(rc);
+			continue;
+		}
+
+		payload_dictionary entry;
+		entry.index = static_cast<uint8_t>(retval.size());
+		entry.port = port;
+		entry.path = directory + "/port-" + std::to_string(port) + ".zdict";
+		std::ofstream(entry.path, std::ios::binary).write(dictionary.data(), rc);
+		std::printf("trained %s: %zu bytes on %zu packets\n", entry.path.c_str(), rc, train_count);
+		retval.push_back(entry);
+	}
+
+	return retval;
+}
+
+
+static port_result _evaluate(
+		const port_corpus & corpus, packet_pool & pool,
+		payload_compressor & compressor, payload_decompressor & decompressor
+)
+{
+	port_result retval;
+	for (const std::string & original: corpus.packets)
+	{
+		auto buffer = pool.acquire();
+		std::memcpy(buffer->data(), original.data(), original.size());
+		buffer->size = original.size();
+
+		const auto compress_start = std::chrono::steady_clock::now();
+		const int dictionary = compressor.compress(*buffer);
+		const auto compress_end = std::chrono::steady_clock::now();
+		retval.compress_us += std::chrono::duration<double, std::micro>(compress_end - compress_start).count();
+
+		retval.packets++;
+		retval.bytes_in += original.size();
+		if (dictionary < 0)
+		{
+			retval.bytes_out += original.size();
+			continue;
+		}
+
+		retval.compressed++;
+		retval.bytes_out += buffer->size + 1;
+
+		// Распаковка так же, как на приемной стороне: заголовки отдельно
+		uint8_t header[IPV4_HEADER_SIZE + TCP_HEADER_SIZE + TCP_MAX_OPTIONS_SIZE];
+		const size_t header_size = ipv4_transport_header_size(buffer->data(), buffer->size);
+		std::memcpy(header, buffer->data(), header_size);
+		const uint8_t * payload = buffer->data() + header_size;
+		size_t payload_size = buffer->size - header_size;
+
+		const auto decompress_start = std::chrono::steady_clock::now();
+		const bool decompressed = decompressor.decompress(static_cast<uint8_t>(dictionary), header, header_size, payload, payload_size);
+		const auto decompress_end = std::chrono::steady_clock::now();
+		retval.decompress_us += std::chrono::duration<double, std::micro>(decompress_end - decompress_start).count();
+
+		if (!decompressed || header_size + payload_size != original.size()
+				|| 0 != std::memcmp(header, original.data(), header_size)
+				|| 0 != std::memcmp(payload, original.data() + header_size, payload_size))
+		{
+			retval.mismatches++;
+		}
+	}
+
+	return retval;
+}
+
+
+int main(int argc, char ** argv)
+{
+	namespace po = boost::program_options;
+
+	std::vector<std::string> paths;
+	std::vector<std::string> dictionary_specs;
+	std::string train_directory;
+	size_t dictionary_size = 4096;
+	size_t min_samples = 64;
+
+	po::options_description options("server-tun payload compression benchmark");
+	options.add_options()
+		("help,h", "this message")
+		("train", po::value(&train_directory), "train dictionaries into this directory")
+		("dict-size", po::value(&dictionary_size)->default_value(dictionary_size), "trained dictionary size")
+		("min-samples", po::value(&min_samples)->default_value(min_samples),
+				"ports with fewer packets get no dictionary")
+		("dict", po::value(&dictionary_specs)->composing(), "index:port:path, same as server-tun --payload-dict")
+		("logs", po::value(&paths)->multitoken(), "its-broker-log-*.zmq-log files")
+	;
+	// Код возврата 2 - распаковка не вернула исходный пакет
+	po::positional_options_description positional;
+	positional.add("logs", -1);
+
+	po::variables_map vm;
+	po::store(po::command_line_parser(argc, argv).options(options).positional(positional).run(), vm);
+	po::notify(vm);
+	if (vm.count("help") || paths.empty() || (train_directory.empty() == dictionary_specs.empty()))
+	{
+		std::cout << "either --train or --dict is required" << std::endl;
+		std::cout << options << std::endl;
+		return vm.count("help") ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	setenv("ITS_LOG_LEVEL", "warning", 0);
+	setup_log();
+
+	std::map<uint16_t, port_corpus> corpus;
+	_load_logs(paths, corpus);
+	if (corpus.empty())
+	{
+		LOG(error) << "there is no IPE UDP/TCP packets in the logs";
+		return EXIT_FAILURE;
+	}
+
+	std::vector<payload_dictionary> dictionaries;
+	for (const auto & spec: dictionary_specs)
+		dictionaries.push_back(payload_dictionary::parse(spec));
+
+	if (!train_directory.empty())
+		dictionaries = _train(corpus, train_directory, dictionary_size, min_samples);
+
+	payload_compressor compressor(dictionaries);
+	payload_decompressor decompressor(dictionaries);
+	packet_pool pool(0xFFFF, 1);
+
+	std::printf("\n%6s %5s %10s %12s %12s %7s %9s %12s %12s\n", "port", "dict", "packets", "bytes in", "bytes out",
+			"ratio", "fallback", "compress us", "decomp us");
+
+	port_result total;
+	for (const auto & item: corpus)
+	{
+		const auto dictionary = std::find_if(dictionaries.begin(), dictionaries.end(), [&item](const payload_dictionary & entry) {
+			return entry.port == item.first;
+		});
+		if (dictionaries.end() == dictionary || item.second.packets.empty())
+			continue;
+
+		const port_result result = _evaluate(item.second, pool, compressor, decompressor);
+		std::printf("%6u %5d %10zu %12zu %12zu %7.3f %8.1f%% %12.2f %12.2f\n",
+				item.first, dictionary->index, result.packets, result.bytes_in, result.bytes_out,
+				static_cast<double>(result.bytes_out) / result.bytes_in,
+				100.0 * (result.packets - result.compressed) / result.packets,
+				result.compress_us / result.packets,
+				result.compressed ? result.decompress_us / result.compressed : 0.0
+		);
+
+		total.packets += result.packets;
+		total.compressed += result.compressed;
+		total.bytes_in += result.bytes_in;
+		total.bytes_out += result.bytes_out;
+		total.compress_us += result.compress_us;
+		total.decompress_us += result.decompress_us;
+		total.mismatches += result.mismatches;
+	}
+
+	if (0 == total.packets)
+	{
+		LOG(error) << "there is no packets for the dictionaries ports";
+		return EXIT_FAILURE;
+	}
+
+	std::printf("%6s %5s %10zu %12zu %12zu %7.3f %8.1f%% %12.2f %12.2f\n",
+			"total", "", total.packets, total.bytes_in, total.bytes_out,
+			static_cast<double>(total.bytes_out) / total.bytes_in,
+			100.0 * (total.packets - total.compressed) / total.packets,
+			total.compress_us / total.packets,
+			total.compressed ? total.decompress_us / total.compressed : 0.0
+	);
+
+	if (!train_directory.empty())
+	{
+		std::printf("\nserver-tun options:");
+		for (const auto & entry: dictionaries)
+			std::printf(" --payload-dict %d:%u:%s", entry.index, entry.port, entry.path.c_str());
+		std::printf("\n");
+	}
+
+	if (total.mismatches)
+	{
+		std::printf("%zu packets were not restored by decompression\n", total.mismatches);
+		return 2;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,479 @@
+#include "header_compression.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#include "tun_link.hpp"
+#include "ip_header.hpp"
+#include "log.hpp"
+
+
+static auto _slg = build_source("header-compression");
+
+
+// Биты маски полей CO
+#define HC_CO_IP_ID 0x01
+#define HC_CO_TOS 0x02
+#define HC_CO_TTL 0x04
+#define HC_CO_UDP_CHECKSUM 0x08
+#define HC_CO_TCP_WINDOW 0x08
+#define HC_CO_TCP_SEQ_SHIFT 4
+#define HC_CO_TCP_ACK_SHIFT 6
+
+//! Опции TCP такие же, как в IR
+#define HC_CO_TCP_OPTIONS_AS_REF 0xFF
+
+
+//! CRC-8 из ROHC: x^8 + x^2 + x + 1, начальное значение 0xFF
+static uint8_t _crc8(const uint8_t * data, size_t size)
+{
+	uint8_t crc = 0xFF;
+	for (size_t i = 0; i < size; i++)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80) ? static_cast<uint8_t>(crc << 1 ^ 0x07) : static_cast<uint8_t>(crc << 1);
+	}
+
+	return crc;
+}
+
+
+//! Размер сжимаемых заголовков пакета или 0, если пакет не сжимается
+static size_t _compressible_header_size(const uint8_t * packet, size_t size)
+{
+	const size_t header_size = ipv4_transport_header_size(packet, size);
+	if (0 == header_size || IP_PROTO_UDP == packet[9])
+		return header_size;
+
+	// Зарезервированные биты и NS в CO не передаются, как и urgent pointer без URG
+	const uint8_t * l4 = packet + IPV4_HEADER_SIZE;
+	if ((l4[12] & 0x0F) || (!(l4[13] & TCP_FLAG_URG) && 0 != ip_get16(l4 + 18)))
+		return 0;
+
+	return header_size;
+}
+
+
+//! Код размера прибавки seq/ack к значению из IR и сама прибавка в out
+static unsigned _encode_tcp_number(uint32_t value, uint32_t ref, uint8_t *& out)
+{
+	const uint32_t delta = value - ref;
+	if (0 == delta)
+		return 0;
+
+	if (delta <= 0xFF)
+	{
+		*out++ = static_cast<uint8_t>(delta);
+		return 1;
+	}
+
+	if (delta <= 0xFFFF)
+	{
+		ip_put16(out, static_cast<uint16_t>(delta));
+		out += 2;
+		return 2;
+	}
+
+	ip_put32(out, value);
+	out += 4;
+	return 3;
+}
+
+
+header_compressor::header_compressor(unsigned refresh_packets, std::chrono::milliseconds refresh_period)
+	: _refresh_packets(std::min(std::max(refresh_packets, 1U), 255U)), _refresh_period(refresh_period)
+{}
+
+
+bool header_compressor::compress(packet_buffer & buffer, std::chrono::steady_clock::time_point now)
+{
+	const uint8_t * packet = buffer.data();
+	const size_t header_size = _compressible_header_size(packet, buffer.size);
+	if (0 == header_size)
+	{
+		_stats.raw_packets++;
+		return false;
+	}
+
+	flow_key_t key;
+	key.src = ip_get32(packet + 12);
+	key.dst = ip_get32(packet + 16);
+	key.src_port = ip_get16(packet + IPV4_HEADER_SIZE);
+	key.dst_port = ip_get16(packet + IPV4_HEADER_SIZE + 2);
+	key.protocol = packet[9];
+
+	uint8_t cid;
+	context_t & ctx = _context(key, cid);
+	ctx.last_used = ++_packet_counter;
+
+	const uint8_t crc = _crc8(packet, header_size);
+	const bool need_ir = ctx.ir_left > 0
+			|| ctx.msn >= _refresh_packets
+			|| now - ctx.ir_time >= _refresh_period
+			// DF в CO не передается
+			|| (packet[6] & IPV4_FLAG_DF) != (ctx.ref[6] & IPV4_FLAG_DF)
+	;
+
+	_stats.header_bytes_in += header_size;
+	if (need_ir)
+	{
+		// Заголовки остаются как есть, спереди только шим, протокол и CRC
+		uint8_t * const ir = buffer.push_front(3);
+		ir[0] = tun_link_shim(tun_link_type::hc_ir, cid);
+		ir[1] = key.protocol;
+		ir[2] = crc;
+
+		std::memcpy(ctx.ref.data(), buffer.data() + 3, header_size);
+		ctx.ref_size = header_size;
+		ctx.msn = 0;
+		ctx.ir_time = now;
+		if (ctx.ir_left > 0)
+			ctx.ir_left--;
+
+		_stats.ir_packets++;
+		_stats.header_bytes_out += header_size + 3;
+		LOG(trace) << "IR for context " << static_cast<int>(cid);
+		return true;
+	}
+
+	ctx.msn++;
+
+	// CO никогда не длиннее исходных заголовков, так что пишем его на их место
+	std::array<uint8_t, HC_MAX_HEADER_SIZE> co;
+	co[0] = tun_link_shim(tun_link_type::hc_co, cid);
+	co[1] = static_cast<uint8_t>(ctx.msn);
+	co[2] = crc;
+	const size_t co_size = 3 + _encode_co(ctx, packet, header_size, co.data() + 3);
+
+	buffer.pull_front(header_size);
+	std::memcpy(buffer.push_front(co_size), co.data(), co_size);
+
+	_stats.co_packets++;
+	_stats.header_bytes_out += co_size;
+	return true;
+}
+
+
+header_compressor::context_t & header_compressor::_context(const flow_key_t & key, uint8_t & cid)
+{
+	size_t victim = 0;
+	for (size_t i = 0; i < _contexts.size(); i++)
+	{
+		context_t & ctx = _contexts[i];
+		if (ctx.used && ctx.key == key)
+		{
+			cid = static_cast<uint8_t>(i);
+			return ctx;
+		}
+
+		// Свободный контекст или тот, что дольше всех не использовался
+		const context_t & best = _contexts[victim];
+		if (best.used && (!ctx.used || ctx.last_used < best.last_used))
+			victim = i;
+	}
+
+	context_t & ctx = _contexts[victim];
+	if (ctx.used)
+		LOG(debug) << "header compression context " << victim << " is reused for a new flow";
+
+	ctx.used = true;
+	ctx.key = key;
+	ctx.ref_size = 0;
+	ctx.msn = 0;
+	ctx.ir_left = HC_IR_REPEAT;
+	cid = static_cast<uint8_t>(victim);
+	return ctx;
+}
+
+
+size_t header_compressor::_encode_co(const context_t & ctx, const uint8_t * header, size_t header_size,
+		uint8_t * out) const
+{
+	const uint8_t * const ref = ctx.ref.data();
+	uint8_t * const begin = out;
+	uint8_t & mask = *out++;
+	mask = 0;
+
+	const uint16_t ip_id = ip_get16(header + 4);
+	if (ip_id != static_cast<uint16_t>(ip_get16(ref + 4) + ctx.msn))
+	{
+		mask |= HC_CO_IP_ID;
+		ip_put16(out, ip_id);
+		out += 2;
+	}
+
+	if (header[1] != ref[1])
+	{
+		mask |= HC_CO_TOS;
+		*out++ = header[1];
+	}
+
+	if (header[8] != ref[8])
+	{
+		mask |= HC_CO_TTL;
+		*out++ = header[8];
+	}
+
+	const uint8_t * l4 = header + IPV4_HEADER_SIZE;
+	const uint8_t * ref_l4 = ref + IPV4_HEADER_SIZE;
+	if (IP_PROTO_UDP == header[9])
+	{
+		const uint16_t checksum = ip_get16(l4 + 6);
+		if (0 != checksum)
+		{
+			mask |= HC_CO_UDP_CHECKSUM;
+			ip_put16(out, checksum);
+			out += 2;
+		}
+
+		return out - begin;
+	}
+
+	*out++ = l4[13];
+
+	const size_t options_size = header_size - IPV4_HEADER_SIZE - TCP_HEADER_SIZE;
+	const size_t ref_options_size = ctx.ref_size - IPV4_HEADER_SIZE - TCP_HEADER_SIZE;
+	if (0 == options_size)
+	{
+		*out++ = 0;
+	}
+	else if (options_size == ref_options_size
+			&& 0 == std::memcmp(l4 + TCP_HEADER_SIZE, ref_l4 + TCP_HEADER_SIZE, options_size))
+	{
+		*out++ = HC_CO_TCP_OPTIONS_AS_REF;
+	}
+	else
+	{
+		*out++ = static_cast<uint8_t>(options_size);
+		std::memcpy(out, l4 + TCP_HEADER_SIZE, options_size);
+		out += options_size;
+	}
+
+	mask |= _encode_tcp_number(ip_get32(l4 + 4), ip_get32(ref_l4 + 4), out) << HC_CO_TCP_SEQ_SHIFT;
+	mask |= _encode_tcp_number(ip_get32(l4 + 8), ip_get32(ref_l4 + 8), out) << HC_CO_TCP_ACK_SHIFT;
+
+	if (ip_get16(l4 + 14) != ip_get16(ref_l4 + 14))
+	{
+		mask |= HC_CO_TCP_WINDOW;
+		std::memcpy(out, l4 + 14, 2);
+		out += 2;
+	}
+
+	std::memcpy(out, l4 + 16, 2);
+	out += 2;
+
+	if (l4[13] & TCP_FLAG_URG)
+	{
+		std::memcpy(out, l4 + 18, 2);
+		out += 2;
+	}
+
+	return out - begin;
+}
+
+
+//! Чтение полей CO с проверкой выхода за пакет
+struct _co_reader
+{
+	const uint8_t * it;
+	const uint8_t * end;
+	bool ok = true;
+
+	const uint8_t * take(size_t size)
+	{
+		static const uint8_t zeros[4] = {};
+		if (!ok || static_cast<size_t>(end - it) < size)
+		{
+			ok = false;
+			return zeros;
+		}
+
+		const uint8_t * retval = it;
+		it += size;
+		return retval;
+	}
+
+	uint8_t u8() { return *take(1); }
+	uint16_t u16() { return ip_get16(take(2)); }
+	uint32_t u32() { return ip_get32(take(4)); }
+
+	uint32_t tcp_number(unsigned code, uint32_t ref)
+	{
+		switch (code)
+		{
+		case 1: return ref + u8();
+		case 2: return ref + u16();
+		case 3: return u32();
+		default: return ref;
+		}
+	}
+};
+
+
+bool header_decompressor::decompress(const uint8_t * packet, size_t packet_size, hc_header & header,
+		const uint8_t *& payload, size_t & payload_size)
+{
+	if (0 == packet_size)
+	{
+		_stats.malformed_drops++;
+		return false;
+	}
+
+	context_t & ctx = _contexts[tun_link_shim_param(packet[0])];
+	switch (tun_link_shim_type(packet[0]))
+	{
+	case tun_link_type::hc_ir:
+		return _decompress_ir(ctx, packet, packet_size, header, payload, payload_size);
+
+	case tun_link_type::hc_co:
+		return _decompress_co(ctx, packet, packet_size, header, payload, payload_size);
+
+	default:
+		_stats.malformed_drops++;
+		return false;
+	}
+}
+
+
+bool header_decompressor::_decompress_ir(context_t & ctx, const uint8_t * packet, size_t packet_size,
+		hc_header & header, const uint8_t *& payload, size_t & payload_size)
+{
+	if (packet_size < 3)
+	{
+		_stats.malformed_drops++;
+		return false;
+	}
+
+	const uint8_t protocol = packet[1];
+	const uint8_t crc = packet[2];
+	const uint8_t * const ip_packet = packet + 3;
+	const size_t ip_packet_size = packet_size - 3;
+
+	const size_t header_size = _compressible_header_size(ip_packet, ip_packet_size);
+	if (0 == header_size || ip_packet[9] != protocol)
+	{
+		_stats.malformed_drops++;
+		return false;
+	}
+
+	if (_crc8(ip_packet, header_size) != crc)
+	{
+		// Компрессор уже считает, что контекст заведен. Старый тоже не годится
+		ctx.valid = false;
+		_stats.crc_drops++;
+		LOG(warning) << "bad CRC in header compression IR for context "
+				<< static_cast<int>(tun_link_shim_param(packet[0]));
+		return false;
+	}
+
+	if (!ctx.valid)
+		LOG(debug) << "header compression context " << static_cast<int>(tun_link_shim_param(packet[0]))
+				<< " is established";
+
+	std::memcpy(ctx.ref.data(), ip_packet, header_size);
+	ctx.ref_size = header_size;
+	ctx.valid = true;
+
+	std::memcpy(header.data.data(), ip_packet, header_size);
+	header.size = header_size;
+	payload = ip_packet + header_size;
+	payload_size = ip_packet_size - header_size;
+
+	_stats.ir_packets++;
+	return true;
+}
+
+
+bool header_decompressor::_decompress_co(context_t & ctx, const uint8_t * packet, size_t packet_size,
+		hc_header & header, const uint8_t *& payload, size_t & payload_size)
+{
+	if (!ctx.valid)
+	{
+		// Ждем IR
+		_stats.no_context_drops++;
+		return false;
+	}
+
+	_co_reader reader{packet + 1, packet + packet_size};
+	const uint8_t msn = reader.u8();
+	const uint8_t crc = reader.u8();
+	const uint8_t mask = reader.u8();
+
+	const uint8_t * const ref = ctx.ref.data();
+	uint8_t * const h = header.data.data();
+	std::memcpy(h, ref, IPV4_HEADER_SIZE);
+
+	ip_put16(h + 4, (mask & HC_CO_IP_ID) ? reader.u16() : static_cast<uint16_t>(ip_get16(ref + 4) + msn));
+	if (mask & HC_CO_TOS)
+		h[1] = reader.u8();
+	if (mask & HC_CO_TTL)
+		h[8] = reader.u8();
+
+	const uint8_t * ref_l4 = ref + IPV4_HEADER_SIZE;
+	uint8_t * l4 = h + IPV4_HEADER_SIZE;
+	size_t header_size;
+	if (IP_PROTO_UDP == ref[9])
+	{
+		std::memcpy(l4, ref_l4, UDP_HEADER_SIZE);
+		ip_put16(l4 + 6, (mask & HC_CO_UDP_CHECKSUM) ? reader.u16() : 0);
+		header_size = IPV4_HEADER_SIZE + UDP_HEADER_SIZE;
+	}
+	else
+	{
+		std::memcpy(l4, ref_l4, TCP_HEADER_SIZE);
+		l4[13] = reader.u8();
+
+		size_t options_size = reader.u8();
+		if (HC_CO_TCP_OPTIONS_AS_REF == options_size)
+		{
+			options_size = ctx.ref_size - IPV4_HEADER_SIZE - TCP_HEADER_SIZE;
+			std::memcpy(l4 + TCP_HEADER_SIZE, ref_l4 + TCP_HEADER_SIZE, options_size);
+		}
+		else if (options_size > TCP_MAX_OPTIONS_SIZE || options_size % 4)
+		{
+			_stats.malformed_drops++;
+			return false;
+		}
+		else
+		{
+			std::memcpy(l4 + TCP_HEADER_SIZE, reader.take(options_size), reader.ok ? options_size : 0);
+		}
+
+		ip_put32(l4 + 4, reader.tcp_number((mask >> HC_CO_TCP_SEQ_SHIFT) & 0x03, ip_get32(ref_l4 + 4)));
+		ip_put32(l4 + 8, reader.tcp_number((mask >> HC_CO_TCP_ACK_SHIFT) & 0x03, ip_get32(ref_l4 + 8)));
+		if (mask & HC_CO_TCP_WINDOW)
+			ip_put16(l4 + 14, reader.u16());
+
+		ip_put16(l4 + 16, reader.u16());
+		ip_put16(l4 + 18, (l4[13] & TCP_FLAG_URG) ? reader.u16() : 0);
+		l4[12] = static_cast<uint8_t>((TCP_HEADER_SIZE + options_size) / 4 << 4);
+		header_size = IPV4_HEADER_SIZE + TCP_HEADER_SIZE + options_size;
+	}
+
+	payload = reader.it;
+	payload_size = reader.end - reader.it;
+	if (!reader.ok || header_size + payload_size > 0xFFFF)
+	{
+		_stats.malformed_drops++;
+		return false;
+	}
+
+	// Длины и контрольная сумма IP не передаются
+	ipv4_set_payload_size(h, header_size, payload_size);
+
+	if (_crc8(h, header_size) != crc)
+	{
+		// Контекст разошелся с компрессором: потерян IR или пакет побит.
+		// Дальше до следующего IR пакеты этого потока не восстановить
+		ctx.valid = false;
+		_stats.crc_drops++;
+		LOG(warning) << "header compression context " << static_cast<int>(tun_link_shim_param(packet[0]))
+				<< " is out of sync, waiting for IR";
+		return false;
+	}
+
+	header.size = header_size;
+	_stats.co_packets++;
+	return true;
+}
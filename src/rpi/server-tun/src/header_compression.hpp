@@ -0,0 +1,164 @@
+#ifndef ITS_SERVER_TUN_SRC_HEADER_COMPRESSION_HPP_
+#define ITS_SERVER_TUN_SRC_HEADER_COMPRESSION_HPP_
+
+/*! Сжатие заголовков IPv4/UDP и IPv4/TCP на радиоканале
+ *
+ *  По мотивам ROHC (RFC 3095, RFC 6846) в однонаправленном режиме: обратной
+ *  связи от декомпрессора нет, канал теряет пакеты, поэтому
+ *  - компрессор держит до HC_MAX_CONTEXTS потоков (адреса, протокол, порты),
+ *    номер контекста едет в младших битах шима (см. tun_link.hpp);
+ *  - контекст заводится пакетом IR с полными заголовками. Первые HC_IR_REPEAT
+ *    пакетов потока - все IR, дальше IR повторяется каждые refresh_packets пакетов
+ *    или refresh_period времени, смотря что раньше;
+ *  - пакеты CO кодируют заголовки относительно заголовков последнего IR, а не
+ *    предыдущего пакета. Поэтому потеря CO пакетов не сбивает декомпрессор;
+ *  - в каждом CO едет CRC-8 исходных заголовков. Если восстановленные
+ *    заголовки с ним не сходятся, контекст декомпрессора считается разошедшимся,
+ *    и пакеты этого потока выбрасываются до следующего IR.
+ *
+ *  Не сжимается (и идет как есть в IPE): не IPv4, IPv4 с опциями, фрагменты,
+ *  протоколы кроме UDP и TCP, TCP с выставленными зарезервированными битами.
+ *
+ *  Формат IR: шим, протокол (17 или 6), CRC-8, заголовки IP и UDP/TCP как есть, данные.
+ *  Формат CO: шим, MSN (номер пакета от IR), CRC-8, маска полей, поля, данные.
+ *  Поля CO по порядку (есть ли поле - по маске или флагам TCP):
+ *  - IP ID (2, если не равен ID из IR + MSN), TOS (1), TTL (1);
+ *  - UDP: контрольная сумма (2, если не ноль);
+ *  - TCP: флаги (1), опции (байт длины: 0 - нет, 0xFF - как в IR, иначе длина
+ *    и сами опции), seq и ack (0, 1 или 2 байта прибавки к значению из IR или
+ *    4 байта значения), окно (2), контрольная сумма (2), urgent pointer (2, при URG).
+ *  Длины, контрольная сумма IP и смещение данных TCP восстанавливаются.
+ */
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+#include "packet_pool.hpp"
+
+
+//! Сколько потоков сжимается одновременно. Номер контекста - 4 бита шима
+#define HC_MAX_CONTEXTS (16)
+//! Самые большие сжимаемые заголовки: IPv4 без опций и TCP с опциями
+#define HC_MAX_HEADER_SIZE (20 + 60)
+//! Сколько первых пакетов нового потока идут IR, на случай потери первого
+#define HC_IR_REPEAT (3)
+
+
+//! Компрессор заголовков исходящих в радиоканал пакетов
+class header_compressor
+{
+public:
+	struct stats_t
+	{
+		uint64_t ir_packets = 0;
+		uint64_t co_packets = 0;
+		uint64_t raw_packets = 0;
+		//! Сколько байт было в заголовках сжатых пакетов и сколько стало
+		uint64_t header_bytes_in = 0;
+		uint64_t header_bytes_out = 0;
+	};
+
+	//! refresh_packets - через сколько пакетов контекст повторяется IR (не больше 255)
+	header_compressor(unsigned refresh_packets, std::chrono::milliseconds refresh_period);
+
+	//! Сжатие заголовков пакета прямо в буфере
+	/*! Возвращает false, если пакет не сжимается и должен уйти как есть (IPE).
+	 *  Иначе в буфере пакет канального уровня */
+	bool compress(packet_buffer & buffer, std::chrono::steady_clock::time_point now);
+
+	const stats_t & stats() const { return _stats; }
+
+private:
+	struct flow_key_t
+	{
+		uint32_t src;
+		uint32_t dst;
+		uint16_t src_port;
+		uint16_t dst_port;
+		uint8_t protocol;
+
+		bool operator==(const flow_key_t & other) const
+		{
+			return src == other.src && dst == other.dst && src_port == other.src_port
+					&& dst_port == other.dst_port && protocol == other.protocol;
+		}
+	};
+
+	struct context_t
+	{
+		bool used = false;
+		flow_key_t key;
+		//! Заголовки из последнего IR, относительно них кодируются CO
+		std::array<uint8_t, HC_MAX_HEADER_SIZE> ref;
+		size_t ref_size = 0;
+		//! Номер пакета от последнего IR
+		unsigned msn = 0;
+		//! Сколько еще пакетов слать IR, не дожидаясь обновления
+		unsigned ir_left = 0;
+		std::chrono::steady_clock::time_point ir_time;
+		//! Для вытеснения давно молчащих потоков
+		uint64_t last_used = 0;
+	};
+
+	context_t & _context(const flow_key_t & key, uint8_t & cid);
+	size_t _encode_co(const context_t & ctx, const uint8_t * header, size_t header_size, uint8_t * out) const;
+
+	unsigned _refresh_packets;
+	std::chrono::steady_clock::duration _refresh_period;
+	std::array<context_t, HC_MAX_CONTEXTS> _contexts;
+	uint64_t _packet_counter = 0;
+	stats_t _stats;
+};
+
+
+//! Заголовки, восстановленные декомпрессором
+struct hc_header
+{
+	std::array<uint8_t, HC_MAX_HEADER_SIZE> data;
+	size_t size = 0;
+};
+
+
+//! Декомпрессор заголовков пришедших из радиоканала пакетов
+class header_decompressor
+{
+public:
+	struct stats_t
+	{
+		uint64_t ir_packets = 0;
+		uint64_t co_packets = 0;
+		//! Выброшенные пакеты: без контекста, с разошедшимся контекстом, битые
+		uint64_t no_context_drops = 0;
+		uint64_t crc_drops = 0;
+		uint64_t malformed_drops = 0;
+	};
+
+	//! Восстановление заголовков пакета канального уровня hc_ir или hc_co (с шимом)
+	/*! Заголовки восстанавливаются в header, данные за ними не копируются:
+	 *  payload указывает внутрь packet. Возвращает false, если пакет нужно выбросить */
+	bool decompress(const uint8_t * packet, size_t packet_size, hc_header & header,
+			const uint8_t *& payload, size_t & payload_size);
+
+	const stats_t & stats() const { return _stats; }
+
+private:
+	struct context_t
+	{
+		bool valid = false;
+		std::array<uint8_t, HC_MAX_HEADER_SIZE> ref;
+		size_t ref_size = 0;
+	};
+
+	bool _decompress_ir(context_t & ctx, const uint8_t * packet, size_t packet_size, hc_header & header,
+			const uint8_t *& payload, size_t & payload_size);
+	bool _decompress_co(context_t & ctx, const uint8_t * packet, size_t packet_size, hc_header & header,
+			const uint8_t *& payload, size_t & payload_size);
+
+	std::array<context_t, HC_MAX_CONTEXTS> _contexts;
+	stats_t _stats;
+};
+
+
+#endif /* ITS_SERVER_TUN_SRC_HEADER_COMPRESSION_HPP_ */
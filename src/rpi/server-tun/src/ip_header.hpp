@@ -0,0 +1,114 @@
+#ifndef ITS_SERVER_TUN_SRC_IP_HEADER_HPP_
+#define ITS_SERVER_TUN_SRC_IP_HEADER_HPP_
+
+/*! Разбор и правка заголовков IPv4/UDP/TCP для сжатия на радиоканале */
+
+#include <cstdint>
+#include <cstddef>
+
+
+#define IPV4_HEADER_SIZE 20
+#define UDP_HEADER_SIZE 8
+#define TCP_HEADER_SIZE 20
+#define TCP_MAX_OPTIONS_SIZE 40
+
+#define IP_PROTO_TCP 6
+#define IP_PROTO_UDP 17
+
+//! Все флаги и смещение фрагмента IPv4, кроме DF
+#define IPV4_FRAGMENT_MASK 0xBFFF
+#define IPV4_FLAG_DF 0x40
+#define TCP_FLAG_URG 0x20
+
+
+inline uint16_t ip_get16(const uint8_t * p)
+{
+	return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+
+inline uint32_t ip_get32(const uint8_t * p)
+{
+	return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16
+			| static_cast<uint32_t>(p[2]) << 8 | p[3];
+}
+
+
+inline void ip_put16(uint8_t * p, uint16_t value)
+{
+	p[0] = static_cast<uint8_t>(value >> 8);
+	p[1] = static_cast<uint8_t>(value);
+}
+
+
+inline void ip_put32(uint8_t * p, uint32_t value)
+{
+	ip_put16(p, static_cast<uint16_t>(value >> 16));
+	ip_put16(p + 2, static_cast<uint16_t>(value));
+}
+
+
+//! Контрольная сумма заголовка IPv4 без опций (поле самой суммы не учитывается)
+inline uint16_t ipv4_checksum(const uint8_t * header)
+{
+	uint32_t sum = 0;
+	for (size_t i = 0; i < IPV4_HEADER_SIZE; i += 2)
+	{
+		if (10 != i)
+			sum += ip_get16(header + i);
+	}
+
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return static_cast<uint16_t>(~sum);
+}
+
+
+//! Размер заголовков IPv4 и UDP/TCP пакета или 0, если пакет не такой
+/*! Подходят только целые пакеты: IPv4 без опций, не фрагменты, длины в заголовках
+ *  сходятся с размером пакета */
+inline size_t ipv4_transport_header_size(const uint8_t * packet, size_t size)
+{
+	if (size < IPV4_HEADER_SIZE || 0x45 != packet[0])
+		return 0;
+
+	if (ip_get16(packet + 2) != size || (ip_get16(packet + 6) & IPV4_FRAGMENT_MASK))
+		return 0;
+
+	const uint8_t * l4 = packet + IPV4_HEADER_SIZE;
+	const size_t l4_size = size - IPV4_HEADER_SIZE;
+	if (IP_PROTO_UDP == packet[9])
+	{
+		if (l4_size < UDP_HEADER_SIZE || ip_get16(l4 + 4) != l4_size)
+			return 0;
+
+		return IPV4_HEADER_SIZE + UDP_HEADER_SIZE;
+	}
+	else if (IP_PROTO_TCP == packet[9])
+	{
+		if (l4_size < TCP_HEADER_SIZE)
+			return 0;
+
+		const size_t tcp_header_size = (l4[12] >> 4) * 4;
+		if (tcp_header_size < TCP_HEADER_SIZE || tcp_header_size > l4_size)
+			return 0;
+
+		return IPV4_HEADER_SIZE + tcp_header_size;
+	}
+
+	return 0;
+}
+
+
+//! Правка длин в заголовках после замены данных пакета на данные размера payload_size
+inline void ipv4_set_payload_size(uint8_t * header, size_t header_size, size_t payload_size)
+{
+	ip_put16(header + 2, static_cast<uint16_t>(header_size + payload_size));
+	ip_put16(header + 10, ipv4_checksum(header));
+	if (IP_PROTO_UDP == header[9])
+		ip_put16(header + IPV4_HEADER_SIZE + 4, static_cast<uint16_t>(header_size - IPV4_HEADER_SIZE + payload_size));
+}
+
+
+#endif /* ITS_SERVER_TUN_SRC_IP_HEADER_HPP_ */
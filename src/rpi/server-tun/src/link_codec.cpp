@@ -0,0 +1,125 @@
+#include "link_codec.hpp"
+
+#include <cstring>
+
+#include "ip_header.hpp"
+#include "tun_link.hpp"
+#include "log.hpp"
+
+
+static auto _slg = build_source("link-codec");
+
+
+link_encoder::link_encoder(std::unique_ptr<payload_compressor> payloads, std::unique_ptr<header_compressor> headers)
+	: _payloads(std::move(payloads)), _headers(std::move(headers))
+{}
+
+
+int link_encoder::encode(packet_buffer & buffer, std::chrono::steady_clock::time_point now)
+{
+	const int dictionary = _payloads ? _payloads->compress(buffer) : -1;
+	const bool headers_compressed = _headers && _headers->compress(buffer, now);
+	if (dictionary >= 0)
+		*buffer.push_front(1) = tun_link_shim(tun_link_type::pc, static_cast<uint8_t>(dictionary));
+
+	if (dictionary >= 0 || headers_compressed)
+		return TUN_LINK_EPP_PROTOCOL_ID;
+
+	return TUN_IPE_EPP_PROTOCOL_ID;
+}
+
+
+void link_encoder::log_stats() const
+{
+	if (_payloads)
+	{
+		const auto & stats = _payloads->stats();
+		LOG(info) << "payload compressor: " << stats.compressed_packets << " compressed, "
+				<< stats.fallback_packets << " not worth it, " << stats.raw_packets << " raw packets, payloads "
+				<< stats.payload_bytes_in << " -> " << stats.payload_bytes_out << " bytes";
+	}
+
+	if (_headers)
+	{
+		const auto & stats = _headers->stats();
+		LOG(info) << "header compressor: " << stats.ir_packets << " IR, " << stats.co_packets << " CO, "
+				<< stats.raw_packets << " raw packets, headers "
+				<< stats.header_bytes_in << " -> " << stats.header_bytes_out << " bytes";
+	}
+}
+
+
+link_decoder::link_decoder(std::unique_ptr<payload_decompressor> payloads)
+	: _payloads(std::move(payloads))
+{}
+
+
+bool link_decoder::decode(const uint8_t * data, size_t size, link_ip_packet & packet)
+{
+	int dictionary = -1;
+	if (size > 0 && tun_link_type::pc == tun_link_shim_type(data[0]))
+	{
+		dictionary = tun_link_shim_param(data[0]);
+		data++;
+		size--;
+	}
+
+	const tun_link_type type = size > 0 ? tun_link_shim_type(data[0]) : tun_link_type::pc;
+	if (tun_link_type::hc_ir == type || tun_link_type::hc_co == type)
+	{
+		if (!_headers.decompress(data, size, packet.header, packet.payload, packet.payload_size))
+		{
+			LOG(debug) << "link packet is dropped by header decompressor";
+			return false;
+		}
+	}
+	else
+	{
+		// Без сжатых заголовков за шимом сжатия данных идет обычный IP пакет
+		const size_t header_size = dictionary >= 0 ? ipv4_transport_header_size(data, size) : 0;
+		if (0 == header_size || header_size > packet.header.data.size())
+		{
+			_malformed_drops++;
+			LOG(warning) << "got malformed link packet of " << size << " bytes";
+			return false;
+		}
+
+		std::memcpy(packet.header.data.data(), data, header_size);
+		packet.header.size = header_size;
+		packet.payload = data + header_size;
+		packet.payload_size = size - header_size;
+	}
+
+	if (dictionary < 0)
+		return true;
+
+	if (!_payloads)
+	{
+		_malformed_drops++;
+		LOG(warning) << "got compressed payload, but there are no payload dictionaries";
+		return false;
+	}
+
+	return _payloads->decompress(static_cast<uint8_t>(dictionary), packet.header.data.data(), packet.header.size,
+			packet.payload, packet.payload_size);
+}
+
+
+void link_decoder::log_stats() const
+{
+	const auto & header_stats = _headers.stats();
+	LOG(info) << "header decompressor: " << header_stats.ir_packets << " IR, " << header_stats.co_packets << " CO, "
+			<< "dropped " << header_stats.no_context_drops << " without context, "
+			<< header_stats.crc_drops << " on CRC, " << header_stats.malformed_drops << " malformed";
+
+	if (_payloads)
+	{
+		const auto & payload_stats = _payloads->stats();
+		LOG(info) << "payload decompressor: " << payload_stats.packets << " packets, dropped "
+				<< payload_stats.unknown_dictionary_drops << " with unknown dictionary, "
+				<< payload_stats.malformed_drops << " malformed";
+	}
+
+	if (_malformed_drops)
+		LOG(info) << "link decoder: dropped " << _malformed_drops << " malformed packets";
+}
@@ -0,0 +1,70 @@
+#ifndef ITS_SERVER_TUN_SRC_LINK_CODEC_HPP_
+#define ITS_SERVER_TUN_SRC_LINK_CODEC_HPP_
+
+/*! Сборка и разбор пакетов канального уровня (см. tun_link.hpp)
+ *
+ *  При отправке сначала сжимаются данные, потом заголовки уже поправленного
+ *  пакета, и последним ставится шим сжатия данных. При приеме все в обратном
+ *  порядке. Любой из шагов может быть выключен.
+ */
+
+#include <chrono>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include "packet_pool.hpp"
+#include "header_compression.hpp"
+#include "payload_compression.hpp"
+
+
+//! Восстановленный IP пакет: заголовки отдельно, данные - куда-то в сообщение
+//! или в буфер распаковщика
+struct link_ip_packet
+{
+	hc_header header;
+	const uint8_t * payload = nullptr;
+	size_t payload_size = 0;
+};
+
+
+//! Отправляющая сторона канального уровня
+class link_encoder
+{
+public:
+	//! Пустой компрессор - этот шаг выключен
+	link_encoder(std::unique_ptr<payload_compressor> payloads, std::unique_ptr<header_compressor> headers);
+
+	//! Обработка прочитанного из туннеля пакета прямо в буфере
+	/*! Возвращает EPP протокол, с которым его нужно отправить */
+	int encode(packet_buffer & buffer, std::chrono::steady_clock::time_point now);
+
+	void log_stats() const;
+
+private:
+	std::unique_ptr<payload_compressor> _payloads;
+	std::unique_ptr<header_compressor> _headers;
+};
+
+
+//! Принимающая сторона канального уровня
+class link_decoder
+{
+public:
+	//! Без распаковщика данных пакеты со сжатыми данными выбрасываются
+	explicit link_decoder(std::unique_ptr<payload_decompressor> payloads);
+
+	//! Восстановление IP пакета из пакета с протоколом TUN_LINK_EPP_PROTOCOL_ID
+	/*! Возвращает false, если пакет нужно выбросить */
+	bool decode(const uint8_t * data, size_t size, link_ip_packet & packet);
+
+	void log_stats() const;
+
+private:
+	std::unique_ptr<payload_decompressor> _payloads;
+	header_decompressor _headers;
+	uint64_t _malformed_drops = 0;
+};
+
+
+#endif /* ITS_SERVER_TUN_SRC_LINK_CODEC_HPP_ */
@@ -12,12 +12,15 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/date_time/posix_time/posix_time_io.hpp>
 #include <boost/log/sinks/sync_frontend.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
 #include <boost/log/sinks/text_ostream_backend.hpp>
 #include <boost/log/attributes/clock.hpp>
 #include <boost/log/utility/setup/common_attributes.hpp>
 #include <boost/log/attributes/clock.hpp>
 #include <boost/log/core/core.hpp>
 
+#include "log_queue.hpp"
+
 
 namespace logging = boost::log;
 namespace sinks = boost::log::sinks;
@@ -27,6 +30,18 @@ namespace attrs = boost::log::attributes;
 namespace keywords = boost::log::keywords;
 
 
+// Емкость очереди асинхронного лога (в записях), степень двойки
+#define ITS_LOG_QUEUE_CAPACITY 4096
+
+
+typedef sinks::text_ostream_backend backend_t;
+typedef sinks::synchronous_sink<backend_t> sync_sink_t;
+typedef sinks::asynchronous_sink<backend_t, log_ring_queue<ITS_LOG_QUEUE_CAPACITY>> async_sink_t;
+
+//! Синк асинхронного лога, если лог работает через него
+static boost::shared_ptr<async_sink_t> _async_sink;
+
+
 std::ostream & operator << (std::ostream & stream, severity_level level_)
 {
 	const char * strings[] = {
@@ -143,19 +158,43 @@ void setup_log()
 	auto core = logging::core::get();
 	core->add_global_attribute("Timestamp", attrs::local_clock());
 
-	typedef sinks::synchronous_sink<sinks::text_ostream_backend> text_sink;
-	boost::shared_ptr<text_sink> sink = boost::make_shared<text_sink>();
-
+	boost::shared_ptr<backend_t> backend = boost::make_shared<backend_t>();
 	boost::shared_ptr<std::ostream> cout_ptr(&std::cout, [](std::ostream*){});
-	sink->locked_backend()->add_stream(cout_ptr);
-	sink->locked_backend()->auto_flush(true);
+	backend->add_stream(cout_ptr);
 
 	formatter_t formatter;
 	if (isatty(1)) // 0 stdint, 1 stdout, 2 stderr/stdlog
 		formatter.enable_shell_color = true;
 
-	sink->set_formatter(std::move(formatter));
-	core->add_sink(sink); // @suppress("Invalid arguments")
+	bool async = true;
+	const char * env_async = std::getenv("ITS_LOG_ASYNC");
+	if (nullptr != env_async)
+		async = std::atoi(env_async) != 0;
+
+	if (async)
+	{
+		// Записи форматируются и пишутся в потоке синка, а в поток вывода
+		// сбрасываются пачкой, когда очередь опустеет
+		backend->auto_flush(false);
+		_async_sink = boost::make_shared<async_sink_t>(backend);
+		_async_sink->set_formatter(std::move(formatter));
+
+		const char * env_overflow = std::getenv("ITS_LOG_OVERFLOW");
+		_async_sink->drop_on_overflow(nullptr == env_overflow || std::string(env_overflow) != "block");
+
+		async_sink_t * sink = _async_sink.get();
+		_async_sink->idle_handler([sink]() { sink->locked_backend()->flush(); });
+
+		core->add_sink(_async_sink); // @suppress("Invalid arguments")
+		std::atexit(shutdown_log);
+	}
+	else
+	{
+		backend->auto_flush(true);
+		boost::shared_ptr<sync_sink_t> sink = boost::make_shared<sync_sink_t>(backend);
+		sink->set_formatter(std::move(formatter));
+		core->add_sink(sink); // @suppress("Invalid arguments")
+	}
 
 
 	severity_level level = severity_level::info;
@@ -167,6 +206,7 @@ void setup_log()
 			level = candidate;
 	}
 
+	log_min_level.store(level);
 	auto filterer = [level](const boost::log::attribute_value_set & attrs)->bool {
 		const auto record_level = logging::extract<severity_level>("Severity", attrs);
 		return record_level >= level;
@@ -176,6 +216,29 @@ void setup_log()
 }
 
 
+void shutdown_log()
+{
+	if (!_async_sink)
+		return;
+
+	logging::core::get()->remove_sink(_async_sink);
+	_async_sink->stop();
+	_async_sink->flush();
+
+	const uint64_t dropped = _async_sink->dropped_records();
+	if (dropped)
+		std::cout << "[log] <warning> " << dropped << " log records were dropped on queue overflow" << std::endl;
+
+	_async_sink.reset();
+}
+
+
+uint64_t log_dropped_records()
+{
+	return _async_sink ? _async_sink->dropped_records() : 0;
+}
+
+
 source_t build_source(std::string channel_name)
 {
 	source_t retval;
@@ -2,6 +2,8 @@
 #define ITS_SERVER_USLP_SRC_LOG_HPP_
 
 
+#include <atomic>
+#include <cstdint>
 #include <ostream>
 #include <istream>
 
@@ -12,7 +14,12 @@
 #include <boost/log/expressions/keyword.hpp>
 
 
-#define LOG(level) BOOST_LOG_SEV(_slg, severity_level::level)
+// Уровень проверяется до того, как Boost.Log начнет собирать запись,
+// так что отфильтрованные записи не стоят ничего кроме сравнения
+#define LOG(level) \
+	for (bool _log_enabled = severity_level::level >= log_min_level.load(std::memory_order_relaxed); \
+			_log_enabled; _log_enabled = false) \
+		BOOST_LOG_SEV(_slg, severity_level::level)
 
 
 enum class severity_level
@@ -27,6 +34,10 @@ enum class severity_level
 };
 
 
+//! Минимальный уровень записей, которые попадают в лог (ITS_LOG_LEVEL)
+inline std::atomic<severity_level> log_min_level = {severity_level::info};
+
+
 BOOST_LOG_ATTRIBUTE_KEYWORD(severity, "Severity", severity_level);
 
 
@@ -41,6 +52,11 @@ source_t build_source(std::string channel_name);
 
 
 void setup_log();
+//! Дописать то, что осталось в очереди лога, и остановить его поток
+/*! Вызывается сама при выходе из программы, но не при аварийном завершении */
+void shutdown_log();
+//! Сколько записей лога было выкинуто из-за переполнения очереди
+uint64_t log_dropped_records();
 
 
 #endif /* ITS_SERVER_USLP_SRC_LOG_HPP_ */
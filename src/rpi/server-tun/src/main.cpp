@@ -1,13 +1,21 @@
 #include <iostream>
 #include <array>
+#include <vector>
+#include <algorithm>
 #include <tuple>
+#include <memory>
+#include <chrono>
 
 #include <unistd.h>
 
 #include <boost/program_options.hpp>
 
+#include <its_reactor.hpp>
+
 #include "tun_device.hpp"
 #include "zmq_server.hpp"
+#include "link_codec.hpp"
+#include "packet_aggregator.hpp"
 
 #include "log.hpp"
 
@@ -15,6 +23,16 @@ static auto _slg = build_source("main");
 
 
 #define TUN_BUFFER_SIZE 1500
+//! Сколько пакетов из туннеля читается за одно пробуждение
+#define TUN_READ_BATCH 64
+//! Сколько свободных буферов пакетов держит пул. Примерно столько сообщений
+//! может стоять в очереди PUB сокета до его SNDHWM
+#define TUN_POOL_CACHED_BUFFERS 1024
+//! Как часто писать в лог статистику сжатия
+#define TUN_LINK_STATS_PERIOD std::chrono::minutes(1)
+//! Сколько байт кадра USLP занимают его заголовки и EPP заголовок сборки.
+//! Сборка набирается до размера кадра без них, чтобы уместиться в один кадр
+#define TUN_AGGREGATE_FRAME_OVERHEAD 24
 
 
 static std::string split_cidr_addr(const std::string & input)
@@ -70,71 +88,137 @@ static std::tuple<int, int, int> split_channel_id(const std::string & input)
 }
 
 
-static void loop(zmq_server & server, tun_device & tun)
+//! Пакеты, прочитанные из туннеля за одно пробуждение
+/*! Пакеты читаются сразу в буферы пула с запасом под EPP заголовок.
+ *  Отправленные буферы уходят в zmq и возвращаются в пул, когда тот их отправит */
+struct uplink_batch
 {
-	const auto tun_fd = tun.fd();
-	const auto & sub_socket = server.bpcs_socket();
+	uplink_batch(size_t packet_capacity)
+		: pool(packet_capacity, TUN_POOL_CACHED_BUFFERS), packets(TUN_READ_BATCH)
+	{
+		outgoing.reserve(TUN_READ_BATCH + 1);
+	}
 
-	std::array<zmq::pollitem_t, 2> poll_items{{
-			{ nullptr, tun_fd , ZMQ_POLLIN, 0 },
-			{ const_cast<void*>(sub_socket.handle()), 0, ZMQ_POLLIN, 0 }
-	}};
+	packet_pool pool;
+	std::vector<uplink_packet> packets;
+
+	//! Сборка мелких пакетов, если она включена
+	std::unique_ptr<packet_aggregator> aggregator;
+	//! SDU после сборщика
+	std::vector<uplink_packet> outgoing;
+	//! На когда взведен таймер отправки недобранной сборки
+	std::chrono::steady_clock::time_point armed_deadline;
+};
 
-	LOG(trace) << "entering poll cycle";
-	int rc = zmq::poll(poll_items, std::chrono::milliseconds(500));
-	if (0 == rc)
-		return;
 
-	if (poll_items[0].revents & ZMQ_POLLIN)
+static void on_tun_readable(zmq_server & server, tun_device & tun, uplink_batch & batch,
+		link_encoder & encoder)
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	// Что-то пришло с туннеля. Выгребаем все, что накопилось, но не больше пачки,
+	// чтобы шина тоже успевала. Остальное epoll отдаст сразу же следующим пробуждением
+	size_t count = 0;
+	while (count < batch.packets.size())
 	{
-		// Что-то пришло с туннеля
-		LOG(debug) << "got event from tun device";
-
-		std::vector<uint8_t> tun_buffer(1500);
-		const size_t readed = tun.read_packet(tun_buffer.data(), tun_buffer.size());
-		if (readed > tun_buffer.size())
-			LOG(error) << "tun device provided larger packet that we can handle";
-
-		tun_buffer.resize(readed);
-		uint16_t flags = 0;
-		uint16_t proto = 0;
-		/*
-		if (readed >= 4)
-		{
-			// Выгребаем информацию о пакете
-			std::memcpy(&flags, tun_buffer.data(), sizeof(flags));
-			std::memcpy(&proto, tun_buffer.data()+2, sizeof(proto));
-			tun_buffer.erase(tun_buffer.begin(), tun_buffer.begin()+4);
-		}
-		else
-			LOG_S(ERROR) << "tun device provided less than 4 bytes, there is no PI";
-		*/
-		LOG(debug) << "there is a tun packet of size "
-				<< tun_buffer.size() << ", "
-				// << "proto " << proto << ","
-				// << "flags " << flags
-		;
-		uplink_packet message;
-		message.data = std::move(tun_buffer);
-		message.proto = proto;
-		message.flags = flags;
-		server.send_uplink_packet(message);
+		uplink_packet & packet = batch.packets[count];
+		// Буфер остается в пакете, если в прошлый раз в него ничего не прочлось
+		if (!packet.buffer)
+			packet.buffer = batch.pool.acquire();
+
+		packet_buffer & buffer = *packet.buffer;
+		if (!tun.try_read_packet(buffer.data(), buffer.capacity(), buffer.size))
+			break;
+
+		packet.proto = 0;
+		packet.flags = 0;
+		// Между чтением и EPP заголовком - сжатие, если оно включено
+		packet.epp_protocol_id = encoder.encode(buffer, now);
+
+		count++;
 	}
 
-	if (poll_items[1].revents & ZMQ_POLLIN)
+	LOG(debug) << "got " << count << " packets from tun device";
+	if (!batch.aggregator)
 	{
-		// Что-то пришло с шины
-		LOG(debug) << "got event from bus";
+		server.send_uplink_packets(batch.packets.data(), count);
+		return;
+	}
+
+	batch.outgoing.clear();
+	for (size_t i = 0; i < count; i++)
+		batch.aggregator->push(batch.packets[i], now, batch.outgoing);
+
+	server.send_uplink_packets(batch.outgoing.data(), batch.outgoing.size());
+}
+
+
+static void arm_aggregation_timer(reactor & events, int timer, uplink_batch & batch)
+{
+	// Таймер всегда взведен на срок текущей сборки. Если та уже ушла целиком,
+	// он сработает впустую
+	const packet_aggregator & aggregator = *batch.aggregator;
+	if (!aggregator.pending() || aggregator.deadline() == batch.armed_deadline)
+		return;
+
+	batch.armed_deadline = aggregator.deadline();
+	const auto delay = std::chrono::duration_cast<std::chrono::microseconds>(
+			batch.armed_deadline - std::chrono::steady_clock::now());
+	// Нулевая задержка таймер останавливает
+	events.set_timer(timer, std::max(delay, std::chrono::microseconds(1)), std::chrono::microseconds(0));
+}
+
+
+static void on_aggregation_timeout(zmq_server & server, uplink_batch & batch)
+{
+	packet_aggregator & aggregator = *batch.aggregator;
+	if (!aggregator.pending() || aggregator.deadline() > std::chrono::steady_clock::now())
+		return;
+
+	batch.outgoing.clear();
+	aggregator.flush(batch.outgoing);
+	server.send_uplink_packets(batch.outgoing.data(), batch.outgoing.size());
+}
+
+
+static void log_aggregation_stats(const packet_aggregator & aggregator)
+{
+	const auto & stats = aggregator.stats();
+	LOG(info) << "aggregator: " << stats.packets << " packets in " << stats.sdus << " SDUs, "
+			<< stats.aggregated_packets << " of them in " << stats.aggregated_sdus << " aggregated SDUs";
+}
+
 
-		downlink_packet message;
-		server.recv_downlink_packet(message);
-		if (message.bad)
+static void on_bus_message(zmq_server & server, tun_device & tun, link_decoder & decoder, downlink_packet & message)
+{
+	// Что-то пришло с шины
+	LOG(debug) << "got event from bus";
+
+	server.recv_downlink_packet(message);
+	if (message.bad)
+	{
+		LOG(debug) << "message is bad";
+		return;
+	}
+
+	// Сборки сервер уже разобрал на пакеты
+	for (const downlink_part & part: message.parts)
+	{
+		if (TUN_IPE_EPP_PROTOCOL_ID == part.epp_protocol_id)
+		{
+			tun.write_packet(part.data, part.size);
+		}
+		else if (TUN_LINK_EPP_PROTOCOL_ID == part.epp_protocol_id)
 		{
-			LOG(debug) << "message is bad";
+			// Заголовки восстанавливаются отдельно, данные пишутся прямо из сообщения
+			// или из буфера распаковщика
+			link_ip_packet packet;
+			if (decoder.decode(part.data, part.size, packet))
+				tun.write_packet(packet.header.data.data(), packet.header.size, packet.payload, packet.payload_size);
 		}
 		else
 		{
-			tun.write_packet(message.data.data(), message.data.size());
+			LOG(warning) << "unexpected EPP protocol id " << part.epp_protocol_id;
 		}
 	}
 }
@@ -150,11 +234,19 @@ int main(int argc, char ** argv)
 	std::string downlink_channel = "66.0.1";
 	std::string tun_addr = "10.0.0.1/24";
 	int tun_mtu = 200;
+	bool compress_headers = false;
+	unsigned hc_refresh_packets = 32;
+	unsigned hc_refresh_ms = 2000;
+	std::vector<std::string> payload_dictionary_specs;
+	bool aggregate = false;
+	unsigned aggregate_hold_ms = 10;
+	unsigned frame_size = 200;
 	// Эти допарсим сами
 	std::string tun_ip;
 	int tun_mask;
 	int uplink_sc, uplink_vc, uplink_map;
 	int downlink_sc, downlink_vc, downlink_map;
+	std::vector<payload_dictionary> payload_dictionaries;
 
 	try
 	{
@@ -166,6 +258,13 @@ int main(int argc, char ** argv)
 				("down-channel", po::value(&downlink_channel)->default_value(downlink_channel))
 				("addr", po::value(&tun_addr)->default_value(tun_addr))
 				("mtu", po::value(&tun_mtu)->default_value(tun_mtu))
+				("compress-headers", po::value(&compress_headers)->default_value(compress_headers)->implicit_value(true))
+				("hc-refresh-packets", po::value(&hc_refresh_packets)->default_value(hc_refresh_packets))
+				("hc-refresh-ms", po::value(&hc_refresh_ms)->default_value(hc_refresh_ms))
+				("payload-dict", po::value(&payload_dictionary_specs)->composing(), "index:port:path")
+				("aggregate", po::value(&aggregate)->default_value(aggregate)->implicit_value(true))
+				("aggregate-hold-ms", po::value(&aggregate_hold_ms)->default_value(aggregate_hold_ms))
+				("frame-size", po::value(&frame_size)->default_value(frame_size), "uplink USLP frame size")
 				("help", po::value<bool>()->implicit_value(true))
 		;
 
@@ -203,6 +302,12 @@ int main(int argc, char ** argv)
 		{
 			throw std::runtime_error("bad downlink channel \"" + std::string(e.what()) + "\"");
 		}
+
+		for (const std::string & spec: payload_dictionary_specs)
+			payload_dictionaries.push_back(payload_dictionary::parse(spec));
+
+		if (aggregate && frame_size <= TUN_AGGREGATE_FRAME_OVERHEAD)
+			throw std::invalid_argument("frame size is too small for aggregation");
 	}
 	catch (std::exception & e)
 	{
@@ -233,6 +338,7 @@ int main(int argc, char ** argv)
 		tun.set_ip(tun_ip, tun_mask);
 		tun.set_mtu(tun_mtu);
 		tun.set_up(true);
+		tun.set_nonblocking(true);
 	}
 	catch (std::exception & e)
 	{
@@ -240,11 +346,85 @@ int main(int argc, char ** argv)
 		return EXIT_FAILURE;
 	}
 
+	// Туннель и шину ждем в одном epoll. Сообщения шины реактор отдает,
+	// пока они есть в сокете, а не по одному на пробуждение
+	uplink_batch batch(std::max<size_t>(TUN_BUFFER_SIZE, tun_mtu));
+	// Разжимать заголовки умеем всегда, а сжимать - только если попросили,
+	// чтобы не сломать связь со старым server-tun на другой стороне.
+	// Данные сжимаются и разжимаются, если на обеих сторонах заданы словари
+	std::unique_ptr<header_compressor> headers;
+	std::unique_ptr<payload_compressor> payloads;
+	std::unique_ptr<payload_decompressor> payloads_decompressor;
+	try
+	{
+		if (compress_headers)
+		{
+			LOG(info) << "compressing headers, refresh every " << hc_refresh_packets << " packets "
+					<< "or " << hc_refresh_ms << " ms";
+			headers.reset(new header_compressor(hc_refresh_packets, std::chrono::milliseconds(hc_refresh_ms)));
+		}
+
+		if (!payload_dictionaries.empty())
+		{
+			payloads.reset(new payload_compressor(payload_dictionaries));
+			payloads_decompressor.reset(new payload_decompressor(payload_dictionaries));
+		}
+	}
+	catch (std::exception & e)
+	{
+		LOG(error) << "unable to setup compression: " << e.what();
+		return EXIT_FAILURE;
+	}
+	link_encoder encoder(std::move(payloads), std::move(headers));
+	link_decoder decoder(std::move(payloads_decompressor));
+	downlink_packet downlink_message;
+
+	// Сборки, как и сжатие, только по просьбе: старый server-tun их не разберет
+	if (aggregate)
+	{
+		const size_t target_size = frame_size - TUN_AGGREGATE_FRAME_OVERHEAD;
+		LOG(info) << "aggregating packets up to " << target_size << " bytes, "
+				<< "holding them up to " << aggregate_hold_ms << " ms";
+		batch.aggregator.reset(new packet_aggregator(batch.pool, target_size, std::chrono::milliseconds(aggregate_hold_ms)));
+	}
+
+	reactor events;
+	int hold_timer = -1;
+	try
+	{
+		hold_timer = events.add_timer([&events, &hold_timer, &server, &batch]() {
+			on_aggregation_timeout(server, batch);
+			arm_aggregation_timer(events, hold_timer, batch);
+		});
+		events.add_fd(tun.fd(), EPOLLIN, [&events, &hold_timer, &server, &tun, &batch, &encoder](int, uint32_t) {
+			on_tun_readable(server, tun, batch, encoder);
+			if (batch.aggregator)
+				arm_aggregation_timer(events, hold_timer, batch);
+		});
+		events.add_zmq(server.bpcs_socket().handle(), [&server, &tun, &decoder, &downlink_message]() {
+			on_bus_message(server, tun, decoder, downlink_message);
+		});
+
+		const int stats_timer = events.add_timer([&encoder, &decoder, &batch]() {
+			encoder.log_stats();
+			decoder.log_stats();
+			if (batch.aggregator)
+				log_aggregation_stats(*batch.aggregator);
+		});
+		events.set_timer(stats_timer, TUN_LINK_STATS_PERIOD, TUN_LINK_STATS_PERIOD);
+	}
+	catch (std::exception & e)
+	{
+		LOG(error) << "unable to setup event loop: " << e.what();
+		return EXIT_FAILURE;
+	}
+
 	while(1)
 	{
 		try
 		{
-			loop(server, tun);
+			LOG(trace) << "entering poll cycle";
+			events.run_once(std::chrono::milliseconds(500));
 		}
 		catch (std::exception & e)
 		{
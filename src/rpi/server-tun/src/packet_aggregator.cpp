@@ -0,0 +1,94 @@
+#include "packet_aggregator.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "tun_link.hpp"
+
+
+//! Если в сборке осталось меньше места, ждать еще пакетов нет смысла:
+//! длина и самый короткий пакет со сжатыми заголовками
+#define AG_MIN_ENTRY_SIZE (8)
+
+
+packet_aggregator::packet_aggregator(packet_pool & pool, size_t target_size, clock::duration hold)
+	: _pool(pool), _target_size(target_size), _hold(hold)
+{
+	if (target_size > TUN_LINK_MAX_AGGREGATED_SIZE)
+		throw std::invalid_argument("aggregated SDU size is too large");
+}
+
+
+void packet_aggregator::push(uplink_packet & packet, clock::time_point now, std::vector<uplink_packet> & output)
+{
+	_stats.packets++;
+
+	const packet_buffer & buffer = *packet.buffer;
+	const size_t entry_size = tun_link_length_size(buffer.size) + buffer.size;
+	if (1 + entry_size > _target_size)
+	{
+		// Крупный пакет едет сам по себе, но после тех, что пришли раньше
+		flush(output);
+		_stats.sdus++;
+		output.push_back(std::move(packet));
+		return;
+	}
+
+	if (pending() && _pending.buffer->size + entry_size > _target_size)
+		flush(output);
+
+	if (!pending())
+	{
+		_pending.buffer = _pool.acquire();
+		if (_pending.buffer->capacity() < _target_size)
+			throw std::logic_error("aggregated SDU does not fit into packet buffer");
+
+		_pending.proto = packet.proto;
+		_pending.flags = packet.flags;
+		_pending.epp_protocol_id = TUN_LINK_EPP_PROTOCOL_ID;
+		_pending.buffer->data()[0] = tun_link_shim(tun_link_type::ag, 0);
+		_pending.buffer->size = 1;
+		_pending_count = 0;
+		_deadline = now + _hold;
+		_first_protocol_id = packet.epp_protocol_id;
+		_first_length_size = tun_link_length_size(buffer.size);
+	}
+
+	packet_buffer & aggregate = *_pending.buffer;
+	uint8_t * p = aggregate.data() + aggregate.size;
+	p += tun_link_put_length(p, buffer.size);
+	std::memcpy(p, buffer.data(), buffer.size);
+	aggregate.size += entry_size;
+	_pending_count++;
+
+	// Буфер уже сдвинут кодером канального уровня, читать в него снова нельзя.
+	// Пусть вернется в пул, acquire() приведет его в порядок
+	packet.buffer.reset();
+
+	if (_target_size - aggregate.size < AG_MIN_ENTRY_SIZE)
+		flush(output);
+}
+
+
+void packet_aggregator::flush(std::vector<uplink_packet> & output)
+{
+	if (!pending())
+		return;
+
+	if (1 == _pending_count)
+	{
+		// Одному пакету обертка не нужна
+		_pending.buffer->pull_front(1 + _first_length_size);
+		_pending.epp_protocol_id = _first_protocol_id;
+	}
+	else
+	{
+		_stats.aggregated_sdus++;
+		_stats.aggregated_packets += _pending_count;
+	}
+
+	_stats.sdus++;
+	output.push_back(std::move(_pending));
+	_pending.buffer.reset();
+	_pending_count = 0;
+}
@@ -0,0 +1,75 @@
+#ifndef ITS_SERVER_TUN_SRC_PACKET_AGGREGATOR_HPP_
+#define ITS_SERVER_TUN_SRC_PACKET_AGGREGATOR_HPP_
+
+/*! Сборка мелких пакетов в один SDU
+ *
+ *  Пинги, DNS, TCP ACK и прочая мелочь по отдельности тратит на EPP заголовок,
+ *  сообщение шины и упаковку USLP больше, чем на себя. Сборщик копирует такие
+ *  пакеты подряд в один буфер с длинами (tun_link_type::ag), пока он не дорастет
+ *  до целевого размера - примерно размера данных в кадре. Пакеты, которые
+ *  с заголовком сборки в цель не влезают, идут сами по себе.
+ *
+ *  Сборка ждет попутчиков не дольше hold от первого пакета в ней. Если за это
+ *  время никто не пришел, единственный пакет уходит без обертки.
+ *  Порядок пакетов сохраняется.
+ */
+
+#include <chrono>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "packet_pool.hpp"
+#include "zmq_server.hpp"
+
+
+class packet_aggregator
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	struct stats_t
+	{
+		uint64_t packets = 0;
+		uint64_t sdus = 0;
+		//! Сборки из нескольких пакетов и пакеты в них
+		uint64_t aggregated_sdus = 0;
+		uint64_t aggregated_packets = 0;
+	};
+
+	//! target_size - до какого размера набирать SDU (без EPP заголовка)
+	/*! Буферы сборок берутся из pool, так что target_size не больше его пакетов */
+	packet_aggregator(packet_pool & pool, size_t target_size, clock::duration hold);
+
+	//! Добавление пакета, прочитанного из туннеля
+	/*! SDU, которые пора отправлять, дописываются в output. Пакет в любом
+	 *  случае остается без буфера: его либо забирает output, либо данные
+	 *  копируются в сборку, а буфер возвращается в пул */
+	void push(uplink_packet & packet, clock::time_point now, std::vector<uplink_packet> & output);
+	//! Отправка текущей сборки, не дожидаясь попутчиков
+	void flush(std::vector<uplink_packet> & output);
+
+	//! Есть ли неотправленная сборка
+	bool pending() const { return static_cast<bool>(_pending.buffer); }
+	//! Когда неотправленную сборку пора отправить
+	clock::time_point deadline() const { return _deadline; }
+
+	const stats_t & stats() const { return _stats; }
+
+private:
+	packet_pool & _pool;
+	size_t _target_size;
+	clock::duration _hold;
+
+	uplink_packet _pending;
+	size_t _pending_count = 0;
+	clock::time_point _deadline;
+	//! Протокол и длина первого пакета - на случай, если он останется в сборке один
+	int _first_protocol_id = 0;
+	size_t _first_length_size = 0;
+
+	stats_t _stats;
+};
+
+
+#endif /* ITS_SERVER_TUN_SRC_PACKET_AGGREGATOR_HPP_ */
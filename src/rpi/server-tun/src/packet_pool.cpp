@@ -0,0 +1,111 @@
+#include "packet_pool.hpp"
+
+#include <mutex>
+#include <vector>
+
+
+//! То, что живет, пока жив пул или хоть один его буфер
+struct packet_pool_core
+{
+	std::mutex mutex;
+	std::vector<packet_buffer*> free_buffers;
+	size_t packet_capacity;
+	size_t max_cached;
+	//! Сколько буферов сейчас вне пула
+	size_t outstanding = 0;
+	//! Пул умер, буферы больше не кэшируются
+	bool closed = false;
+};
+
+
+packet_pool::packet_pool(size_t packet_capacity, size_t max_cached)
+	: _core(new packet_pool_core())
+{
+	_core->packet_capacity = packet_capacity;
+	_core->max_cached = max_cached;
+	_core->free_buffers.reserve(max_cached);
+}
+
+
+packet_pool::~packet_pool()
+{
+	std::vector<packet_buffer*> free_buffers;
+	bool delete_core;
+	{
+		std::lock_guard<std::mutex> lock(_core->mutex);
+		_core->closed = true;
+		free_buffers.swap(_core->free_buffers);
+		// Иначе ядро удалит последний вернувшийся буфер
+		delete_core = 0 == _core->outstanding;
+	}
+
+	for (packet_buffer * buffer: free_buffers)
+		delete buffer;
+
+	if (delete_core)
+		delete _core;
+}
+
+
+packet_pool::buffer_ptr packet_pool::acquire()
+{
+	packet_buffer * buffer = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(_core->mutex);
+		_core->outstanding++;
+		if (!_core->free_buffers.empty())
+		{
+			buffer = _core->free_buffers.back();
+			_core->free_buffers.pop_back();
+		}
+	}
+
+	if (!buffer)
+	{
+		try
+		{
+			buffer = new packet_buffer(_core, _core->packet_capacity);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(_core->mutex);
+			_core->outstanding--;
+			throw;
+		}
+	}
+
+	buffer->size = 0;
+	buffer->_offset = PACKET_POOL_HEADROOM;
+	return buffer_ptr(buffer);
+}
+
+
+void packet_pool::release(packet_buffer * buffer)
+{
+	if (!buffer)
+		return;
+
+	packet_pool_core * const core = buffer->_owner;
+	bool delete_core;
+	{
+		std::lock_guard<std::mutex> lock(core->mutex);
+		core->outstanding--;
+		if (!core->closed && core->free_buffers.size() < core->max_cached)
+		{
+			core->free_buffers.push_back(buffer);
+			buffer = nullptr;
+		}
+
+		delete_core = core->closed && 0 == core->outstanding;
+	}
+
+	delete buffer;
+	if (delete_core)
+		delete core;
+}
+
+
+void packet_pool::zmq_free(void *, void * hint)
+{
+	release(static_cast<packet_buffer*>(hint));
+}
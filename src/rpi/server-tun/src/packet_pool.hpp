@@ -0,0 +1,110 @@
+#ifndef ITS_SERVER_TUN_SRC_PACKET_POOL_HPP_
+#define ITS_SERVER_TUN_SRC_PACKET_POOL_HPP_
+
+
+#include <memory>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+
+//! Запас перед пакетом под заголовки, которые дописываются перед ним уже
+//! после чтения из туннеля: EPP (до 8 байт) и канального уровня server-tun
+#define PACKET_POOL_HEADROOM (32)
+
+
+struct packet_pool_core;
+
+
+//! Буфер под один IP пакет с запасом под заголовки перед ним
+/*! Пакет читается из туннеля сразу в data(), а заголовки потом пишутся
+ *  в запас перед ним через push_front(), так что пакет никуда не копируется */
+class packet_buffer
+{
+public:
+	packet_buffer(packet_pool_core * owner, size_t capacity)
+		: _owner(owner), _capacity(capacity), _storage(new uint8_t[PACKET_POOL_HEADROOM + capacity])
+	{}
+
+	packet_buffer(const packet_buffer &) = delete;
+	packet_buffer & operator=(const packet_buffer &) = delete;
+
+	//! Начало пакета. Перед ним есть headroom() байт
+	uint8_t * data() { return _storage.get() + _offset; }
+	const uint8_t * data() const { return _storage.get() + _offset; }
+	//! Сколько места от data() до конца буфера
+	size_t capacity() const { return PACKET_POOL_HEADROOM + _capacity - _offset; }
+	//! Сколько места осталось перед пакетом
+	size_t headroom() const { return _offset; }
+
+	//! Расширение пакета на count байт назад, в запас. Возвращает новое начало пакета
+	uint8_t * push_front(size_t count)
+	{
+		if (count > _offset)
+			throw std::logic_error("packet buffer headroom exhausted");
+
+		_offset -= count;
+		size += count;
+		return data();
+	}
+
+	//! Отрезание count байт от начала пакета
+	void pull_front(size_t count)
+	{
+		if (count > size)
+			throw std::logic_error("packet buffer underflow");
+
+		_offset += count;
+		size -= count;
+	}
+
+	//! Размер лежащего в буфере пакета
+	size_t size = 0;
+
+private:
+	friend class packet_pool;
+
+	packet_pool_core * _owner;
+	size_t _capacity;
+	size_t _offset = PACKET_POOL_HEADROOM;
+	std::unique_ptr<uint8_t[]> _storage;
+};
+
+
+//! Пул буферов пакетов
+/*! Отправленный без копирования буфер возвращает в пул поток ввода-вывода zmq,
+ *  когда сообщение уходит из очередей сокета. Поэтому возврат потокобезопасен
+ *  и может случиться уже после смерти самого пула - тогда буфер просто удаляется */
+class packet_pool
+{
+public:
+	struct deleter
+	{
+		void operator()(packet_buffer * buffer) const { packet_pool::release(buffer); }
+	};
+
+	typedef std::unique_ptr<packet_buffer, deleter> buffer_ptr;
+
+	//! max_cached - сколько свободных буферов держать. Сверх этого буферы выделяются и удаляются
+	packet_pool(size_t packet_capacity, size_t max_cached);
+	packet_pool(const packet_pool &) = delete;
+	packet_pool & operator=(const packet_pool &) = delete;
+	~packet_pool();
+
+	//! Свободный буфер. Если в пуле пусто - новый
+	buffer_ptr acquire();
+
+	//! Возврат буфера в пул. Можно звать из любого потока
+	static void release(packet_buffer * buffer);
+	//! Функция освобождения для zmq_msg_init_data. hint - packet_buffer
+	static void zmq_free(void * data, void * hint);
+
+private:
+	packet_pool_core * _core;
+};
+
+
+typedef packet_pool::buffer_ptr packet_buffer_ptr;
+
+
+#endif /* ITS_SERVER_TUN_SRC_PACKET_POOL_HPP_ */
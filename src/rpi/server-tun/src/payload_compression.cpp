@@ -0,0 +1,285 @@
+#include "payload_compression.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#ifdef ITS_TUN_WITH_ZSTD
+// Ради кадров без магического числа (ZSTD_f_zstd1_magicless)
+#define ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+#endif
+
+#include "ip_header.hpp"
+#include "log.hpp"
+
+
+static auto _slg = build_source("payload-compression");
+
+
+payload_dictionary payload_dictionary::parse(const std::string & spec)
+{
+	const auto first_colon = spec.find(':');
+	const auto second_colon = first_colon == std::string::npos ? first_colon : spec.find(':', first_colon + 1);
+	if (std::string::npos == second_colon)
+		throw std::invalid_argument("bad payload dictionary \"" + spec + "\", expected index:port:path");
+
+	const int index = std::stoi(spec.substr(0, first_colon));
+	const int port = std::stoi(spec.substr(first_colon + 1, second_colon - first_colon - 1));
+	if (index < 0 || index >= PC_MAX_DICTIONARIES)
+		throw std::invalid_argument("bad payload dictionary index in \"" + spec + "\"");
+
+	if (port < 0 || port > 0xFFFF)
+		throw std::invalid_argument("bad payload dictionary port in \"" + spec + "\"");
+
+	payload_dictionary retval;
+	retval.index = static_cast<uint8_t>(index);
+	retval.port = static_cast<uint16_t>(port);
+	retval.path = spec.substr(second_colon + 1);
+	return retval;
+}
+
+
+#ifdef ITS_TUN_WITH_ZSTD
+
+
+static std::vector<char> _load_dictionary(const payload_dictionary & dictionary)
+{
+	std::ifstream stream(dictionary.path, std::ios::binary);
+	if (!stream)
+		throw std::runtime_error("unable to open payload dictionary " + dictionary.path);
+
+	std::vector<char> retval((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+	if (retval.empty())
+		throw std::runtime_error("payload dictionary " + dictionary.path + " is empty");
+
+	return retval;
+}
+
+
+static void _check_zstd(size_t rc, const char * what)
+{
+	if (ZSTD_isError(rc))
+		throw std::runtime_error(std::string(what) + ": " + ZSTD_getErrorName(rc));
+}
+
+
+payload_compressor::payload_compressor(const std::vector<payload_dictionary> & dictionaries)
+	: _scratch(0xFFFF)
+{
+	_cctx = ZSTD_createCCtx();
+	if (!_cctx)
+		throw std::bad_alloc();
+
+	try
+	{
+		// Все, что можно, из кадра выкидываем
+		_check_zstd(ZSTD_CCtx_setParameter(_cctx, ZSTD_c_format, ZSTD_f_zstd1_magicless), "unable to set zstd format");
+		_check_zstd(ZSTD_CCtx_setParameter(_cctx, ZSTD_c_checksumFlag, 0), "unable to disable zstd checksum");
+		_check_zstd(ZSTD_CCtx_setParameter(_cctx, ZSTD_c_dictIDFlag, 0), "unable to disable zstd dictionary id");
+
+		for (const payload_dictionary & dictionary: dictionaries)
+		{
+			if (_dictionaries[dictionary.index])
+				throw std::invalid_argument("payload dictionary index " + std::to_string(dictionary.index) + " is used twice");
+
+			const std::vector<char> content = _load_dictionary(dictionary);
+			_dictionaries[dictionary.index] = ZSTD_createCDict(content.data(), content.size(), PC_COMPRESSION_LEVEL);
+			if (!_dictionaries[dictionary.index])
+				throw std::runtime_error("unable to load payload dictionary " + dictionary.path);
+
+			_port_dictionaries[dictionary.port] = dictionary.index;
+			LOG(info) << "using payload dictionary " << static_cast<int>(dictionary.index) << " "
+					<< "for port " << dictionary.port << " from " << dictionary.path;
+		}
+	}
+	catch (...)
+	{
+		_release();
+		throw;
+	}
+}
+
+
+payload_compressor::~payload_compressor()
+{
+	_release();
+}
+
+
+void payload_compressor::_release()
+{
+	for (ZSTD_CDict * & dictionary: _dictionaries)
+	{
+		ZSTD_freeCDict(dictionary);
+		dictionary = nullptr;
+	}
+
+	ZSTD_freeCCtx(_cctx);
+	_cctx = nullptr;
+}
+
+
+int payload_compressor::compress(packet_buffer & buffer)
+{
+	uint8_t * const packet = buffer.data();
+	const size_t header_size = ipv4_transport_header_size(packet, buffer.size);
+	const size_t payload_size = buffer.size - header_size;
+	if (0 == header_size || payload_size < PC_MIN_PAYLOAD_SIZE)
+	{
+		_stats.raw_packets++;
+		return -1;
+	}
+
+	const uint8_t * l4 = packet + IPV4_HEADER_SIZE;
+	auto it = _port_dictionaries.find(ip_get16(l4 + 2));
+	if (_port_dictionaries.end() == it)
+		it = _port_dictionaries.find(ip_get16(l4));
+
+	if (_port_dictionaries.end() == it)
+	{
+		_stats.raw_packets++;
+		return -1;
+	}
+
+	// Места ровно столько, чтобы сжатие с шимом выиграло хотя бы байт.
+	// Не влезло - значит не окупилось
+	const uint8_t index = it->second;
+	_check_zstd(ZSTD_CCtx_refCDict(_cctx, _dictionaries[index]), "unable to select zstd dictionary");
+	const size_t rc = ZSTD_compress2(_cctx, _scratch.data(), payload_size - 2, packet + header_size, payload_size);
+	if (ZSTD_isError(rc))
+	{
+		// Недожатый кадр остался в контексте, его нужно выбросить
+		ZSTD_CCtx_reset(_cctx, ZSTD_reset_session_only);
+		_stats.fallback_packets++;
+		return -1;
+	}
+
+	std::memcpy(packet + header_size, _scratch.data(), rc);
+	buffer.size = header_size + rc;
+	ipv4_set_payload_size(packet, header_size, rc);
+
+	_stats.compressed_packets++;
+	_stats.payload_bytes_in += payload_size;
+	_stats.payload_bytes_out += rc;
+	return index;
+}
+
+
+payload_decompressor::payload_decompressor(const std::vector<payload_dictionary> & dictionaries)
+	: _buffer(0xFFFF)
+{
+	_dctx = ZSTD_createDCtx();
+	if (!_dctx)
+		throw std::bad_alloc();
+
+	try
+	{
+		_check_zstd(ZSTD_DCtx_setParameter(_dctx, ZSTD_d_format, ZSTD_f_zstd1_magicless), "unable to set zstd format");
+
+		for (const payload_dictionary & dictionary: dictionaries)
+		{
+			if (_dictionaries[dictionary.index])
+				throw std::invalid_argument("payload dictionary index " + std::to_string(dictionary.index) + " is used twice");
+
+			const std::vector<char> content = _load_dictionary(dictionary);
+			_dictionaries[dictionary.index] = ZSTD_createDDict(content.data(), content.size());
+			if (!_dictionaries[dictionary.index])
+				throw std::runtime_error("unable to load payload dictionary " + dictionary.path);
+		}
+	}
+	catch (...)
+	{
+		_release();
+		throw;
+	}
+}
+
+
+payload_decompressor::~payload_decompressor()
+{
+	_release();
+}
+
+
+void payload_decompressor::_release()
+{
+	for (ZSTD_DDict * & dictionary: _dictionaries)
+	{
+		ZSTD_freeDDict(dictionary);
+		dictionary = nullptr;
+	}
+
+	ZSTD_freeDCtx(_dctx);
+	_dctx = nullptr;
+}
+
+
+bool payload_decompressor::decompress(uint8_t index, uint8_t * header, size_t header_size,
+		const uint8_t *& payload, size_t & payload_size)
+{
+	if (index >= PC_MAX_DICTIONARIES || !_dictionaries[index])
+	{
+		_stats.unknown_dictionary_drops++;
+		LOG(warning) << "got payload compressed with unknown dictionary " << static_cast<int>(index);
+		return false;
+	}
+
+	_check_zstd(ZSTD_DCtx_refDDict(_dctx, _dictionaries[index]), "unable to select zstd dictionary");
+	const size_t rc = ZSTD_decompressDCtx(_dctx, _buffer.data(), 0xFFFF - header_size, payload, payload_size);
+	if (ZSTD_isError(rc))
+	{
+		_stats.malformed_drops++;
+		LOG(warning) << "unable to decompress payload: " << ZSTD_getErrorName(rc);
+		return false;
+	}
+
+	ipv4_set_payload_size(header, header_size, rc);
+	payload = _buffer.data();
+	payload_size = rc;
+	_stats.packets++;
+	return true;
+}
+
+
+#else
+
+
+payload_compressor::payload_compressor(const std::vector<payload_dictionary> & dictionaries)
+{
+	if (!dictionaries.empty())
+		throw std::runtime_error("server-tun is built without zstd, payload dictionaries are not supported");
+}
+
+
+payload_compressor::~payload_compressor()
+{}
+
+
+int payload_compressor::compress(packet_buffer &)
+{
+	_stats.raw_packets++;
+	return -1;
+}
+
+
+payload_decompressor::payload_decompressor(const std::vector<payload_dictionary> & dictionaries)
+{
+	if (!dictionaries.empty())
+		throw std::runtime_error("server-tun is built without zstd, payload dictionaries are not supported");
+}
+
+
+payload_decompressor::~payload_decompressor()
+{}
+
+
+bool payload_decompressor::decompress(uint8_t, uint8_t *, size_t, const uint8_t *&, size_t &)
+{
+	_stats.unknown_dictionary_drops++;
+	return false;
+}
+
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef ITS_SERVER_TUN_SRC_PAYLOAD_COMPRESSION_HPP_
+#define ITS_SERVER_TUN_SRC_PAYLOAD_COMPRESSION_HPP_
+
+/*! Сжатие данных UDP/TCP пакетов словарями zstd
+ *
+ *  Трафик через туннель однообразный: MAVLink поверх UDP, опрос телеметрии,
+ *  одни и те же JSON команды. Поэтому даже пакеты в десятки байт хорошо жмутся
+ *  словарем, заранее обученным на таком трафике (см. bench/payload_bench.cpp).
+ *  Словарь выбирается по порту назначения пакета, а если для него словаря нет -
+ *  по порту источника, чтобы ответы жались тем же словарем, что и запросы.
+ *
+ *  Сжимаются только данные. Длины в заголовках правятся под сжатые данные,
+ *  так что пакет остается правильным IPv4 пакетом (кроме контрольной суммы
+ *  UDP/TCP, она сойдется после распаковки) и его заголовки дальше могут
+ *  сжиматься сами. Перед пакетом потом ставится шим tun_link_type::pc
+ *  с номером словаря. Если сжатие не выигрывает хотя бы байта с учетом шима,
+ *  пакет остается как был.
+ *
+ *  Кадры zstd идут без магического числа, контрольной суммы и номера словаря:
+ *  для таких пакетов это слишком дорого. Номер словаря едет в шиме, так что
+ *  словари под одними номерами на обеих сторонах должны совпадать.
+ *
+ *  Без zstd (ITS_TUN_WITH_ZSTD) сервер собирается, но словари не загружает.
+ */
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+
+#include "packet_pool.hpp"
+
+
+//! Сколько словарей. Номер словаря - 4 бита шима
+#define PC_MAX_DICTIONARIES (16)
+//! Данные короче этого не сжимаются
+#define PC_MIN_PAYLOAD_SIZE (8)
+//! Уровень сжатия zstd. На пакетах в сотню байт выше смысла нет
+#define PC_COMPRESSION_LEVEL (3)
+
+
+// Чтобы не тащить zstd.h в заголовок
+struct ZSTD_CCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DCtx_s;
+struct ZSTD_DDict_s;
+
+
+//! Словарь: номер в шиме, порт, по которому он выбирается, и файл с ним
+struct payload_dictionary
+{
+	uint8_t index = 0;
+	uint16_t port = 0;
+	std::string path;
+
+	//! Разбор "номер:порт:путь" из командной строки
+	static payload_dictionary parse(const std::string & spec);
+};
+
+
+//! Сжатие данных пакетов, уходящих в радиоканал
+class payload_compressor
+{
+public:
+	struct stats_t
+	{
+		uint64_t compressed_packets = 0;
+		//! Без словаря или не UDP/TCP
+		uint64_t raw_packets = 0;
+		//! Сжатие не окупилось
+		uint64_t fallback_packets = 0;
+		//! Данные сжатых пакетов до и после сжатия
+		uint64_t payload_bytes_in = 0;
+		uint64_t payload_bytes_out = 0;
+	};
+
+	explicit payload_compressor(const std::vector<payload_dictionary> & dictionaries);
+	payload_compressor(const payload_compressor &) = delete;
+	payload_compressor & operator=(const payload_compressor &) = delete;
+	~payload_compressor();
+
+	//! Сжатие данных пакета прямо в буфере
+	/*! Возвращает номер словаря или -1, если пакет остался как был */
+	int compress(packet_buffer & buffer);
+
+	const stats_t & stats() const { return _stats; }
+
+private:
+	void _release();
+
+	ZSTD_CCtx_s * _cctx = nullptr;
+	std::array<ZSTD_CDict_s*, PC_MAX_DICTIONARIES> _dictionaries = {};
+	std::unordered_map<uint16_t, uint8_t> _port_dictionaries;
+	std::vector<uint8_t> _scratch;
+	stats_t _stats;
+};
+
+
+//! Распаковка данных пакетов, пришедших из радиоканала
+class payload_decompressor
+{
+public:
+	struct stats_t
+	{
+		uint64_t packets = 0;
+		uint64_t unknown_dictionary_drops = 0;
+		uint64_t malformed_drops = 0;
+	};
+
+	explicit payload_decompressor(const std::vector<payload_dictionary> & dictionaries);
+	payload_decompressor(const payload_decompressor &) = delete;
+	payload_decompressor & operator=(const payload_decompressor &) = delete;
+	~payload_decompressor();
+
+	//! Распаковка данных, сжатых словарем index
+	/*! Длины в header правятся под распакованные данные. payload после вызова
+	 *  указывает на них во внутреннем буфере, живущем до следующего вызова.
+	 *  Возвращает false, если пакет нужно выбросить */
+	bool decompress(uint8_t index, uint8_t * header, size_t header_size,
+			const uint8_t *& payload, size_t & payload_size);
+
+	const stats_t & stats() const { return _stats; }
+
+private:
+	void _release();
+
+	ZSTD_DCtx_s * _dctx = nullptr;
+	std::array<ZSTD_DDict_s*, PC_MAX_DICTIONARIES> _dictionaries = {};
+	std::vector<uint8_t> _buffer;
+	stats_t _stats;
+};
+
+
+#endif /* ITS_SERVER_TUN_SRC_PAYLOAD_COMPRESSION_HPP_ */
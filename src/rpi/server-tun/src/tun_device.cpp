@@ -9,6 +9,7 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
@@ -230,6 +231,26 @@ void tun_device::set_mtu(int mtu)
 }
 
 
+void tun_device::set_nonblocking(bool nonblocking)
+{
+	if (!is_open())
+		throw std::runtime_error("device is not open");
+
+	int flags = ::fcntl(_fd, F_GETFL);
+	if (flags < 0)
+		throw std::system_error(std::error_code(errno, std::system_category()), "unable to get tun fd flags");
+
+	if (nonblocking)
+		flags |= O_NONBLOCK;
+	else
+		flags &= ~O_NONBLOCK;
+
+	int rc = ::fcntl(_fd, F_SETFL, flags);
+	if (rc < 0)
+		throw std::system_error(std::error_code(errno, std::system_category()), "unable to set tun fd flags");
+}
+
+
 size_t tun_device::read_packet(uint8_t * buffer, size_t buffer_size)
 {
 	if (!is_open())
@@ -243,6 +264,25 @@ size_t tun_device::read_packet(uint8_t * buffer, size_t buffer_size)
 }
 
 
+bool tun_device::try_read_packet(uint8_t * buffer, size_t buffer_size, size_t & packet_size)
+{
+	if (!is_open())
+		throw std::runtime_error("device is not open");
+
+	int portion = ::read(_fd, buffer, buffer_size);
+	if (portion < 0)
+	{
+		if (EAGAIN == errno || EWOULDBLOCK == errno)
+			return false;
+
+		throw std::system_error(std::error_code(errno, std::system_category()), "unable to read from tun device");
+	}
+
+	packet_size = portion;
+	return true;
+}
+
+
 size_t tun_device::write_packet(const uint8_t * buffer, size_t buffer_size)
 {
 	if (!is_open())
@@ -255,3 +295,21 @@ size_t tun_device::write_packet(const uint8_t * buffer, size_t buffer_size)
 	return portion;
 }
 
+
+size_t tun_device::write_packet(const uint8_t * header, size_t header_size, const uint8_t * payload, size_t payload_size)
+{
+	if (!is_open())
+		throw std::runtime_error("device is not open");
+
+	struct iovec parts[2];
+	parts[0].iov_base = const_cast<uint8_t*>(header);
+	parts[0].iov_len = header_size;
+	parts[1].iov_base = const_cast<uint8_t*>(payload);
+	parts[1].iov_len = payload_size;
+
+	ssize_t portion = ::writev(_fd, parts, 2);
+	if (portion < 0)
+		throw std::system_error(std::error_code(errno, std::system_category()), "unable to write to tun device");
+
+	return portion;
+}
@@ -25,9 +25,15 @@ public:
 	void set_ip(const std::string & ip, int netmask);
 	void set_up(bool up);
 	void set_mtu(int mtu);
+	//! Неблокирующий режим: чтение из пустого туннеля не ждет пакета
+	void set_nonblocking(bool nonblocking);
 
 	size_t read_packet(uint8_t * buffer, size_t buffer_size);
+	//! Чтение пакета в неблокирующем режиме. false, если пакетов больше нет
+	bool try_read_packet(uint8_t * buffer, size_t buffer_size, size_t & packet_size);
 	size_t write_packet(const uint8_t * buffer, size_t buffer_size);
+	//! Запись пакета из двух кусков одним writev, без склейки в один буфер
+	size_t write_packet(const uint8_t * header, size_t header_size, const uint8_t * payload, size_t payload_size);
 
 	int fd() { return _fd; }
 	const std::string & name() const { return _name; }
@@ -0,0 +1,119 @@
+#ifndef ITS_SERVER_TUN_SRC_TUN_LINK_HPP_
+#define ITS_SERVER_TUN_SRC_TUN_LINK_HPP_
+
+/*! Канальный уровень между двумя server-tun
+ *
+ *  Обычный IP пакет идет по радио в EPP пакете с протоколом IPE как есть.
+ *  Все остальное, что server-tun делает с пакетами для экономии эфира,
+ *  идет в EPP пакетах с протоколом TUN_LINK_EPP_PROTOCOL_ID (mission-specific).
+ *  Первый байт таких пакетов - шим: в старших четырех битах тип пакета
+ *  (tun_link_type), в младших - его параметр (например номер контекста сжатия).
+ *
+ *  Шимы могут идти друг за другом: сначала шим сжатия данных, затем пакет
+ *  со сжатыми заголовками или обычный IP пакет. Поэтому типы 4 и 6 заняты -
+ *  это версии IP в первом байте пакета.
+ *
+ *  Пакет типа ag собирает в один SDU несколько пакетов (обычных IP или канального
+ *  уровня), перед каждым - его длина (tun_link_put_length). Так мелкие пакеты
+ *  делят между собой EPP заголовок, сообщение шины и упаковку USLP.
+ *
+ *  server-tun на борту и на земле один и тот же, так что это все симметрично:
+ *  что один отправляет, другой разбирает.
+ */
+
+#include <cstdint>
+#include <cstddef>
+
+
+//! EPP протокол IPE - пакет без изменений
+#define TUN_IPE_EPP_PROTOCOL_ID (0x02)
+//! EPP протокол пакетов канального уровня server-tun (mission-specific)
+#define TUN_LINK_EPP_PROTOCOL_ID (0x07)
+//! Самый длинный пакет, длину которого можно записать в сборке
+#define TUN_LINK_MAX_AGGREGATED_SIZE (0x7FFF)
+
+
+//! Тип пакета канального уровня, старшие 4 бита шима
+enum class tun_link_type: uint8_t
+{
+	//! Сжатые заголовки: пакет с полными заголовками, (пере)заводящий контекст
+	hc_ir = 0x1,
+	//! Сжатые заголовки: пакет с заголовками относительно контекста
+	hc_co = 0x2,
+	//! Данные UDP/TCP сжаты словарем с номером из параметра шима, дальше пакет
+	pc = 0x3,
+	//! Сборка из нескольких пакетов с длинами
+	ag = 0x5,
+};
+
+
+inline uint8_t tun_link_shim(tun_link_type type, uint8_t param)
+{
+	return static_cast<uint8_t>(static_cast<uint8_t>(type) << 4 | (param & 0x0F));
+}
+
+
+inline tun_link_type tun_link_shim_type(uint8_t shim)
+{
+	return static_cast<tun_link_type>(shim >> 4);
+}
+
+
+inline uint8_t tun_link_shim_param(uint8_t shim)
+{
+	return shim & 0x0F;
+}
+
+
+//! Обычный ли это IP пакет (IPv4 или IPv6), а не пакет канального уровня
+inline bool tun_link_is_ip_packet(uint8_t first_byte)
+{
+	const uint8_t version = first_byte >> 4;
+	return 4 == version || 6 == version;
+}
+
+
+//! Размер длины пакета в сборке: до 127 байт - один байт, дальше два
+inline size_t tun_link_length_size(size_t length)
+{
+	return length < 0x80 ? 1 : 2;
+}
+
+
+//! Запись длины пакета в сборке. Возвращает, сколько байт она заняла
+inline size_t tun_link_put_length(uint8_t * p, size_t length)
+{
+	if (length < 0x80)
+	{
+		p[0] = static_cast<uint8_t>(length);
+		return 1;
+	}
+
+	p[0] = static_cast<uint8_t>(0x80 | length >> 8);
+	p[1] = static_cast<uint8_t>(length);
+	return 2;
+}
+
+
+//! Чтение длины пакета в сборке. Возвращает, сколько байт она заняла, или 0,
+//! если длина не влезла в available байт
+inline size_t tun_link_get_length(const uint8_t * p, size_t available, size_t & length)
+{
+	if (available < 1)
+		return 0;
+
+	if (0 == (p[0] & 0x80))
+	{
+		length = p[0];
+		return 1;
+	}
+
+	if (available < 2)
+		return 0;
+
+	length = static_cast<size_t>(p[0] & 0x7F) << 8 | p[1];
+	return 2;
+}
+
+
+#endif /* ITS_SERVER_TUN_SRC_TUN_LINK_HPP_ */
@@ -2,8 +2,14 @@
 
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
+#include <array>
+#include <string>
+#include <algorithm>
 
 #include <json.hpp>
+#include <gbus_meta.h>
+#include <gbus_topic.h>
 
 #include <ccsds/epp/epp_header.hpp>
 
@@ -15,19 +21,36 @@ static auto _slg = build_source("zmq-server");
 
 #define ITS_BSCP_ENDPOINT_KEY "ITS_GBUS_BSCP_ENDPOINT"
 #define ITS_BPCS_ENDPOINT_KEY "ITS_GBUS_BPCS_ENDPOINT"
+//! Срок жизни аплинк пакетов в очереди USLP сервера (мс). Ноль или не задан - бессрочно
+#define ITS_UPLINK_TTL_KEY "ITS_TUN_UPLINK_TTL_MS"
 
 #define ITS_GBUS_TOPIC_DOWNLINK_SDU "uslp.downlink_sdu"
 #define ITS_GBUS_TOPIC_UPLINK_SDU_REQUEST "uslp.uplink_sdu_request"
 #define ITS_GBUS_TOPIC_UPLINK_SDU_EVENT "uslp.uplink_sdu_event"
 
 
+static std::string _channel_topic(const char * base, int sc_id, int vc_id, int map_id)
+{
+	const size_t base_size = std::strlen(base);
+	std::string retval(base_size + GBUS_TOPIC_CHANNEL_SUFFIX_MAX_SIZE, '\0');
+	const size_t size = gbus_topic_format_channel(
+			retval.data(), retval.size(), base, base_size,
+			static_cast<uint16_t>(sc_id), static_cast<uint8_t>(vc_id), static_cast<uint8_t>(map_id)
+	);
+	retval.resize(size);
+	return retval;
+}
+
+
 zmq_server::zmq_server()
-	: _ctx(nullptr)
+	: _ctx(nullptr),
+	  _uplink_topic(_channel_topic(ITS_GBUS_TOPIC_UPLINK_SDU_REQUEST, 0, 0, 0))
 {}
 
 
 zmq_server::zmq_server(zmq::context_t * ctx)
-	: _ctx(ctx)
+	: _ctx(ctx),
+	  _uplink_topic(_channel_topic(ITS_GBUS_TOPIC_UPLINK_SDU_REQUEST, 0, 0, 0))
 {
 
 }
@@ -35,6 +58,7 @@ zmq_server::zmq_server(zmq::context_t * ctx)
 
 zmq_server::zmq_server(zmq_server && other)
 	: _ctx(other._ctx),
+	  _uplink_topic(_channel_topic(ITS_GBUS_TOPIC_UPLINK_SDU_REQUEST, 0, 0, 0)),
 	  _bpcs_socket(std::move(other._bpcs_socket)),
 	  _bscp_socket(std::move(other._bscp_socket))
 {
@@ -69,6 +93,7 @@ void zmq_server::set_uplink_channel(int sc_id, int vc_id, int map_id)
 	_uplink_sc_id = sc_id;
 	_uplink_vc_id = vc_id;
 	_uplink_map_id = map_id;
+	_uplink_topic = _channel_topic(ITS_GBUS_TOPIC_UPLINK_SDU_REQUEST, sc_id, vc_id, map_id);
 
 	LOG(info) << "using uplink channel " << sc_id << "," << vc_id << "," << map_id;
 }
@@ -113,6 +138,18 @@ void zmq_server::open()
 		throw std::runtime_error("unable to fetch BPCS endpoint address");
 	}
 
+	const char * meta_format = std::getenv(GBUS_META_FORMAT_ENV_KEY);
+	_binary_metadata = meta_format && std::string(meta_format) == GBUS_META_FORMAT_BINARY;
+	if (_binary_metadata)
+		LOG(info) << "using binary metadata for outgoing messages";
+
+	const char * uplink_ttl = std::getenv(ITS_UPLINK_TTL_KEY);
+	if (uplink_ttl)
+	{
+		_uplink_ttl_ms = std::min<uint32_t>(std::stoul(uplink_ttl), GBUS_META_MAX_TTL_MS);
+		LOG(info) << "using uplink packets ttl " << _uplink_ttl_ms << " ms";
+	}
+
 	open(bpcs, bscp);
 }
 
@@ -130,13 +167,9 @@ void zmq_server::open(const std::string & bpcs_endpoint, const std::string & bsc
 	_bscp_socket.connect(bscp_endpoint.c_str());
 
 	// Подписываемся на единственное интересное нам сообщение
-	std::stringstream topic_stream;
-	topic_stream << ITS_GBUS_TOPIC_DOWNLINK_SDU << "."
-			<< _downlink_sc_id << "."
-			<< _downlink_vc_id << "."
-			<< _downlink_map_id
-	;
-	const std::string topic = topic_stream.str();
+	const std::string topic = _channel_topic(
+			ITS_GBUS_TOPIC_DOWNLINK_SDU, _downlink_sc_id, _downlink_vc_id, _downlink_map_id
+	);
 	LOG(info) << "subscribing to \"" << topic << "\"";
 	_bpcs_socket.set(zmq::sockopt::subscribe, topic);
 }
@@ -149,12 +182,44 @@ void zmq_server::close()
 }
 
 
+//! Разбор сборки из нескольких пакетов. Битый хвост сборки выбрасывается
+static void _split_aggregated_sdu(const uint8_t * begin, const uint8_t * end, std::vector<downlink_part> & parts)
+{
+	// Первый байт - шим самой сборки
+	const uint8_t * p = begin + 1;
+	while (p != end)
+	{
+		size_t size = 0;
+		const size_t length_size = tun_link_get_length(p, end - p, size);
+		if (0 == length_size || 0 == size || size > static_cast<size_t>(end - p) - length_size)
+		{
+			LOG(warning) << "got malformed aggregated SDU, dropping its " << end - p << " tail bytes";
+			break;
+		}
+
+		p += length_size;
+		downlink_part part;
+		// Обычные IP пакеты (в том числе IPv6) в сборке отличаются от пакетов
+		// канального уровня версией IP
+		part.epp_protocol_id = tun_link_is_ip_packet(p[0]) ? TUN_IPE_EPP_PROTOCOL_ID : TUN_LINK_EPP_PROTOCOL_ID;
+		part.data = p;
+		part.size = size;
+		parts.push_back(part);
+		p += size;
+	}
+
+	LOG(debug) << "aggregated SDU contains " << parts.size() << " packets";
+}
+
+
 void zmq_server::recv_downlink_packet(downlink_packet & packet)
 {
 	zmq::message_t topic_msg;
 	zmq::message_t meta_msg;
-	zmq::message_t data_msg;
+	// Данные принимаем прямо в пакет, чтобы потом не копировать
+	zmq::message_t & data_msg = packet.message;
 	bool bad_packet = false;
+	packet.parts.clear();
 
 	auto rv = _bpcs_socket.recv(topic_msg);
 	if (!topic_msg.more())
@@ -197,24 +262,46 @@ void zmq_server::recv_downlink_packet(downlink_packet & packet)
 
 	// работаем с метаданными
 	// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-	const char * meta_data_begin = reinterpret_cast<const char*>(meta_msg.data());
-	const std::string_view meta(meta_data_begin, meta_msg.size());
-	const auto j = nlohmann::json::parse(meta);
-
-	// Проверяем что это пакет для нас
-	//   Доверяем zmq в наших подписках
+	// Формат метаданных определяем по их первому байту
+	if (gbus_meta_is_binary(meta_msg.data(), meta_msg.size()))
+	{
+		gbus_meta_t meta{};
+		const int rc = gbus_meta_decode(meta_msg.data<uint8_t>(), meta_msg.size(), &meta);
+		if (0 != rc || GBUS_META_DOWNLINK_SDU != meta.type)
+		{
+			LOG(error) << "unable to decode binary metadata: " << rc << ", type " << static_cast<int>(meta.type);
+			throw std::runtime_error("bad binary metadata");
+		}
 
-	// Провеяем флаги
-	const char * bad_flags[] = { "idle", "corrupted", "incomplete", "stray" };
-	for (const nlohmann::json & flag: j["flags"])
+		const uint32_t bad_flags = GBUS_META_SDU_FLAG_IDLE | GBUS_META_SDU_FLAG_CORRUPTED
+				| GBUS_META_SDU_FLAG_INCOMPLETE | GBUS_META_SDU_FLAG_STRAY;
+		if (meta.body.downlink_sdu.flags & bad_flags)
+		{
+			LOG(info) << "sdu got bad flags " << meta.body.downlink_sdu.flags;
+			bad_packet = true;
+		}
+	}
+	else
 	{
-		for (const char * baddie: bad_flags)
+		const char * meta_data_begin = reinterpret_cast<const char*>(meta_msg.data());
+		const std::string_view meta(meta_data_begin, meta_msg.size());
+		const auto j = nlohmann::json::parse(meta);
+
+		// Проверяем что это пакет для нас
+		//   Доверяем zmq в наших подписках
+
+		// Провеяем флаги
+		const char * bad_flags[] = { "idle", "corrupted", "incomplete", "stray" };
+		for (const nlohmann::json & flag: j["flags"])
 		{
-			if (baddie == flag.get<std::string_view>())
+			for (const char * baddie: bad_flags)
 			{
-				LOG(info) << "sdu got \"" << baddie << "\" flag";
-				bad_packet = true;
-				goto breakout;
+				if (baddie == flag.get<std::string_view>())
+				{
+					LOG(info) << "sdu got \"" << baddie << "\" flag";
+					bad_packet = true;
+					goto breakout;
+				}
 			}
 		}
 	}
@@ -239,6 +326,7 @@ breakout:
 				<< "of size " << header.payload_size()
 		;
 
+		packet.epp_protocol_id = header.protocol_id;
 		// Сдвигаем указатель за заголовок
 		std::advance(data_begin, header.size());
 		// Проверим размер на всякий
@@ -252,48 +340,105 @@ breakout:
 	}
 
 	packet.bad = bad_packet;
-	packet.data = std::vector<uint8_t>(data_begin, data_end);
+	if (bad_packet)
+		return;
+
+	const bool aggregated = TUN_LINK_EPP_PROTOCOL_ID == packet.epp_protocol_id && data_begin != data_end
+			&& tun_link_type::ag == tun_link_shim_type(data_begin[0]);
+	if (aggregated)
+	{
+		_split_aggregated_sdu(data_begin, data_end, packet.parts);
+	}
+	else
+	{
+		downlink_part part;
+		part.epp_protocol_id = packet.epp_protocol_id;
+		part.data = data_begin;
+		part.size = data_end - data_begin;
+		packet.parts.push_back(part);
+	}
+}
+
+
+void zmq_server::send_uplink_packet(uplink_packet & packet)
+{
+	send_uplink_packets(&packet, 1);
+}
+
+
+void zmq_server::send_uplink_packets(uplink_packet * packets, size_t count)
+{
+	if (0 == count)
+		return;
+
+	const uint64_t first_cookie = _uplink_cookie;
+	for (size_t i = 0; i < count; i++)
+		_send_uplink_packet(packets[i], _uplink_cookie++);
+
+	LOG(info) << "sent " << count << " uplink SDUs, "
+			<< "cookies " << first_cookie << ".." << _uplink_cookie - 1;
 }
 
 
-void zmq_server::send_uplink_packet(const uplink_packet & packet)
+void zmq_server::_send_uplink_packet(uplink_packet & packet, uint64_t cookie)
 {
-	std::stringstream topic_stream;
-	topic_stream << ITS_GBUS_TOPIC_UPLINK_SDU_REQUEST << "."
-			<< _uplink_sc_id << "."
-			<< _uplink_vc_id << "."
-			<< _uplink_map_id
-	;
-	const std::string topic = topic_stream.str();
-
-	nlohmann::json j;
-	j["sc_id"] = _uplink_sc_id;
-	j["vchannel_id"] = _uplink_vc_id;
-	j["map_id"] = _uplink_map_id;
-	j["qos"] = "expedited";
-	j["cookie"] = _uplink_cookie++;
-
-	// Дополнительная информация
-	j["extra"] = {
-		{ "proto", packet.proto },
-		{ "flags", packet.flags }
-	};
-	const std::string metadata = j.dump();
-
-	// Дорисовываем epp заголовок
+	const std::string & topic = _uplink_topic;
+
+	std::array<uint8_t, GBUS_META_MAX_SIZE> binary_metadata;
+	zmq::const_buffer metadata;
+	if (_binary_metadata)
+	{
+		gbus_meta_t meta{};
+		meta.type = GBUS_META_UPLINK_SDU_REQUEST;
+		meta.body.uplink_sdu_request.sc_id = _uplink_sc_id;
+		meta.body.uplink_sdu_request.vchannel_id = _uplink_vc_id;
+		meta.body.uplink_sdu_request.map_id = _uplink_map_id;
+		meta.body.uplink_sdu_request.qos = GBUS_META_QOS_EXPEDITED;
+		meta.body.uplink_sdu_request.cookie = cookie;
+		meta.body.uplink_sdu_request.ttl_ms = _uplink_ttl_ms;
+
+		const size_t size = gbus_meta_encode(&meta, binary_metadata.data(), binary_metadata.size());
+		metadata = zmq::const_buffer(binary_metadata.data(), size);
+	}
+	else
+	{
+		nlohmann::json j;
+		j["sc_id"] = _uplink_sc_id;
+		j["vchannel_id"] = _uplink_vc_id;
+		j["map_id"] = _uplink_map_id;
+		j["qos"] = "expedited";
+		j["cookie"] = cookie;
+		if (_uplink_ttl_ms)
+			j["ttl_ms"] = _uplink_ttl_ms;
+
+		// Дополнительная информация
+		j["extra"] = {
+			{ "proto", packet.proto },
+			{ "flags", packet.flags }
+		};
+		_json_metadata = j.dump();
+		metadata = zmq::const_buffer(_json_metadata.data(), _json_metadata.size());
+	}
+
+	// Дорисовываем epp заголовок прямо перед пакетом, в запасе буфера
+	packet_buffer & buffer = *packet.buffer;
 	ccsds::epp::header_t header;
-	header.protocol_id = static_cast<int>(ccsds::epp::protocol_id_t::IPE);
-	header.accomadate_to_payload_size(packet.data.size());
+	header.protocol_id = packet.epp_protocol_id;
+	header.accomadate_to_payload_size(buffer.size);
+
+	uint8_t * const sdu_begin = buffer.push_front(header.size());
+	header.write(sdu_begin, sdu_begin + header.size());
 
-	std::vector<uint8_t> data(header.size());
-	header.write(data.begin(), data.end());
-	data.insert(data.end(), packet.data.begin(), packet.data.end());
+	// Буфер теперь принадлежит сообщению. Вернет его в пул zmq, когда отправит.
+	// Если отправка не удастся - сообщение вернет его само при разрушении
+	zmq::message_t sdu(sdu_begin, buffer.size, &packet_pool::zmq_free, &buffer);
+	packet.buffer.release();
 
-	LOG(info) << "sending uplink SDU cookie " << j["cookie"] << " "
+	LOG(debug) << "sending uplink SDU cookie " << cookie << " "
 			<< "of size " << header.payload_size();
 
 	_bscp_socket.send(zmq::const_buffer(topic.data(), topic.size()), zmq::send_flags::sndmore);
-	_bscp_socket.send(zmq::const_buffer(metadata.data(), metadata.size()), zmq::send_flags::sndmore);
-	_bscp_socket.send(zmq::const_buffer(data.data(), data.size()));
+	_bscp_socket.send(metadata, zmq::send_flags::sndmore);
+	_bscp_socket.send(sdu, zmq::send_flags::none);
 }
 
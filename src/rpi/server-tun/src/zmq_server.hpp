@@ -2,23 +2,47 @@
 #define ITS_SERVER_TUN_SRC_ZMQ_SERVER_HPP_
 
 
+#include <string>
 #include <vector>
 
 #include <zmq.hpp>
 
+#include "packet_pool.hpp"
+#include "tun_link.hpp"
 
+
+//! Один пакет из принятого SDU
+struct downlink_part
+{
+	//! IP пакет как есть (IPE) или пакет канального уровня server-tun
+	int epp_protocol_id = 0;
+	const uint8_t * data = nullptr;
+	size_t size = 0;
+};
+
+
+//! Принятый с шины SDU
+/*! Пакеты не копируются из сообщения zmq: parts указывают внутрь message
+ *  за EPP заголовком и живут, пока живо сообщение. Обычно пакет в SDU один,
+ *  сборки (tun_link_type::ag) разбираются на входящие в них пакеты.
+ *  Пакет стоит переиспользовать между приемами, чтобы не выделять parts */
 struct downlink_packet
 {
-	bool bad;
-	std::vector<uint8_t> data;
+	bool bad = false;
+	int epp_protocol_id = 0;
+	zmq::message_t message;
+	std::vector<downlink_part> parts;
 };
 
 
 struct uplink_packet
 {
-	uint32_t proto;
-	uint32_t flags;
-	std::vector<uint8_t> data;
+	uint32_t proto = 0;
+	uint32_t flags = 0;
+	//! IP пакет как есть (IPE) или пакет канального уровня server-tun
+	int epp_protocol_id = TUN_IPE_EPP_PROTOCOL_ID;
+	//! Пакет в буфере пула. Отправка забирает буфер и отдает его zmq без копирования
+	packet_buffer_ptr buffer;
 };
 
 
@@ -44,21 +68,35 @@ public:
 	void close();
 
 	void recv_downlink_packet(downlink_packet & packet);
-	void send_uplink_packet(const uplink_packet & packet);
+	void send_uplink_packet(uplink_packet & packet);
+	//! Отправка пачки пакетов, прочитанных из туннеля за одно пробуждение
+	void send_uplink_packets(uplink_packet * packets, size_t count);
 
 	zmq::socket_t & bpcs_socket() { return _bpcs_socket; }
 	zmq::socket_t & bscp_socket() { return _bscp_socket; }
 
 private:
+	void _send_uplink_packet(uplink_packet & packet, uint64_t cookie);
+
 	int _uplink_sc_id = 0;
 	int _uplink_vc_id = 0;
 	int _uplink_map_id = 0;
+	//! Топик аплинк пакетов, собирается при смене канала, а не на каждый пакет
+	std::string _uplink_topic;
 
 	int _downlink_sc_id = 0;
 	int _downlink_vc_id = 0;
 	int _downlink_map_id = 0;
 
 	uint64_t _uplink_cookie = 0;
+	//! Срок жизни аплинк пакетов в очереди USLP сервера (мс). Ноль - бессрочно
+	uint32_t _uplink_ttl_ms = 0;
+
+	//! Слать ли метаданные в бинарном формате вместо JSON
+	bool _binary_metadata = false;
+
+	//! Буфер JSON метаданных, переживающий пакеты, чтобы не выделять память на каждый
+	std::string _json_metadata;
 
 	zmq::context_t * _ctx;
 
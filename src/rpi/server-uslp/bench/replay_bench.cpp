@@ -0,0 +1,386 @@
+/* Бенчмарк USLP сервера на записанном трафике
+ *
+ * Читает .zmq-log файлы брокера и скармливает входящие сообщения USLP сервера
+ * (radio.downlink_frame, radio.uplink_state, uslp.uplink_sdu_request) прямо
+ * в dispatcher, без сокетов. Исходящие сообщения сервера ловятся в памяти
+ * и сравниваются с теми, что сервер опубликовал, когда лог писался.
+ *
+ * Сравнение идет по каждому семейству топиков отдельно: по порядку топиков
+ * и содержимому пейлоадов. Метаданные не сравниваются - в них время. Если
+ * лог писался не с момента запуска сервера или с радио, которое теряло
+ * фреймы по таймауту, расхождения ожидаемы.
+ */
+
+#include <map>
+#include <array>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+#include <variant>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+#include <boost/program_options.hpp>
+
+#include <zmq.hpp>
+
+#include "log.hpp"
+#include "stack.hpp"
+#include "bus_io.hpp"
+#include "dispatcher.hpp"
+
+#include "zmq_log.hpp"
+
+
+static auto _slg = build_source("replay-bench");
+
+
+//! Входящее сообщение, заранее разложенное по zmq буферам
+struct replay_message
+{
+	double time;
+	zmq::message_t topic;
+	zmq::message_t metadata;
+	zmq::message_t payload;
+};
+
+
+//! Отпечаток исходящего сообщения для сравнения
+struct output_print
+{
+	std::string topic;
+	uint64_t payload_hash;
+
+	bool operator==(const output_print & other) const
+	{
+		return topic == other.topic && payload_hash == other.payload_hash;
+	}
+};
+
+
+//! Отпечатки исходящих сообщений по семействам топиков
+typedef std::map<std::string, std::vector<output_print>> output_prints_t;
+
+
+static uint64_t _fnv1a(const void * data, size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const uint8_t * bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+
+static bool _starts_with(const std::string & left, const char * right)
+{
+	return 0 == left.compare(0, std::strlen(right), right);
+}
+
+
+//! Семейство топика исходящего сообщения сервера. nullptr, если это не оно
+static const char * _output_family(const std::string & topic)
+{
+	for (const char * family: {
+			ITS_GBUS_TOPIC_DOWNLINK_SDU, ITS_GBUS_TOPIC_UPLINK_SDU_EVENT, ITS_GBUS_TOPIC_UPLINK_FRAME
+	})
+	{
+		if (_starts_with(topic, family))
+			return family;
+	}
+
+	return nullptr;
+}
+
+
+static bool _is_input_topic(const std::string & topic)
+{
+	return _starts_with(topic, ITS_GBUS_TOPIC_UPLINK_SDU_REQUEST)
+			|| topic == ITS_GBUS_TOPIC_DOWNLINK_FRAME
+			|| topic == ITS_GBUS_TOPIC_UPLINK_STATE
+	;
+}
+
+
+static std::string _channel_topic(const char * base, const ccsds::uslp::gmapid_t & gmapid)
+{
+	return std::string(base)
+			+ "." + std::to_string(gmapid.sc_id())
+			+ "." + std::to_string(gmapid.vchannel_id())
+			+ "." + std::to_string(gmapid.map_id())
+	;
+}
+
+
+//! Исходящие сообщения сервера, пойманные в памяти
+class recording_output: public bus_output
+{
+public:
+	using bus_output::send_message;
+
+	virtual void send_message(const sdu_downlink & message) override
+	{
+		_record(ITS_GBUS_TOPIC_DOWNLINK_SDU, _channel_topic(ITS_GBUS_TOPIC_DOWNLINK_SDU, message.gmapid),
+				message.data.data(), message.data.size()
+		);
+	}
+
+	virtual void send_message(const sdu_uplink_event & message) override
+	{
+		_record(ITS_GBUS_TOPIC_UPLINK_SDU_EVENT, _channel_topic(ITS_GBUS_TOPIC_UPLINK_SDU_EVENT, message.gmapid),
+				nullptr, 0
+		);
+	}
+
+	virtual void send_message(const radio_uplink_frame & message) override
+	{
+		_record(ITS_GBUS_TOPIC_UPLINK_FRAME, ITS_GBUS_TOPIC_UPLINK_FRAME,
+				message.data.data(), message.data.size()
+		);
+	}
+
+	virtual void send_message(const sdu_uplink_event_batch & message) override
+	{
+		// Раскладываем пачку обратно, чтобы сравнить её с записанными одиночными событиями
+		for (const auto & event: message.events)
+			send_message(event);
+	}
+
+	virtual void send_message(const uplink_queue_state & message) override
+	{
+		// Отчеты об очередях идут по таймеру, сравнивать их не с чем
+	}
+
+	virtual void send_message(const uslp_stats::report & message) override
+	{
+		// Статистика зависит от времени, сравнивать её не с чем
+	}
+
+	output_prints_t & prints() { return _prints; }
+
+private:
+	void _record(const char * family, std::string topic, const void * data, size_t size)
+	{
+		_prints[family].push_back(output_print{std::move(topic), _fnv1a(data, size)});
+	}
+
+	output_prints_t _prints;
+};
+
+
+//! Стоимость обработки сообщений одного типа
+struct message_costs
+{
+	const char * name = nullptr;
+	std::vector<uint64_t> ns;
+
+	void print() const
+	{
+		if (ns.empty())
+			return;
+
+		std::vector<uint64_t> sorted(ns);
+		std::sort(sorted.begin(), sorted.end());
+		uint64_t sum = 0;
+		for (auto value: sorted)
+			sum += value;
+
+		auto percentile = [&sorted](double fraction) {
+			return sorted[std::min(sorted.size() - 1, static_cast<size_t>(sorted.size() * fraction))];
+		};
+
+		std::printf("%-22s %10zu msgs, mean %8lu ns, p50 %8lu ns, p99 %8lu ns, max %8lu ns\n",
+				name, sorted.size(), static_cast<unsigned long>(sum / sorted.size()),
+				static_cast<unsigned long>(percentile(0.50)), static_cast<unsigned long>(percentile(0.99)),
+				static_cast<unsigned long>(sorted.back())
+		);
+	}
+};
+
+
+static void _load_logs(
+		const std::vector<std::string> & paths,
+		std::vector<replay_message> & inputs,
+		output_prints_t & recorded_outputs
+)
+{
+	zmq_log_record record;
+	for (const auto & path: paths)
+	{
+		zmq_log_reader reader(path);
+		LOG(info) << "loading " << path << " (format version " << reader.version() << ")";
+		while (reader.read(record))
+		{
+			if (record.parts.empty())
+				continue;
+
+			const std::string & topic = record.parts[0];
+			if (_is_input_topic(topic) && record.parts.size() >= 2)
+			{
+				const std::string empty;
+				const std::string & payload = record.parts.size() > 2 ? record.parts[2] : empty;
+				inputs.push_back(replay_message{
+						record.time,
+						zmq::message_t(topic.data(), topic.size()),
+						zmq::message_t(record.parts[1].data(), record.parts[1].size()),
+						zmq::message_t(payload.data(), payload.size())
+				});
+			}
+			else if (const char * family = _output_family(topic))
+			{
+				const std::string empty;
+				const std::string & payload = record.parts.size() > 2 ? record.parts[2] : empty;
+				recorded_outputs[family].push_back(output_print{topic, _fnv1a(payload.data(), payload.size())});
+			}
+		}
+	}
+}
+
+
+//! Сравнение исходящих сообщений. Возвращает количество разошедшихся семейств
+static int _compare_outputs(const output_prints_t & recorded, const output_prints_t & replayed)
+{
+	int retval = 0;
+	for (const char * family: {
+			ITS_GBUS_TOPIC_DOWNLINK_SDU, ITS_GBUS_TOPIC_UPLINK_SDU_EVENT, ITS_GBUS_TOPIC_UPLINK_FRAME
+	})
+	{
+		static const std::vector<output_print> none;
+		const auto recorded_itt = recorded.find(family);
+		const auto replayed_itt = replayed.find(family);
+		const auto & expected = recorded_itt != recorded.end() ? recorded_itt->second : none;
+		const auto & actual = replayed_itt != replayed.end() ? replayed_itt->second : none;
+
+		const auto mismatch = std::mismatch(expected.begin(), expected.end(), actual.begin(), actual.end());
+		if (mismatch.first == expected.end() && mismatch.second == actual.end())
+		{
+			std::printf("%-22s %10zu msgs, match\n", family, expected.size());
+			continue;
+		}
+
+		retval++;
+		const size_t index = std::distance(expected.begin(), mismatch.first);
+		std::printf("%-22s %10zu recorded, %10zu replayed, DIVERGED at #%zu", family,
+				expected.size(), actual.size(), index
+		);
+		if (mismatch.first != expected.end() && mismatch.second != actual.end())
+			std::printf(" (recorded %s, replayed %s)", mismatch.first->topic.c_str(), mismatch.second->topic.c_str());
+		std::printf("\n");
+	}
+
+	return retval;
+}
+
+
+int main(int argc, char ** argv)
+{
+	namespace po = boost::program_options;
+
+	std::vector<std::string> paths;
+	double speed = 0;
+	size_t uplink_window = 1;
+	bool batch_events = false;
+
+	po::options_description options("server-uslp replay benchmark");
+	options.add_options()
+		("help,h", "this message")
+		("speed", po::value(&speed)->default_value(speed),
+				"replay speed relative to the recording. 0 - as fast as possible")
+		("uplink-window", po::value(&uplink_window)->default_value(uplink_window),
+				"same as ITS_USLP_UPLINK_WINDOW of the recorded server")
+		("batch-events", po::bool_switch(&batch_events),
+				"publish uplink SDU events in batches (ITS_USLP_SDU_EVENTS=batch)")
+		("logs", po::value(&paths)->multitoken(), "its-broker-log-*.zmq-log files in replay order")
+	;
+	// Код возврата 2 - исходящие сообщения разошлись с записанными
+	po::positional_options_description positional;
+	positional.add("logs", -1);
+
+	po::variables_map vm;
+	po::store(po::command_line_parser(argc, argv).options(options).positional(positional).run(), vm);
+	po::notify(vm);
+	if (vm.count("help") || paths.empty())
+	{
+		std::cout << options << std::endl;
+		return paths.empty() ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	// Сервер много пишет в лог на каждое сообщение, нам это мерять не нужно
+	setenv("ITS_LOG_LEVEL", "error", 0);
+	setup_log();
+
+	std::vector<replay_message> inputs;
+	output_prints_t recorded_outputs;
+	_load_logs(paths, inputs, recorded_outputs);
+	if (inputs.empty())
+	{
+		LOG(error) << "there is no server-uslp input messages in the logs";
+		return EXIT_FAILURE;
+	}
+
+	// Сокеты bus_io не подключены, он тут только для разбора сообщений
+	zmq::context_t ctx;
+	bus_io io(ctx);
+	recording_output output;
+
+	ostack ost;
+	istack ist;
+	dispatcher d(ist, ost, io, output);
+	d.uplink().frame_done_timeout(std::chrono::milliseconds(5000));
+	d.uplink().uplink_window(uplink_window);
+	if (batch_events)
+		d.uplink().event_publishing(uplink_pipeline::event_publishing_t::batch);
+
+	std::array<message_costs, std::variant_size_v<bus_input_message>> costs;
+	message_costs rejected_costs;
+	rejected_costs.name = "unparsed";
+
+	bus_input_message message;
+	const auto start = std::chrono::steady_clock::now();
+	for (auto & input: inputs)
+	{
+		if (speed > 0)
+		{
+			const auto offset = std::chrono::duration<double>((input.time - inputs.front().time) / speed);
+			std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::nanoseconds>(offset));
+		}
+
+		const auto message_start = std::chrono::steady_clock::now();
+		const bool parsed = io.parse_message(input.topic, input.metadata, input.payload, message);
+		if (parsed)
+		{
+			d.dispatch(message);
+			d.uplink().clear_frames_queue();
+			d.uplink().flush_events();
+		}
+		const auto message_end = std::chrono::steady_clock::now();
+
+		const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(message_end - message_start).count();
+		auto & message_costs = parsed ? costs[message.index()] : rejected_costs;
+		if (parsed)
+			message_costs.name = to_string(message);
+		message_costs.ns.push_back(ns);
+	}
+	const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	const double recorded_span = inputs.back().time - inputs.front().time;
+	std::printf("replayed %zu messages in %.3f s (recorded over %.1f s): %.0f msgs/s\n",
+			inputs.size(), elapsed, recorded_span, inputs.size() / elapsed
+	);
+
+	for (const auto & message_costs: costs)
+		message_costs.print();
+	rejected_costs.print();
+
+	std::printf("\n");
+	const int diverged = _compare_outputs(recorded_outputs, output.prints());
+	return diverged ? 2 : EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+#include "zmq_log.hpp"
+
+#include <array>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+
+#define ZMQ_LOG_MAGIC "ZMQLOG"
+#define ZMQ_LOG_MAGIC_SIZE (sizeof(ZMQ_LOG_MAGIC) - 1)
+
+
+//! Числа в файле в little endian независимо от платформы
+template <typename T>
+static T _unpack_le(const uint8_t * data)
+{
+	T retval = 0;
+	for (size_t i = 0; i < sizeof(T); i++)
+		retval |= static_cast<T>(data[i]) << (8 * i);
+
+	return retval;
+}
+
+
+zmq_log_reader::zmq_log_reader(const std::string & path)
+	: _path(path), _stream(path, std::ios::binary)
+{
+	if (!_stream)
+		throw std::runtime_error("unable to open zmq log file " + path);
+
+	_probe_version();
+}
+
+
+bool zmq_log_reader::read(zmq_log_record & record)
+{
+	// Первичный заголовок: время и количество частей
+	std::array<uint8_t, 16> header;
+	const size_t header_size = (0 == _version) ? 8 + 4 : 8 + 4 + 4;
+	if (!_read_bytes(header.data(), 1))
+		return false; // Честный конец файла
+
+	if (!_read_bytes(header.data() + 1, header_size - 1))
+		throw std::runtime_error("unexpected EOF in primary header of " + _path);
+
+	uint32_t parts_count;
+	if (0 == _version)
+	{
+		record.time = static_cast<double>(_unpack_le<uint64_t>(header.data()));
+		parts_count = _unpack_le<uint32_t>(header.data() + 8);
+	}
+	else
+	{
+		const uint64_t time_s = _unpack_le<uint64_t>(header.data());
+		const uint32_t time_us = _unpack_le<uint32_t>(header.data() + 8);
+		record.time = static_cast<double>(time_s) + time_us / 1e6;
+		parts_count = _unpack_le<uint32_t>(header.data() + 12);
+	}
+
+	// Вторичный заголовок: размеры частей
+	std::vector<uint8_t> sizes_bytes(parts_count * 4);
+	if (!_read_bytes(sizes_bytes.data(), sizes_bytes.size()))
+		throw std::runtime_error("unexpected EOF in secondary header of " + _path);
+
+	record.parts.resize(parts_count);
+	for (uint32_t i = 0; i < parts_count; i++)
+	{
+		auto & part = record.parts[i];
+		part.resize(_unpack_le<uint32_t>(sizes_bytes.data() + i * 4));
+		if (!_read_bytes(part.data(), part.size()))
+			throw std::runtime_error("unexpected EOF in message body of " + _path);
+	}
+
+	return true;
+}
+
+
+void zmq_log_reader::_probe_version()
+{
+	std::array<uint8_t, ZMQ_LOG_MAGIC_SIZE + 4> header;
+	if (_read_bytes(header.data(), header.size())
+			&& 0 == std::memcmp(header.data(), ZMQ_LOG_MAGIC, ZMQ_LOG_MAGIC_SIZE)
+	)
+	{
+		_version = _unpack_le<uint32_t>(header.data() + ZMQ_LOG_MAGIC_SIZE);
+	}
+	else
+	{
+		// У нулевой версии заголовка файла нет вовсе
+		_stream.clear();
+		_stream.seekg(0);
+		_version = 0;
+	}
+
+	if (_version != 0 && _version != 1)
+		throw std::runtime_error("unsupported zmq log version " + std::to_string(_version) + " in " + _path);
+}
+
+
+bool zmq_log_reader::_read_bytes(void * data, size_t size)
+{
+	if (0 == size)
+		return true;
+
+	_stream.read(static_cast<char*>(data), size);
+	return static_cast<size_t>(_stream.gcount()) == size;
+}
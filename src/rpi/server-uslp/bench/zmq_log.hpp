@@ -0,0 +1,42 @@
+#ifndef ITS_SERVER_USLP_BENCH_ZMQ_LOG_HPP_
+#define ITS_SERVER_USLP_BENCH_ZMQ_LOG_HPP_
+
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+
+//! Запись лога брокера: время приёма и части мультипарт сообщения
+struct zmq_log_record
+{
+	//! posix время в секундах
+	double time = 0;
+	std::vector<std::string> parts;
+};
+
+
+//! Чтение .zmq-log файлов брокера
+/*! Формат описан в src/zmq/its_logfile.py, поддерживаются версии 0 и 1 */
+class zmq_log_reader
+{
+public:
+	explicit zmq_log_reader(const std::string & path);
+
+	int version() const { return _version; }
+
+	//! Чтение очередной записи. false, если файл кончился
+	/*! Кидает исключение, если файл обрывается посреди записи */
+	bool read(zmq_log_record & record);
+
+private:
+	void _probe_version();
+	bool _read_bytes(void * data, size_t size);
+
+	std::string _path;
+	std::ifstream _stream;
+	int _version = 0;
+};
+
+
+#endif /* ITS_SERVER_USLP_BENCH_ZMQ_LOG_HPP_ */
@@ -2,11 +2,17 @@
 
 
 #include "log.hpp"
+#include "stack.hpp"
 #include "json.hpp"
 
 #include <thread>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <utility>
+#include <algorithm>
 
-#include <boost/algorithm/string.hpp>
+#include <gbus_meta.h>
 
 #include <ccsds/uslp/events.hpp>
 #include <ccsds/uslp/common/ids_io.hpp>
@@ -15,15 +21,6 @@
 static auto _slg = build_source("bus-io");
 
 
-#define ITS_GBUS_TOPIC_DOWNLINK_SDU "uslp.downlink_sdu"
-#define ITS_GBUS_TOPIC_UPLINK_SDU_REQUEST "uslp.uplink_sdu_request"
-#define ITS_GBUS_TOPIC_UPLINK_SDU_EVENT "uslp.uplink_sdu_event"
-
-#define ITS_GBUS_TOPIC_UPLINK_FRAME "radio.uplink_frame"
-#define ITS_GBUS_TOPIC_DOWNLINK_FRAME "radio.downlink_frame"
-#define ITS_GBUS_TOPIC_UPLINK_STATE "radio.uplink_state"
-
-
 namespace nlohmann {
 
 	template <class T>
@@ -126,6 +123,7 @@ static std::string _uplink_sdu_event_kind_to_string(sdu_uplink_event::event_kind
 	case sdu_uplink_event::event_kind_t::sdu_sent_to_radio: return "sdu_sent_to_radio";
 	case sdu_uplink_event::event_kind_t::sdu_radiated: return "sdu_radiated";
 	case sdu_uplink_event::event_kind_t::sdu_radiation_failed: return "sdu_radiation_failed";
+	case sdu_uplink_event::event_kind_t::sdu_expired: return "sdu_expired";
 	};
 
 	std::stringstream error;
@@ -134,70 +132,200 @@ static std::string _uplink_sdu_event_kind_to_string(sdu_uplink_event::event_kind
 }
 
 
-static std::string _channel_id_to_topic(const std::string & topic_base, ccsds::uslp::gmapid_t ch_id)
+bool _starts_with(std::string_view left, std::string_view right)
 {
-	std::stringstream stream;
-	stream << topic_base << "."
-		<< static_cast<int>(ch_id.sc_id()) << "."
-		<< static_cast<int>(ch_id.vchannel_id()) << "."
-		<< static_cast<int>(ch_id.map_id())
-	;
-	return stream.str();
+	if (left.size() < right.size())
+		return false;
+
+	const std::string_view left_in_size_of_right = left.substr(0, right.size());
+	return left_in_size_of_right == right;
 }
 
 
-static ccsds::uslp::gmapid_t _channel_id_from_topic(const std::string_view topic)
+static gbus_meta_t _make_binary_meta(gbus_meta_type_t type)
 {
-	std::vector<std::string> parts;
-	boost::algorithm::split(parts, topic, boost::is_any_of("."), boost::token_compress_on);
+	const auto now = std::chrono::system_clock::now().time_since_epoch();
+	const auto now_s = std::chrono::duration_cast<std::chrono::seconds>(now);
+	const auto now_us = std::chrono::duration_cast<std::chrono::microseconds>(now - now_s);
+
+	gbus_meta_t retval;
+	std::memset(&retval, 0x00, sizeof(retval));
+	retval.type = type;
+	retval.time_s = now_s.count();
+	retval.time_us = now_us.count();
+	return retval;
+}
 
-	if (parts.size() < 3)
-		throw std::invalid_argument("bad topic for channel id extraction: " + std::string(topic));
 
-	try
-	{
-		const int sc_id = std::stoi(parts[parts.size()-3], 0, 0);
-		const int vc_id = std::stoi(parts[parts.size()-2], 0, 0);
-		const int map_id = std::stoi(parts[parts.size()-1], 0, 0);
-		return ccsds::uslp::gmapid_t(sc_id, vc_id, map_id);
-	}
-	catch (std::exception & e)
+static const gbus_meta_t & _expect_binary_meta(const gbus_meta_t & meta, gbus_meta_type_t type)
+{
+	if (meta.type != type)
 	{
-		std::throw_with_nested(
-				std::invalid_argument("bad topic for channel id extraction: " + std::string(topic))
-		);
+		std::stringstream error;
+		error << "unexpected binary metadata type " << static_cast<int>(meta.type) << ", "
+				<< "expected " << static_cast<int>(type);
+		throw std::runtime_error(error.str());
 	}
+
+	return meta;
 }
 
-bool _starts_with(std::string_view left, std::string_view right)
+
+static uint8_t _qos_to_binary(ccsds::uslp::qos_t qos)
 {
-	if (left.size() < right.size())
-		return false;
+	if (ccsds::uslp::qos_t::EXPEDITED == qos)
+		return GBUS_META_QOS_EXPEDITED;
+	else if (ccsds::uslp::qos_t::SEQUENCE_CONTROLLED == qos)
+		return GBUS_META_QOS_SEQUENCE_CONTROLLED;
+	else
+		throw std::invalid_argument("invalid qos enum value");
+}
 
-	const std::string_view left_in_size_of_right = left.substr(0, right.size());
-	return left_in_size_of_right == right;
+
+static ccsds::uslp::qos_t _qos_from_binary(uint8_t qos)
+{
+	if (GBUS_META_QOS_EXPEDITED == qos)
+		return ccsds::uslp::qos_t::EXPEDITED;
+	else if (GBUS_META_QOS_SEQUENCE_CONTROLLED == qos)
+		return ccsds::uslp::qos_t::SEQUENCE_CONTROLLED;
+	else
+		throw std::invalid_argument("invalid qos binary value " + std::to_string(qos));
+}
+
+
+static uint32_t _downlink_sdu_flags_to_binary(uint64_t flags)
+{
+	using ccsds::uslp::acceptor_event_map_sdu;
+
+	uint32_t retval = 0;
+	if (flags & acceptor_event_map_sdu::INCOMPLETE) retval |= GBUS_META_SDU_FLAG_INCOMPLETE;
+	if (flags & acceptor_event_map_sdu::IDLE) retval |= GBUS_META_SDU_FLAG_IDLE;
+	if (flags & acceptor_event_map_sdu::CORRUPTED) retval |= GBUS_META_SDU_FLAG_CORRUPTED;
+	if (flags & acceptor_event_map_sdu::MAPA) retval |= GBUS_META_SDU_FLAG_MAPA;
+	if (flags & acceptor_event_map_sdu::MAPP) retval |= GBUS_META_SDU_FLAG_MAPP;
+	if (flags & acceptor_event_map_sdu::STRAY) retval |= GBUS_META_SDU_FLAG_STRAY;
+	return retval;
 }
 
 
+static uint8_t _uplink_sdu_event_kind_to_binary(sdu_uplink_event::event_kind_t kind)
+{
+	switch (kind)
+	{
+	case sdu_uplink_event::event_kind_t::sdu_accepted: return GBUS_META_SDU_ACCEPTED;
+	case sdu_uplink_event::event_kind_t::sdu_rejected: return GBUS_META_SDU_REJECTED;
+	case sdu_uplink_event::event_kind_t::sdu_sent_to_radio: return GBUS_META_SDU_SENT_TO_RADIO;
+	case sdu_uplink_event::event_kind_t::sdu_radiated: return GBUS_META_SDU_RADIATED;
+	case sdu_uplink_event::event_kind_t::sdu_radiation_failed: return GBUS_META_SDU_RADIATION_FAILED;
+	case sdu_uplink_event::event_kind_t::sdu_expired: return GBUS_META_SDU_EXPIRED;
+	};
+
+	std::stringstream error;
+	error << "invalid SDU uplink event kind: \"" << std::to_string(static_cast<int>(kind)) << "\"";
+	throw std::invalid_argument(error.str());
+}
+
+
+//! Метаданные исходящего сообщения в одном из форматов
+class metadata_buffer
+{
+public:
+	void assign(const nlohmann::json & j)
+	{
+		_json = j.dump();
+		_buffer = zmq::const_buffer(_json.data(), _json.size());
+	}
+
+	void assign(const gbus_meta_t & meta)
+	{
+		const size_t size = gbus_meta_encode(&meta, _binary.data(), _binary.size());
+		if (0 == size)
+			throw std::runtime_error("unable to encode binary metadata");
+
+		_buffer = zmq::const_buffer(_binary.data(), size);
+	}
+
+	zmq::const_buffer buffer() const { return _buffer; }
+
+private:
+	std::string _json;
+	std::array<uint8_t, GBUS_META_MAX_SIZE> _binary;
+	zmq::const_buffer _buffer;
+};
+
+
 // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 
 
 struct preparsed_message
 {
-	const nlohmann::json & metadata;
-	const std::vector<uint8_t> && payload;
+	//! Метаданные, если они пришли в JSON
+	const nlohmann::json * json;
+	//! Метаданные, если они пришли в бинарном формате
+	const gbus_meta_t * binary;
+	zmq::message_t & payload;
 };
 
 
 bus_io::bus_io(zmq::context_t & ctx)
-	: _ctx(ctx), _pub_socket(), _sub_socket()
+	: _ctx(ctx), _pub_socket(), _sub_socket(),
+	  _downlink_sdu_topics(ITS_GBUS_TOPIC_DOWNLINK_SDU),
+	  _uplink_sdu_event_topics(ITS_GBUS_TOPIC_UPLINK_SDU_EVENT)
+{
+	radio_topics({pchannel_config()});
+}
+
+
+void bus_io::radio_topics(const std::vector<pchannel_config> & pchannels)
+{
+	_radio_topics.clear();
+	_downlink_sources.clear();
+	_downlink_sdu_topics.clear();
+	_uplink_sdu_event_topics.clear();
+	for (size_t pchannel = 0; pchannel < pchannels.size(); pchannel++)
+	{
+		const auto & config = pchannels[pchannel];
+		_downlink_sdu_topics.intern(config.sc_id, config.downlink_vchannel_id);
+		_uplink_sdu_event_topics.intern(config.sc_id, config.uplink_vchannel_id);
+		_radio_topics.push_back(radio_topics_t{
+			config.radio_topic + ITS_GBUS_SUFFIX_UPLINK_FRAME,
+			config.radio_topic + ITS_GBUS_SUFFIX_UPLINK_STATE
+		});
+
+		std::vector<std::string> prefixes = {config.radio_topic};
+		prefixes.insert(prefixes.end(), config.downlink_receivers.begin(), config.downlink_receivers.end());
+		for (const auto & prefix: prefixes)
+		{
+			for (const auto & source: _downlink_sources)
+			{
+				if (source.prefix == prefix)
+					throw std::runtime_error("downlink frames of \"" + prefix + "\" are claimed by more than one receiver");
+			}
+
+			_downlink_sources.push_back(downlink_source_t{
+				prefix, prefix + ITS_GBUS_SUFFIX_DOWNLINK_FRAME, pchannel
+			});
+		}
+	}
+}
+
+
+std::vector<std::string> bus_io::downlink_sources() const
 {
+	std::vector<std::string> retval;
+	for (const auto & source: _downlink_sources)
+		retval.push_back(source.prefix);
+
+	return retval;
 }
 
 
 void bus_io::connect_bpcs(const std::string & endpoint)
 {
+	if (_sub_watch >= 0)
+		_reactor.remove(std::exchange(_sub_watch, -1));
+
 	_sub_socket = zmq::socket_t(_ctx, zmq::socket_type::sub);
 
 	LOG(info) << "connecting BPCS to \"" << endpoint << "\"";
@@ -205,8 +333,13 @@ void bus_io::connect_bpcs(const std::string & endpoint)
 
 	LOG(debug) << "subscribing to topics";
 	_sub_socket.set(zmq::sockopt::subscribe, ITS_GBUS_TOPIC_UPLINK_SDU_REQUEST);
-	_sub_socket.set(zmq::sockopt::subscribe, ITS_GBUS_TOPIC_DOWNLINK_FRAME);
-	_sub_socket.set(zmq::sockopt::subscribe, ITS_GBUS_TOPIC_UPLINK_STATE);
+	for (const auto & topics: _radio_topics)
+		_sub_socket.set(zmq::sockopt::subscribe, topics.uplink_state);
+
+	for (const auto & source: _downlink_sources)
+		_sub_socket.set(zmq::sockopt::subscribe, source.downlink_frame);
+
+	_sub_watch = _reactor.add_zmq(_sub_socket.handle());
 }
 
 
@@ -221,6 +354,9 @@ void bus_io::connect_bscp(const std::string & endpoint)
 
 void bus_io::close()
 {
+	if (_sub_watch >= 0)
+		_reactor.remove(std::exchange(_sub_watch, -1));
+
 	_pub_socket.close();
 	_sub_socket.close();
 }
@@ -230,23 +366,37 @@ void bus_io::send_message(const sdu_downlink & message)
 {
 	LOG(trace) << "sending 'SDU accepted' bus message";
 
-	const std::string topic = _channel_id_to_topic(ITS_GBUS_TOPIC_DOWNLINK_SDU, message.gmapid);
+	const std::string_view topic = _downlink_sdu_topics.topic(message.gmapid);
 
-	nlohmann::json j;
-	j["sc_id"] = message.gmapid.mcid().sc_id();
-	j["vchannel_id"] = message.gmapid.vchannel_id();
-	j["map_id"] = message.gmapid.map_id();
-
-	j["qos"] = _qos_to_string(message.qos);
-	j["flags"] = _downlink_sdu_flags_to_string(message.flags);
-
-	std::string metadata = j.dump();
+	metadata_buffer metadata;
+	if (_binary_metadata)
+	{
+		gbus_meta_t meta = _make_binary_meta(GBUS_META_DOWNLINK_SDU);
+		auto & m = meta.body.downlink_sdu;
+		m.sc_id = message.gmapid.mcid().sc_id();
+		m.vchannel_id = message.gmapid.vchannel_id();
+		m.map_id = message.gmapid.map_id();
+		m.qos = _qos_to_binary(message.qos);
+		m.flags = _downlink_sdu_flags_to_binary(message.flags);
+		metadata.assign(meta);
+	}
+	else
+	{
+		nlohmann::json j;
+		j["sc_id"] = message.gmapid.mcid().sc_id();
+		j["vchannel_id"] = message.gmapid.vchannel_id();
+		j["map_id"] = message.gmapid.map_id();
+
+		j["qos"] = _qos_to_string(message.qos);
+		j["flags"] = _downlink_sdu_flags_to_string(message.flags);
+		metadata.assign(j);
+	}
 
 	const std::vector<uint8_t> & data = message.data;
 
 	// Фигачим в сокет!
 	_pub_socket.send(zmq::const_buffer(topic.data(), topic.size()), zmq::send_flags::sndmore);
-	_pub_socket.send(zmq::const_buffer(metadata.data(), metadata.size()), zmq::send_flags::sndmore);
+	_pub_socket.send(metadata.buffer(), zmq::send_flags::sndmore);
 	_pub_socket.send(zmq::const_buffer(data.data(), data.size()));
 }
 
@@ -255,23 +405,112 @@ void bus_io::send_message(const sdu_uplink_event & message)
 {
 	LOG(trace) << "sending uplink sdu event bus message";
 
-	const std::string topic = _channel_id_to_topic(ITS_GBUS_TOPIC_UPLINK_SDU_EVENT, message.gmapid);
+	const std::string_view topic = _uplink_sdu_event_topics.topic(message.gmapid);
+
+	metadata_buffer metadata;
+	if (_binary_metadata)
+	{
+		gbus_meta_t meta = _make_binary_meta(GBUS_META_UPLINK_SDU_EVENT);
+		auto & m = meta.body.uplink_sdu_event;
+		m.sc_id = message.gmapid.mcid().sc_id();
+		m.vchannel_id = message.gmapid.vchannel_id();
+		m.map_id = message.gmapid.map_id();
+		m.cookie = message.part_cookie.cookie;
+		m.part_no = message.part_cookie.part_no;
+		m.is_final_part = message.part_cookie.final;
+		m.event = _uplink_sdu_event_kind_to_binary(message.event_kind);
+		m.comment = message.comment.data();
+		m.comment_size = std::min<size_t>(message.comment.size(), GBUS_META_MAX_COMMENT_SIZE);
+		metadata.assign(meta);
+	}
+	else
+	{
+		nlohmann::json j;
+		j["sc_id"] = message.gmapid.mcid().sc_id();
+		j["vchannel_id"] = message.gmapid.vchannel_id();
+		j["map_id"] = message.gmapid.map_id();
+
+		auto cookie = nlohmann::json();
+		cookie["cookie"] = message.part_cookie.cookie;
+		cookie["part_no"] = message.part_cookie.part_no;
+		cookie["is_final_part"] = message.part_cookie.final;
+		j["cookie"] = std::move(cookie);
+		j["event"] = _uplink_sdu_event_kind_to_string(message.event_kind);
+		j["comment"] = message.comment;
+		metadata.assign(j);
+	}
+	// данных тут нет.
+
+	// В сокет!
+	_pub_socket.send(zmq::const_buffer(topic.data(), topic.size()), zmq::send_flags::sndmore);
+	_pub_socket.send(metadata.buffer());
+}
+
+
+void bus_io::send_message(const radio_uplink_frame & message)
+{
+	LOG(trace) << "sending uplink frame bus message";
+
+	const std::string & topic = _radio_topics.at(message.pchannel).uplink_frame;
+
+	metadata_buffer metadata;
+	if (_binary_metadata)
+	{
+		gbus_meta_t meta = _make_binary_meta(GBUS_META_UPLINK_FRAME);
+		meta.body.uplink_frame.cookie = message.frame_cookie;
+		metadata.assign(meta);
+	}
+	else
+	{
+		nlohmann::json j;
+		j["cookie"] = message.frame_cookie;
+		metadata.assign(j);
+	}
+
+	// В сокет!
+	_pub_socket.send(zmq::const_buffer(topic.data(), topic.size()), zmq::send_flags::sndmore);
+	_pub_socket.send(metadata.buffer(), zmq::send_flags::sndmore);
+	_pub_socket.send(zmq::const_buffer(message.data.data(), message.data.size()));
+}
+
+
+void bus_output::send_message(const bus_output_message & message)
+{
+	std::visit([this](const auto & m) { send_message(m); }, message);
+}
+
+
+void bus_io::send_message(const uplink_queue_state & message)
+{
+	LOG(trace) << "sending uplink queue state bus message";
+
+	const std::string topic = ITS_GBUS_TOPIC_UPLINK_QUEUE_STATE;
+
+	const auto now = std::chrono::system_clock::now().time_since_epoch();
+	const auto now_s = std::chrono::duration_cast<std::chrono::seconds>(now);
+	const auto now_us = std::chrono::duration_cast<std::chrono::microseconds>(now - now_s);
 
 	nlohmann::json j;
-	j["sc_id"] = message.gmapid.mcid().sc_id();
-	j["vchannel_id"] = message.gmapid.vchannel_id();
-	j["map_id"] = message.gmapid.map_id();
-
-	auto cookie = nlohmann::json();
-	cookie["cookie"] = message.part_cookie.cookie;
-	cookie["part_no"] = message.part_cookie.part_no;
-	cookie["is_final_part"] = message.part_cookie.final;
-	j["cookie"] = std::move(cookie);
-	j["event"] = _uplink_sdu_event_kind_to_string(message.event_kind);
-	j["comment"] = message.comment;
+	j["time_s"] = now_s.count();
+	j["time_us"] = now_us.count();
+
+	auto queues = nlohmann::json::array();
+	for (const auto & queue: message.queues)
+	{
+		auto jqueue = nlohmann::json();
+		jqueue["sc_id"] = queue.gmapid.mcid().sc_id();
+		jqueue["vchannel_id"] = queue.gmapid.vchannel_id();
+		jqueue["map_id"] = queue.gmapid.map_id();
+		jqueue["sdus"] = queue.sdus;
+		jqueue["bytes"] = queue.bytes;
+		jqueue["max_sdus"] = queue.max_sdus;
+		jqueue["max_bytes"] = queue.max_bytes;
+		jqueue["stacked_sdus"] = queue.stacked_sdus;
+		queues.push_back(std::move(jqueue));
+	}
+	j["queues"] = std::move(queues);
 
 	const std::string metadata = j.dump();
-	// данных тут нет.
 
 	// В сокет!
 	_pub_socket.send(zmq::const_buffer(topic.data(), topic.size()), zmq::send_flags::sndmore);
@@ -279,24 +518,96 @@ void bus_io::send_message(const sdu_uplink_event & message)
 }
 
 
-void bus_io::send_message(const radio_uplink_frame & message)
+void bus_io::send_message(const sdu_uplink_event_batch & message)
 {
-	LOG(trace) << "sending uplink frame bus message";
+	LOG(trace) << "sending batch of " << message.events.size() << " uplink sdu events";
 
-	const std::string topic = ITS_GBUS_TOPIC_UPLINK_FRAME;
+	const std::string topic = ITS_GBUS_TOPIC_UPLINK_EVENT_BATCH;
+
+	auto events = nlohmann::json::array();
+	for (const auto & event: message.events)
+	{
+		auto jevent = nlohmann::json();
+		jevent["sc_id"] = event.gmapid.mcid().sc_id();
+		jevent["vchannel_id"] = event.gmapid.vchannel_id();
+		jevent["map_id"] = event.gmapid.map_id();
+
+		auto cookie = nlohmann::json();
+		cookie["cookie"] = event.part_cookie.cookie;
+		cookie["part_no"] = event.part_cookie.part_no;
+		cookie["is_final_part"] = event.part_cookie.final;
+		jevent["cookie"] = std::move(cookie);
+		jevent["event"] = _uplink_sdu_event_kind_to_string(event.event_kind);
+		jevent["comment"] = event.comment;
+		events.push_back(std::move(jevent));
+	}
 
 	nlohmann::json j;
-	j["cookie"] = message.frame_cookie;
+	j["events"] = std::move(events);
 	const std::string metadata = j.dump();
 
 	// В сокет!
 	_pub_socket.send(zmq::const_buffer(topic.data(), topic.size()), zmq::send_flags::sndmore);
-	_pub_socket.send(zmq::const_buffer(metadata.data(), metadata.size()), zmq::send_flags::sndmore);
-	_pub_socket.send(zmq::const_buffer(message.data.data(), message.data.size()));
+	_pub_socket.send(zmq::const_buffer(metadata.data(), metadata.size()));
 }
 
 
-std::unique_ptr<bus_input_message> bus_io::recv_message()
+void bus_io::send_message(const uslp_stats::report & message)
+{
+	LOG(trace) << "sending stats bus message";
+
+	const std::string topic = ITS_GBUS_TOPIC_STATS;
+
+	const auto now = std::chrono::system_clock::now().time_since_epoch();
+	const auto now_s = std::chrono::duration_cast<std::chrono::seconds>(now);
+	const auto now_us = std::chrono::duration_cast<std::chrono::microseconds>(now - now_s);
+
+	nlohmann::json j;
+	j["time_s"] = now_s.count();
+	j["time_us"] = now_us.count();
+	j["interval_ms"] = message.interval.count();
+
+	auto counters = nlohmann::json::object();
+	for (size_t i = 0; i < uslp_stats::counters_count; i++)
+		counters[to_string(static_cast<uslp_stats::counter_t>(i))] = message.counters[i];
+	j["counters"] = std::move(counters);
+
+	auto latencies = nlohmann::json::object();
+	for (size_t i = 0; i < uslp_stats::stages_count; i++)
+	{
+		const latency_summary & summary = message.latencies[i];
+		auto stage = nlohmann::json();
+		stage["count"] = summary.count;
+		stage["min"] = summary.min;
+		stage["mean"] = summary.mean;
+		stage["p50"] = summary.p50;
+		stage["p90"] = summary.p90;
+		stage["p99"] = summary.p99;
+		stage["p999"] = summary.p999;
+		stage["max"] = summary.max;
+		latencies[to_string(static_cast<uslp_stats::stage_t>(i))] = std::move(stage);
+	}
+	j["latency_us"] = std::move(latencies);
+
+	auto sources = nlohmann::json::object();
+	for (const auto & source: message.sources)
+	{
+		auto jsource = nlohmann::json::object();
+		for (size_t i = 0; i < uslp_stats::source_counters_count; i++)
+			jsource[to_string(static_cast<uslp_stats::source_counter_t>(i))] = source.counters[i];
+		sources[source.name] = std::move(jsource);
+	}
+	j["downlink_sources"] = std::move(sources);
+
+	const std::string metadata = j.dump();
+
+	// В сокет!
+	_pub_socket.send(zmq::const_buffer(topic.data(), topic.size()), zmq::send_flags::sndmore);
+	_pub_socket.send(zmq::const_buffer(metadata.data(), metadata.size()));
+}
+
+
+bool bus_io::recv_message(bus_input_message & message)
 {
 	zmq::message_t topic_msg;
 	zmq::message_t metadata_msg;
@@ -307,11 +618,9 @@ std::unique_ptr<bus_input_message> bus_io::recv_message()
 	if (0 == result)
 	{
 		LOG(error) << "got empty topic message";
-		return nullptr;
+		return false;
 	}
 
-	const std::string topic(reinterpret_cast<char*>(topic_msg.data()), topic_msg.size());
-	LOG(trace) << "got msg topic \"" << topic << "\"";
 	if (!topic_msg.more())
 	{
 		LOG(error) << "there is no zmq message parts after topic";
@@ -323,24 +632,18 @@ std::unique_ptr<bus_input_message> bus_io::recv_message()
 	if (0 == result)
 	{
 		LOG(error) << "got empty message metadata";;
-		return nullptr;
+		return false;
 	}
-	const std::string raw_metadata(reinterpret_cast<char*>(metadata_msg.data()), metadata_msg.size());
-	LOG(trace) << "raw metadata as follows " << raw_metadata;
-	const auto metadata = nlohmann::json::parse(raw_metadata);
 
 	// Гребем пейлоад, если он есть
-	std::vector<uint8_t> payload;
+	// Сами байты остаются в payload_msg и уезжают в сообщение вместе с ним
 	if (metadata_msg.more())
 	{
 		result = _sub_socket.recv(payload_msg);
 		if (result > 0)
 		{
 			// Ну тут уже никак не проверяем
-			const auto * data_begin = reinterpret_cast<const uint8_t*>(payload_msg.data());
-			const auto * data_end = data_begin + payload_msg.size();;
-			payload.assign(data_begin, data_end);
-			LOG(trace) << "got payload of size " << payload.size();
+			LOG(trace) << "got payload of size " << payload_msg.size();
 		}
 		else
 		{
@@ -353,160 +656,313 @@ std::unique_ptr<bus_input_message> bus_io::recv_message()
 	}
 
 	// Сливаем что там осталось
-	zmq::message_t flush = std::move(payload_msg);
-	while(flush.more())
+	if (payload_msg.more())
 	{
-		LOG(warning) << "flushing extra message data";
-		auto result = _sub_socket.recv(flush);
+		zmq::message_t flush;
+		do
+		{
+			LOG(warning) << "flushing extra message data";
+			auto result = _sub_socket.recv(flush);
+		} while(flush.more());
 	}
 
-	std::unique_ptr<bus_input_message> retval;
-	try
+	return parse_message(topic_msg, metadata_msg, payload_msg, message);
+}
+
+
+bool bus_io::parse_radio_message(
+		std::string_view topic,
+		const preparsed_message & preparsed,
+		bus_input_message & message
+)
+{
+	// Радио и приёмников обычно одно-два, так что просто перебираем
+	for (size_t source = 0; source < _downlink_sources.size(); source++)
 	{
-		if (_starts_with(topic, ITS_GBUS_TOPIC_UPLINK_SDU_REQUEST))
-		{
-			retval = parse_sdu_uplink_request_message(topic, preparsed_message{metadata, std::move(payload)});
-			LOG(debug) << "got an uplink sdu request message";
-		}
-		else if (topic == ITS_GBUS_TOPIC_DOWNLINK_FRAME)
+		if (topic == _downlink_sources[source].downlink_frame)
 		{
-			retval = parse_downlink_frame_message(preparsed_message{metadata, std::move(payload)});
+			auto & frame = message.emplace<radio_downlink_frame>();
+			parse_downlink_frame_message(preparsed, frame);
+			frame.pchannel = _downlink_sources[source].pchannel;
+			frame.source = source;
 			LOG(debug) << "got a downlink frame message";
+			return true;
 		}
-		else if (topic == ITS_GBUS_TOPIC_UPLINK_STATE)
+	}
+
+	for (size_t pchannel = 0; pchannel < _radio_topics.size(); pchannel++)
+	{
+		const auto & topics = _radio_topics[pchannel];
+		if (topic == topics.uplink_state)
 		{
-			retval = parse_radio_uplink_state_message(preparsed_message{metadata, std::move(payload)});
+			auto & state = message.emplace<radio_uplink_state>();
+			parse_radio_uplink_state_message(preparsed, state);
+			state.pchannel = pchannel;
 			LOG(trace) << "got a radio uplink state message";
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+bool bus_io::parse_message(
+		const zmq::message_t & topic_msg,
+		const zmq::message_t & metadata_msg,
+		zmq::message_t & payload_msg,
+		bus_input_message & message
+)
+{
+	const auto recv_time = std::chrono::steady_clock::now();
+	if (_stats)
+		_stats->count(uslp_stats::counter_t::bus_messages_received);
+
+	// Топик и метаданные разбираем прямо в буферах zmq, без копирования в строки
+	const std::string_view topic(topic_msg.data<char>(), topic_msg.size());
+	LOG(trace) << "got msg topic \"" << topic << "\"";
+
+	const std::string_view raw_metadata(metadata_msg.data<char>(), metadata_msg.size());
+	const bool binary_metadata = gbus_meta_is_binary(metadata_msg.data(), metadata_msg.size());
+	if (!binary_metadata)
+		LOG(trace) << "raw metadata as follows " << raw_metadata;
+	else
+		LOG(trace) << "got binary metadata of size " << metadata_msg.size();
+
+	try
+	{
+		// Формат метаданных определяем по их первому байту
+		nlohmann::json json_metadata;
+		gbus_meta_t binary_metadata_value;
+		preparsed_message preparsed{nullptr, nullptr, payload_msg};
+		if (binary_metadata)
+		{
+			const int rc = gbus_meta_decode(
+					metadata_msg.data<uint8_t>(), metadata_msg.size(), &binary_metadata_value
+			);
+			if (0 != rc)
+				throw std::runtime_error("unable to decode binary metadata: " + std::to_string(rc));
+
+			preparsed.binary = &binary_metadata_value;
 		}
 		else
+		{
+			json_metadata = nlohmann::json::parse(raw_metadata.begin(), raw_metadata.end());
+			preparsed.json = &json_metadata;
+		}
+
+		// Сообщение собирается прямо в переданном экземпляре
+		if (_starts_with(topic, ITS_GBUS_TOPIC_UPLINK_SDU_REQUEST))
+		{
+			parse_sdu_uplink_request_message(topic, preparsed, message.emplace<sdu_uplink_request>());
+			LOG(debug) << "got an uplink sdu request message";
+		}
+		else if (!parse_radio_message(topic, preparsed, message))
 		{
 			LOG(error) << "unknown topic received";
-			retval = nullptr;
+			if (_stats)
+				_stats->count(uslp_stats::counter_t::bus_messages_rejected);
+			return false;
 		}
 	}
 	catch (std::exception & e)
 	{
 		LOG(error) << "unable to parse message of topic " << topic << ": " << e.what();
-		retval = nullptr;
+		if (_stats)
+			_stats->count(uslp_stats::counter_t::bus_messages_rejected);
+		return false;
 	}
 
-	return retval;
+	// Отсюда отсчитываются задержки всех следующих этапов
+	const auto parse_time = std::chrono::steady_clock::now();
+	std::visit([parse_time](auto & m) { m.parse_time = parse_time; }, message);
+	if (_stats)
+		_stats->record(uslp_stats::stage_t::bus_recv_to_parse, parse_time - recv_time);
+
+	return true;
 }
 
 
 bool bus_io::poll_sub_socket(std::chrono::milliseconds timeout)
 {
-	zmq::pollitem_t items[] = {
-			{ _sub_socket, 0, ZMQ_POLLIN, 0 }
-	};
+	// ZMQ_FD срабатывает по фронту и о сообщениях, недобранных
+	// диспетчером в прошлый раз, уже не скажет. Поэтому сперва смотрим сами
+	if (sub_socket_readable())
+		return true;
+
+	// Прерывание сигналом реактор ошибкой не считает, просто вернемся раньше
+	_reactor.run_once(timeout);
+	return sub_socket_readable();
+}
 
-	try
-	{
-		int rv = zmq::poll(items, sizeof(items)/sizeof(*items), timeout);
-		return rv > 0;
-	}
-	catch (zmq::error_t & e)
-	{
-		if (e.num() == EINTR)
-		{
-			LOG(info) << "poll interrupted by syscall";
-			return false;
-		}
 
-		// Все остальное кидаем выше
-		throw;
-	}
+bool bus_io::sub_socket_readable()
+{
+	// В отличии от zmq::poll здесь не делается системных вызовов,
+	// zmq просто сообщает есть ли в очереди сокета целое сообщение
+	const int events = _sub_socket.get(zmq::sockopt::events);
+	return events & ZMQ_POLLIN;
 }
 
 
-std::unique_ptr<sdu_uplink_request>
-bus_io::parse_sdu_uplink_request_message(
+void bus_io::parse_sdu_uplink_request_message(
 		std::string_view topic,
-		const preparsed_message & message
+		const preparsed_message & message,
+		sdu_uplink_request & retval
 )
 {
-	const ccsds::uslp::gmapid_t topic_ch_id = _channel_id_from_topic(topic);
+	const ccsds::uslp::gmapid_t topic_ch_id = topic_table::parse(topic);
 
 	// разгребаем выгребенное
-	const nlohmann::json & j = message.metadata;
-	const auto sc_id = _get_or_die<int>(j, "sc_id");
-	const auto vchannel_id = _get_or_die<int>(j, "vchannel_id");
-	const auto map_id = _get_or_die<int>(j, "map_id");
-	const auto qos = _qos_from_string(_get_or_die<std::string>(j, "qos"));
-	const auto cookie = _get_or_die<ccsds::uslp::payload_cookie_t>(j, "cookie");
+	int sc_id, vchannel_id, map_id;
+	ccsds::uslp::qos_t qos;
+	ccsds::uslp::payload_cookie_t cookie;
+	std::optional<std::chrono::milliseconds> ttl;
+	if (message.binary)
+	{
+		const auto & m = _expect_binary_meta(*message.binary, GBUS_META_UPLINK_SDU_REQUEST).body.uplink_sdu_request;
+		sc_id = m.sc_id;
+		vchannel_id = m.vchannel_id;
+		map_id = m.map_id;
+		qos = _qos_from_binary(m.qos);
+		cookie = m.cookie;
+		if (m.ttl_ms)
+			ttl = std::chrono::milliseconds(m.ttl_ms);
+	}
+	else
+	{
+		const nlohmann::json & j = *message.json;
+		sc_id = _get_or_die<int>(j, "sc_id");
+		vchannel_id = _get_or_die<int>(j, "vchannel_id");
+		map_id = _get_or_die<int>(j, "map_id");
+		qos = _qos_from_string(_get_or_die<std::string>(j, "qos"));
+		cookie = _get_or_die<ccsds::uslp::payload_cookie_t>(j, "cookie");
+
+		// Срок жизни можно задать относительным или абсолютным POSIX временем
+		const auto ttl_itt = j.find("ttl_ms");
+		if (ttl_itt != j.end() && !ttl_itt->is_null())
+			ttl = std::chrono::milliseconds(ttl_itt->get<int64_t>());
+
+		const auto deadline_itt = j.find("deadline_s");
+		if (deadline_itt != j.end() && !deadline_itt->is_null())
+		{
+			const auto deadline_us_itt = j.find("deadline_us");
+			const int64_t deadline_us = (deadline_us_itt != j.end() && !deadline_us_itt->is_null())
+					? deadline_us_itt->get<int64_t>() : 0
+			;
+			const auto deadline = std::chrono::seconds(deadline_itt->get<int64_t>())
+					+ std::chrono::microseconds(deadline_us)
+			;
+			const auto now = std::chrono::system_clock::now().time_since_epoch();
+			const auto deadline_ttl = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+			if (!ttl || deadline_ttl < *ttl)
+				ttl = deadline_ttl;
+		}
+	}
 
 	// Строим само сообщение
-	auto retval = std::make_unique<sdu_uplink_request>();
+	retval.gmapid.sc_id(sc_id);
+	retval.gmapid.vchannel_id(vchannel_id);
+	retval.gmapid.map_id(map_id);
+	retval.cookie = cookie;
+	retval.qos = qos;
+	retval.ttl = ttl;
 
-	retval->gmapid.sc_id(sc_id);
-	retval->gmapid.vchannel_id(vchannel_id);
-	retval->gmapid.map_id(map_id);
-	retval->cookie = cookie;
-	retval->qos = qos;
+	retval.data = bus_payload(std::move(message.payload));
 
-	retval->data = std::move(message.payload);
-
-	if (topic_ch_id != retval->gmapid)
+	if (topic_ch_id != retval.gmapid)
 	{
 		LOG(warning) << "channel id missmatch for sdu uplink request. "
-				<< "in topic: " << topic_ch_id << "; in metadata: " << retval->gmapid << " "
+				<< "in topic: " << topic_ch_id << "; in metadata: " << retval.gmapid << " "
 				<< "assuming right one in metadata"
 		;
 	}
-
-	return retval;
 }
 
 
-std::unique_ptr<radio_downlink_frame>
-bus_io::parse_downlink_frame_message(
-		const preparsed_message & message
+void bus_io::parse_downlink_frame_message(
+		const preparsed_message & message,
+		radio_downlink_frame & retval
 )
 {
 	// Разгребаем
-	const auto & j = message.metadata;
-	const bool checksum_valid = _get_or_die<bool>(j, "checksum_valid");
-	const uint64_t frame_no = _get_or_die<uint64_t>(j, "frame_no");
-	const auto cookie = _get_or_die<ccsds::uslp::payload_cookie_t >(j, "cookie");
+	bool checksum_valid;
+	std::optional<uint16_t> frame_no;
+	ccsds::uslp::payload_cookie_t cookie;
+	if (message.binary)
+	{
+		const auto & m = _expect_binary_meta(*message.binary, GBUS_META_DOWNLINK_FRAME).body.downlink_frame;
+		// Непроверенная сумма считается правильной, как и в JSON
+		checksum_valid = !(m.flags & GBUS_META_DF_CHECKSUM_KNOWN) || (m.flags & GBUS_META_DF_CHECKSUM_VALID);
+		if (m.flags & GBUS_META_DF_FRAME_NO_VALID)
+			frame_no = m.frame_no;
+		cookie = m.cookie;
+	}
+	else
+	{
+		const auto & j = *message.json;
+		// У SDR приёмника контрольной суммы нет вовсе, у радио она может быть не проверена (null)
+		const auto itt = j.find("checksum_valid");
+		checksum_valid = (itt == j.end() || itt->is_null()) ? true : _get_or_die<bool>(j, "checksum_valid");
+		// Номера фрейма радио может и не знать
+		const auto frame_no_itt = j.find("frame_no");
+		if (frame_no_itt != j.end() && !frame_no_itt->is_null())
+			frame_no = _get_or_die<uint16_t>(j, "frame_no");
+		cookie = _get_or_die<ccsds::uslp::payload_cookie_t >(j, "cookie");
+	}
 
 	// Формируем сообщение
-	auto retval = std::make_unique<radio_downlink_frame>();
-	retval->checksum_valid = checksum_valid;
-	retval->frame_no = frame_no;
-	retval->data = std::move(message.payload);
-	retval->frame_cookie = cookie;
-
-	return retval;
+	retval.checksum_valid = checksum_valid;
+	retval.frame_no = frame_no;
+	retval.data = bus_payload(std::move(message.payload));
+	retval.frame_cookie = cookie;
 }
 
 
-std::unique_ptr<radio_uplink_state>
-bus_io::parse_radio_uplink_state_message(
-		const preparsed_message & message
+void bus_io::parse_radio_uplink_state_message(
+		const preparsed_message & message,
+		radio_uplink_state & retval
 )
 {
-	const auto & j = message.metadata;
-	auto get_optional_cookie = [&j](const std::string & key) -> std::optional<uint64_t>
+	std::optional<uint64_t> cookie_in_wait, cookie_in_progress, cookie_sent, cookie_dropped;
+	if (message.binary)
 	{
-		const auto itt = j.find(key);
-		if (j.end() == itt || itt->is_null())
-			return {};
+		// В бинарном формате null изображается нулем
+		auto get_optional_cookie = [](uint64_t value) -> std::optional<uint64_t>
+		{
+			if (0 == value)
+				return {};
 
-		return itt->get<uint64_t>();
-	};
+			return value;
+		};
 
-	const auto cookie_in_wait = get_optional_cookie("cookie_in_wait");
-	const auto cookie_in_progress = get_optional_cookie("cookie_in_progress");
-	const auto cookie_sent = get_optional_cookie("cookie_sent");
-	const auto cookie_dropped = get_optional_cookie("cookie_dropped");
+		const auto & m = _expect_binary_meta(*message.binary, GBUS_META_UPLINK_STATE).body.uplink_state;
+		cookie_in_wait = get_optional_cookie(m.cookie_in_wait);
+		cookie_in_progress = get_optional_cookie(m.cookie_in_progress);
+		cookie_sent = get_optional_cookie(m.cookie_sent);
+		cookie_dropped = get_optional_cookie(m.cookie_dropped);
+	}
+	else
+	{
+		const auto & j = *message.json;
+		auto get_optional_cookie = [&j](const std::string & key) -> std::optional<uint64_t>
+		{
+			const auto itt = j.find(key);
+			if (j.end() == itt || itt->is_null())
+				return {};
 
-	// собираем объект
-	auto retval = std::make_unique<radio_uplink_state>();
-	retval->cookie_in_wait = cookie_in_wait;
-	retval->cookie_in_progress = cookie_in_progress;
-	retval->cookie_done = cookie_sent;
-	retval->cookie_failed = cookie_dropped;
+			return itt->get<uint64_t>();
+		};
 
-	return retval;
-}
+		cookie_in_wait = get_optional_cookie("cookie_in_wait");
+		cookie_in_progress = get_optional_cookie("cookie_in_progress");
+		cookie_sent = get_optional_cookie("cookie_sent");
+		cookie_dropped = get_optional_cookie("cookie_dropped");
+	}
 
+	// собираем объект
+	retval.cookie_in_wait = cookie_in_wait;
+	retval.cookie_in_progress = cookie_in_progress;
+	retval.cookie_done = cookie_sent;
+	retval.cookie_failed = cookie_dropped;
+}
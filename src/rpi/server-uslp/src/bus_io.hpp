@@ -2,52 +2,178 @@
 #define ITS_SERVER_USLP_SRC_BUS_IO_HPP_
 
 
-#include <memory>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <string_view>
 
 #include <zmq.hpp>
 
+#include <its_reactor.hpp>
+
 #include "bus_messages.hpp"
+#include "stats.hpp"
+#include "topic_table.hpp"
+
+
+#define ITS_GBUS_TOPIC_DOWNLINK_SDU "uslp.downlink_sdu"
+#define ITS_GBUS_TOPIC_UPLINK_SDU_REQUEST "uslp.uplink_sdu_request"
+#define ITS_GBUS_TOPIC_UPLINK_SDU_EVENT "uslp.uplink_sdu_event"
+#define ITS_GBUS_TOPIC_STATS "uslp.stats"
+#define ITS_GBUS_TOPIC_UPLINK_QUEUE_STATE "uslp.uplink_queue_state"
+//! Не начинается с ITS_GBUS_TOPIC_UPLINK_SDU_EVENT, чтобы старые подписчики его не получали
+#define ITS_GBUS_TOPIC_UPLINK_EVENT_BATCH "uslp.uplink_event_batch"
+
+#define ITS_GBUS_TOPIC_UPLINK_FRAME "radio.uplink_frame"
+#define ITS_GBUS_TOPIC_DOWNLINK_FRAME "radio.downlink_frame"
+#define ITS_GBUS_TOPIC_UPLINK_STATE "radio.uplink_state"
+
+//! Окончания топиков радио, у каждого радио свой префикс
+#define ITS_GBUS_SUFFIX_UPLINK_FRAME ".uplink_frame"
+#define ITS_GBUS_SUFFIX_DOWNLINK_FRAME ".downlink_frame"
+#define ITS_GBUS_SUFFIX_UPLINK_STATE ".uplink_state"
 
 
 struct preparsed_message;
+struct pchannel_config;
 
 
-class bus_io
+//! Куда тракты отправляют исходящие сообщения
+/*! Обычно это bus_io, но тракты можно прицепить к чему угодно - например
+ *  к бенчмарку, которому нужны сообщения, а не сокеты */
+class bus_output
+{
+public:
+	virtual ~bus_output() = default;
+
+	virtual void send_message(const sdu_downlink & message) = 0;
+	virtual void send_message(const sdu_uplink_event & message) = 0;
+	virtual void send_message(const radio_uplink_frame & message) = 0;
+	virtual void send_message(const uplink_queue_state & message) = 0;
+	virtual void send_message(const sdu_uplink_event_batch & message) = 0;
+	//! Публикация статистики сервера
+	virtual void send_message(const uslp_stats::report & message) = 0;
+
+	void send_message(const bus_output_message & message);
+};
+
+
+class bus_io: public bus_output
 {
 public:
 	bus_io(zmq::context_t & ctx);
 
+	//! Топики радио и приёмников физических каналов, по порядку их номеров
+	/*! По умолчанию одно радио с префиксом "radio". Задавать до connect_bpcs().
+	 *  Приёмники нумеруются подряд: сначала радио канала, потом его дополнительные
+	 *  приёмники, потом следующий канал. Заодно по номерам аппаратов и виртуальных
+	 *  каналов собираются топики исходящих SDU и их событий */
+	void radio_topics(const std::vector<pchannel_config> & pchannels);
+
+	//! Имена (префиксы топиков) приёмников даунлинк фреймов по их номерам
+	std::vector<std::string> downlink_sources() const;
+
 	void connect_bpcs(const std::string & endpoint);
 	void connect_bscp(const std::string & endpoint);
 
 	void close();
 
-	void send_message(const sdu_downlink & message);
-	void send_message(const sdu_uplink_event & message);
-	void send_message(const radio_uplink_frame & message);
-
-	std::unique_ptr<bus_input_message> recv_message();
+	//! Слать ли метаданные исходящих сообщений в бинарном формате вместо JSON
+	/*! Входящие сообщения принимаются в обоих форматах независимо от этой настройки */
+	void binary_metadata(bool value) { _binary_metadata = value; }
+	bool binary_metadata() const { return _binary_metadata; }
+
+	using bus_output::send_message;
+	virtual void send_message(const sdu_downlink & message) override;
+	virtual void send_message(const sdu_uplink_event & message) override;
+	virtual void send_message(const radio_uplink_frame & message) override;
+	//! Тоже всегда в JSON, как и статистика
+	virtual void send_message(const uplink_queue_state & message) override;
+	//! Пачка событий всегда в JSON - её размер не ограничен
+	virtual void send_message(const sdu_uplink_event_batch & message) override;
+	//! Статистика всегда уходит в JSON, это редкое сообщение
+	virtual void send_message(const uslp_stats::report & message) override;
+
+	//! Куда писать статистику приёма сообщений. nullptr - никуда
+	void stats(uslp_stats * value) { _stats = value; }
+
+	//! Приём очередного сообщения с шины в переданный экземпляр
+	/*! Экземпляр можно переиспользовать между вызовами, тогда на приём
+	 *  сообщений не выделяется память. false, если сообщение принять не удалось */
+	bool recv_message(bus_input_message & message);
+
+	//! Разбор уже принятого сообщения из его частей
+	/*! Пейлоад при этом переезжает в сообщение. Годится для сообщений,
+	 *  пришедших не из сокета (например из лога брокера) */
+	bool parse_message(
+			const zmq::message_t & topic_msg,
+			const zmq::message_t & metadata_msg,
+			zmq::message_t & payload_msg,
+			bus_input_message & message
+	);
 
 	zmq::socket_t & sub_socket() { return _sub_socket; }
 	zmq::socket_t & pub_socket() { return _pub_socket; }
 
+	//! Ожидание сообщения в sub сокете не дольше timeout
+	/*! Ждет в epoll на ZMQ_FD сокета. true, если сообщение можно забирать */
 	bool poll_sub_socket(std::chrono::milliseconds timeout);
+	//! Есть ли в sub сокете еще сообщения, которые можно забрать не блокируясь
+	bool sub_socket_readable();
 
 private:
-	std::unique_ptr<sdu_uplink_request> parse_sdu_uplink_request_message(
+	void parse_sdu_uplink_request_message(
 			std::string_view topic,
-			const preparsed_message & message
+			const preparsed_message & message,
+			sdu_uplink_request & retval
+	);
+	void parse_downlink_frame_message(
+			const preparsed_message & message,
+			radio_downlink_frame & retval
 	);
-	std::unique_ptr<radio_downlink_frame> parse_downlink_frame_message(
-			const preparsed_message & message
+	void parse_radio_uplink_state_message(
+			const preparsed_message & message,
+			radio_uplink_state & retval
 	);
-	std::unique_ptr<radio_uplink_state> parse_radio_uplink_state_message(
-			const preparsed_message & message
+	//! Разбор сообщений радио. false, если топик не принадлежит ни одному радио
+	bool parse_radio_message(
+			std::string_view topic,
+			const preparsed_message & preparsed,
+			bus_input_message & message
 	);
 
 	zmq::context_t & _ctx;
 	zmq::socket_t _sub_socket;
 	zmq::socket_t _pub_socket;
+
+	//! Ожидание sub сокета. Сообщения из него забирают диспетчеры, реактор только будит
+	reactor _reactor;
+	int _sub_watch = -1;
+
+	//! Топики радио по номерам физических каналов
+	struct radio_topics_t
+	{
+		std::string uplink_frame;
+		std::string uplink_state;
+	};
+	std::vector<radio_topics_t> _radio_topics;
+
+	//! Топики сообщений с номером MAP канала, собранные по настройкам каналов
+	topic_table _downlink_sdu_topics;
+	topic_table _uplink_sdu_event_topics;
+
+	//! Приёмник даунлинк фреймов
+	struct downlink_source_t
+	{
+		std::string prefix;
+		std::string downlink_frame;
+		size_t pchannel;
+	};
+	//! Приёмники по их номерам
+	std::vector<downlink_source_t> _downlink_sources;
+
+	bool _binary_metadata = false;
+	uslp_stats * _stats = nullptr;
 };
 
 
@@ -1,36 +1,27 @@
 #include "bus_messages.hpp"
 
 
-std::string to_string(bus_input_message::kind_t kind)
+const char * to_string(const bus_input_message & message)
 {
-	switch (kind)
+	switch (message.index())
 	{
-	case bus_input_message::kind_t::sdu_uplink_request:
-		return "sdu_uplink_request";
-
-	case bus_input_message::kind_t::radio_uplink_state:
-		return "radio_uplink_state";
-
-	case bus_input_message::kind_t::radio_frame_downlink:
-		return "radio_frame_downlink";
-
-	default:
-		return "<unknown:" + std::to_string(static_cast<int>(kind));
+	case 0: return "sdu_uplink_request";
+	case 1: return "radio_frame_downlink";
+	case 2: return "radio_uplink_state";
+	default: return "<unknown>";
 	}
 }
 
 
-std::string to_string(bus_output_message::kind_t kind)
+const char * to_string(const bus_output_message & message)
 {
-	switch (kind)
+	switch (message.index())
 	{
-	case bus_output_message::kind_t::sdu_uplink_event:
-		return "sdu_uplink_event";
-
-	case bus_output_message::kind_t::sdu_downlink_arrived:
-		return "sdu_downlink_arrived";
-
-	default:
-		return "<unknown:" + std::to_string(static_cast<int>(kind));
+	case 0: return "sdu_uplink_event";
+	case 1: return "sdu_downlink_arrived";
+	case 2: return "radio_uplink_frame";
+	case 3: return "uplink_queue_state";
+	case 4: return "sdu_uplink_event_batch";
+	default: return "<unknown>";
 	}
 }
@@ -3,47 +3,41 @@
 
 
 #include <string>
+#include <chrono>
 #include <cstdint>
 #include <vector>
 #include <optional>
+#include <variant>
+
+#include <zmq.hpp>
 
 #include <ccsds/uslp/common/defs.hpp>
 #include <ccsds/uslp/common/ids.hpp>
 
 
 
-//! Абстрактное входящее сообщение c шины
-class bus_input_message
+//! Байты входящего сообщения прямо в буфере zmq
+/*! Держит принятую часть zmq сообщения живой, чтобы стек мог читать данные
+ *  без промежуточного копирования */
+class bus_payload
 {
 public:
-	//! Тип сообщения
-	enum class kind_t
-	{
-		sdu_uplink_request,		//!< клиенты хотят что-то отправить
-		radio_frame_downlink,	//!< радио прислало новый фрейм
-		radio_uplink_state,		//!< cостояние отправного буфера радио
-	};
+	bus_payload() = default;
+	explicit bus_payload(zmq::message_t && message): _message(std::move(message)) {}
 
-protected:
-	bus_input_message(kind_t kind_): kind(kind_) {}
+	const uint8_t * data() const { return static_cast<const uint8_t*>(_message.data()); }
+	size_t size() const { return _message.size(); }
+	bool empty() const { return 0 == size(); }
 
-public:
-	virtual ~bus_input_message() = default;
-
-	const kind_t kind;
+private:
+	zmq::message_t _message;
 };
 
 
-std::string to_string(bus_input_message::kind_t kind);
-
-
 //! Сообщение с данными для отправки в USLP стек
 /*! для mapa данные отправлются как есть, для mapp заворачиваются в epp пакет */
-class sdu_uplink_request: public bus_input_message
+struct sdu_uplink_request
 {
-public:
-	sdu_uplink_request(): bus_input_message(kind_t::sdu_uplink_request) {} // @suppress("Class members should be properly initialized")
-
 	//! Идентификатор канала по которому сообщение должно быть отправлено
 	ccsds::uslp::gmapid_t gmapid;
 	//! Желаемое качество отправки пакета
@@ -51,16 +45,17 @@ public:
 	//! Кука сообщения
 	ccsds::uslp::payload_cookie_t cookie;
 	//! Данные сообщения
-	std::vector<uint8_t> data;
+	bus_payload data;
+	//! Срок жизни SDU от момента разбора. Если не успеет уйти - sdu_expired
+	std::optional<std::chrono::milliseconds> ttl;
+	//! Когда сообщение было разобрано (для статистики задержек)
+	std::chrono::steady_clock::time_point parse_time;
 };
 
 
 //! Сообщение о состоянии отправного буфера радио
-class radio_uplink_state: public bus_input_message
+struct radio_uplink_state
 {
-public:
-	radio_uplink_state(): bus_input_message(kind_t::radio_uplink_state) {}
-
 	//! кука фрейма ожидающего отправку
 	std::optional<uint64_t> cookie_in_wait;
 	//! кука фрейма находящегося в процессе отправки
@@ -69,61 +64,56 @@ public:
 	std::optional<uint64_t> cookie_done;
 	//! кука фрейма, отправка которого не получилась
 	std::optional<uint64_t> cookie_failed;
+	//! Номер физического канала, от радио которого пришло сообщение
+	size_t pchannel = 0;
+	//! Когда сообщение было разобрано (для статистики задержек)
+	std::chrono::steady_clock::time_point parse_time;
 };
 
 
 //! Сообщение с фреймом, полученным от радио
 /*! Само по себе радио шлет больше метаданных, рисуем только те, что интересны */
-class radio_downlink_frame: public bus_input_message
+struct radio_downlink_frame
 {
-public:
-	radio_downlink_frame(): bus_input_message(kind_t::radio_frame_downlink) {}
-
 	//! Правильная ли у этого фрейма контрольная сумма уровня радио
 	bool checksum_valid = false;
 	//! Номер сообщения
 	uint64_t frame_cookie = 0;
-	//! Номер фрейма (по мнению радио)
-	uint16_t frame_no = 0;
+	//! Номер фрейма (по мнению радио). Пусто, если радио его не знает
+	std::optional<uint16_t> frame_no;
 	//! Собственно байты сообщения
-	std::vector<uint8_t> data;
+	bus_payload data;
+	//! Номер физического канала, от радио которого пришел фрейм
+	size_t pchannel = 0;
+	//! Номер приёмника, сквозной по всем физическим каналам
+	/*! У канала может быть несколько приёмников, слышащих одни и те же фреймы */
+	size_t source = 0;
+	//! Когда сообщение было разобрано (для статистики задержек)
+	std::chrono::steady_clock::time_point parse_time;
 };
 
 
-// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-
-
-//! Абстрактное сообщение отправляемое сервером на шину
-class bus_output_message
-{
-public:
-	//! Тип сообщения
-	enum class kind_t
-	{
-		sdu_uplink_event,		//!< событие, случившееся с отправляемым SDU
-		sdu_downlink_arrived,	//!< SDU было принято стеком
-		radio_uplink_frame,		//!< Отправка фрейма в радио-сервер
-	};
-
-protected:
-	bus_output_message(kind_t kind_): kind(kind_) {}
-
-public:
-	virtual ~bus_output_message() = default;
+//! Входящее сообщение c шины
+/*! Закрытый набор типов, поэтому без кучи и без виртуальщины.
+ *  Один экземпляр можно переиспользовать для приёма сообщений раз за разом */
+typedef std::variant<
+		sdu_uplink_request,		//!< клиенты хотят что-то отправить
+		radio_downlink_frame,	//!< радио прислало новый фрейм
+		radio_uplink_state		//!< cостояние отправного буфера радио
+> bus_input_message;
 
-	const kind_t kind;
-};
 
+//! Название типа сообщения для логов
+const char * to_string(const bus_input_message & message);
 
-std::string to_string(bus_output_message::kind_t kind);
 
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 
 
 //! Сообщение об удивительных событиях, происходящих с SDU в стеке и не только
-class sdu_uplink_event: public bus_output_message
+struct sdu_uplink_event
 {
-public:
 	//! Собственно что случилось с фреймом
 	enum class event_kind_t
 	{
@@ -132,30 +122,34 @@ public:
 		sdu_sent_to_radio,		//!< Передан на сервер радио
 		sdu_radiated,			//!< Излучён в эфир
 		sdu_radiation_failed,	//!< Илучение в эфир не удалось
+		sdu_expired,			//!< Не ушел в эфир до истечения срока жизни
 		// Пока все, но вообще тут должны быть еще
 		// sdu_delivered		//!< Пакет добрался до борта
 		// sdu_abandoned		//!< Пакет не добрался до борта
 	};
 
-	sdu_uplink_event(): bus_output_message(kind_t::sdu_uplink_event) {} // @suppress("Class members should be properly initialized")
-
 	//! идентификатор канала
 	ccsds::uslp::gmapid_t gmapid;
 	//! cookie фрагмента полезной нагрузки
 	ccsds::uslp::payload_part_cookie_t part_cookie;
 	//! Тип события
-	event_kind_t event_kind;
+	event_kind_t event_kind = event_kind_t::sdu_accepted;
 	//! Комментарий к событию
 	std::string comment;
 };
 
 
-//! Сообщение о том, что SDU пришло по радио и было принято стеком
-class sdu_downlink: public bus_output_message
+//! События SDU, накопленные за один цикл опроса
+/*! Уходят на шину одним сообщением вместо отдельного на каждую часть SDU */
+struct sdu_uplink_event_batch
 {
-public:
-	sdu_downlink(): bus_output_message(kind_t::sdu_downlink_arrived) {}
+	std::vector<sdu_uplink_event> events;
+};
 
+
+//! Сообщение о том, что SDU пришло по радио и было принято стеком
+struct sdu_downlink
+{
 	//! идентификатор канала
 	ccsds::uslp::gmapid_t gmapid;
 	//! qos пакета
@@ -167,14 +161,49 @@ public:
 };
 
 
-class radio_uplink_frame: public bus_output_message
+//! Отправка фрейма в радио-сервер
+struct radio_uplink_frame
 {
-public:
-	radio_uplink_frame(): bus_output_message(kind_t::radio_uplink_frame) {}
-
-	uint64_t frame_cookie;
+	//! Номер физического канала, радио которого предназначен фрейм
+	size_t pchannel = 0;
+	uint64_t frame_cookie = 0;
 	std::vector<uint8_t> data;
 };
 
 
+//! Заполненность очередей аплинк SDU по MAP каналам
+/*! Чтобы клиенты могли не слать больше, чем сервер готов принять */
+struct uplink_queue_state
+{
+	struct map_queue
+	{
+		ccsds::uslp::gmapid_t gmapid;
+		//! Сколько SDU и байт ждут в очереди
+		size_t sdus;
+		size_t bytes;
+		//! Лимиты очереди. Ноль - без лимита
+		size_t max_sdus;
+		size_t max_bytes;
+		//! Сколько SDU уже отдано стеку и еще не ушло целиком
+		size_t stacked_sdus;
+	};
+
+	std::vector<map_queue> queues;
+};
+
+
+//! Сообщение отправляемое сервером на шину
+typedef std::variant<
+		sdu_uplink_event,		//!< событие, случившееся с отправляемым SDU
+		sdu_downlink,			//!< SDU было принято стеком
+		radio_uplink_frame,		//!< Отправка фрейма в радио-сервер
+		uplink_queue_state,		//!< Заполненность очередей аплинка
+		sdu_uplink_event_batch	//!< Пачка событий отправляемых SDU
+> bus_output_message;
+
+
+//! Название типа сообщения для логов
+const char * to_string(const bus_output_message & message);
+
+
 #endif /* ITS_SERVER_USLP_SRC_BUS_MESSAGES_HPP_ */
@@ -2,89 +2,61 @@
 #define ITS_SERVER_USLP_SRC_DISPATCHER_HPP_
 
 
-#include <tuple>
-#include <optional>
-#include <deque>
+#include <chrono>
 
 #include "stack.hpp"
 #include "bus_messages.hpp"
 #include "bus_io.hpp"
+#include "stats.hpp"
+#include "uplink_pipeline.hpp"
+#include "downlink_pipeline.hpp"
 
-#include <ccsds/uslp/events.hpp>
-#include <ccsds/uslp/input_stack.hpp>
 
+// Период пола событий на сокете (мс)
+#define ITS_DISPATCHER_POLL_PERIOD 1000
+// Период пола, пока в очередь тракта ждут отложенные сообщения (мс)
+#define ITS_DISPATCHER_BACKLOG_RETRY_PERIOD 1
 
-//! Информация о фрейме отправленном на радио
-/*! Нужна для сопоставления кук SDU с куками фрейма и для оповещения
- *  клиентов о том, что там происходит с их SDU */
-struct frame_queue_entry_t
-{
-	//! Состояние фрейма в его жизненом цикле
-	enum class frame_state_t
-	{
-		sent_to_radio, in_wait, in_progress,
-		radiated, failed // терминальные события
-	};
-
-	//! Кука фрейма
-	uint64_t frame_cookie;
-	//! Канал из которого был выгребен ccsds фрейм
-	ccsds::uslp::gmapid_t sdu_mapid;
-	//! Куки SDU, летящие этим фреймом
-	std::vector<ccsds::uslp::payload_part_cookie_t> sdu_cookies;
-	//! Время отправки фрейма в радио
-	/*! Нужно для таймаутов чтобы очередь не вырастала до бесконечности */
-	std::chrono::steady_clock::time_point send_time;
-	//! Состояние фрейма
-	frame_state_t state;
-};
 
-
-class dispatcher: public ccsds::uslp::input_stack_event_handler
+//! Разгребает сообщения шины по аплинк и даунлинк трактам в одном потоке
+class dispatcher
 {
 public:
 	dispatcher(istack & istack_, ostack & ostack_, bus_io & io_);
+	//! Исходящие сообщения трактов уходят в output_, а не в сокет io_
+	dispatcher(istack & istack_, ostack & ostack_, bus_io & io_, bus_output & output_);
 
 	void poll();
 
-	template <typename DURATION>
-	void frame_done_timeout(const DURATION & timeout)
-	{
-		_frame_done_timeout = std::chrono::duration_cast<std::chrono::milliseconds>(timeout);
-	}
+	//! Обработка одного сообщения, принятого мимо сокета
+	void dispatch(bus_input_message & message);
 
-	std::chrono::milliseconds frame_done_timeout() const { return _frame_done_timeout; }
+	//! Сколько сообщений с шины разгребается за одно пробуждение (не меньше одного)
+	void batch_limit(size_t value) { _batch_limit = value ? value : 1; }
+	size_t batch_limit() const { return _batch_limit; }
 
+	uplink_pipeline & uplink() { return _uplink; }
+	downlink_pipeline & downlink() { return _downlink; }
+	uslp_stats & stats() { return _stats; }
 
 protected:
-	// приём и обработка сообщений с шины
-	virtual void _on_map_sdu_event(const ccsds::uslp::acceptor_event_map_sdu & event) override;
-
-	// Приём и обработка собщений с шины
-	void _dispatch_bus_message(const bus_input_message & message);
-
-	void _on_sdu_uplink_request(const sdu_uplink_request & request);
-	void _on_radio_downlink_frame(const radio_downlink_frame & frame);
-
-	void _on_radio_uplink_state(const radio_uplink_state & state);
-	void _clear_frames_queue();
-	void _update_frames_queue(const radio_uplink_state & state);
-	void _decide_next_uplink_frame(const radio_uplink_state & state);
+	//! Публикация статистики, если пришло её время
+	void _publish_stats();
 
 private:
-	//! Кука для следующего отправляемого сообщения для радио (не должно быть нулём)
-	uint64_t _next_rf_uplink_frame_cookie = 1;
-
-	//! Информация о фреймах, которые мы отправили в большой мир и теперь следим за их
-	//! судьбой
-	std::deque<frame_queue_entry_t> _frames_in_wait;
+	//! Максимум сообщений с шины, обрабатываемых за один вызов poll()
+	size_t _batch_limit = 1;
 
-	//! Таймаут, который мы даем фреймам на то, чтобы их судьба как-то решилась
-	std::chrono::milliseconds _frame_done_timeout = std::chrono::milliseconds(5000);
+	//! Переиспользуемый экземпляр входящего сообщения
+	/*! Сообщения принимаются на одном и том же месте без выделения памяти */
+	bus_input_message _input_message;
 
-	istack & _istack;
-	ostack & _ostack;
 	bus_io & _io;
+	bus_output & _output;
+	//! Объявлена до трактов, так как они пишут в неё с самого конструктора
+	uslp_stats _stats;
+	uplink_pipeline _uplink;
+	downlink_pipeline _downlink;
 };
 
 
@@ -0,0 +1,241 @@
+#include "downlink_dedup.hpp"
+
+#include <algorithm>
+
+#include "log.hpp"
+
+
+static auto _slg = build_source("downlink-dedup");
+
+
+downlink_dedup::downlink_dedup(downlink_dedup_handler & handler)
+	: _handler(handler)
+{
+}
+
+
+void downlink_dedup::push(radio_downlink_frame && frame, time_point_t now)
+{
+	held_frame_t held{_frame_key(frame), std::move(frame), now + _reorder_time};
+
+	// Опознать фрейм не по чему - пропускаем как есть
+	if (!held.key.frame_no && !held.key.vc_frame)
+	{
+		if (held.frame.checksum_valid || _pass_invalid)
+			_deliver(held, false);
+		else
+			_discard(held, downlink_dedup_handler::discard_reason_t::invalid);
+
+		return;
+	}
+
+	if (_was_delivered(held.key) || _is_held(held.key))
+	{
+		_discard(held, downlink_dedup_handler::discard_reason_t::duplicate);
+		return;
+	}
+
+	auto same_key = [&held](const held_frame_t & other) { return other.key == held.key; };
+	if (!held.frame.checksum_valid)
+	{
+		// Битых копий одного фрейма достаточно одной - первой
+		if (std::any_of(_invalid.begin(), _invalid.end(), same_key))
+			_discard(held, downlink_dedup_handler::discard_reason_t::duplicate);
+		else
+			_invalid.push_back(std::move(held));
+
+		return;
+	}
+
+	// Правильная копия делает битые ненужными
+	for (auto itt = _invalid.begin(); itt != _invalid.end(); )
+	{
+		if (!same_key(*itt))
+		{
+			++itt;
+			continue;
+		}
+
+		_discard(*itt, downlink_dedup_handler::discard_reason_t::duplicate);
+		itt = _invalid.erase(itt);
+	}
+
+	_accept(std::move(held));
+}
+
+
+void downlink_dedup::poll(time_point_t now)
+{
+	// Правильная копия так и не пришла
+	while (!_invalid.empty() && _invalid.front().deadline <= now)
+	{
+		held_frame_t held = std::move(_invalid.front());
+		_invalid.pop_front();
+
+		if (_pass_invalid)
+			_accept(std::move(held));
+		else
+			_discard(held, downlink_dedup_handler::discard_reason_t::invalid);
+	}
+
+	// Пропущенные фреймы так и не пришли. Отдаем все до последнего
+	// передержанного, перепрыгивая дыры
+	const auto last_expired = std::find_if(_held.rbegin(), _held.rend(),
+			[now](const held_frame_t & held) { return held.deadline <= now; }
+	);
+	if (last_expired == _held.rend())
+		return;
+
+	const auto end = last_expired.base();
+	LOG(debug) << "giving up waiting for downlink frame " << *_next_frame_no;
+	for (auto itt = _held.begin(); itt != end; ++itt)
+		_deliver(*itt, true);
+
+	_held.erase(_held.begin(), end);
+	_deliver_consecutive();
+}
+
+
+std::chrono::milliseconds downlink_dedup::poll_timeout(std::chrono::milliseconds max_timeout) const
+{
+	std::optional<time_point_t> deadline;
+	if (!_invalid.empty())
+		deadline = _invalid.front().deadline;
+
+	for (const auto & held: _held)
+	{
+		if (!deadline || held.deadline < *deadline)
+			deadline = held.deadline;
+	}
+
+	if (!deadline)
+		return max_timeout;
+
+	const auto now = std::chrono::steady_clock::now();
+	if (*deadline <= now)
+		return std::chrono::milliseconds(0);
+
+	const auto until_deadline = std::chrono::ceil<std::chrono::milliseconds>(*deadline - now);
+	return std::min(until_deadline, max_timeout);
+}
+
+
+downlink_dedup::frame_key_t downlink_dedup::_frame_key(const radio_downlink_frame & frame)
+{
+	frame_key_t retval;
+	retval.frame_no = frame.frame_no;
+
+	// Основной заголовок USLP фрейма: 4 байта идентификаторов, 2 байта длины
+	// и байт флагов, младшие 3 бита которого - длина номера фрейма в VC
+	const uint8_t * data = frame.data.data();
+	const size_t size = frame.data.size();
+	if (size < 7)
+		return retval;
+
+	// Укороченный заголовок - номера там нет
+	if (data[3] & 0x01)
+		return retval;
+
+	const size_t counter_size = data[6] & 0x07;
+	if (0 == counter_size || size < 7 + counter_size)
+		return retval;
+
+	const uint8_t vchannel_id = ((data[2] & 0x07) << 3) | (data[3] >> 5);
+	uint64_t counter = 0;
+	for (size_t i = 0; i < counter_size; i++)
+		counter = (counter << 8) | data[7 + i];
+
+	retval.vc_frame = std::make_pair(vchannel_id, counter);
+	return retval;
+}
+
+
+void downlink_dedup::_accept(held_frame_t && held)
+{
+	if (!held.key.frame_no || !_next_frame_no || *held.key.frame_no == *_next_frame_no)
+	{
+		_deliver(held, true);
+		_deliver_consecutive();
+		return;
+	}
+
+	const uint16_t distance = _distance(*held.key.frame_no);
+	if (distance >= 0x8000)
+	{
+		// Опоздавший фрейм: его уже перестали ждать, но стеку он еще может пригодиться
+		_deliver(held, false);
+		return;
+	}
+
+	if (distance < ITS_DOWNLINK_REORDER_MAX_FRAMES && _reorder_time.count() > 0)
+	{
+		// Придерживаем, вдруг пропущенные подвезет другой приёмник
+		const auto position = std::find_if(_held.begin(), _held.end(),
+				[this, distance](const held_frame_t & other) { return _distance(*other.key.frame_no) > distance; }
+		);
+		_held.insert(position, std::move(held));
+		return;
+	}
+
+	// Слишком большая дыра, ждать её бессмысленно. Все придержанные идут раньше этого фрейма
+	LOG(debug) << "downlink frame " << *held.key.frame_no << " is " << distance << " frames ahead, resyncing";
+	for (auto & other: _held)
+		_deliver(other, true);
+
+	_held.clear();
+	_deliver(held, true);
+	_deliver_consecutive();
+}
+
+
+void downlink_dedup::_deliver(held_frame_t & held, bool advance)
+{
+	if (held.key.frame_no || held.key.vc_frame)
+	{
+		_delivered[_delivered_pos] = held.key;
+		_delivered_pos = (_delivered_pos + 1) % _delivered.size();
+		_delivered_count = std::min(_delivered_count + 1, _delivered.size());
+	}
+
+	if (advance && held.key.frame_no)
+		_next_frame_no = static_cast<uint16_t>(*held.key.frame_no + 1);
+
+	_handler.on_frame_ready(held.frame);
+}
+
+
+void downlink_dedup::_discard(held_frame_t & held, downlink_dedup_handler::discard_reason_t reason)
+{
+	_handler.on_frame_discarded(held.frame, reason);
+}
+
+
+void downlink_dedup::_deliver_consecutive()
+{
+	while (!_held.empty() && *_held.front().key.frame_no == *_next_frame_no)
+	{
+		_deliver(_held.front(), true);
+		_held.pop_front();
+	}
+}
+
+
+uint16_t downlink_dedup::_distance(uint16_t frame_no) const
+{
+	return static_cast<uint16_t>(frame_no - *_next_frame_no);
+}
+
+
+bool downlink_dedup::_was_delivered(const frame_key_t & key) const
+{
+	return std::find(_delivered.begin(), _delivered.begin() + _delivered_count, key)
+			!= _delivered.begin() + _delivered_count;
+}
+
+
+bool downlink_dedup::_is_held(const frame_key_t & key) const
+{
+	return std::any_of(_held.begin(), _held.end(),
+			[&key](const held_frame_t & held) { return held.key == key; }
+	);
+}
@@ -0,0 +1,139 @@
+#ifndef ITS_SERVER_USLP_SRC_DOWNLINK_DEDUP_HPP_
+#define ITS_SERVER_USLP_SRC_DOWNLINK_DEDUP_HPP_
+
+
+#include <array>
+#include <deque>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <optional>
+
+#include "bus_messages.hpp"
+
+
+//! Сколько последних отданных стеку фреймов помнится для отсева копий
+#define ITS_DOWNLINK_DEDUP_HISTORY (64)
+//! Насколько фрейм может обогнать пропущенный, чтобы его еще имело смысл придержать
+#define ITS_DOWNLINK_REORDER_MAX_FRAMES (32)
+
+
+//! Кому окно отдает фреймы
+class downlink_dedup_handler
+{
+public:
+	//! Почему копия фрейма не пошла в стек
+	enum class discard_reason_t
+	{
+		//! Такой фрейм уже получен от этого или другого приёмника
+		duplicate,
+		//! Битая контрольная сумма, а правильная копия так и не пришла
+		invalid,
+	};
+
+	virtual ~downlink_dedup_handler() = default;
+
+	void on_frame_ready(radio_downlink_frame & frame) { _on_frame_ready(frame); }
+	void on_frame_discarded(const radio_downlink_frame & frame, discard_reason_t reason)
+	{
+		_on_frame_discarded(frame, reason);
+	}
+
+protected:
+	//! Фрейм пора кормить в стек
+	virtual void _on_frame_ready(radio_downlink_frame & frame) = 0;
+	//! Копия фрейма выброшена
+	virtual void _on_frame_discarded(const radio_downlink_frame & frame, discard_reason_t reason) = 0;
+};
+
+
+//! Окно склейки даунлинк фреймов от нескольких приёмников
+/*! Один и тот же фрейм может прийти от каждого приёмника, а может не прийти
+ *  ни от одного. В стек проходит одна копия - первая с правильной контрольной
+ *  суммой. Копия с битой суммой ждет reorder_time, не придет ли правильная.
+ *
+ *  Заодно восстанавливается порядок: фрейм, обогнавший пропущенный, ждет
+ *  до reorder_time, не подвезет ли пропущенный более медленный приёмник.
+ *  Фреймы опознаются по номеру фрейма радио и номеру фрейма USLP в его
+ *  виртуальном канале, если он есть в заголовке. Фреймы без номера радио
+ *  не упорядочиваются, а совсем без номеров - проходят как есть */
+class downlink_dedup
+{
+public:
+	typedef std::chrono::steady_clock::time_point time_point_t;
+
+	explicit downlink_dedup(downlink_dedup_handler & handler);
+
+	//! Сколько ждать копию фрейма от других приёмников. Ноль - не ждать
+	void reorder_time(std::chrono::milliseconds value) { _reorder_time = value; }
+	std::chrono::milliseconds reorder_time() const { return _reorder_time; }
+
+	//! Пускать ли в стек фреймы с битой суммой, если правильная копия так и не пришла
+	void pass_invalid(bool value) { _pass_invalid = value; }
+	bool pass_invalid() const { return _pass_invalid; }
+
+	//! Приём копии фрейма от какого-либо приёмника
+	void push(radio_downlink_frame && frame, time_point_t now);
+	//! Отдача фреймов, ждать которые больше нет смысла
+	void poll(time_point_t now);
+
+	//! Сколько можно спать, чтобы не проспать фрейм, которого пора отдавать
+	std::chrono::milliseconds poll_timeout(std::chrono::milliseconds max_timeout) const;
+
+private:
+	//! Чем фреймы отличаются друг от друга
+	struct frame_key_t
+	{
+		std::optional<uint16_t> frame_no;
+		//! Виртуальный канал и номер фрейма USLP в нем, если он там есть
+		std::optional<std::pair<uint8_t, uint64_t>> vc_frame;
+
+		bool operator==(const frame_key_t & other) const
+		{
+			return frame_no == other.frame_no && vc_frame == other.vc_frame;
+		}
+	};
+
+	//! Копия фрейма, придержанная в окне
+	struct held_frame_t
+	{
+		frame_key_t key;
+		radio_downlink_frame frame;
+		time_point_t deadline;
+	};
+
+	//! Ключ фрейма по номеру радио и заголовку USLP фрейма
+	static frame_key_t _frame_key(const radio_downlink_frame & frame);
+
+	//! Фрейм с правильной суммой, которого еще не было
+	void _accept(held_frame_t && held);
+	//! Отдача фрейма в стек. advance - сдвигать ли ожидаемый номер за этот фрейм
+	void _deliver(held_frame_t & held, bool advance);
+	void _discard(held_frame_t & held, downlink_dedup_handler::discard_reason_t reason);
+	//! Отдача придержанных фреймов, идущих подряд от ожидаемого
+	void _deliver_consecutive();
+	//! На сколько фреймов номер опережает ожидаемый (по модулю 2^16)
+	uint16_t _distance(uint16_t frame_no) const;
+
+	bool _was_delivered(const frame_key_t & key) const;
+	bool _is_held(const frame_key_t & key) const;
+
+	downlink_dedup_handler & _handler;
+	std::chrono::milliseconds _reorder_time = std::chrono::milliseconds(0);
+	bool _pass_invalid = false;
+
+	//! Номер фрейма радио, который ожидается следующим
+	std::optional<uint16_t> _next_frame_no;
+	//! Фреймы с правильной суммой, обогнавшие пропущенный. По возрастанию номера
+	std::deque<held_frame_t> _held;
+	//! Копии с битой суммой в ожидании правильной. По времени прихода
+	std::deque<held_frame_t> _invalid;
+
+	//! Кольцо последних отданных стеку фреймов
+	std::array<frame_key_t, ITS_DOWNLINK_DEDUP_HISTORY> _delivered;
+	size_t _delivered_count = 0;
+	size_t _delivered_pos = 0;
+};
+
+
+#endif /* ITS_SERVER_USLP_SRC_DOWNLINK_DEDUP_HPP_ */
@@ -0,0 +1,125 @@
+#include "downlink_pipeline.hpp"
+
+#include <sstream>
+
+#include "log.hpp"
+
+
+static auto _slg = build_source("downlink");
+
+
+downlink_pipeline::downlink_pipeline(istack & istack_, bus_output & output_, uslp_stats & stats_)
+	: _dedup(*this), _istack(istack_), _output(output_), _stats(stats_)
+{
+	_istack.set_event_handler(this);
+}
+
+
+void downlink_pipeline::on_radio_downlink_frame(radio_downlink_frame & frame)
+{
+	LOG(trace) << "got radio downlink frame " << frame.frame_cookie << " from source " << frame.source;
+	_stats.count(frame.source, uslp_stats::source_counter_t::frames);
+
+	const auto now = std::chrono::steady_clock::now();
+	_dedup.push(std::move(frame), now);
+	_dedup.poll(now);
+}
+
+
+void downlink_pipeline::release_frames()
+{
+	_dedup.poll(std::chrono::steady_clock::now());
+}
+
+
+void downlink_pipeline::_on_frame_ready(radio_downlink_frame & frame)
+{
+	_stats.count(frame.source, uslp_stats::source_counter_t::delivered);
+	try
+	{
+		// Сюда доходят битые фреймы, только если так велено
+		if (!frame.checksum_valid)
+			LOG(warning) << "downlink frame with invalid checksum";
+
+		// Наконец то кормим фрейм в стек
+		// SDU вылезают из него прямо внутри push_frame, там и меряем
+		_push_start_time = std::chrono::steady_clock::now();
+		_stats.record(uslp_stats::stage_t::parse_to_push_frame, *_push_start_time - frame.parse_time);
+		_istack.push_frame(frame.data.data(), frame.data.size());
+		_push_start_time.reset();
+
+		_stats.count(uslp_stats::counter_t::downlink_frames_received);
+		LOG(debug) << "accepted radio downlink frame cookie " << frame.frame_cookie;
+	}
+	catch (std::exception & e)
+	{
+		_push_start_time.reset();
+		_stats.count(uslp_stats::counter_t::downlink_frames_rejected);
+		LOG(error) << "unable to receive radio frame " << frame.frame_cookie << ": "
+				<< e.what();
+	}
+}
+
+
+void downlink_pipeline::_on_frame_discarded(const radio_downlink_frame & frame, discard_reason_t reason)
+{
+	switch (reason)
+	{
+	case discard_reason_t::duplicate:
+		_stats.count(frame.source, uslp_stats::source_counter_t::duplicates);
+		LOG(trace) << "dropping duplicate downlink frame " << frame.frame_cookie << " from source " << frame.source;
+		break;
+
+	case discard_reason_t::invalid:
+		_stats.count(frame.source, uslp_stats::source_counter_t::invalid);
+		LOG(warning) << "dropping downlink frame " << frame.frame_cookie << " with invalid checksum";
+		break;
+	};
+}
+
+
+void downlink_pipeline::_on_map_sdu_event(const ccsds::uslp::acceptor_event_map_sdu & event)
+{
+	std::stringstream flags_stream;
+
+	if (event.flags & ccsds::uslp::acceptor_event_map_sdu::MAPA)
+		flags_stream << "mapa, ";
+
+	if (event.flags & ccsds::uslp::acceptor_event_map_sdu::MAPP)
+		flags_stream << "mapp, ";
+
+	if (event.flags & ccsds::uslp::acceptor_event_map_sdu::INCOMPLETE)
+		flags_stream << "incomplete, ";
+
+	if (event.flags & ccsds::uslp::acceptor_event_map_sdu::IDLE)
+		flags_stream << "idle, ";
+
+	if (event.flags & ccsds::uslp::acceptor_event_map_sdu::CORRUPTED)
+		flags_stream << "corrupted, ";
+
+	if (event.flags & ccsds::uslp::acceptor_event_map_sdu::STRAY)
+		flags_stream << "stray, ";
+
+
+	auto flags_string = flags_stream.str();
+	if (flags_string.size())
+		flags_string.resize(flags_string.size()-2); // Откусываем ", " с хвоста
+
+	LOG(info) << "got downlink map SDU " << event.channel_id << " "
+			<< event.data.size() << " bytes"
+			<< (flags_string.size() ? ("; " + flags_string) : (""))
+	;
+
+	// Собираем сообщение
+	auto & message = _downlink_message;
+	message.gmapid = event.channel_id;
+	message.qos = event.qos;
+	message.flags = event.flags;
+	message.data = event.data;
+
+	if (_push_start_time)
+		_stats.record(uslp_stats::stage_t::push_frame_to_map_sdu, std::chrono::steady_clock::now() - *_push_start_time);
+	_stats.count(uslp_stats::counter_t::downlink_sdus);
+
+	_output.send_message(message);
+}
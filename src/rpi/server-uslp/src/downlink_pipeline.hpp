@@ -0,0 +1,70 @@
+#ifndef ITS_SERVER_USLP_SRC_DOWNLINK_PIPELINE_HPP_
+#define ITS_SERVER_USLP_SRC_DOWNLINK_PIPELINE_HPP_
+
+
+#include "stack.hpp"
+#include "bus_messages.hpp"
+#include "bus_io.hpp"
+#include "stats.hpp"
+#include "downlink_dedup.hpp"
+
+#include <ccsds/uslp/events.hpp>
+#include <ccsds/uslp/input_stack.hpp>
+
+#include <chrono>
+#include <optional>
+
+
+//! Даунлинк тракт: приём фреймов от радио во входной стек и публикация SDU
+/*! Владеет входным стеком. Все методы должны вызываться из одного потока.
+ *  Фреймы идут в стек через окно склейки, так что копии одного фрейма от
+ *  нескольких приёмников разбираются один раз */
+class downlink_pipeline:
+		public ccsds::uslp::input_stack_event_handler,
+		private downlink_dedup_handler
+{
+public:
+	downlink_pipeline(istack & istack_, bus_output & output_, uslp_stats & stats_);
+
+	//! Пейлоад фрейма может переехать в окно склейки
+	void on_radio_downlink_frame(radio_downlink_frame & frame);
+
+	//! Отдача стеку придержанных фреймов, ждать копий которых больше нет смысла
+	/*! Диспетчер зовет это периодически, даже если новых фреймов нет */
+	void release_frames();
+	//! Сколько можно спать, чтобы не передержать фрейм
+	std::chrono::milliseconds poll_timeout(std::chrono::milliseconds max_timeout) const
+	{
+		return _dedup.poll_timeout(max_timeout);
+	}
+
+	//! Сколько ждать копию фрейма от других приёмников. Ноль - не ждать
+	void reorder_time(std::chrono::milliseconds value) { _dedup.reorder_time(value); }
+	std::chrono::milliseconds reorder_time() const { return _dedup.reorder_time(); }
+
+	//! Пускать ли в стек фреймы с битой суммой, если правильная копия так и не пришла
+	void pass_invalid(bool value) { _dedup.pass_invalid(value); }
+	bool pass_invalid() const { return _dedup.pass_invalid(); }
+
+protected:
+	virtual void _on_map_sdu_event(const ccsds::uslp::acceptor_event_map_sdu & event) override;
+
+	//! Окно склейки решило, что фрейм пора кормить в стек
+	virtual void _on_frame_ready(radio_downlink_frame & frame) override;
+	virtual void _on_frame_discarded(const radio_downlink_frame & frame, discard_reason_t reason) override;
+
+private:
+	//! Переиспользуемый экземпляр исходящего сообщения
+	sdu_downlink _downlink_message;
+	//! Когда текущий фрейм был подан в стек. Пусто, если стек сейчас ничего не разбирает
+	std::optional<std::chrono::steady_clock::time_point> _push_start_time;
+
+	downlink_dedup _dedup;
+
+	istack & _istack;
+	bus_output & _output;
+	uslp_stats & _stats;
+};
+
+
+#endif /* ITS_SERVER_USLP_SRC_DOWNLINK_PIPELINE_HPP_ */
@@ -0,0 +1,136 @@
+#include "frame_table.hpp"
+
+#include <cassert>
+
+
+const frame_queue_entry_t * frame_table::find(uint64_t frame_cookie) const
+{
+	const auto itt = _entries.find(frame_cookie);
+	if (itt == _entries.end())
+		return nullptr;
+
+	return &itt->second;
+}
+
+
+void frame_table::insert(frame_queue_entry_t entry)
+{
+	assert(frame_state_t::sent_to_radio == entry.state);
+	assert(_sent_index.empty() || _sent_index.back().time <= entry.send_time);
+
+	const auto frame_cookie = entry.frame_cookie;
+	const auto send_time = entry.send_time;
+	const auto state = entry.state;
+	entry.state_time = send_time;
+
+	const auto [itt, inserted] = _entries.try_emplace(frame_cookie, std::move(entry));
+	if (!inserted)
+	{
+		// Куки у нас уникальные, так что такого не бывает. Но если вдруг -
+		// свежий фрейм важнее
+		_state_counters[_state_index(itt->second.state)]--;
+		itt->second = std::move(entry);
+	}
+
+	_state_counters[_state_index(state)]++;
+	_sent_index.push_back(expiry_entry_t{send_time, frame_cookie});
+	_prune_expiry_indexes();
+}
+
+
+bool frame_table::set_state(uint64_t frame_cookie, frame_state_t state, time_point_t now)
+{
+	// Обратно в очередь радио фреймы не возвращаются
+	assert(frame_state_t::in_wait == state || frame_state_t::in_progress == state);
+	assert(_taken_index.empty() || _taken_index.back().time <= now);
+
+	const auto itt = _entries.find(frame_cookie);
+	if (itt == _entries.end())
+		return false;
+
+	auto & entry = itt->second;
+	_state_counters[_state_index(entry.state)]--;
+	_state_counters[_state_index(state)]++;
+	entry.state = state;
+	entry.state_time = now;
+
+	// Прежняя запись индекса станет мертвой и уйдет при чистке
+	_taken_index.push_back(expiry_entry_t{now, frame_cookie});
+	_prune_expiry_indexes();
+	return true;
+}
+
+
+std::optional<frame_queue_entry_t> frame_table::extract(uint64_t frame_cookie)
+{
+	auto node = _entries.extract(frame_cookie);
+	if (node.empty())
+		return std::nullopt;
+
+	_state_counters[_state_index(node.mapped().state)]--;
+	_prune_expiry_indexes();
+	return std::move(node.mapped());
+}
+
+
+std::optional<frame_queue_entry_t> frame_table::extract_expired(
+		time_point_t now, duration_t sent_timeout, duration_t taken_timeout
+)
+{
+	if (!_sent_index.empty() && _sent_index.front().time + sent_timeout <= now)
+		return extract(_sent_index.front().frame_cookie);
+
+	if (!_taken_index.empty() && _taken_index.front().time + taken_timeout <= now)
+		return extract(_taken_index.front().frame_cookie);
+
+	return std::nullopt;
+}
+
+
+std::optional<frame_table::time_point_t> frame_table::next_deadline(
+		duration_t sent_timeout, duration_t taken_timeout
+) const
+{
+	std::optional<time_point_t> retval;
+	if (!_sent_index.empty())
+		retval = _sent_index.front().time + sent_timeout;
+
+	if (!_taken_index.empty())
+	{
+		const auto deadline = _taken_index.front().time + taken_timeout;
+		if (!retval || deadline < *retval)
+			retval = deadline;
+	}
+
+	return retval;
+}
+
+
+bool frame_table::_sent_entry_alive(const expiry_entry_t & expiry) const
+{
+	const auto itt = _entries.find(expiry.frame_cookie);
+	return itt != _entries.end()
+			&& frame_state_t::sent_to_radio == itt->second.state
+			&& itt->second.send_time == expiry.time
+	;
+}
+
+
+bool frame_table::_taken_entry_alive(const expiry_entry_t & expiry) const
+{
+	const auto itt = _entries.find(expiry.frame_cookie);
+	return itt != _entries.end()
+			&& frame_state_t::sent_to_radio != itt->second.state
+			&& itt->second.state_time == expiry.time
+	;
+}
+
+
+void frame_table::_prune_expiry_indexes()
+{
+	while (!_sent_index.empty() && !_sent_entry_alive(_sent_index.front()))
+		_sent_index.pop_front();
+
+	while (!_taken_index.empty() && !_taken_entry_alive(_taken_index.front()))
+		_taken_index.pop_front();
+}
@@ -0,0 +1,120 @@
+#ifndef ITS_SERVER_USLP_SRC_FRAME_TABLE_HPP_
+#define ITS_SERVER_USLP_SRC_FRAME_TABLE_HPP_
+
+
+#include <array>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <optional>
+#include <unordered_map>
+
+#include <ccsds/uslp/common/defs.hpp>
+#include <ccsds/uslp/common/ids.hpp>
+
+
+//! Информация о фрейме отправленном на радио
+/*! Нужна для сопоставления кук SDU с куками фрейма и для оповещения
+ *  клиентов о том, что там происходит с их SDU */
+struct frame_queue_entry_t
+{
+	//! Состояние фрейма в его жизненом цикле
+	enum class frame_state_t
+	{
+		sent_to_radio, in_wait, in_progress,
+		radiated, failed // терминальные события
+	};
+
+	//! Кука фрейма
+	uint64_t frame_cookie;
+	//! Канал из которого был выгребен ccsds фрейм
+	ccsds::uslp::gmapid_t sdu_mapid;
+	//! Куки SDU, летящие этим фреймом
+	std::vector<ccsds::uslp::payload_part_cookie_t> sdu_cookies;
+	//! Время отправки фрейма в радио
+	/*! Нужно для таймаутов чтобы очередь не вырастала до бесконечности */
+	std::chrono::steady_clock::time_point send_time;
+	//! Состояние фрейма
+	frame_state_t state;
+	//! Когда радио взялось за фрейм (перевело в in_wait или in_progress)
+	/*! С этого момента фрейм ждет только сам себя, таймаут отсчитывается отсюда.
+	 *  Заполняется таблицей */
+	std::chrono::steady_clock::time_point state_time;
+};
+
+
+//! Таблица фреймов, за судьбой которых следит диспетчер
+/*! Фреймы ищутся по куке за O(1), количество фреймов в каждом состоянии
+ *  хранится счетчиками. Для таймаутов ведется два индекса: фреймы в sent_to_radio
+ *  в порядке отправки и фреймы, за которые радио уже взялось, в порядке смены
+ *  состояния. Таймауты у них разные: пока фрейм в sent_to_radio, он может
+ *  стоять в очереди радио за другими фреймами окна.
+ *  Фреймы в терминальных состояниях в таблице не хранятся - их нужно
+ *  забирать через extract() */
+class frame_table
+{
+public:
+	typedef frame_queue_entry_t::frame_state_t frame_state_t;
+	typedef std::chrono::steady_clock::time_point time_point_t;
+	typedef std::chrono::steady_clock::duration duration_t;
+
+	//! Поиск фрейма по куке. nullptr, если такого нет
+	const frame_queue_entry_t * find(uint64_t frame_cookie) const;
+
+	//! Добавление свежеотправленного фрейма
+	/*! Фреймы должны добавляться в порядке неубывания времени отправки */
+	void insert(frame_queue_entry_t entry);
+
+	//! Перевод фрейма в in_wait или in_progress. false, если фрейма нет
+	/*! Таймаут фрейма с этого момента отсчитывается заново от now */
+	bool set_state(uint64_t frame_cookie, frame_state_t state, time_point_t now);
+
+	//! Изъятие фрейма из таблицы
+	std::optional<frame_queue_entry_t> extract(uint64_t frame_cookie);
+
+	//! Изъятие фрейма, у которого к моменту now вышел таймаут
+	/*! sent_timeout - для фреймов в sent_to_radio от отправки,
+	 *  taken_timeout - для остальных от смены состояния */
+	std::optional<frame_queue_entry_t> extract_expired(
+			time_point_t now, duration_t sent_timeout, duration_t taken_timeout
+	);
+
+	//! Ближайший момент, когда у какого-то фрейма выйдет таймаут
+	std::optional<time_point_t> next_deadline(duration_t sent_timeout, duration_t taken_timeout) const;
+
+	//! Количество фреймов в указанном состоянии
+	size_t count(frame_state_t state) const { return _state_counters[_state_index(state)]; }
+	size_t size() const { return _entries.size(); }
+	bool empty() const { return _entries.empty(); }
+
+private:
+	//! Запись индекса таймаутов
+	struct expiry_entry_t
+	{
+		//! send_time или state_time фрейма, смотря по индексу
+		time_point_t time;
+		uint64_t frame_cookie;
+	};
+
+	static constexpr size_t _states_count = static_cast<size_t>(frame_state_t::failed) + 1;
+
+	static size_t _state_index(frame_state_t state) { return static_cast<size_t>(state); }
+
+	//! Живая ли еще запись индекса фреймов в sent_to_radio
+	bool _sent_entry_alive(const expiry_entry_t & expiry) const;
+	//! Живая ли еще запись индекса фреймов, за которые взялось радио
+	bool _taken_entry_alive(const expiry_entry_t & expiry) const;
+	//! Выкидывает из голов индексов таймаутов записи об изъятых и сменивших состояние фреймах
+	void _prune_expiry_indexes();
+
+	std::unordered_map<uint64_t, frame_queue_entry_t> _entries;
+	//! Куки фреймов в sent_to_radio в порядке отправки
+	/*! Изъятые не с головы фреймы удаляются отсюда лениво, но голова всегда живая */
+	std::deque<expiry_entry_t> _sent_index;
+	//! Куки фреймов в in_wait и in_progress в порядке смены состояния. Чистится так же
+	std::deque<expiry_entry_t> _taken_index;
+	std::array<size_t, _states_count> _state_counters = {};
+};
+
+
+#endif /* ITS_SERVER_USLP_SRC_FRAME_TABLE_HPP_ */
@@ -2,13 +2,22 @@
 #include <csignal>
 #include <atomic>
 #include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <sstream>
 
 #include <zmq.hpp>
 
 #include "log.hpp"
 #include "bus_io.hpp"
 #include "dispatcher.hpp"
+#include "threaded_dispatcher.hpp"
+#include "sharded_dispatcher.hpp"
 #include "stack.hpp"
+#include "json.hpp"
+
+#include <gbus_meta.h>
 
 
 static auto _slg = build_source("main");
@@ -16,6 +25,41 @@ static auto _slg = build_source("main");
 
 #define ITS_BSCP_ENDPOINT_KEY "ITS_GBUS_BSCP_ENDPOINT"
 #define ITS_BPCS_ENDPOINT_KEY "ITS_GBUS_BPCS_ENDPOINT"
+#define ITS_BATCH_LIMIT_KEY "ITS_USLP_BATCH_LIMIT"
+#define ITS_UPLINK_WINDOW_KEY "ITS_USLP_UPLINK_WINDOW"
+#define ITS_FRAME_TIMEOUT_KEY "ITS_USLP_FRAME_TIMEOUT_MS"
+#define ITS_THREADED_KEY "ITS_USLP_THREADED"
+#define ITS_QUEUE_CAPACITY_KEY "ITS_USLP_QUEUE_CAPACITY"
+#define ITS_STATS_PERIOD_KEY "ITS_USLP_STATS_PERIOD"
+#define ITS_MAP_SCHEDULE_KEY "ITS_USLP_MAP_SCHEDULE"
+#define ITS_EXPEDITED_FIRST_KEY "ITS_USLP_EXPEDITED_FIRST"
+#define ITS_MAP_LIMITS_KEY "ITS_USLP_MAP_LIMITS"
+#define ITS_QUEUE_REPORT_PERIOD_KEY "ITS_USLP_QUEUE_REPORT_PERIOD"
+#define ITS_SDU_EVENTS_KEY "ITS_USLP_SDU_EVENTS"
+#define ITS_PCHANNELS_KEY "ITS_USLP_PCHANNELS"
+#define ITS_DOWNLINK_RECEIVERS_KEY "ITS_USLP_DOWNLINK_RECEIVERS"
+#define ITS_DOWNLINK_REORDER_KEY "ITS_USLP_DOWNLINK_REORDER_MS"
+#define ITS_DOWNLINK_INVALID_KEY "ITS_USLP_DOWNLINK_INVALID"
+#define ITS_JOURNAL_KEY "ITS_USLP_JOURNAL"
+#define ITS_JOURNAL_SIZE_KEY "ITS_USLP_JOURNAL_SIZE"
+
+
+//! Настройки планирования аплинк MAP канала
+struct map_schedule_entry
+{
+	uint8_t map_id;
+	unsigned priority;
+	unsigned weight;
+};
+
+
+//! Лимиты очереди аплинк MAP канала
+struct map_limits_entry
+{
+	uint8_t map_id;
+	size_t max_sdus;
+	size_t max_bytes;
+};
 
 
 //! Настройки приложения
@@ -25,6 +69,43 @@ struct config
 	std::string bpcs_endpoint;
 	//! Эндпоинт broker subscribe, client publish
 	std::string bscp_endpoint;
+	//! Сколько сообщений с шины диспетчер разгребает за одно пробуждение
+	size_t batch_limit = 1;
+	//! Сколько фреймов может одновременно ждать отправки на стороне радио
+	size_t uplink_window = 1;
+	//! Сколько радио может возиться с одним фреймом, прежде чем мы его похороним (мс)
+	long frame_timeout_ms = 5000;
+	//! Слать ли метаданные сообщений в бинарном формате
+	bool binary_metadata = false;
+	//! Разносить ли аплинк и даунлинк тракты по отдельным потокам
+	bool threaded = false;
+	//! Емкость очередей сообщений между потоками
+	size_t queue_capacity = 1024;
+	//! Период публикации статистики в uslp.stats (мс). Ноль - не публиковать
+	long stats_period_ms = 10000;
+	//! Приоритеты и веса аплинк MAP каналов. Пусто - как решит uplink_pipeline
+	std::vector<map_schedule_entry> map_schedule;
+	//! Пускать ли expedited SDU вперед sequence controlled
+	bool expedited_first = true;
+	//! Лимиты очередей аплинк MAP каналов. Для остальных - по умолчанию
+	std::vector<map_limits_entry> map_limits;
+	//! Период публикации заполненности очередей (мс). Ноль - не публиковать
+	long queue_report_period_ms = 1000;
+	//! Как публиковать события SDU: по одному, пачками или и так и так
+	uplink_pipeline::event_publishing_t event_publishing = uplink_pipeline::event_publishing_t::single;
+	//! Физические каналы из файла настроек. Пусто - одно радио по умолчанию, без шардирования
+	std::vector<pchannel_config> pchannels;
+	//! Дополнительные приёмники радио по умолчанию (префиксы их топиков)
+	std::vector<std::string> downlink_receivers;
+	//! Сколько ждать копию фрейма от других приёмников (мс). Только для каналов с несколькими приёмниками
+	long downlink_reorder_ms = 50;
+	//! Пускать ли в стек фреймы с битой суммой, если правильной копии нет
+	bool downlink_pass_invalid = false;
+	//! Префикс путей журналов аплинк SDU, к нему добавляется имя физического канала.
+	//! Пусто - без журнала
+	std::string journal_path;
+	//! Размер файла журнала
+	size_t journal_size = ITS_SDU_JOURNAL_DEFAULT_SIZE;
 };
 
 
@@ -51,6 +132,113 @@ static void signal_handler(int signal)
 }
 
 
+//! Разбор списка вида "map_id:a:b,..." в записи ENTRY{map_id, a, b}
+template <typename ENTRY, typename VALUE>
+static std::vector<ENTRY> parse_map_triples(const char * key, const std::string & text)
+{
+	std::vector<ENTRY> retval;
+	std::stringstream entries(text);
+	std::string entry;
+	while (std::getline(entries, entry, ','))
+	{
+		unsigned map_id;
+		VALUE first, second;
+		char colon1, colon2;
+		std::stringstream fields(entry);
+		if (!(fields >> map_id >> colon1 >> first >> colon2 >> second)
+				|| colon1 != ':' || colon2 != ':' || !(fields >> std::ws).eof()
+		)
+		{
+			throw std::runtime_error(std::string("bad ") + key + " entry \"" + entry + "\"");
+		}
+
+		retval.push_back(ENTRY{static_cast<uint8_t>(map_id), first, second});
+	}
+
+	return retval;
+}
+
+
+static uplink_pipeline::event_publishing_t parse_event_publishing(const std::string & text)
+{
+	if (text == "single")
+		return uplink_pipeline::event_publishing_t::single;
+	else if (text == "batch")
+		return uplink_pipeline::event_publishing_t::batch;
+	else if (text == "both")
+		return uplink_pipeline::event_publishing_t::both;
+
+	throw std::runtime_error("bad " ITS_SDU_EVENTS_KEY " value \"" + text + "\"");
+}
+
+
+//! Разбор списка вида "a,b,..."
+static std::vector<std::string> parse_list(const std::string & text)
+{
+	std::vector<std::string> retval;
+	std::stringstream entries(text);
+	std::string entry;
+	while (std::getline(entries, entry, ','))
+	{
+		if (!entry.empty())
+			retval.push_back(entry);
+	}
+
+	return retval;
+}
+
+
+static bool parse_downlink_invalid(const std::string & text)
+{
+	if (text == "drop")
+		return false;
+	else if (text == "pass")
+		return true;
+
+	throw std::runtime_error("bad " ITS_DOWNLINK_INVALID_KEY " value \"" + text + "\"");
+}
+
+
+//! Загрузка физических каналов из JSON файла
+/*! Файл вида {"pchannels": [{"name": "lora", "radio_topic": "radio", ...}, ...]},
+ *  поля каналов как в pchannel_config, отсутствующие берутся по умолчанию */
+static std::vector<pchannel_config> load_pchannels(const std::string & path)
+{
+	std::ifstream stream(path);
+	if (!stream)
+		throw std::runtime_error("unable to open physical channels config " + path);
+
+	const nlohmann::json j = nlohmann::json::parse(stream);
+	std::vector<pchannel_config> retval;
+	for (const auto & jchannel: j.at("pchannels"))
+	{
+		pchannel_config channel;
+		channel.name = jchannel.value("name", channel.name);
+		channel.radio_topic = jchannel.value("radio_topic", channel.radio_topic);
+		channel.downlink_receivers = jchannel.value("downlink_receivers", channel.downlink_receivers);
+		channel.sc_id = jchannel.value("sc_id", channel.sc_id);
+		channel.frame_size = jchannel.value("frame_size", channel.frame_size);
+		channel.uplink_vchannel_id = jchannel.value("uplink_vchannel_id", channel.uplink_vchannel_id);
+		channel.downlink_vchannel_id = jchannel.value("downlink_vchannel_id", channel.downlink_vchannel_id);
+		channel.uplink = jchannel.value("uplink", channel.uplink);
+		channel.cpu = jchannel.value("cpu", channel.cpu);
+
+		for (const auto & other: retval)
+		{
+			if (other.name == channel.name || other.radio_topic == channel.radio_topic)
+				throw std::runtime_error("physical channel \"" + channel.name + "\" is not unique");
+		}
+
+		retval.push_back(std::move(channel));
+	}
+
+	if (retval.empty())
+		throw std::runtime_error("there is no physical channels in " + path);
+
+	return retval;
+}
+
+
 static config get_config(int argc, char ** argv)
 {
 	config retval;
@@ -65,10 +253,169 @@ static config get_config(int argc, char ** argv)
 	else
 		throw std::runtime_error("there is no BPCS endpoint in " ITS_BSCP_ENDPOINT_KEY " envvar");
 
+	if (const char * env_batch_limit = std::getenv(ITS_BATCH_LIMIT_KEY))
+		retval.batch_limit = std::stoul(env_batch_limit);
+
+	if (const char * env_uplink_window = std::getenv(ITS_UPLINK_WINDOW_KEY))
+		retval.uplink_window = std::stoul(env_uplink_window);
+
+	if (const char * env_frame_timeout = std::getenv(ITS_FRAME_TIMEOUT_KEY))
+		retval.frame_timeout_ms = std::stol(env_frame_timeout);
+
+	if (const char * env_threaded = std::getenv(ITS_THREADED_KEY))
+		retval.threaded = std::stoi(env_threaded) != 0;
+
+	if (const char * env_queue_capacity = std::getenv(ITS_QUEUE_CAPACITY_KEY))
+		retval.queue_capacity = std::stoul(env_queue_capacity);
+
+	if (const char * env_stats_period = std::getenv(ITS_STATS_PERIOD_KEY))
+		retval.stats_period_ms = std::stol(env_stats_period);
+
+	if (const char * env_map_schedule = std::getenv(ITS_MAP_SCHEDULE_KEY))
+		retval.map_schedule = parse_map_triples<map_schedule_entry, unsigned>(ITS_MAP_SCHEDULE_KEY, env_map_schedule);
+
+	if (const char * env_expedited_first = std::getenv(ITS_EXPEDITED_FIRST_KEY))
+		retval.expedited_first = std::stoi(env_expedited_first) != 0;
+
+	if (const char * env_map_limits = std::getenv(ITS_MAP_LIMITS_KEY))
+		retval.map_limits = parse_map_triples<map_limits_entry, size_t>(ITS_MAP_LIMITS_KEY, env_map_limits);
+
+	if (const char * env_queue_report_period = std::getenv(ITS_QUEUE_REPORT_PERIOD_KEY))
+		retval.queue_report_period_ms = std::stol(env_queue_report_period);
+
+	if (const char * env_sdu_events = std::getenv(ITS_SDU_EVENTS_KEY))
+		retval.event_publishing = parse_event_publishing(env_sdu_events);
+
+	if (const char * env_pchannels = std::getenv(ITS_PCHANNELS_KEY))
+		retval.pchannels = load_pchannels(env_pchannels);
+
+	if (const char * env_downlink_receivers = std::getenv(ITS_DOWNLINK_RECEIVERS_KEY))
+		retval.downlink_receivers = parse_list(env_downlink_receivers);
+
+	if (const char * env_downlink_reorder = std::getenv(ITS_DOWNLINK_REORDER_KEY))
+		retval.downlink_reorder_ms = std::stol(env_downlink_reorder);
+
+	if (const char * env_downlink_invalid = std::getenv(ITS_DOWNLINK_INVALID_KEY))
+		retval.downlink_pass_invalid = parse_downlink_invalid(env_downlink_invalid);
+
+	if (const char * env_journal = std::getenv(ITS_JOURNAL_KEY))
+		retval.journal_path = env_journal;
+
+	if (const char * env_journal_size = std::getenv(ITS_JOURNAL_SIZE_KEY))
+		retval.journal_size = std::stoul(env_journal_size);
+
+	if (const char * env_meta_format = std::getenv(GBUS_META_FORMAT_ENV_KEY))
+		retval.binary_metadata = (std::string(env_meta_format) == GBUS_META_FORMAT_BINARY);
+
 	return retval;
 }
 
 
+static void configure_uplink(uplink_pipeline & uplink, const pchannel_config & pchannel, const config & c)
+{
+	uplink.frame_done_timeout(std::chrono::milliseconds(c.frame_timeout_ms));
+	uplink.uplink_window(c.uplink_window);
+	LOG(info) << "uplink window is " << uplink.uplink_window() << " frames, "
+			<< "frame timeout is " << uplink.frame_done_timeout().count() << " ms";
+	for (const auto & entry: c.map_schedule)
+	{
+		const ccsds::uslp::gmapid_t gmapid(pchannel.sc_id, pchannel.uplink_vchannel_id, entry.map_id);
+		uplink.scheduler().add_map(gmapid, entry.priority, entry.weight);
+		LOG(info) << "uplink map " << gmapid << " has priority " << entry.priority << ", weight " << entry.weight;
+	}
+	uplink.scheduler().expedited_first(c.expedited_first);
+	LOG(info) << "expedited SDUs go first: " << (c.expedited_first ? "yes" : "no");
+	for (const auto & entry: c.map_limits)
+	{
+		const ccsds::uslp::gmapid_t gmapid(pchannel.sc_id, pchannel.uplink_vchannel_id, entry.map_id);
+		uplink.scheduler().map_limits(gmapid, entry.max_sdus, entry.max_bytes);
+		LOG(info) << "uplink map " << gmapid << " queue is limited to "
+				<< entry.max_sdus << " SDUs, " << entry.max_bytes << " bytes";
+	}
+	uplink.queue_report_period(std::chrono::milliseconds(c.queue_report_period_ms));
+	LOG(info) << "uplink queues report period is " << uplink.queue_report_period().count() << " ms";
+	uplink.event_publishing(c.event_publishing);
+	if (c.event_publishing != uplink_pipeline::event_publishing_t::single)
+		LOG(info) << "publishing uplink SDU events in batches";
+
+	// Журнал последним: поднятые из него SDU встают в уже настроенные очереди
+	if (!c.journal_path.empty())
+		uplink.open_journal(c.journal_path + "." + pchannel.name, c.journal_size);
+}
+
+
+static void configure_downlink(downlink_pipeline & downlink, const pchannel_config & pchannel, const config & c)
+{
+	// С одним приёмником ждать копий неоткуда
+	const long reorder_ms = pchannel.downlink_receivers.empty() ? 0 : c.downlink_reorder_ms;
+	downlink.reorder_time(std::chrono::milliseconds(reorder_ms));
+	downlink.pass_invalid(c.downlink_pass_invalid);
+	LOG(info) << "downlink frames have " << pchannel.downlink_receivers.size() << " extra receivers, "
+			<< "reorder time is " << downlink.reorder_time().count() << " ms, "
+			<< "frames with invalid checksum are " << (downlink.pass_invalid() ? "passed" : "dropped")
+	;
+}
+
+
+//! Физический канал для диспетчеров без шардирования
+static pchannel_config default_pchannel(const config & c)
+{
+	pchannel_config retval;
+	retval.downlink_receivers = c.downlink_receivers;
+	return retval;
+}
+
+
+template <typename DISPATCHER>
+static void configure_dispatcher(DISPATCHER & d, const config & c, const bus_io & io)
+{
+	d.batch_limit(c.batch_limit);
+	LOG(info) << "dispatcher batch limit is " << d.batch_limit();
+	configure_uplink(d.uplink(), default_pchannel(c), c);
+	configure_downlink(d.downlink(), default_pchannel(c), c);
+	d.stats().report_period(std::chrono::milliseconds(c.stats_period_ms));
+	d.stats().downlink_sources(io.downlink_sources());
+	LOG(info) << "stats period is " << d.stats().report_period().count() << " ms";
+}
+
+
+static void configure_dispatcher(sharded_dispatcher & d, const config & c, const bus_io & io)
+{
+	d.batch_limit(c.batch_limit);
+	LOG(info) << "dispatcher batch limit is " << d.batch_limit();
+	for (size_t i = 0; i < d.pchannels_count(); i++)
+	{
+		LOG(info) << "configuring physical channel \"" << d.pchannel(i).name << "\"";
+		configure_uplink(d.uplink(i), d.pchannel(i), c);
+		configure_downlink(d.downlink(i), d.pchannel(i), c);
+	}
+	d.stats().report_period(std::chrono::milliseconds(c.stats_period_ms));
+	d.stats().downlink_sources(io.downlink_sources());
+	LOG(info) << "stats period is " << d.stats().report_period().count() << " ms";
+}
+
+
+template <typename DISPATCHER>
+static void run_dispatcher(DISPATCHER & d)
+{
+	signal_catched.store(false);
+	std::signal(SIGTERM, signal_handler);
+	std::signal(SIGINT, signal_handler);
+	std::signal(SIGHUP, signal_handler);
+
+	while(1)
+	{
+		if (signal_catched.load())
+		{
+			LOG(info) << "got signal " << signal_value << " stooping loop";
+			break;
+		}
+
+		d.poll();
+	}
+}
+
+
 static int real_main(int argc, char ** argv)
 {
 	setup_log();
@@ -86,29 +433,72 @@ static int real_main(int argc, char ** argv)
 
 	zmq::context_t ctx;
 	bus_io io(ctx);
+	// Без файла каналов радио одно, но приёмников у него может быть несколько
+	const std::vector<pchannel_config> radio_pchannels = c.pchannels.empty()
+			? std::vector<pchannel_config>{default_pchannel(c)}
+			: c.pchannels
+	;
+	io.radio_topics(radio_pchannels);
 	io.connect_bpcs(c.bpcs_endpoint);
 	io.connect_bscp(c.bscp_endpoint);
+	io.binary_metadata(c.binary_metadata);
+	if (c.binary_metadata)
+		LOG(info) << "using binary metadata for outgoing messages";
 
-	ostack ost;
-	istack ist;
-
-	dispatcher d(ist, ost, io);
-	d.frame_done_timeout(std::chrono::milliseconds(5000));
+	if (!c.pchannels.empty())
+	{
+		// Каждому физическому каналу свой поток, стеки и сокет для отправки
+		std::vector<std::unique_ptr<bus_io>> pchannel_ios;
+		std::vector<bus_output*> outputs;
+		for (size_t i = 0; i < c.pchannels.size(); i++)
+		{
+			pchannel_ios.push_back(std::make_unique<bus_io>(ctx));
+			pchannel_ios.back()->radio_topics(radio_pchannels);
+			pchannel_ios.back()->connect_bscp(c.bscp_endpoint);
+			pchannel_ios.back()->binary_metadata(c.binary_metadata);
+			outputs.push_back(pchannel_ios.back().get());
+		}
 
-	signal_catched.store(false);
-	std::signal(SIGTERM, signal_handler);
-	std::signal(SIGINT, signal_handler);
-	std::signal(SIGHUP, signal_handler);
+		LOG(info) << "running " << c.pchannels.size() << " physical channels on separate threads";
+		sharded_dispatcher d(io, c.pchannels, outputs, c.queue_capacity);
+		configure_dispatcher(d, c, io);
+		d.start();
+		run_dispatcher(d);
+		d.stop();
 
-	while(1)
+		for (auto & pchannel_io: pchannel_ios)
+			pchannel_io->close();
+	}
+	else if (c.threaded)
 	{
-		if (signal_catched.load())
+		ostack ost;
+		istack ist;
+
+		// Каждому тракту свой сокет для отправки
+		bus_io uplink_io(ctx), downlink_io(ctx);
+		for (bus_io * pipeline_io: {&uplink_io, &downlink_io})
 		{
-			LOG(info) << "got signal " << signal_value << " stooping loop";
-			break;
+			pipeline_io->connect_bscp(c.bscp_endpoint);
+			pipeline_io->binary_metadata(c.binary_metadata);
 		}
 
-		d.poll();
+		LOG(info) << "running uplink and downlink pipelines on separate threads";
+		threaded_dispatcher d(ist, ost, io, uplink_io, downlink_io, c.queue_capacity);
+		configure_dispatcher(d, c, io);
+		d.start();
+		run_dispatcher(d);
+		d.stop();
+
+		uplink_io.close();
+		downlink_io.close();
+	}
+	else
+	{
+		ostack ost;
+		istack ist;
+		dispatcher d(ist, ost, io);
+		configure_dispatcher(d, c, io);
+		run_dispatcher(d);
 	}
 
 	LOG(info) << "terminating gracefully";
@@ -130,6 +520,7 @@ int main(int argc, char ** argv)
 	catch (std::exception & e)
 	{
 		LOG(error) << "failure! " << e.what();
+		shutdown_log();
 		// Бросаем дальше, чтобы увидеть стектрейс от логуру
 		throw;
 	}
@@ -0,0 +1,282 @@
+#include "map_scheduler.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+
+void map_scheduler::add_map(const ccsds::uslp::gmapid_t & gmapid, unsigned priority, unsigned weight)
+{
+	channel_t * channel = _find_channel(gmapid);
+	if (!channel)
+	{
+		_channels.emplace_back();
+		channel = &_channels.back();
+		channel->gmapid = gmapid;
+	}
+
+	channel->priority = priority;
+	channel->weight = weight ? weight : 1;
+	_rebuild_levels();
+}
+
+
+bool map_scheduler::has_map(const ccsds::uslp::gmapid_t & gmapid) const
+{
+	return nullptr != _find_channel(gmapid);
+}
+
+
+void map_scheduler::map_limits(const ccsds::uslp::gmapid_t & gmapid, size_t max_sdus, size_t max_bytes)
+{
+	channel_t * channel = _find_channel(gmapid);
+	if (!channel)
+		throw std::runtime_error("map channel is not registered in uplink scheduler");
+
+	channel->max_sdus = max_sdus;
+	channel->max_bytes = max_bytes;
+}
+
+
+bool map_scheduler::can_accept(const ccsds::uslp::gmapid_t & gmapid, size_t size) const
+{
+	const channel_t * channel = _find_channel(gmapid);
+	if (!channel)
+		return false;
+
+	if (channel->max_sdus && channel->pending_count() + 1 > channel->max_sdus)
+		return false;
+
+	if (channel->max_bytes && channel->pending_bytes + size > channel->max_bytes)
+		return false;
+
+	return true;
+}
+
+
+void map_scheduler::push(pending_sdu && sdu)
+{
+	channel_t * channel = _find_channel(sdu.gmapid);
+	if (!channel)
+		throw std::runtime_error("map channel is not registered in uplink scheduler");
+
+	channel->pending_bytes += sdu.data.size();
+	if (sdu.deadline)
+		_pending_with_deadline++;
+
+	const bool urgent = _expedited_first && sdu.qos == ccsds::uslp::qos_t::EXPEDITED;
+	(urgent ? channel->urgent : channel->regular).push_back(std::move(sdu));
+	_pending_count++;
+}
+
+
+bool map_scheduler::pop(pending_sdu & sdu)
+{
+	// Уровень может отдать SDU стеку, только если в стеке мало данных этого
+	// и более приоритетных уровней. Менее приоритетные на него не влияют
+	size_t backlog = 0;
+	for (auto & level: _levels)
+	{
+		for (size_t index: level.channels)
+			backlog += _channels[index].backlog();
+
+		if (!_level_pending(level))
+			continue;
+
+		// Строгий приоритет: пока этот уровень ждет, нижние тоже ждут
+		if (backlog >= _frame_size)
+			return false;
+
+		channel_t & channel = _pick_channel(level);
+		auto & queue = channel.urgent.empty() ? channel.regular : channel.urgent;
+		sdu = std::move(queue.front());
+		queue.pop_front();
+		channel.pending_bytes -= sdu.data.size();
+		_pending_count--;
+		if (sdu.deadline)
+			_pending_with_deadline--;
+
+		channel.stacked.push_back(stacked_sdu{sdu.cookie, sdu.data.size(), sdu.accept_time});
+		channel.stacked_bytes += sdu.data.size();
+		return true;
+	}
+
+	return false;
+}
+
+
+void map_scheduler::expire(time_point_t now, std::vector<expired_sdu> & expired)
+{
+	if (0 == _pending_with_deadline)
+		return;
+
+	for (auto & channel: _channels)
+	{
+		for (auto * queue: {&channel.urgent, &channel.regular})
+		{
+			auto is_expired = [now](const pending_sdu & sdu) { return sdu.deadline && *sdu.deadline <= now; };
+			auto first_expired = std::stable_partition(queue->begin(), queue->end(),
+					[&is_expired](const pending_sdu & sdu) { return !is_expired(sdu); }
+			);
+
+			for (auto itt = first_expired; itt != queue->end(); ++itt)
+			{
+				expired.push_back(expired_sdu{itt->gmapid, itt->cookie});
+				channel.pending_bytes -= itt->data.size();
+				_pending_count--;
+				_pending_with_deadline--;
+			}
+
+			queue->erase(first_expired, queue->end());
+		}
+	}
+}
+
+
+void map_scheduler::frame_popped(const ccsds::uslp::gmapid_t & gmapid)
+{
+	if (channel_t * channel = _find_channel(gmapid))
+		channel->popped_bytes = std::min(channel->popped_bytes + _frame_size, channel->stacked_bytes);
+}
+
+
+std::optional<map_scheduler::time_point_t> map_scheduler::sdu_sent(
+		const ccsds::uslp::gmapid_t & gmapid, ccsds::uslp::payload_cookie_t cookie
+)
+{
+	channel_t * channel = _find_channel(gmapid);
+	if (!channel)
+		return std::nullopt;
+
+	// Стек отдает SDU канала в порядке подачи, так что обычно это первый
+	auto itt = std::find_if(channel->stacked.begin(), channel->stacked.end(),
+			[cookie](const stacked_sdu & stacked) { return stacked.cookie == cookie; }
+	);
+	if (itt == channel->stacked.end())
+		return std::nullopt;
+
+	const auto retval = itt->accept_time;
+	channel->stacked_bytes -= itt->size;
+	channel->popped_bytes = channel->popped_bytes > itt->size ? channel->popped_bytes - itt->size : 0;
+	channel->stacked.erase(itt);
+	return retval;
+}
+
+
+void map_scheduler::queue_state(uplink_queue_state & state) const
+{
+	state.queues.clear();
+	for (const auto & channel: _channels)
+	{
+		state.queues.push_back(uplink_queue_state::map_queue{
+			channel.gmapid,
+			channel.pending_count(), channel.pending_bytes,
+			channel.max_sdus, channel.max_bytes,
+			channel.stacked.size()
+		});
+	}
+}
+
+
+void map_scheduler::stack_drained()
+{
+	for (auto & channel: _channels)
+	{
+		channel.stacked.clear();
+		channel.stacked_bytes = 0;
+		channel.popped_bytes = 0;
+	}
+}
+
+
+map_scheduler::channel_t * map_scheduler::_find_channel(const ccsds::uslp::gmapid_t & gmapid)
+{
+	for (auto & channel: _channels)
+	{
+		if (channel.gmapid == gmapid)
+			return &channel;
+	}
+
+	return nullptr;
+}
+
+
+const map_scheduler::channel_t * map_scheduler::_find_channel(const ccsds::uslp::gmapid_t & gmapid) const
+{
+	return const_cast<map_scheduler*>(this)->_find_channel(gmapid);
+}
+
+
+void map_scheduler::_rebuild_levels()
+{
+	_levels.clear();
+	for (size_t i = 0; i < _channels.size(); i++)
+	{
+		const unsigned priority = _channels[i].priority;
+		auto itt = std::find_if(_levels.begin(), _levels.end(),
+				[priority](const level_t & level) { return level.priority == priority; }
+		);
+		if (itt == _levels.end())
+		{
+			_levels.push_back(level_t{priority, {}});
+			itt = std::prev(_levels.end());
+		}
+
+		itt->channels.push_back(i);
+	}
+
+	std::sort(_levels.begin(), _levels.end(),
+			[](const level_t & left, const level_t & right) { return left.priority < right.priority; }
+	);
+
+	for (auto & channel: _channels)
+		channel.deficit = 0;
+}
+
+
+bool map_scheduler::_level_pending(const level_t & level) const
+{
+	for (size_t index: level.channels)
+	{
+		if (!_channels[index].empty())
+			return true;
+	}
+
+	return false;
+}
+
+
+map_scheduler::channel_t & map_scheduler::_pick_channel(level_t & level)
+{
+	auto advance = [&level]() {
+		level.cursor = (level.cursor + 1) % level.channels.size();
+		level.quantum_given = false;
+	};
+
+	// Дефицит каналов растет с каждым обходом, так что цикл конечен
+	while (true)
+	{
+		channel_t & channel = _channels[level.channels[level.cursor]];
+		if (channel.empty())
+		{
+			// Пустой канал не копит право на эфир
+			channel.deficit = 0;
+			advance();
+			continue;
+		}
+
+		if (!level.quantum_given)
+		{
+			channel.deficit += channel.weight * _frame_size;
+			level.quantum_given = true;
+		}
+
+		const size_t size = channel.front().data.size();
+		if (size <= channel.deficit)
+		{
+			channel.deficit -= size;
+			return channel;
+		}
+
+		advance();
+	}
+}
@@ -0,0 +1,175 @@
+#ifndef ITS_SERVER_USLP_SRC_MAP_SCHEDULER_HPP_
+#define ITS_SERVER_USLP_SRC_MAP_SCHEDULER_HPP_
+
+
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <optional>
+
+#include <ccsds/uslp/common/defs.hpp>
+#include <ccsds/uslp/common/ids.hpp>
+
+#include "bus_messages.hpp"
+
+
+// Лимиты очереди MAP канала по умолчанию. Ноль - без лимита
+#define ITS_MAP_QUEUE_DEFAULT_MAX_SDUS (256)
+#define ITS_MAP_QUEUE_DEFAULT_MAX_BYTES (256*1024)
+
+
+//! Планировщик аплинк SDU между MAP каналами
+/*! SDU не идут в стек сразу, а ждут своей очереди здесь. Стек получает их
+ *  понемногу - не больше фрейма на каждый уровень приоритета, поэтому его
+ *  собственный круговой мультиплексор MAP каналов почти ни на что не влияет
+ *  и порядок фреймов определяется планировщиком.
+ *
+ *  У каждого MAP канала есть приоритет и вес. Уровни приоритета обслуживаются
+ *  строго по порядку (меньше число - выше приоритет), а каналы одного уровня
+ *  делят эфир пропорционально весам (deficit round robin по байтам SDU).
+ *  Внутри канала expedited SDU могут обгонять sequence controlled */
+class map_scheduler
+{
+public:
+	typedef std::chrono::steady_clock::time_point time_point_t;
+
+	//! SDU в ожидании отправки
+	struct pending_sdu
+	{
+		ccsds::uslp::gmapid_t gmapid;
+		ccsds::uslp::qos_t qos = ccsds::uslp::qos_t::EXPEDITED;
+		ccsds::uslp::payload_cookie_t cookie = 0;
+		bus_payload data;
+		//! Когда SDU был принят в очередь
+		time_point_t accept_time;
+		//! Если SDU не ушел в стек к этому времени - он уже никому не нужен
+		std::optional<time_point_t> deadline;
+	};
+
+	//! SDU, выкинутый из очереди по сроку жизни
+	struct expired_sdu
+	{
+		ccsds::uslp::gmapid_t gmapid;
+		ccsds::uslp::payload_cookie_t cookie;
+	};
+
+	//! Размер фрейма
+	/*! Столько байт SDU держится в стеке на каждом уровне приоритета
+	 *  и столько добавляет к дефициту канала один его обход с весом 1 */
+	void frame_size(size_t value) { _frame_size = value ? value : 1; }
+	size_t frame_size() const { return _frame_size; }
+
+	//! Пускать ли expedited SDU вперед sequence controlled в пределах канала
+	void expedited_first(bool value) { _expedited_first = value; }
+	bool expedited_first() const { return _expedited_first; }
+
+	//! Добавление канала или изменение настроек существующего
+	/*! Нулевой вес считается единичным */
+	void add_map(const ccsds::uslp::gmapid_t & gmapid, unsigned priority, unsigned weight);
+	bool has_map(const ccsds::uslp::gmapid_t & gmapid) const;
+
+	//! Лимиты очереди канала: сколько SDU и байт в ней может ждать. Ноль - без лимита
+	/*! SDU, уже отданные стеку, в лимиты не входят */
+	void map_limits(const ccsds::uslp::gmapid_t & gmapid, size_t max_sdus, size_t max_bytes);
+
+	//! Поместится ли SDU указанного размера в очередь канала
+	bool can_accept(const ccsds::uslp::gmapid_t & gmapid, size_t size) const;
+
+	//! Постановка SDU в очередь его канала. Канал должен быть добавлен
+	/*! Лимиты здесь не проверяются, для этого есть can_accept() */
+	void push(pending_sdu && sdu);
+
+	//! Следующий SDU, который пора отдать стеку. false, если таких нет
+	/*! Выданный SDU считается лежащим в стеке, пока не будет отправлен фрейм
+	 *  с его последней частью (sdu_sent) или пока стек не опустеет (stack_drained) */
+	bool pop(pending_sdu & sdu);
+
+	//! Выкидывание из очередей SDU, срок жизни которых истек к now
+	/*! Выкинутые дописываются в expired. В стеке SDU уже не достать, но их
+	 *  там не больше фрейма-другого на уровень приоритета */
+	void expire(time_point_t now, std::vector<expired_sdu> & expired);
+
+	//! Учет фрейма, выгребенного из стека для указанного канала
+	void frame_popped(const ccsds::uslp::gmapid_t & gmapid);
+	//! Последняя часть SDU ушла из стека. Возвращает время приёма SDU в очередь
+	std::optional<time_point_t> sdu_sent(
+			const ccsds::uslp::gmapid_t & gmapid, ccsds::uslp::payload_cookie_t cookie
+	);
+	//! Стеку больше нечего отправлять - все выданные ему SDU ушли
+	void stack_drained();
+
+	//! Сколько SDU ждут в очередях
+	size_t pending_count() const { return _pending_count; }
+
+	//! Заполненность очередей каналов для отчета на шину
+	void queue_state(uplink_queue_state & state) const;
+
+private:
+	//! SDU, отданный стеку
+	struct stacked_sdu
+	{
+		ccsds::uslp::payload_cookie_t cookie;
+		size_t size;
+		time_point_t accept_time;
+	};
+
+	struct channel_t
+	{
+		ccsds::uslp::gmapid_t gmapid;
+		unsigned priority = 0;
+		unsigned weight = 1;
+
+		//! Очереди SDU: с expedited_first сюда попадают expedited SDU
+		std::deque<pending_sdu> urgent;
+		std::deque<pending_sdu> regular;
+		size_t pending_bytes = 0;
+		size_t max_sdus = ITS_MAP_QUEUE_DEFAULT_MAX_SDUS;
+		size_t max_bytes = ITS_MAP_QUEUE_DEFAULT_MAX_BYTES;
+		//! Сколько байт канал еще может отдать в этом обходе
+		size_t deficit = 0;
+
+		//! SDU в стеке в порядке подачи
+		std::deque<stacked_sdu> stacked;
+		size_t stacked_bytes = 0;
+		//! Оценка того, сколько из них уже ушло фреймами
+		size_t popped_bytes = 0;
+
+		bool empty() const { return urgent.empty() && regular.empty(); }
+		size_t pending_count() const { return urgent.size() + regular.size(); }
+		const pending_sdu & front() const { return urgent.empty() ? regular.front() : urgent.front(); }
+		//! Сколько байт канала еще ждет в стеке
+		size_t backlog() const { return stacked_bytes > popped_bytes ? stacked_bytes - popped_bytes : 0; }
+	};
+
+	//! Каналы одного приоритета
+	struct level_t
+	{
+		unsigned priority;
+		std::vector<size_t> channels;
+		//! Канал, который сейчас обходится
+		size_t cursor = 0;
+		//! Получил ли текущий канал квант в этом обходе
+		bool quantum_given = false;
+	};
+
+	channel_t * _find_channel(const ccsds::uslp::gmapid_t & gmapid);
+	const channel_t * _find_channel(const ccsds::uslp::gmapid_t & gmapid) const;
+	void _rebuild_levels();
+	bool _level_pending(const level_t & level) const;
+	//! Выбор канала уровня по deficit round robin. На уровне должны быть SDU
+	channel_t & _pick_channel(level_t & level);
+
+	size_t _frame_size = 200;
+	bool _expedited_first = true;
+	size_t _pending_count = 0;
+	//! Сколько SDU в очередях имеют срок жизни. Если нисколько - expire() ничего не делает
+	size_t _pending_with_deadline = 0;
+
+	//! В deque, потому что очереди SDU некопируемые
+	std::deque<channel_t> _channels;
+	//! Уровни в порядке убывания приоритета
+	std::vector<level_t> _levels;
+};
+
+
+#endif /* ITS_SERVER_USLP_SRC_MAP_SCHEDULER_HPP_ */
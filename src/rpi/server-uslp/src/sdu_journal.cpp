@@ -0,0 +1,479 @@
+#include "sdu_journal.hpp"
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ccsds/uslp/common/ids_io.hpp>
+
+#include "log.hpp"
+
+
+static auto _slg = build_source("sdu-journal");
+
+
+#define ITS_SDU_JOURNAL_MAGIC "USLPJRN1"
+#define ITS_SDU_JOURNAL_VERSION (1)
+//! Записи начинаются после заголовка файла
+#define ITS_SDU_JOURNAL_HEADER_SIZE (64)
+
+//! Виды записей
+#define ITS_SDU_JOURNAL_RECORD_ACCEPTED (1)
+#define ITS_SDU_JOURNAL_RECORD_DONE (2)
+
+
+//! Заголовок файла журнала
+struct journal_header_t
+{
+	char magic[8];
+	uint32_t version;
+	//! Записи других эпох считаются мусором
+	uint32_t epoch;
+};
+
+
+static_assert(sizeof(journal_header_t) <= ITS_SDU_JOURNAL_HEADER_SIZE, "journal header does not fit");
+
+
+//! Записи выравниваются на 8 байт, чтобы заголовки читались целиком
+static size_t _align(size_t size)
+{
+	return (size + 7) & ~static_cast<size_t>(7);
+}
+
+
+static std::runtime_error _errno_error(const std::string & what)
+{
+	return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+
+sdu_journal::sdu_journal(const std::string & path, size_t capacity)
+	: _path(path)
+{
+	_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (_fd < 0)
+		throw _errno_error("unable to open uplink journal " + path);
+
+	try
+	{
+		struct stat st;
+		if (0 != ::fstat(_fd, &st))
+			throw _errno_error("unable to stat uplink journal " + path);
+
+		// Файл больше заданного не обрезаем, там могут быть живые записи
+		const bool fresh = 0 == st.st_size;
+		capacity = std::max(capacity, static_cast<size_t>(st.st_size));
+		if (capacity < ITS_SDU_JOURNAL_HEADER_SIZE + sizeof(record_header_t))
+			throw std::runtime_error("uplink journal capacity is too small");
+
+		_map_file(_fd, capacity, fresh);
+
+		journal_header_t header;
+		std::memcpy(&header, _base, sizeof(header));
+		if (0 != std::memcmp(header.magic, ITS_SDU_JOURNAL_MAGIC, sizeof(header.magic))
+				|| header.version != ITS_SDU_JOURNAL_VERSION
+		)
+		{
+			throw std::runtime_error(path + " is not an uplink journal");
+		}
+
+		_epoch = header.epoch;
+		_scan();
+	}
+	catch (...)
+	{
+		_unmap_file();
+		::close(_fd);
+		_fd = -1;
+		throw;
+	}
+
+	LOG(info) << "opened uplink journal " << path << ": " << _live.size() << " live SDUs, "
+			<< _write_pos << " of " << _capacity << " bytes used"
+	;
+}
+
+
+sdu_journal::~sdu_journal()
+{
+	if (_base)
+		::msync(_base, _capacity, MS_SYNC);
+
+	_unmap_file();
+	if (_fd >= 0)
+		::close(_fd);
+}
+
+
+std::vector<sdu_journal::restored_sdu> sdu_journal::restore() const
+{
+	// Порядок приёма - это порядок записей в файле
+	std::vector<size_t> offsets;
+	offsets.reserve(_live.size());
+	for (const auto & live: _live)
+		offsets.push_back(live.second);
+	std::sort(offsets.begin(), offsets.end());
+
+	std::vector<restored_sdu> retval;
+	retval.reserve(offsets.size());
+	for (const size_t offset: offsets)
+	{
+		record_header_t header;
+		std::memcpy(&header, _base + offset, sizeof(header));
+
+		restored_sdu sdu;
+		sdu.gmapid = ccsds::uslp::gmapid_t(header.sc_id, header.vchannel_id, header.map_id);
+		sdu.qos = static_cast<ccsds::uslp::qos_t>(header.qos);
+		sdu.cookie = header.cookie;
+		sdu.data = bus_payload(zmq::message_t(_base + offset + sizeof(header), header.size - sizeof(header)));
+		if (header.deadline_us)
+			sdu.deadline = wall_time_point_t(std::chrono::microseconds(header.deadline_us));
+
+		retval.push_back(std::move(sdu));
+	}
+
+	return retval;
+}
+
+
+bool sdu_journal::sdu_accepted(
+		const ccsds::uslp::gmapid_t & gmapid, ccsds::uslp::qos_t qos,
+		ccsds::uslp::payload_cookie_t cookie, const uint8_t * data, size_t size,
+		std::optional<wall_time_point_t> deadline
+)
+{
+	// Обнулить пустой журнал - одна запись в заголовок, а сжатие подождет maintain()
+	if (!_fits(size) && _live.empty())
+		_reset();
+
+	if (!_fits(size))
+	{
+		LOG(error) << "uplink journal is full, SDU " << gmapid << ", cookie " << cookie
+				<< " will not survive restart"
+		;
+		return false;
+	}
+
+	int64_t deadline_us = 0;
+	if (deadline)
+	{
+		deadline_us = std::chrono::duration_cast<std::chrono::microseconds>(deadline->time_since_epoch()).count();
+		// Ноль занят под "бессрочно"
+		deadline_us = deadline_us ? deadline_us : 1;
+	}
+
+	const size_t offset = _write_pos;
+	const size_t record_size = _put_record(
+			_base, offset, _epoch, ITS_SDU_JOURNAL_RECORD_ACCEPTED,
+			gmapid, static_cast<uint8_t>(qos), cookie, deadline_us, data, size
+	);
+
+	_write_pos += record_size;
+	_live.emplace(sdu_key_t(gmapid, cookie), offset);
+	_live_bytes += record_size;
+	_dirty = true;
+	return true;
+}
+
+
+void sdu_journal::sdu_done(const ccsds::uslp::gmapid_t & gmapid, ccsds::uslp::payload_cookie_t cookie)
+{
+	const auto itt = _live.find(sdu_key_t(gmapid, cookie));
+	if (itt == _live.end())
+		return;
+
+	record_header_t accepted;
+	std::memcpy(&accepted, _base + itt->second, sizeof(accepted));
+	_live_bytes -= _align(accepted.size);
+	_live.erase(itt);
+
+	if (_live.empty())
+	{
+		// Помнить больше нечего
+		_reset();
+		return;
+	}
+
+	// Место под эту запись зарезервировано при приёме SDU. Не хватить его может
+	// только в журнале, записанном до появления резерва
+	if (_write_pos + _done_record_size() > _capacity)
+	{
+		LOG(error) << "no room for done record in uplink journal, SDU " << gmapid << ", cookie " << cookie
+				<< " will be sent again after restart"
+		;
+		return;
+	}
+
+	_write_pos += _put_record(
+			_base, _write_pos, _epoch, ITS_SDU_JOURNAL_RECORD_DONE,
+			gmapid, 0, cookie, 0, nullptr, 0
+	);
+	_dirty = true;
+}
+
+
+void sdu_journal::maintain()
+{
+	// Места осталось мало, а мусора накопилось достаточно, чтобы переписывать было ради чего.
+	// Сжимать больше негде, так что ждать, пока мусора станет больше половины, нельзя
+	const size_t used = _write_pos - ITS_SDU_JOURNAL_HEADER_SIZE;
+	if (_write_pos > _capacity / 4 * 3 && used - _live_bytes >= _capacity / 8)
+		_compact();
+
+	if (!_dirty)
+		return;
+
+	if (0 != ::msync(_base, _capacity, MS_ASYNC))
+		LOG(warning) << "unable to sync uplink journal: " << std::strerror(errno);
+
+	_dirty = false;
+}
+
+
+void sdu_journal::_map_file(int fd, size_t capacity, bool init)
+{
+	if (0 != ::ftruncate(fd, static_cast<off_t>(capacity)))
+		throw _errno_error("unable to resize uplink journal " + _path);
+
+	void * base = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == base)
+		throw _errno_error("unable to map uplink journal " + _path);
+
+	_base = static_cast<uint8_t*>(base);
+	_capacity = capacity;
+	if (!init)
+		return;
+
+	journal_header_t header = {};
+	std::memcpy(header.magic, ITS_SDU_JOURNAL_MAGIC, sizeof(header.magic));
+	header.version = ITS_SDU_JOURNAL_VERSION;
+	header.epoch = 1;
+	std::memcpy(_base, &header, sizeof(header));
+}
+
+
+void sdu_journal::_unmap_file()
+{
+	if (!_base)
+		return;
+
+	::munmap(_base, _capacity);
+	_base = nullptr;
+}
+
+
+void sdu_journal::_scan()
+{
+	_live.clear();
+	_live_bytes = 0;
+
+	size_t offset = ITS_SDU_JOURNAL_HEADER_SIZE;
+	while (offset + sizeof(record_header_t) <= _capacity)
+	{
+		record_header_t header;
+		std::memcpy(&header, _base + offset, sizeof(header));
+		if (header.epoch != _epoch || header.size < sizeof(header) || offset + header.size > _capacity)
+			break;
+
+		// Недописанная перед падением запись
+		const uint32_t crc = header.crc;
+		header.crc = 0;
+		uint32_t actual_crc = _crc32(0, reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+		actual_crc = _crc32(actual_crc, _base + offset + sizeof(header), header.size - sizeof(header));
+		if (crc != actual_crc)
+		{
+			LOG(warning) << "uplink journal record at " << offset << " is broken, dropping the tail";
+			break;
+		}
+
+		const sdu_key_t key(ccsds::uslp::gmapid_t(header.sc_id, header.vchannel_id, header.map_id), header.cookie);
+		if (ITS_SDU_JOURNAL_RECORD_ACCEPTED == header.kind)
+		{
+			_live.emplace(key, offset);
+			_live_bytes += _align(header.size);
+		}
+		else if (ITS_SDU_JOURNAL_RECORD_DONE == header.kind)
+		{
+			const auto itt = _live.find(key);
+			if (itt != _live.end())
+			{
+				record_header_t accepted;
+				std::memcpy(&accepted, _base + itt->second, sizeof(accepted));
+				_live_bytes -= _align(accepted.size);
+				_live.erase(itt);
+			}
+		}
+
+		offset += _align(header.size);
+	}
+
+	_write_pos = offset;
+}
+
+
+size_t sdu_journal::_put_record(
+		uint8_t * base, size_t offset, uint32_t epoch, uint8_t kind,
+		const ccsds::uslp::gmapid_t & gmapid, uint8_t qos, ccsds::uslp::payload_cookie_t cookie,
+		int64_t deadline_us, const uint8_t * data, size_t size
+) const
+{
+	record_header_t header = {};
+	header.epoch = epoch;
+	header.size = static_cast<uint32_t>(sizeof(header) + size);
+	header.kind = kind;
+	header.qos = qos;
+	header.sc_id = gmapid.sc_id();
+	header.vchannel_id = gmapid.vchannel_id();
+	header.map_id = gmapid.map_id();
+	header.cookie = cookie;
+	header.deadline_us = deadline_us;
+
+	uint32_t crc = _crc32(0, reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+	crc = _crc32(crc, data, size);
+	header.crc = crc;
+
+	// Данные раньше заголовка: запись без заголовка при чтении не видна
+	if (size)
+		std::memcpy(base + offset + sizeof(header), data, size);
+	std::memcpy(base + offset, &header, sizeof(header));
+
+	return _align(header.size);
+}
+
+
+bool sdu_journal::_fits(size_t size) const
+{
+	const size_t reserved = (_live.size() + 1) * _done_record_size();
+	return _write_pos + _align(sizeof(record_header_t) + size) + reserved <= _capacity;
+}
+
+
+size_t sdu_journal::_done_record_size()
+{
+	return _align(sizeof(record_header_t));
+}
+
+
+void sdu_journal::_reset()
+{
+	// Одна запись в заголовок делает все старые записи мусором
+	_epoch++;
+	std::memcpy(_base + offsetof(journal_header_t, epoch), &_epoch, sizeof(_epoch));
+	_write_pos = ITS_SDU_JOURNAL_HEADER_SIZE;
+	_live_bytes = 0;
+	_dirty = true;
+}
+
+
+void sdu_journal::_compact()
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	// Новый файл пишется рядом и подменяет старый только целиком готовым
+	const std::string tmp_path = _path + ".tmp";
+	const int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		LOG(error) << "unable to compact uplink journal: " << _errno_error(tmp_path).what();
+		return;
+	}
+
+	uint8_t * const old_base = _base;
+	const size_t old_capacity = _capacity;
+	const int old_fd = _fd;
+	const uint32_t old_epoch = _epoch;
+	try
+	{
+		_map_file(fd, old_capacity, true);
+	}
+	catch (std::exception & e)
+	{
+		LOG(error) << "unable to compact uplink journal: " << e.what();
+		_base = old_base;
+		_capacity = old_capacity;
+		::close(fd);
+		::unlink(tmp_path.c_str());
+		return;
+	}
+
+	uint8_t * const new_base = _base;
+	const uint32_t new_epoch = old_epoch + 1;
+	std::memcpy(new_base + offsetof(journal_header_t, epoch), &new_epoch, sizeof(new_epoch));
+
+	// Живые записи в порядке приёма
+	std::vector<std::multimap<sdu_key_t, size_t>::iterator> live;
+	for (auto itt = _live.begin(); itt != _live.end(); ++itt)
+		live.push_back(itt);
+	std::sort(live.begin(), live.end(), [](const auto & left, const auto & right) { return left->second < right->second; });
+
+	size_t offset = ITS_SDU_JOURNAL_HEADER_SIZE;
+	std::vector<size_t> new_offsets;
+	new_offsets.reserve(live.size());
+	for (const auto & itt: live)
+	{
+		record_header_t header;
+		std::memcpy(&header, old_base + itt->second, sizeof(header));
+		new_offsets.push_back(offset);
+		offset += _put_record(
+				new_base, offset, new_epoch, ITS_SDU_JOURNAL_RECORD_ACCEPTED,
+				itt->first.first, header.qos, header.cookie, header.deadline_us,
+				old_base + itt->second + sizeof(header), header.size - sizeof(header)
+		);
+	}
+
+	::msync(new_base, offset, MS_SYNC);
+	if (0 != ::rename(tmp_path.c_str(), _path.c_str()))
+	{
+		LOG(error) << "unable to compact uplink journal: " << _errno_error("rename").what();
+		::munmap(new_base, old_capacity);
+		::close(fd);
+		::unlink(tmp_path.c_str());
+		_base = old_base;
+		return;
+	}
+
+	::munmap(old_base, old_capacity);
+	::close(old_fd);
+	_fd = fd;
+	_epoch = new_epoch;
+	_write_pos = offset;
+	_live_bytes = offset - ITS_SDU_JOURNAL_HEADER_SIZE;
+	for (size_t i = 0; i < live.size(); i++)
+		live[i]->second = new_offsets[i];
+
+	LOG(info) << "compacted uplink journal to " << live.size() << " SDUs, " << offset << " bytes in "
+			<< std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()
+			<< " us"
+	;
+}
+
+
+uint32_t sdu_journal::_crc32(uint32_t crc, const uint8_t * data, size_t size)
+{
+	static const auto table = []() {
+		std::array<uint32_t, 256> retval;
+		for (uint32_t i = 0; i < retval.size(); i++)
+		{
+			uint32_t value = i;
+			for (int bit = 0; bit < 8; bit++)
+				value = (value & 1) ? (0xEDB88320u ^ (value >> 1)) : (value >> 1);
+			retval[i] = value;
+		}
+		return retval;
+	}();
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
@@ -0,0 +1,151 @@
+#ifndef ITS_SERVER_USLP_SRC_SDU_JOURNAL_HPP_
+#define ITS_SERVER_USLP_SRC_SDU_JOURNAL_HPP_
+
+
+#include <map>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+
+#include <ccsds/uslp/common/defs.hpp>
+#include <ccsds/uslp/common/ids.hpp>
+
+#include "bus_messages.hpp"
+
+
+//! Размер файла журнала по умолчанию
+#define ITS_SDU_JOURNAL_DEFAULT_SIZE (16*1024*1024)
+
+
+//! Журнал принятых аплинк SDU, переживающий падение сервера
+/*! Файл отображается в память целиком, записи только дописываются в конец:
+ *  "SDU принят" с его данными и "судьба SDU решилась". Запись в отображенную
+ *  память переживает падение процесса, поэтому после перезапуска журнал знает
+ *  все SDU, которые были приняты, но так и не ушли в эфир.
+ *
+ *  Каждая запись несет номер эпохи журнала и контрольную сумму, так что
+ *  недописанный хвост и записи прошлых эпох при чтении отбрасываются.
+ *  Когда живых SDU нет, журнал обнуляется сменой эпохи. Когда место кончается,
+ *  живые записи переписываются в новый файл, который подменяет старый. Это
+ *  делается только в maintain(), не на пути приёма SDU и отчетов о фреймах.
+ *
+ *  Под запись "судьба SDU решилась" место резервируется еще при приёме SDU,
+ *  так что она всегда влезает: иначе выполненная телекоманда после перезапуска
+ *  ушла бы в эфир еще раз.
+ *
+ *  На диск журнал сбрасывается асинхронно в maintain(), так что от пропадания
+ *  питания он защищает не полностью */
+class sdu_journal
+{
+public:
+	typedef std::chrono::system_clock::time_point wall_time_point_t;
+
+	//! SDU, пережившие перезапуск
+	struct restored_sdu
+	{
+		ccsds::uslp::gmapid_t gmapid;
+		ccsds::uslp::qos_t qos = ccsds::uslp::qos_t::EXPEDITED;
+		ccsds::uslp::payload_cookie_t cookie = 0;
+		bus_payload data;
+		//! Срок жизни по часам реального времени - монотонные перезапуск не переживают
+		std::optional<wall_time_point_t> deadline;
+	};
+
+	//! Открытие или создание журнала. Файл меньше capacity дорастает до неё
+	sdu_journal(const std::string & path, size_t capacity);
+	~sdu_journal();
+
+	sdu_journal(const sdu_journal &) = delete;
+	sdu_journal & operator=(const sdu_journal &) = delete;
+
+	const std::string & path() const { return _path; }
+
+	//! Живые SDU, найденные в журнале при открытии, в порядке их приёма
+	std::vector<restored_sdu> restore() const;
+
+	//! SDU принят. false, если места в журнале нет (сжимать его тут не будут)
+	bool sdu_accepted(
+			const ccsds::uslp::gmapid_t & gmapid, ccsds::uslp::qos_t qos,
+			ccsds::uslp::payload_cookie_t cookie, const uint8_t * data, size_t size,
+			std::optional<wall_time_point_t> deadline
+	);
+	//! Судьба SDU решилась (ушел в эфир, не ушел, протух). Неизвестные SDU игнорируются
+	void sdu_done(const ccsds::uslp::gmapid_t & gmapid, ccsds::uslp::payload_cookie_t cookie);
+
+	//! Сжатие журнала при необходимости и асинхронный сброс на диск
+	/*! Зовется периодически, вне горячего пути приёма SDU. Сжатие переписывает
+	 *  файл и синхронно сбрасывает его на диск, так что может занять время */
+	void maintain();
+
+	//! Сколько SDU в журнале ждут своей судьбы
+	size_t live_count() const { return _live.size(); }
+	//! Сколько байт журнала занято
+	size_t used_bytes() const { return _write_pos; }
+	size_t capacity() const { return _capacity; }
+
+private:
+	//! Заголовок записи. Данные SDU идут сразу за ним
+	struct record_header_t
+	{
+		uint32_t epoch;
+		//! Размер записи вместе с заголовком, без выравнивания
+		uint32_t size;
+		//! crc32 заголовка (с нулем на месте crc) и данных
+		uint32_t crc;
+		uint8_t kind;
+		uint8_t qos;
+		uint8_t vchannel_id;
+		uint8_t map_id;
+		uint16_t sc_id;
+		uint16_t reserved0;
+		uint32_t reserved1;
+		uint64_t cookie;
+		//! Срок жизни, микросекунды от эпохи unix. Ноль - бессрочно
+		int64_t deadline_us;
+	};
+
+	typedef std::pair<ccsds::uslp::gmapid_t, ccsds::uslp::payload_cookie_t> sdu_key_t;
+
+	//! Отображение файла в память (и создание его, если нужно)
+	void _map_file(int fd, size_t capacity, bool init);
+	void _unmap_file();
+	//! Разбор записей текущей эпохи. Останавливается на первой негодной
+	void _scan();
+	//! Запись в отображение по смещению. Место должно быть
+	size_t _put_record(
+			uint8_t * base, size_t offset, uint32_t epoch, uint8_t kind,
+			const ccsds::uslp::gmapid_t & gmapid, uint8_t qos, ccsds::uslp::payload_cookie_t cookie,
+			int64_t deadline_us, const uint8_t * data, size_t size
+	) const;
+	//! Влезет ли запись "SDU принят" с size байтами данных вместе с резервом
+	//! под записи "судьба решилась" всех живых SDU и её собственную
+	bool _fits(size_t size) const;
+	//! Сколько места занимает запись "судьба SDU решилась"
+	static size_t _done_record_size();
+	//! Смена эпохи, когда живых SDU нет
+	void _reset();
+	//! Переписывание живых записей в новый файл
+	void _compact();
+
+	static uint32_t _crc32(uint32_t crc, const uint8_t * data, size_t size);
+
+	std::string _path;
+	int _fd = -1;
+	uint8_t * _base = nullptr;
+	size_t _capacity = 0;
+	uint32_t _epoch = 0;
+	size_t _write_pos = 0;
+	//! Есть ли записи, еще не отданные msync
+	bool _dirty = false;
+
+	//! Смещения записей "SDU принят" живых SDU. Ключи могут повторяться,
+	//! если клиент прислал тот же SDU еще раз
+	std::multimap<sdu_key_t, size_t> _live;
+	//! Сколько байт занимают записи живых SDU
+	size_t _live_bytes = 0;
+};
+
+
+#endif /* ITS_SERVER_USLP_SRC_SDU_JOURNAL_HPP_ */
@@ -0,0 +1,321 @@
+#include "sharded_dispatcher.hpp"
+
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "log.hpp"
+#include "dispatcher.hpp"
+
+
+static auto _slg = build_source("sharded-dispatcher");
+
+
+sharded_dispatcher::shard_t::shard_t(
+		const pchannel_config & config_, size_t index,
+		bus_output & output, uslp_stats & stats, size_t queue_capacity
+)
+	: config(config_), ist(config), ost(config),
+	  uplink(config, index, ost, output, stats), downlink(ist, output, stats),
+	  queue(queue_capacity)
+{
+}
+
+
+sharded_dispatcher::sharded_dispatcher(
+		bus_io & io_,
+		const std::vector<pchannel_config> & pchannels,
+		const std::vector<bus_output*> & outputs,
+		size_t queue_capacity
+)
+	: _io(io_)
+{
+	if (pchannels.empty())
+		throw std::runtime_error("there should be at least one physical channel");
+
+	if (pchannels.size() != outputs.size())
+		throw std::runtime_error("each physical channel should have its own bus output");
+
+	for (size_t i = 0; i < pchannels.size(); i++)
+	{
+		const auto & config = pchannels[i];
+		_shards.push_back(std::make_unique<shard_t>(config, i, *outputs[i], _stats, queue_capacity));
+		if (!config.uplink)
+			continue;
+
+		for (const uint8_t map_id: {UPLINK_TELECOMMAND_MAPID, UPLINK_IP_MAPID})
+		{
+			const ccsds::uslp::gmapid_t gmapid(config.sc_id, config.uplink_vchannel_id, map_id);
+			for (const auto & route: _uplink_routes)
+			{
+				if (route.first == gmapid)
+					throw std::runtime_error("uplink map channel is served by more than one physical channel");
+			}
+
+			_uplink_routes.emplace_back(gmapid, i);
+		}
+	}
+
+	_io.stats(&_stats);
+}
+
+
+sharded_dispatcher::~sharded_dispatcher()
+{
+	stop();
+}
+
+
+void sharded_dispatcher::start()
+{
+	if (_running.exchange(true))
+		return;
+
+	for (auto & shard: _shards)
+	{
+		LOG(info) << "starting physical channel \"" << shard->config.name << "\" thread, "
+				<< "radio topics \"" << shard->config.radio_topic << "\", "
+				<< "extra receivers " << shard->config.downlink_receivers.size() << ", "
+				<< "queue capacity " << shard->queue.capacity()
+		;
+
+		shard->thread = std::thread(&sharded_dispatcher::_shard_thread_main, this, std::ref(*shard));
+		_pin_shard_thread(*shard);
+	}
+}
+
+
+void sharded_dispatcher::stop()
+{
+	if (!_running.exchange(false))
+		return;
+
+	LOG(info) << "stopping physical channel threads";
+	for (auto & shard: _shards)
+		shard->queue.notify();
+
+	for (auto & shard: _shards)
+		shard->thread.join();
+}
+
+
+void sharded_dispatcher::poll()
+{
+	{
+		std::lock_guard<std::mutex> lock(_worker_error_mutex);
+		if (_worker_error)
+			std::rethrow_exception(_worker_error);
+	}
+
+	_drain_backlogs();
+	if (shard_t * stuck = _full_backlog_shard())
+	{
+		// Канал совсем не успевает. Откладывать больше некуда, так что
+		// с шины не читаем, пока он не освободит место
+		LOG(trace) << "\"" << stuck->config.name << "\" backlog is full, waiting for its queue";
+		const auto timeout = _stats.report_timeout(std::chrono::milliseconds(ITS_DISPATCHER_POLL_PERIOD));
+		if (stuck->queue.wait_for_space(timeout))
+			_drain_backlogs();
+
+		_publish_stats();
+		return;
+	}
+
+	LOG(trace) << "entering poll cycle";
+	auto timeout = _stats.report_timeout(std::chrono::milliseconds(ITS_DISPATCHER_POLL_PERIOD));
+	const bool have_backlog = std::any_of(_shards.begin(), _shards.end(), [](const auto & shard) {
+		return !shard->backlog.empty();
+	});
+	if (have_backlog)
+		timeout = std::min(timeout, std::chrono::milliseconds(ITS_DISPATCHER_BACKLOG_RETRY_PERIOD));
+
+	const bool have_msgs = _io.poll_sub_socket(timeout);
+	LOG(trace) << "poll complete with " << have_msgs;
+	if (!have_msgs)
+	{
+		_publish_stats();
+		return;
+	}
+
+	size_t processed = 0;
+	do
+	{
+		if (_io.recv_message(_input_message))
+			_route_bus_message(std::move(_input_message));
+		else
+			LOG(trace) << "unable to read message?";
+
+	} while (++processed < _batch_limit && !_full_backlog_shard() && _io.sub_socket_readable());
+
+	LOG(trace) << "routed " << processed << " bus messages in this cycle";
+	_publish_stats();
+}
+
+
+void sharded_dispatcher::_publish_stats()
+{
+	if (!_stats.report_due())
+		return;
+
+	LOG(trace) << "publishing stats";
+	_io.send_message(_stats.take_report());
+}
+
+
+size_t sharded_dispatcher::_uplink_shard(const ccsds::uslp::gmapid_t & gmapid) const
+{
+	for (const auto & route: _uplink_routes)
+	{
+		if (route.first == gmapid)
+			return route.second;
+	}
+
+	// Такого канала нет нигде, пусть первый канал откажет клиенту
+	return 0;
+}
+
+
+void sharded_dispatcher::_route_bus_message(bus_input_message && message)
+{
+	LOG(trace) << "routing " << to_string(message) << " bus message";
+	const size_t index = std::visit([this](const auto & m) -> size_t {
+		using message_type = std::decay_t<decltype(m)>;
+		if constexpr (std::is_same_v<message_type, sdu_uplink_request>)
+			return _uplink_shard(m.gmapid);
+		else
+			return m.pchannel;
+	}, message);
+
+	auto & shard = *_shards.at(index);
+	if (std::holds_alternative<radio_downlink_frame>(message))
+	{
+		// Даунлинк фреймы радио все равно не переотправит, а ждать канал мы не можем -
+		// иначе встанут остальные каналы. Поэтому если канал не успевает - фрейм теряется
+		if (!shard.queue.try_push(std::move(message)))
+		{
+			_stats.count(uslp_stats::counter_t::downlink_frames_dropped);
+			LOG(error) << "\"" << shard.config.name << "\" queue is full, dropping radio frame";
+		}
+
+		return;
+	}
+
+	// Аплинк сообщения терять нельзя, но и ждать канал тут нельзя - встанут остальные.
+	// Поэтому откладываем сообщение до следующего poll(). Порядок сохраняется:
+	// пока есть отложенные, новые встают за ними
+	if (shard.backlog.empty() && shard.queue.try_push(std::move(message)))
+		return;
+
+	if (shard.backlog.empty())
+		LOG(warning) << "\"" << shard.config.name << "\" queue is full, holding uplink messages";
+
+	shard.backlog.push_back(std::move(message));
+}
+
+
+void sharded_dispatcher::_drain_backlogs()
+{
+	for (auto & shard: _shards)
+	{
+		while (!shard->backlog.empty() && shard->queue.try_push(std::move(shard->backlog.front())))
+			shard->backlog.pop_front();
+	}
+}
+
+
+sharded_dispatcher::shard_t * sharded_dispatcher::_full_backlog_shard()
+{
+	for (auto & shard: _shards)
+	{
+		if (shard->backlog.size() >= shard->queue.capacity())
+			return shard.get();
+	}
+
+	return nullptr;
+}
+
+
+void sharded_dispatcher::_shard_thread_main(shard_t & shard)
+{
+	try
+	{
+		bus_input_message message;
+		while (_running.load())
+		{
+			const auto timeout = shard.downlink.poll_timeout(
+					shard.uplink.poll_timeout(std::chrono::milliseconds(ITS_DISPATCHER_POLL_PERIOD))
+			);
+			if (shard.queue.wait(timeout))
+			{
+				while (shard.queue.try_pop(message))
+				{
+					std::visit([&shard](auto & m) {
+						using message_type = std::decay_t<decltype(m)>;
+						if constexpr (std::is_same_v<message_type, sdu_uplink_request>)
+							shard.uplink.on_sdu_uplink_request(m);
+						else if constexpr (std::is_same_v<message_type, radio_downlink_frame>)
+							shard.downlink.on_radio_downlink_frame(m);
+						else if constexpr (std::is_same_v<message_type, radio_uplink_state>)
+							shard.uplink.on_radio_uplink_state(m);
+						else
+							static_assert(sizeof(message_type) == 0, "unhandled bus message type");
+					}, message);
+				}
+			}
+
+			// Периодически чистим фреймы по таймауту
+			shard.downlink.release_frames();
+			shard.uplink.clear_frames_queue();
+			shard.uplink.publish_restored_events();
+			shard.uplink.expire_sdus();
+			shard.uplink.report_queues();
+			shard.uplink.flush_events();
+			shard.uplink.maintain_journal();
+		}
+	}
+	catch (...)
+	{
+		LOG(error) << "physical channel \"" << shard.config.name << "\" thread failed";
+		_store_worker_error(std::current_exception());
+	}
+}
+
+
+void sharded_dispatcher::_pin_shard_thread(shard_t & shard)
+{
+	// Имя потока видно в top -H, больше 15 символов нельзя
+	const std::string thread_name = ("uslp-" + shard.config.name).substr(0, 15);
+	pthread_setname_np(shard.thread.native_handle(), thread_name.c_str());
+
+	if (shard.config.cpu < 0)
+		return;
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(shard.config.cpu, &cpus);
+	const int rc = pthread_setaffinity_np(shard.thread.native_handle(), sizeof(cpus), &cpus);
+	if (0 != rc)
+	{
+		// Без привязки канал все равно работает, так что не падаем
+		LOG(warning) << "unable to pin \"" << shard.config.name << "\" thread "
+				<< "to cpu " << shard.config.cpu << ": error " << rc
+		;
+		return;
+	}
+
+	LOG(info) << "physical channel \"" << shard.config.name << "\" thread is pinned to cpu " << shard.config.cpu;
+}
+
+
+void sharded_dispatcher::_store_worker_error(std::exception_ptr error)
+{
+	std::lock_guard<std::mutex> lock(_worker_error_mutex);
+	if (!_worker_error)
+		_worker_error = error;
+}
@@ -0,0 +1,121 @@
+#ifndef ITS_SERVER_USLP_SRC_SHARDED_DISPATCHER_HPP_
+#define ITS_SERVER_USLP_SRC_SHARDED_DISPATCHER_HPP_
+
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <exception>
+
+#include "stack.hpp"
+#include "bus_messages.hpp"
+#include "bus_io.hpp"
+#include "spsc_queue.hpp"
+#include "stats.hpp"
+#include "uplink_pipeline.hpp"
+#include "downlink_pipeline.hpp"
+
+
+//! Разгребает сообщения шины по нескольким физическим каналам
+/*! У каждого физического канала (радио) свои входной и выходной стеки,
+ *  аплинк и даунлинк тракты и очередь сообщений, и все это живет в своем
+ *  потоке, который можно прибить к ядру процессора. Поток, вызывающий poll(),
+ *  только принимает сообщения с шины и раскидывает их по каналам: сообщения
+ *  радио - по номеру радио, запросы на отправку SDU - по MAP каналу.
+ *
+ *  Отправляют сообщения на шину потоки каналов сами, каждый через свой
+ *  bus_output, так как zmq сокеты нельзя делить между потоками */
+class sharded_dispatcher
+{
+public:
+	//! Каналу pchannels[i] достается outputs[i]
+	sharded_dispatcher(
+			bus_io & io_,
+			const std::vector<pchannel_config> & pchannels,
+			const std::vector<bus_output*> & outputs,
+			size_t queue_capacity
+	);
+	~sharded_dispatcher();
+
+	//! Запуск потоков каналов. Тракты нужно настраивать до этого
+	void start();
+	//! Остановка потоков каналов
+	void stop();
+
+	//! Приём сообщений с шины и раздача их каналам
+	/*! Пробрасывает исключения, случившиеся в потоках каналов */
+	void poll();
+
+	//! Сколько сообщений с шины разгребается за одно пробуждение (не меньше одного)
+	void batch_limit(size_t value) { _batch_limit = value ? value : 1; }
+	size_t batch_limit() const { return _batch_limit; }
+
+	size_t pchannels_count() const { return _shards.size(); }
+	const pchannel_config & pchannel(size_t index) const { return _shards.at(index)->config; }
+	uplink_pipeline & uplink(size_t index) { return _shards.at(index)->uplink; }
+	downlink_pipeline & downlink(size_t index) { return _shards.at(index)->downlink; }
+	uslp_stats & stats() { return _stats; }
+
+protected:
+	//! Все, что принадлежит одному физическому каналу
+	struct shard_t
+	{
+		shard_t(
+				const pchannel_config & config_, size_t index,
+				bus_output & output, uslp_stats & stats, size_t queue_capacity
+		);
+
+		pchannel_config config;
+		istack ist;
+		ostack ost;
+		uplink_pipeline uplink;
+		downlink_pipeline downlink;
+		spsc_queue<bus_input_message> queue;
+		//! Аплинк сообщения, не влезшие в очередь. Не больше её емкости, трогает только поток шины
+		std::deque<bus_input_message> backlog;
+		std::thread thread;
+	};
+
+	//! Передача сообщения в очередь соответствующего канала
+	void _route_bus_message(bus_input_message && message);
+	//! Перекладывание отложенных аплинк сообщений в очереди каналов, пока есть место
+	void _drain_backlogs();
+	//! Канал, которому откладывать сообщения больше некуда, или nullptr
+	shard_t * _full_backlog_shard();
+	//! Номер канала, который отправляет SDU этого MAP канала
+	size_t _uplink_shard(const ccsds::uslp::gmapid_t & gmapid) const;
+	//! Публикация статистики, если пришло её время
+	void _publish_stats();
+
+	void _shard_thread_main(shard_t & shard);
+	//! Прибивание потока канала к ядру, если так сказано в настройках
+	static void _pin_shard_thread(shard_t & shard);
+	//! Запоминает исключение потока канала, чтобы пробросить его из poll()
+	void _store_worker_error(std::exception_ptr error);
+
+private:
+	//! Максимум сообщений с шины, обрабатываемых за один вызов poll()
+	size_t _batch_limit = 1;
+
+	//! Переиспользуемый экземпляр входящего сообщения
+	bus_input_message _input_message;
+
+	bus_io & _io;
+	//! Общая для всех каналов. Объявлена до каналов, так как они пишут в неё с самого конструктора
+	uslp_stats _stats;
+	std::vector<std::unique_ptr<shard_t>> _shards;
+	//! Какой канал отправляет какой аплинк MAP канал
+	std::vector<std::pair<ccsds::uslp::gmapid_t, size_t>> _uplink_routes;
+
+	std::atomic<bool> _running = {false};
+
+	std::mutex _worker_error_mutex;
+	std::exception_ptr _worker_error;
+};
+
+
+#endif /* ITS_SERVER_USLP_SRC_SHARDED_DISPATCHER_HPP_ */
@@ -0,0 +1,159 @@
+#ifndef ITS_SERVER_USLP_SRC_SPSC_QUEUE_HPP_
+#define ITS_SERVER_USLP_SRC_SPSC_QUEUE_HPP_
+
+
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstddef>
+#include <condition_variable>
+
+
+//! Очередь без блокировок для одного писателя и одного читателя
+/*! Элементы живут в заранее выделенном кольцевом буфере и перемещаются
+ *  в него и из него, так что в процессе работы память не выделяется.
+ *  Читатель может уснуть в ожидании элементов, писатель будит его только
+ *  если тот действительно спит, поэтому в горячем пути мьютекс не трогается.
+ *  Так же писатель может уснуть на полной очереди */
+template <typename T>
+class spsc_queue
+{
+public:
+	explicit spsc_queue(size_t capacity)
+		: _slots(_round_up_to_power_of_two(capacity + 1)), _mask(_slots.size() - 1)
+	{}
+
+	spsc_queue(const spsc_queue &) = delete;
+	spsc_queue & operator=(const spsc_queue &) = delete;
+
+	//! Сколько элементов влезает в очередь
+	size_t capacity() const { return _slots.size() - 1; }
+
+	//! Попытка положить элемент. false, если очередь полна (вызывается писателем)
+	bool try_push(T && value)
+	{
+		const size_t tail = _tail.load(std::memory_order_relaxed);
+		const size_t next_tail = (tail + 1) & _mask;
+		if (next_tail == _head.load(std::memory_order_acquire))
+			return false;
+
+		_slots[tail] = std::move(value);
+		_tail.store(next_tail, std::memory_order_release);
+
+		// Будим читателя, если он уснул
+		// Барьер не дает прочитать флаг раньше, чем читатель увидит новый хвост
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (_consumer_sleeping.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<std::mutex> lock(_wakeup_mutex);
+			_wakeup.notify_one();
+		}
+
+		return true;
+	}
+
+	//! Попытка забрать элемент. false, если очередь пуста (вызывается читателем)
+	bool try_pop(T & value)
+	{
+		const size_t head = _head.load(std::memory_order_relaxed);
+		if (head == _tail.load(std::memory_order_acquire))
+			return false;
+
+		value = std::move(_slots[head]);
+		_head.store((head + 1) & _mask, std::memory_order_release);
+
+		// Будим писателя, если он уснул на полной очереди. Барьер как в try_push()
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (_producer_sleeping.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<std::mutex> lock(_wakeup_mutex);
+			_space.notify_one();
+		}
+
+		return true;
+	}
+
+	bool empty() const
+	{
+		return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+	}
+
+	bool full() const
+	{
+		const size_t next_tail = (_tail.load(std::memory_order_acquire) + 1) & _mask;
+		return next_tail == _head.load(std::memory_order_acquire);
+	}
+
+	//! Ожидание элементов в очереди не дольше указанного времени (вызывается читателем)
+	/*! Возвращает true, если очередь не пуста. Возвращается раньше срока
+	 *  и после notify() */
+	template <typename DURATION>
+	bool wait(const DURATION & timeout)
+	{
+		if (!empty())
+			return true;
+
+		std::unique_lock<std::mutex> lock(_wakeup_mutex);
+		_consumer_sleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		_wakeup.wait_for(lock, timeout, [this]() { return _interrupted || !empty(); });
+		_consumer_sleeping.store(false, std::memory_order_relaxed);
+		_interrupted = false;
+		return !empty();
+	}
+
+	//! Ожидание места в очереди не дольше указанного времени (вызывается писателем)
+	/*! Возвращает true, если в очереди есть место */
+	template <typename DURATION>
+	bool wait_for_space(const DURATION & timeout)
+	{
+		if (!full())
+			return true;
+
+		std::unique_lock<std::mutex> lock(_wakeup_mutex);
+		_producer_sleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const bool retval = _space.wait_for(lock, timeout, [this]() { return !full(); });
+		_producer_sleeping.store(false, std::memory_order_relaxed);
+		return retval;
+	}
+
+	//! Разбудить читателя без новых элементов (например для остановки)
+	/*! Если читатель сейчас не ждет, сразу вернется его следующий wait(),
+	 *  так что пробуждение не теряется */
+	void notify()
+	{
+		std::lock_guard<std::mutex> lock(_wakeup_mutex);
+		_interrupted = true;
+		_wakeup.notify_one();
+	}
+
+private:
+	static size_t _round_up_to_power_of_two(size_t value)
+	{
+		size_t retval = 1;
+		while (retval < value)
+			retval <<= 1;
+
+		return retval;
+	}
+
+	std::vector<T> _slots;
+	const size_t _mask;
+
+	//! Индексы на разных кешлиниях, чтобы писатель и читатель не мешали друг другу
+	alignas(64) std::atomic<size_t> _head = {0};
+	alignas(64) std::atomic<size_t> _tail = {0};
+
+	alignas(64) std::atomic<bool> _consumer_sleeping = {false};
+	std::atomic<bool> _producer_sleeping = {false};
+	std::mutex _wakeup_mutex;
+	std::condition_variable _wakeup;
+	std::condition_variable _space;
+	//! Выставляется notify(), сбрасывается проснувшимся wait(). Под _wakeup_mutex
+	bool _interrupted = false;
+};
+
+
+#endif /* ITS_SERVER_USLP_SRC_SPSC_QUEUE_HPP_ */
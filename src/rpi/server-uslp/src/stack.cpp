@@ -17,18 +17,24 @@
 
 
 ostack::ostack()
+	: ostack(pchannel_config())
+{
+}
+
+
+ostack::ostack(const pchannel_config & config)
 {
 	using namespace ccsds;
 	using namespace ccsds::uslp;
 
-	mchannel_rr_muxer * phys = create_pchannel<mchannel_rr_muxer>("lora");
-	phys->frame_size(RADIO_FRAME_SIZE);
+	mchannel_rr_muxer * phys = create_pchannel<mchannel_rr_muxer>(config.name);
+	phys->frame_size(config.frame_size);
 	phys->error_control_len(error_control_len_t::ZERO);
 
-	auto master = create_mchannel<vchannel_rr_muxer>(mcid_t(SPACECRAFT_ID));
+	auto master = create_mchannel<vchannel_rr_muxer>(mcid_t(config.sc_id));
 	master->id_is_destination(true);
 
-	auto virt = create_vchannel<map_rr_muxer>(gvcid_t(master->channel_id, UPLINK_VCHANNEL_ID));
+	auto virt = create_vchannel<map_rr_muxer>(gvcid_t(master->channel_id, config.uplink_vchannel_id));
 	virt->frame_seq_no_len(2);
 
 	auto * command_channel = create_map<map_packet_emitter>(gmapid_t(virt->channel_id, UPLINK_TELECOMMAND_MAPID));
@@ -39,20 +45,26 @@ ostack::ostack()
 
 
 istack::istack()
+	: istack(pchannel_config())
+{
+}
+
+
+istack::istack(const pchannel_config & config)
 {
 	using namespace ccsds;
 	using namespace ccsds::uslp;
 
 	mchannel_demuxer * phys;
-	phys = create_pchannel<mchannel_demuxer>("lora");
+	phys = create_pchannel<mchannel_demuxer>(config.name);
 	phys->insert_zone_size(0);
 	phys->error_control_len(error_control_len_t::ZERO);
 
 	vchannel_demuxer * master;
-	master = create_mchannel<vchannel_demuxer>(mcid_t(SPACECRAFT_ID));
+	master = create_mchannel<vchannel_demuxer>(mcid_t(config.sc_id));
 
 	map_demuxer * virt;
-	virt = create_vchannel<map_demuxer>(gvcid_t(master->channel_id, DOWNLINK_VCHANNEL_ID));
+	virt = create_vchannel<map_demuxer>(gvcid_t(master->channel_id, config.downlink_vchannel_id));
 
 	auto * telemetry_channel = create_map<map_packet_acceptor>(gmapid_t(virt->channel_id, DOWNLINK_TELEMETERY_MAPID));
 	telemetry_channel->emit_idle_packets(false);
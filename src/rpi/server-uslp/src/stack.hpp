@@ -2,10 +2,18 @@
 #define ITS_SERVER_USLP_SRC_STACK_HPP_
 
 
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <cstddef>
+
 #include <ccsds/uslp/output_stack.hpp>
 #include <ccsds/uslp/input_stack.hpp>
 
 
+// Настройки физического канала по умолчанию
+#define RADIO_PCHANNEL_NAME			"lora"
+#define RADIO_TOPIC_PREFIX			"radio"
 #define RADIO_FRAME_SIZE			(200)
 #define SPACECRAFT_ID				(0x42)
 
@@ -18,10 +26,34 @@
 #define DOWNLINK_IP_MAPID			(0x01)
 
 
+//! Настройки физического канала: радио, через которое сервер говорит с аппаратом
+/*! Структура MAP каналов у всех физических каналов одинаковая, отличаются
+ *  только номера аппарата и виртуальных каналов */
+struct pchannel_config
+{
+	//! Имя физического канала в стеке
+	std::string name = RADIO_PCHANNEL_NAME;
+	//! Префикс топиков радио: <prefix>.downlink_frame, <prefix>.uplink_state, <prefix>.uplink_frame
+	std::string radio_topic = RADIO_TOPIC_PREFIX;
+	//! Префиксы топиков дополнительных приёмников (например SDR), слышащих то же радио
+	/*! Их <prefix>.downlink_frame идут в стек этого же канала, копии отсеиваются */
+	std::vector<std::string> downlink_receivers;
+	uint16_t sc_id = SPACECRAFT_ID;
+	size_t frame_size = RADIO_FRAME_SIZE;
+	uint8_t uplink_vchannel_id = UPLINK_VCHANNEL_ID;
+	uint8_t downlink_vchannel_id = DOWNLINK_VCHANNEL_ID;
+	//! Умеет ли радио отправлять. Если нет, запросы на отправку сюда не попадают
+	bool uplink = true;
+	//! Ядро процессора, к которому прибивается поток канала. Меньше нуля - не прибивать
+	int cpu = -1;
+};
+
+
 class ostack: public ccsds::uslp::output_stack
 {
 public:
 	ostack();
+	explicit ostack(const pchannel_config & config);
 };
 
 
@@ -29,6 +61,7 @@ class istack: public ccsds::uslp::input_stack
 {
 public:
 	istack();
+	explicit istack(const pchannel_config & config);
 };
 
 
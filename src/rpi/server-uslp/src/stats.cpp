@@ -0,0 +1,229 @@
+#include "stats.hpp"
+
+#include <algorithm>
+
+#include "log.hpp"
+
+
+static auto _slg = build_source("stats");
+
+
+void latency_histogram::record(uint64_t value_us)
+{
+	_buckets[_bucket_index(value_us)].fetch_add(1, std::memory_order_relaxed);
+	_sum.fetch_add(value_us, std::memory_order_relaxed);
+
+	uint64_t current = _min.load(std::memory_order_relaxed);
+	while (value_us < current && !_min.compare_exchange_weak(current, value_us, std::memory_order_relaxed))
+		{}
+
+	current = _max.load(std::memory_order_relaxed);
+	while (value_us > current && !_max.compare_exchange_weak(current, value_us, std::memory_order_relaxed))
+		{}
+}
+
+
+latency_summary latency_histogram::take_summary()
+{
+	std::array<uint64_t, _buckets_count> buckets;
+	uint64_t count = 0;
+	for (size_t i = 0; i < _buckets_count; i++)
+	{
+		buckets[i] = _buckets[i].exchange(0, std::memory_order_relaxed);
+		count += buckets[i];
+	}
+
+	// Сумма и экстремумы могут немного разойтись с корзинами, если кто-то
+	// пишет прямо сейчас. Количество берем по корзинам, они важнее
+	const uint64_t sum = _sum.exchange(0, std::memory_order_relaxed);
+	const uint64_t min = _min.exchange(UINT64_MAX, std::memory_order_relaxed);
+	const uint64_t max = _max.exchange(0, std::memory_order_relaxed);
+
+	latency_summary retval;
+	if (0 == count)
+		return retval;
+
+	retval.count = count;
+	retval.min = min != UINT64_MAX ? min : 0;
+	retval.max = max;
+	retval.mean = sum / count;
+
+	// Перцентили считаем за один проход по корзинам
+	const std::array<std::pair<double, uint64_t*>, 4> percentiles = {{
+			{0.50, &retval.p50}, {0.90, &retval.p90}, {0.99, &retval.p99}, {0.999, &retval.p999}
+	}};
+
+	uint64_t seen = 0;
+	size_t next_percentile = 0;
+	for (size_t i = 0; i < _buckets_count && next_percentile < percentiles.size(); i++)
+	{
+		seen += buckets[i];
+		while (next_percentile < percentiles.size()
+				&& seen >= percentiles[next_percentile].first * count
+		)
+		{
+			// Верхняя граница корзины может оказаться больше реального максимума
+			*percentiles[next_percentile].second = std::min(_bucket_upper_bound(i), retval.max);
+			next_percentile++;
+		}
+	}
+
+	return retval;
+}
+
+
+size_t latency_histogram::_bucket_index(uint64_t value)
+{
+	if (value < _sub_bucket_count)
+		return value;
+
+	value = std::min<uint64_t>(value, (uint64_t(1) << _max_value_bits) - 1);
+
+	// Номер октавы определяет сдвиг, старшие биты значения - корзину в октаве
+	const unsigned msb = 63 - __builtin_clzll(value);
+	const unsigned shift = msb - (_sub_bucket_bits - 1);
+	return shift * _sub_bucket_half + (value >> shift);
+}
+
+
+uint64_t latency_histogram::_bucket_upper_bound(size_t index)
+{
+	if (index < _sub_bucket_count)
+		return index;
+
+	const unsigned shift = index / _sub_bucket_half - 1;
+	const uint64_t mantissa = index - shift * _sub_bucket_half;
+	return ((mantissa + 1) << shift) - 1;
+}
+
+
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+
+
+bool uslp_stats::report_due(std::chrono::steady_clock::time_point now) const
+{
+	if (_report_period.count() <= 0)
+		return false;
+
+	return now >= _interval_start + _report_period;
+}
+
+
+std::chrono::milliseconds uslp_stats::report_timeout(std::chrono::milliseconds max_timeout) const
+{
+	if (_report_period.count() <= 0)
+		return max_timeout;
+
+	const auto deadline = _interval_start + _report_period;
+	const auto now = std::chrono::steady_clock::now();
+	if (deadline <= now)
+		return std::chrono::milliseconds(0);
+
+	const auto until_deadline = std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+	return std::min(until_deadline, max_timeout);
+}
+
+
+void uslp_stats::downlink_sources(const std::vector<std::string> & names)
+{
+	if (names.size() > ITS_USLP_MAX_DOWNLINK_SOURCES)
+		LOG(warning) << "only first " << ITS_USLP_MAX_DOWNLINK_SOURCES << " of " << names.size()
+				<< " downlink sources are accounted in stats"
+		;
+
+	_source_names.assign(
+			names.begin(),
+			names.begin() + std::min(names.size(), static_cast<size_t>(ITS_USLP_MAX_DOWNLINK_SOURCES))
+	);
+}
+
+
+uslp_stats::report uslp_stats::take_report()
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	report retval;
+	retval.interval = std::chrono::duration_cast<std::chrono::milliseconds>(now - _interval_start);
+	for (size_t i = 0; i < counters_count; i++)
+		retval.counters[i] = _counters[i].load(std::memory_order_relaxed);
+
+	// Этот счетчик ведет сам лог
+	retval.counters[static_cast<size_t>(counter_t::log_records_dropped)] = log_dropped_records();
+
+	for (size_t i = 0; i < stages_count; i++)
+		retval.latencies[i] = _latencies[i].take_summary();
+
+	for (size_t i = 0; i < _source_names.size(); i++)
+	{
+		source_report source;
+		source.name = _source_names[i];
+		for (size_t j = 0; j < source_counters_count; j++)
+			source.counters[j] = _sources[i][j].load(std::memory_order_relaxed);
+
+		retval.sources.push_back(std::move(source));
+	}
+
+	_interval_start = now;
+	return retval;
+}
+
+
+const char * to_string(uslp_stats::stage_t stage)
+{
+	switch (stage)
+	{
+	case uslp_stats::stage_t::bus_recv_to_parse: return "bus_recv_to_parse";
+	case uslp_stats::stage_t::parse_to_push_frame: return "parse_to_push_frame";
+	case uslp_stats::stage_t::push_frame_to_map_sdu: return "push_frame_to_map_sdu";
+	case uslp_stats::stage_t::sdu_request_to_accepted: return "sdu_request_to_accepted";
+	case uslp_stats::stage_t::uplink_frame_to_radiated: return "uplink_frame_to_radiated";
+	case uslp_stats::stage_t::command_sdu_accepted_to_sent: return "command_sdu_accepted_to_sent";
+	case uslp_stats::stage_t::ip_sdu_accepted_to_sent: return "ip_sdu_accepted_to_sent";
+	};
+
+	return "<unknown>";
+}
+
+
+const char * to_string(uslp_stats::counter_t counter)
+{
+	switch (counter)
+	{
+	case uslp_stats::counter_t::bus_messages_received: return "bus_messages_received";
+	case uslp_stats::counter_t::bus_messages_rejected: return "bus_messages_rejected";
+	case uslp_stats::counter_t::uplink_sdus_accepted: return "uplink_sdus_accepted";
+	case uslp_stats::counter_t::uplink_sdus_rejected: return "uplink_sdus_rejected";
+	case uslp_stats::counter_t::uplink_sdus_queue_full: return "uplink_sdus_queue_full";
+	case uslp_stats::counter_t::uplink_sdus_expired: return "uplink_sdus_expired";
+	case uslp_stats::counter_t::uplink_sdus_restored: return "uplink_sdus_restored";
+	case uslp_stats::counter_t::uplink_sdus_not_journaled: return "uplink_sdus_not_journaled";
+	case uslp_stats::counter_t::uplink_sdu_events: return "uplink_sdu_events";
+	case uslp_stats::counter_t::uplink_event_messages_sent: return "uplink_event_messages_sent";
+	case uslp_stats::counter_t::uplink_frames_sent: return "uplink_frames_sent";
+	case uslp_stats::counter_t::uplink_frames_radiated: return "uplink_frames_radiated";
+	case uslp_stats::counter_t::uplink_frames_failed: return "uplink_frames_failed";
+	case uslp_stats::counter_t::uplink_frames_timed_out: return "uplink_frames_timed_out";
+	case uslp_stats::counter_t::downlink_frames_received: return "downlink_frames_received";
+	case uslp_stats::counter_t::downlink_frames_rejected: return "downlink_frames_rejected";
+	case uslp_stats::counter_t::downlink_frames_dropped: return "downlink_frames_dropped";
+	case uslp_stats::counter_t::downlink_sdus: return "downlink_sdus";
+	case uslp_stats::counter_t::log_records_dropped: return "log_records_dropped";
+	};
+
+	return "<unknown>";
+}
+
+
+const char * to_string(uslp_stats::source_counter_t counter)
+{
+	switch (counter)
+	{
+	case uslp_stats::source_counter_t::frames: return "frames";
+	case uslp_stats::source_counter_t::delivered: return "delivered";
+	case uslp_stats::source_counter_t::duplicates: return "duplicates";
+	case uslp_stats::source_counter_t::invalid: return "invalid";
+	};
+
+	return "<unknown>";
+}
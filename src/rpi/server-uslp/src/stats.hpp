@@ -0,0 +1,205 @@
+#ifndef ITS_SERVER_USLP_SRC_STATS_HPP_
+#define ITS_SERVER_USLP_SRC_STATS_HPP_
+
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+//! Сколько приёмников даунлинк фреймов учитывает статистика
+#define ITS_USLP_MAX_DOWNLINK_SOURCES (8)
+
+
+//! Сводка гистограммы задержек за интервал (все значения в микросекундах)
+struct latency_summary
+{
+	uint64_t count = 0;
+	uint64_t min = 0;
+	uint64_t max = 0;
+	uint64_t mean = 0;
+	uint64_t p50 = 0;
+	uint64_t p90 = 0;
+	uint64_t p99 = 0;
+	uint64_t p999 = 0;
+};
+
+
+//! Гистограмма задержек в духе HDR Histogram
+/*! Корзины логарифмические, каждая октава делится на 16 линейных корзин,
+ *  так что погрешность перцентилей не больше 1/16 при любом масштабе,
+ *  а памяти нужно фиксированное количество. Запись идет атомиками без
+ *  блокировок, поэтому писать можно из любого количества потоков */
+class latency_histogram
+{
+public:
+	latency_histogram() = default;
+	latency_histogram(const latency_histogram &) = delete;
+	latency_histogram & operator=(const latency_histogram &) = delete;
+
+	void record(uint64_t value_us);
+
+	//! Сводка по накопленным значениям с обнулением гистограммы
+	/*! Записи, идущие одновременно с этим вызовом, могут частично попасть
+	 *  в следующий интервал. Для статистики это не страшно */
+	latency_summary take_summary();
+
+private:
+	//! Линейных корзин на октаву: 2**_sub_bucket_bits / 2
+	static constexpr unsigned _sub_bucket_bits = 5;
+	static constexpr uint64_t _sub_bucket_count = uint64_t(1) << _sub_bucket_bits;
+	static constexpr uint64_t _sub_bucket_half = _sub_bucket_count / 2;
+	//! Все что больше - складывается в последнюю корзину (это больше часа)
+	static constexpr unsigned _max_value_bits = 32;
+	static constexpr size_t _buckets_count =
+			(_max_value_bits - _sub_bucket_bits) * _sub_bucket_half + _sub_bucket_count;
+
+	static size_t _bucket_index(uint64_t value);
+	//! Наибольшее значение, попадающее в корзину
+	static uint64_t _bucket_upper_bound(size_t index);
+
+	std::array<std::atomic<uint64_t>, _buckets_count> _buckets = {};
+	std::atomic<uint64_t> _sum = {0};
+	std::atomic<uint64_t> _min = {UINT64_MAX};
+	std::atomic<uint64_t> _max = {0};
+};
+
+
+//! Встроенная статистика USLP сервера
+/*! Счетчики событий (монотонные с момента запуска) и гистограммы задержек
+ *  по этапам обработки (за интервал между публикациями) */
+class uslp_stats
+{
+public:
+	//! Этапы, задержки которых измеряются
+	enum class stage_t
+	{
+		//! От приёма всех частей сообщения до конца его разбора
+		bus_recv_to_parse,
+		//! От конца разбора даунлинк фрейма до подачи его в стек
+		parse_to_push_frame,
+		//! От подачи фрейма в стек до выхода из него SDU
+		push_frame_to_map_sdu,
+		//! От конца разбора запроса на отправку SDU до sdu_accepted
+		sdu_request_to_accepted,
+		//! От отправки фрейма в радио до подтверждения его излучения
+		uplink_frame_to_radiated,
+		//! От sdu_accepted до отправки в радио фрейма с концом SDU телекоманды
+		command_sdu_accepted_to_sent,
+		//! То же для IP SDU
+		ip_sdu_accepted_to_sent,
+	};
+
+	//! Счетчики событий
+	enum class counter_t
+	{
+		bus_messages_received,
+		bus_messages_rejected,
+		uplink_sdus_accepted,
+		uplink_sdus_rejected,
+		uplink_sdus_queue_full,
+		uplink_sdus_expired,
+		uplink_sdus_restored,
+		uplink_sdus_not_journaled,
+		uplink_sdu_events,
+		uplink_event_messages_sent,
+		uplink_frames_sent,
+		uplink_frames_radiated,
+		uplink_frames_failed,
+		uplink_frames_timed_out,
+		downlink_frames_received,
+		downlink_frames_rejected,
+		downlink_frames_dropped,
+		downlink_sdus,
+		log_records_dropped,
+	};
+
+	//! Счетчики приёмника даунлинк фреймов
+	enum class source_counter_t
+	{
+		//! Все копии фреймов от приёмника
+		frames,
+		//! Копии, попавшие в стек. Это и есть польза от приёмника
+		delivered,
+		//! Копии фреймов, уже полученных от него или других приёмников
+		duplicates,
+		//! Копии с битой суммой, вместо которых так и не пришло правильных
+		invalid,
+	};
+
+	static constexpr size_t stages_count = static_cast<size_t>(stage_t::ip_sdu_accepted_to_sent) + 1;
+	static constexpr size_t counters_count = static_cast<size_t>(counter_t::log_records_dropped) + 1;
+	static constexpr size_t source_counters_count = static_cast<size_t>(source_counter_t::invalid) + 1;
+
+	//! Счетчики одного приёмника для публикации
+	struct source_report
+	{
+		std::string name;
+		std::array<uint64_t, source_counters_count> counters;
+	};
+
+	//! Снимок статистики для публикации
+	struct report
+	{
+		//! За сколько времени собраны гистограммы
+		std::chrono::milliseconds interval;
+		std::array<uint64_t, counters_count> counters;
+		std::array<latency_summary, stages_count> latencies;
+		std::vector<source_report> sources;
+	};
+
+	//! Как часто публиковать статистику. Ноль - не публиковать вовсе
+	void report_period(std::chrono::milliseconds value) { _report_period = value; }
+	std::chrono::milliseconds report_period() const { return _report_period; }
+
+	void count(counter_t counter, uint64_t value = 1)
+	{
+		_counters[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+	}
+
+	void count(size_t source, source_counter_t counter, uint64_t value = 1)
+	{
+		if (source < ITS_USLP_MAX_DOWNLINK_SOURCES)
+			_sources[source][static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+	}
+
+	//! Имена приёмников даунлинк фреймов по их номерам
+	/*! Задаются до запуска потоков. Лишние сверх ITS_USLP_MAX_DOWNLINK_SOURCES не учитываются */
+	void downlink_sources(const std::vector<std::string> & names);
+	const std::vector<std::string> & downlink_sources() const { return _source_names; }
+
+	template <typename DURATION>
+	void record(stage_t stage, const DURATION & duration)
+	{
+		const auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+		_latencies[static_cast<size_t>(stage)].record(us > 0 ? static_cast<uint64_t>(us) : 0);
+	}
+
+	//! Пора ли публиковать статистику
+	bool report_due(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) const;
+	//! Сколько можно спать, чтобы не проспать публикацию статистики
+	std::chrono::milliseconds report_timeout(std::chrono::milliseconds max_timeout) const;
+
+	//! Снимок счетчиков и сводки гистограмм. Гистограммы при этом обнуляются
+	/*! Вызывается только из того потока, что публикует статистику */
+	report take_report();
+
+private:
+	std::chrono::milliseconds _report_period = std::chrono::milliseconds(0);
+	std::array<std::atomic<uint64_t>, counters_count> _counters = {};
+	std::array<latency_histogram, stages_count> _latencies;
+	std::vector<std::string> _source_names;
+	std::array<std::array<std::atomic<uint64_t>, source_counters_count>, ITS_USLP_MAX_DOWNLINK_SOURCES> _sources = {};
+	std::chrono::steady_clock::time_point _interval_start = std::chrono::steady_clock::now();
+};
+
+
+const char * to_string(uslp_stats::stage_t stage);
+const char * to_string(uslp_stats::counter_t counter);
+const char * to_string(uslp_stats::source_counter_t counter);
+
+
+#endif /* ITS_SERVER_USLP_SRC_STATS_HPP_ */
@@ -0,0 +1,226 @@
+#include "threaded_dispatcher.hpp"
+
+#include <chrono>
+#include <algorithm>
+#include <type_traits>
+
+#include "log.hpp"
+#include "dispatcher.hpp"
+
+
+static auto _slg = build_source("threaded-dispatcher");
+
+
+threaded_dispatcher::threaded_dispatcher(
+		istack & istack_, ostack & ostack_,
+		bus_io & io_, bus_output & uplink_output_, bus_output & downlink_output_,
+		size_t queue_capacity
+)
+	: _io(io_), _uplink(ostack_, uplink_output_, _stats), _downlink(istack_, downlink_output_, _stats),
+	  _uplink_queue(queue_capacity), _downlink_queue(queue_capacity)
+{
+	_io.stats(&_stats);
+}
+
+
+threaded_dispatcher::~threaded_dispatcher()
+{
+	stop();
+}
+
+
+void threaded_dispatcher::start()
+{
+	if (_running.exchange(true))
+		return;
+
+	LOG(info) << "starting pipeline threads, queue capacity " << _uplink_queue.capacity();
+	_uplink_thread = std::thread(&threaded_dispatcher::_uplink_thread_main, this);
+	_downlink_thread = std::thread(&threaded_dispatcher::_downlink_thread_main, this);
+}
+
+
+void threaded_dispatcher::stop()
+{
+	if (!_running.exchange(false))
+		return;
+
+	LOG(info) << "stopping pipeline threads";
+	_uplink_queue.notify();
+	_downlink_queue.notify();
+	_uplink_thread.join();
+	_downlink_thread.join();
+}
+
+
+void threaded_dispatcher::poll()
+{
+	{
+		std::lock_guard<std::mutex> lock(_worker_error_mutex);
+		if (_worker_error)
+			std::rethrow_exception(_worker_error);
+	}
+
+	_drain_uplink_backlog();
+	if (_uplink_backlog_full())
+	{
+		// Аплинк тракт совсем не успевает. Откладывать больше некуда, так что
+		// с шины не читаем, пока он не освободит место
+		LOG(trace) << "uplink backlog is full, waiting for uplink queue";
+		const auto timeout = _stats.report_timeout(std::chrono::milliseconds(ITS_DISPATCHER_POLL_PERIOD));
+		if (_uplink_queue.wait_for_space(timeout))
+			_drain_uplink_backlog();
+
+		_publish_stats();
+		return;
+	}
+
+	LOG(trace) << "entering poll cycle";
+	auto timeout = _stats.report_timeout(std::chrono::milliseconds(ITS_DISPATCHER_POLL_PERIOD));
+	if (!_uplink_backlog.empty())
+		timeout = std::min(timeout, std::chrono::milliseconds(ITS_DISPATCHER_BACKLOG_RETRY_PERIOD));
+
+	const bool have_msgs = _io.poll_sub_socket(timeout);
+	LOG(trace) << "poll complete with " << have_msgs;
+	if (!have_msgs)
+	{
+		_publish_stats();
+		return;
+	}
+
+	size_t processed = 0;
+	do
+	{
+		if (_io.recv_message(_input_message))
+			_route_bus_message(std::move(_input_message));
+		else
+			LOG(trace) << "unable to read message?";
+
+	} while (++processed < _batch_limit && !_uplink_backlog_full() && _io.sub_socket_readable());
+
+	LOG(trace) << "routed " << processed << " bus messages in this cycle";
+	_publish_stats();
+}
+
+
+void threaded_dispatcher::_publish_stats()
+{
+	if (!_stats.report_due())
+		return;
+
+	LOG(trace) << "publishing stats";
+	_io.send_message(_stats.take_report());
+}
+
+
+void threaded_dispatcher::_route_bus_message(bus_input_message && message)
+{
+	LOG(trace) << "routing " << to_string(message) << " bus message";
+	if (std::holds_alternative<radio_downlink_frame>(message))
+	{
+		// Даунлинк фреймы радио все равно не переотправит, а ждать тракт мы не можем -
+		// иначе встанет аплинк. Поэтому если тракт не успевает - фрейм теряется
+		if (!_downlink_queue.try_push(std::move(message)))
+		{
+			_stats.count(uslp_stats::counter_t::downlink_frames_dropped);
+			LOG(error) << "downlink queue is full, dropping radio frame";
+		}
+
+		return;
+	}
+
+	// Аплинк сообщения терять нельзя, но и ждать тракт тут нельзя - встанет даунлинк.
+	// Поэтому откладываем сообщение до следующего poll(). Порядок сохраняется:
+	// пока есть отложенные, новые встают за ними
+	if (_uplink_backlog.empty() && _uplink_queue.try_push(std::move(message)))
+		return;
+
+	if (_uplink_backlog.empty())
+		LOG(warning) << "uplink queue is full, holding uplink messages";
+
+	_uplink_backlog.push_back(std::move(message));
+}
+
+
+void threaded_dispatcher::_drain_uplink_backlog()
+{
+	while (!_uplink_backlog.empty() && _uplink_queue.try_push(std::move(_uplink_backlog.front())))
+		_uplink_backlog.pop_front();
+}
+
+
+void threaded_dispatcher::_uplink_thread_main()
+{
+	try
+	{
+		bus_input_message message;
+		while (_running.load())
+		{
+			const auto timeout = _uplink.poll_timeout(std::chrono::milliseconds(ITS_DISPATCHER_POLL_PERIOD));
+			if (_uplink_queue.wait(timeout))
+			{
+				while (_uplink_queue.try_pop(message))
+				{
+					if (auto * request = std::get_if<sdu_uplink_request>(&message))
+						_uplink.on_sdu_uplink_request(*request);
+					else if (const auto * state = std::get_if<radio_uplink_state>(&message))
+						_uplink.on_radio_uplink_state(*state);
+					else
+						LOG(error) << "unexpected " << to_string(message) << " in uplink queue";
+				}
+			}
+
+			// Периодически чистим фреймы по таймауту
+			_uplink.clear_frames_queue();
+			_uplink.publish_restored_events();
+			_uplink.expire_sdus();
+			_uplink.report_queues();
+			_uplink.flush_events();
+			_uplink.maintain_journal();
+		}
+	}
+	catch (...)
+	{
+		LOG(error) << "uplink pipeline thread failed";
+		_store_worker_error(std::current_exception());
+	}
+}
+
+
+void threaded_dispatcher::_downlink_thread_main()
+{
+	try
+	{
+		bus_input_message message;
+		while (_running.load())
+		{
+			const auto timeout = _downlink.poll_timeout(std::chrono::milliseconds(ITS_DISPATCHER_POLL_PERIOD));
+			if (_downlink_queue.wait(timeout))
+			{
+				while (_downlink_queue.try_pop(message))
+				{
+					if (auto * frame = std::get_if<radio_downlink_frame>(&message))
+						_downlink.on_radio_downlink_frame(*frame);
+					else
+						LOG(error) << "unexpected " << to_string(message) << " in downlink queue";
+				}
+			}
+
+			// Придержанные окном склейки фреймы ждут не вечно
+			_downlink.release_frames();
+		}
+	}
+	catch (...)
+	{
+		LOG(error) << "downlink pipeline thread failed";
+		_store_worker_error(std::current_exception());
+	}
+}
+
+
+void threaded_dispatcher::_store_worker_error(std::exception_ptr error)
+{
+	std::lock_guard<std::mutex> lock(_worker_error_mutex);
+	if (!_worker_error)
+		_worker_error = error;
+}
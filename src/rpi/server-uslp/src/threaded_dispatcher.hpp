@@ -0,0 +1,98 @@
+#ifndef ITS_SERVER_USLP_SRC_THREADED_DISPATCHER_HPP_
+#define ITS_SERVER_USLP_SRC_THREADED_DISPATCHER_HPP_
+
+
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <exception>
+
+#include "stack.hpp"
+#include "bus_messages.hpp"
+#include "bus_io.hpp"
+#include "spsc_queue.hpp"
+#include "stats.hpp"
+#include "uplink_pipeline.hpp"
+#include "downlink_pipeline.hpp"
+
+
+//! Разгребает сообщения шины по аплинк и даунлинк трактам в отдельных потоках
+/*! Поток, вызывающий poll(), только принимает сообщения с шины и раскидывает
+ *  их по очередям трактов. Аплинк тракт со своим стеком и планированием
+ *  фреймов работает в своем потоке, даунлинк тракт - в своем, поэтому поток
+ *  больших даунлинк SDU не задерживает решения по аплинку.
+ *
+ *  Отправляют сообщения на шину тракты сами, каждый через свой bus_output,
+ *  так как zmq сокеты нельзя делить между потоками */
+class threaded_dispatcher
+{
+public:
+	threaded_dispatcher(
+			istack & istack_, ostack & ostack_,
+			bus_io & io_, bus_output & uplink_output_, bus_output & downlink_output_,
+			size_t queue_capacity
+	);
+	~threaded_dispatcher();
+
+	//! Запуск потоков трактов. Тракты нужно настраивать до этого
+	void start();
+	//! Остановка потоков трактов
+	void stop();
+
+	//! Приём сообщений с шины и раздача их трактам
+	/*! Пробрасывает исключения, случившиеся в потоках трактов */
+	void poll();
+
+	//! Сколько сообщений с шины разгребается за одно пробуждение (не меньше одного)
+	void batch_limit(size_t value) { _batch_limit = value ? value : 1; }
+	size_t batch_limit() const { return _batch_limit; }
+
+	uplink_pipeline & uplink() { return _uplink; }
+	downlink_pipeline & downlink() { return _downlink; }
+	uslp_stats & stats() { return _stats; }
+
+protected:
+	//! Передача сообщения в очередь соответствующего тракта
+	void _route_bus_message(bus_input_message && message);
+	//! Перекладывание отложенных аплинк сообщений в очередь тракта, пока есть место
+	void _drain_uplink_backlog();
+	bool _uplink_backlog_full() const { return _uplink_backlog.size() >= _uplink_queue.capacity(); }
+	//! Публикация статистики, если пришло её время
+	/*! Публикуется из потока шины через его сокет, тракты пишут в статистику атомиками */
+	void _publish_stats();
+
+	void _uplink_thread_main();
+	void _downlink_thread_main();
+	//! Запоминает исключение потока тракта, чтобы пробросить его из poll()
+	void _store_worker_error(std::exception_ptr error);
+
+private:
+	//! Максимум сообщений с шины, обрабатываемых за один вызов poll()
+	size_t _batch_limit = 1;
+
+	//! Переиспользуемый экземпляр входящего сообщения
+	bus_input_message _input_message;
+
+	bus_io & _io;
+	//! Объявлена до трактов, так как они пишут в неё с самого конструктора
+	uslp_stats _stats;
+	uplink_pipeline _uplink;
+	downlink_pipeline _downlink;
+
+	spsc_queue<bus_input_message> _uplink_queue;
+	spsc_queue<bus_input_message> _downlink_queue;
+	//! Аплинк сообщения, не влезшие в очередь тракта. Не больше её емкости
+	/*! Пока они ждут тут, шина читается дальше и даунлинк не стоит */
+	std::deque<bus_input_message> _uplink_backlog;
+
+	std::atomic<bool> _running = {false};
+	std::thread _uplink_thread;
+	std::thread _downlink_thread;
+
+	std::mutex _worker_error_mutex;
+	std::exception_ptr _worker_error;
+};
+
+
+#endif /* ITS_SERVER_USLP_SRC_THREADED_DISPATCHER_HPP_ */
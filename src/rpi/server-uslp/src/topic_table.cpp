@@ -0,0 +1,63 @@
+#include "topic_table.hpp"
+
+#include <utility>
+#include <stdexcept>
+
+#include <gbus_topic.h>
+
+
+topic_table::topic_table(std::string base)
+	: _base(std::move(base))
+{
+}
+
+
+void topic_table::intern(uint16_t sc_id, uint8_t vchannel_id)
+{
+	for (uint8_t map_id = 0; map_id < ITS_USLP_MAP_IDS_COUNT; map_id++)
+		_build(ccsds::uslp::gmapid_t(sc_id, vchannel_id, map_id));
+}
+
+
+std::string_view topic_table::topic(const ccsds::uslp::gmapid_t & gmapid)
+{
+	const auto it = _topics.find(_key(gmapid));
+	if (it != _topics.end())
+		return it->second;
+
+	return _build(gmapid);
+}
+
+
+ccsds::uslp::gmapid_t topic_table::parse(std::string_view topic)
+{
+	uint16_t sc_id;
+	uint8_t vchannel_id, map_id;
+	const int rc = gbus_topic_parse_channel(topic.data(), topic.size(), &sc_id, &vchannel_id, &map_id);
+	if (0 != rc)
+		throw std::invalid_argument("bad topic for channel id extraction: " + std::string(topic));
+
+	return ccsds::uslp::gmapid_t(sc_id, vchannel_id, map_id);
+}
+
+
+uint32_t topic_table::_key(const ccsds::uslp::gmapid_t & gmapid)
+{
+	return uint32_t(gmapid.mcid().sc_id()) << 16
+			| uint32_t(gmapid.vchannel_id()) << 8
+			| uint32_t(gmapid.map_id())
+	;
+}
+
+
+const std::string & topic_table::_build(const ccsds::uslp::gmapid_t & gmapid)
+{
+	std::string topic(_base.size() + GBUS_TOPIC_CHANNEL_SUFFIX_MAX_SIZE, '\0');
+	const size_t size = gbus_topic_format_channel(
+			topic.data(), topic.size(), _base.data(), _base.size(),
+			gmapid.mcid().sc_id(), gmapid.vchannel_id(), gmapid.map_id()
+	);
+	topic.resize(size);
+
+	return _topics[_key(gmapid)] = std::move(topic);
+}
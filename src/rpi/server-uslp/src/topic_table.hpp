@@ -0,0 +1,50 @@
+#ifndef ITS_SERVER_USLP_SRC_TOPIC_TABLE_HPP_
+#define ITS_SERVER_USLP_SRC_TOPIC_TABLE_HPP_
+
+
+#include <string>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+#include <ccsds/uslp/common/ids.hpp>
+
+
+//! Сколько MAP каналов может быть в виртуальном канале USLP
+#define ITS_USLP_MAP_IDS_COUNT (16)
+
+
+//! Заранее собранные топики вида <база>.<sc_id>.<vchannel_id>.<map_id>
+/*! Топики всех MAP каналов известных виртуальных каналов собираются один раз
+ *  при настройке, так что отправка сообщения топик не строит и память
+ *  под него не выделяет. Топик неизвестного канала собирается при первом
+ *  обращении и тоже запоминается. Не потокобезопасна, как и bus_io */
+class topic_table
+{
+public:
+	explicit topic_table(std::string base);
+
+	const std::string & base() const { return _base; }
+
+	//! Сборка топиков всех MAP каналов виртуального канала
+	void intern(uint16_t sc_id, uint8_t vchannel_id);
+	void clear() { _topics.clear(); }
+
+	//! Топик канала. Ссылка живет до clear()
+	std::string_view topic(const ccsds::uslp::gmapid_t & gmapid);
+
+	//! Канал из трех последних частей топика. Без выделения памяти
+	/*! std::invalid_argument, если номера канала в топике нет */
+	static ccsds::uslp::gmapid_t parse(std::string_view topic);
+
+private:
+	static uint32_t _key(const ccsds::uslp::gmapid_t & gmapid);
+
+	const std::string & _build(const ccsds::uslp::gmapid_t & gmapid);
+
+	std::string _base;
+	std::unordered_map<uint32_t, std::string> _topics;
+};
+
+
+#endif /* ITS_SERVER_USLP_SRC_TOPIC_TABLE_HPP_ */
@@ -0,0 +1,637 @@
+#include "uplink_pipeline.hpp"
+
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+
+#include "log.hpp"
+
+
+static auto _slg = build_source("uplink");
+
+
+uplink_pipeline::uplink_pipeline(ostack & ostack_, bus_output & output_, uslp_stats & stats_)
+	: uplink_pipeline(pchannel_config(), 0, ostack_, output_, stats_)
+{
+}
+
+
+uplink_pipeline::uplink_pipeline(
+		const pchannel_config & config, size_t pchannel,
+		ostack & ostack_, bus_output & output_, uslp_stats & stats_
+)
+	: _pchannel(pchannel), _frame_size(config.frame_size), _ostack(ostack_), _output(output_), _stats(stats_)
+{
+	_scheduler.frame_size(_frame_size);
+	_scheduler.add_map(ccsds::uslp::gmapid_t(config.sc_id, config.uplink_vchannel_id, UPLINK_TELECOMMAND_MAPID), 0, 1);
+	_scheduler.add_map(ccsds::uslp::gmapid_t(config.sc_id, config.uplink_vchannel_id, UPLINK_IP_MAPID), 1, 1);
+}
+
+
+void uplink_pipeline::open_journal(const std::string & path, size_t capacity)
+{
+	const auto start = std::chrono::steady_clock::now();
+	_journal = std::make_unique<sdu_journal>(path, capacity);
+
+	auto restored = _journal->restore();
+	for (auto & restored_sdu: restored)
+	{
+		if (!_scheduler.has_map(restored_sdu.gmapid))
+		{
+			LOG(warning) << "journal has SDU for unknown map channel " << restored_sdu.gmapid << ", dropping";
+			_journal->sdu_done(restored_sdu.gmapid, restored_sdu.cookie);
+			continue;
+		}
+
+		// Монотонные часы перезапуск не переживают, срок жизни хранится по настенным
+		const auto now = std::chrono::steady_clock::now();
+		std::optional<map_scheduler::time_point_t> deadline;
+		if (restored_sdu.deadline)
+		{
+			const auto ttl = *restored_sdu.deadline - std::chrono::system_clock::now();
+			if (ttl.count() <= 0)
+			{
+				_restored_events.push_back(restored_event_t{restored_sdu.gmapid, restored_sdu.cookie, true});
+				continue;
+			}
+
+			deadline = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(ttl);
+		}
+
+		// Лимиты очереди тут не проверяем - эти SDU уже были приняты
+		map_scheduler::pending_sdu sdu;
+		sdu.gmapid = restored_sdu.gmapid;
+		sdu.qos = restored_sdu.qos;
+		sdu.cookie = restored_sdu.cookie;
+		sdu.data = std::move(restored_sdu.data);
+		sdu.accept_time = now;
+		sdu.deadline = deadline;
+		_scheduler.push(std::move(sdu));
+
+		_stats.count(uslp_stats::counter_t::uplink_sdus_restored);
+		_restored_events.push_back(restored_event_t{restored_sdu.gmapid, restored_sdu.cookie, false});
+	}
+
+	// Клиентам расскажем, когда брокер подпишется на наш сокет
+	_restored_events_time = std::chrono::steady_clock::now() + std::chrono::milliseconds(ITS_SDU_RESTORED_EVENTS_DELAY);
+
+	LOG(info) << "restored " << _scheduler.pending_count() << " uplink SDUs from " << path << " in "
+			<< std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()
+			<< " us"
+	;
+}
+
+
+void uplink_pipeline::on_sdu_uplink_request(sdu_uplink_request & request)
+{
+	LOG(debug) << "got SDU uplink request for " << request.gmapid << ", "
+			<< "cookie " << request.cookie
+	;
+
+	try
+	{
+		auto * channel = _ostack.get_map_channel(request.gmapid);
+		if (!channel || !_scheduler.has_map(request.gmapid))
+		{
+			// У нас нет канала, которому бы предназначался этот пакет
+			std::stringstream error;
+			error << "there is no map channel " << request.gmapid << " "
+				<< "registered in output stack";
+			throw std::runtime_error(error.str());
+		}
+
+		if (request.ttl && request.ttl->count() <= 0)
+		{
+			// Срок жизни истек еще до того, как SDU до нас дошел
+			_report_expired_sdu(request.gmapid, request.cookie);
+			return;
+		}
+
+		if (!_scheduler.can_accept(request.gmapid, request.data.size()))
+		{
+			// Клиент должен подождать, пока очередь разгребется
+			LOG(warning) << "uplink queue of " << request.gmapid << " is full, "
+					<< "rejecting SDU with cookie " << request.cookie
+			;
+
+			_stats.count(uslp_stats::counter_t::uplink_sdus_queue_full);
+			_reject_sdu(request, ITS_SDU_REJECTED_QUEUE_FULL);
+			return;
+		}
+
+		// В стек данные попадут, когда до них дойдет очередь
+		map_scheduler::pending_sdu sdu;
+		sdu.gmapid = request.gmapid;
+		sdu.qos = request.qos;
+		sdu.cookie = request.cookie;
+		sdu.data = std::move(request.data);
+		sdu.accept_time = std::chrono::steady_clock::now();
+		if (request.ttl)
+			sdu.deadline = request.parse_time + *request.ttl;
+
+		// В журнал - до того, как клиент узнает о приёме
+		const char * accept_comment = nullptr;
+		if (_journal)
+		{
+			std::optional<sdu_journal::wall_time_point_t> wall_deadline;
+			if (sdu.deadline)
+			{
+				wall_deadline = std::chrono::system_clock::now() + std::chrono::duration_cast<std::chrono::system_clock::duration>(
+						*sdu.deadline - std::chrono::steady_clock::now()
+				);
+			}
+
+			if (!_journal->sdu_accepted(sdu.gmapid, sdu.qos, sdu.cookie, sdu.data.data(), sdu.data.size(), wall_deadline))
+			{
+				// Отправить SDU мы все равно можем, но клиент должен знать,
+				// что после перезапуска сервера его придется прислать заново
+				_stats.count(uslp_stats::counter_t::uplink_sdus_not_journaled);
+				accept_comment = ITS_SDU_ACCEPTED_NOT_JOURNALED;
+			}
+		}
+
+		_scheduler.push(std::move(sdu));
+
+		LOG(info) << "accepted SDU uplink " << request.gmapid << ", "
+				<< "cookie: " << request.cookie
+		;
+
+		// Сообщаем об этом клиенту
+		_stats.record(
+				uslp_stats::stage_t::sdu_request_to_accepted,
+				std::chrono::steady_clock::now() - request.parse_time
+		);
+		_stats.count(uslp_stats::counter_t::uplink_sdus_accepted);
+		_report_accepted_sdu(request.gmapid, request.cookie, accept_comment);
+	}
+	catch (std::exception & e)
+	{
+		LOG(error) << "SDU for " << request.gmapid << ", "
+				<< "cookie: " << request.cookie << " "
+				<< "rejected: " << e.what()
+		;
+
+		_reject_sdu(request, e.what());
+	}
+}
+
+
+void uplink_pipeline::on_radio_uplink_state(const radio_uplink_state & state)
+{
+	LOG(trace) << "got radio uplink state";
+	try
+	{
+		_decide_next_uplink_frame(state);
+	}
+	catch (std::exception & e)
+	{
+		LOG(error) << "unable to process radio uplink state message: " << e.what();
+	}
+}
+
+
+void uplink_pipeline::clear_frames_queue()
+{
+	// Здесь мы будем чистить фреймы с которыми случился таймаут
+	// Таблица отдает их в порядке отправки и смены состояния, так что дальше первых живых фреймов не смотрим
+	const auto now = std::chrono::steady_clock::now();
+	while (auto finfo = _frames_in_wait.extract_expired(now, _sent_frame_timeout(), _frame_done_timeout))
+	{
+		LOG(error) << "frame " << finfo->frame_cookie << " timed out";
+		_stats.count(uslp_stats::counter_t::uplink_frames_timed_out);
+		_report_frame_sdus(*finfo, sdu_uplink_event::event_kind_t::sdu_radiation_failed);
+	}
+}
+
+
+void uplink_pipeline::report_queues()
+{
+	if (_queue_report_period.count() <= 0)
+		return;
+
+	const auto now = std::chrono::steady_clock::now();
+	if (now < _last_queue_report + _queue_report_period)
+		return;
+
+	LOG(trace) << "reporting uplink queues state";
+	_last_queue_report = now;
+	_scheduler.queue_state(_queue_state_message);
+	_output.send_message(_queue_state_message);
+}
+
+
+void uplink_pipeline::expire_sdus()
+{
+	// Иначе sdu_expired обгонит sdu_accepted поднятого из журнала SDU
+	if (!_restored_events.empty())
+		return;
+
+	_expired_sdus.clear();
+	_scheduler.expire(std::chrono::steady_clock::now(), _expired_sdus);
+	for (const auto & expired: _expired_sdus)
+		_report_expired_sdu(expired.gmapid, expired.cookie);
+}
+
+
+void uplink_pipeline::publish_restored_events()
+{
+	if (_restored_events.empty() || std::chrono::steady_clock::now() < _restored_events_time)
+		return;
+
+	LOG(info) << "publishing events for " << _restored_events.size() << " SDUs restored from journal";
+	for (const auto & event: _restored_events)
+	{
+		if (event.expired)
+			_report_expired_sdu(event.gmapid, event.cookie);
+		else
+			_report_accepted_sdu(event.gmapid, event.cookie, ITS_SDU_ACCEPTED_RESTORED);
+	}
+
+	// Больше не понадобится
+	_restored_events.clear();
+	_restored_events.shrink_to_fit();
+}
+
+
+std::chrono::milliseconds uplink_pipeline::poll_timeout(std::chrono::milliseconds max_timeout) const
+{
+	if (!_restored_events.empty())
+	{
+		const auto until_restored_events = std::chrono::ceil<std::chrono::milliseconds>(
+				_restored_events_time - std::chrono::steady_clock::now()
+		);
+		max_timeout = std::max(std::min(until_restored_events, max_timeout), std::chrono::milliseconds(0));
+	}
+
+	if (_queue_report_period.count() > 0)
+	{
+		const auto until_report = std::chrono::ceil<std::chrono::milliseconds>(
+				_last_queue_report + _queue_report_period - std::chrono::steady_clock::now()
+		);
+		max_timeout = std::max(std::min(until_report, max_timeout), std::chrono::milliseconds(0));
+	}
+
+	const auto deadline = _frames_in_wait.next_deadline(_sent_frame_timeout(), _frame_done_timeout);
+	if (!deadline)
+		return max_timeout;
+
+	const auto now = std::chrono::steady_clock::now();
+	if (*deadline <= now)
+		return std::chrono::milliseconds(0);
+
+	// Округляем вверх, чтобы не просыпаться за мгновение до дедлайна впустую
+	const auto until_deadline = std::chrono::ceil<std::chrono::milliseconds>(*deadline - now);
+	return std::min(until_deadline, max_timeout);
+}
+
+
+void uplink_pipeline::flush_events()
+{
+	auto & events = _uplink_event_batch.events;
+	if (events.empty())
+		return;
+
+	LOG(trace) << "publishing " << events.size() << " uplink sdu events in a batch";
+	_stats.count(uslp_stats::counter_t::uplink_event_messages_sent);
+	_output.send_message(_uplink_event_batch);
+	events.clear();
+}
+
+
+void uplink_pipeline::maintain_journal()
+{
+	if (_journal)
+		_journal->maintain();
+}
+
+
+sdu_uplink_event & uplink_pipeline::_make_uplink_event()
+{
+	auto & retval = _uplink_event_message;
+	retval.comment.clear();
+	return retval;
+}
+
+
+void uplink_pipeline::_publish_uplink_event(const sdu_uplink_event & event)
+{
+	_stats.count(uslp_stats::counter_t::uplink_sdu_events);
+
+	if (_event_publishing != event_publishing_t::batch)
+	{
+		_stats.count(uslp_stats::counter_t::uplink_event_messages_sent);
+		_output.send_message(event);
+	}
+
+	if (_event_publishing != event_publishing_t::single)
+		_uplink_event_batch.events.push_back(event);
+}
+
+
+void uplink_pipeline::_reject_sdu(const sdu_uplink_request & request, const std::string & comment)
+{
+	auto & reply = _make_uplink_event();
+	reply.part_cookie.cookie = request.cookie;
+	reply.part_cookie.part_no = 0;
+	reply.part_cookie.final = true;
+
+	reply.event_kind = sdu_uplink_event::event_kind_t::sdu_rejected;
+	reply.gmapid = request.gmapid;
+	reply.comment = comment;
+	_stats.count(uslp_stats::counter_t::uplink_sdus_rejected);
+	_publish_uplink_event(reply);
+}
+
+
+void uplink_pipeline::_report_accepted_sdu(
+		const ccsds::uslp::gmapid_t & gmapid, ccsds::uslp::payload_cookie_t cookie, const char * comment
+)
+{
+	auto & reply = _make_uplink_event();
+	reply.part_cookie.cookie = cookie;
+	reply.part_cookie.part_no = 0;
+	reply.part_cookie.final = true;
+
+	reply.event_kind = sdu_uplink_event::event_kind_t::sdu_accepted;
+	reply.gmapid = gmapid;
+	if (comment)
+		reply.comment = comment;
+	_publish_uplink_event(reply);
+}
+
+
+void uplink_pipeline::_journal_sdu_done(const ccsds::uslp::gmapid_t & gmapid, ccsds::uslp::payload_cookie_t cookie)
+{
+	if (_journal)
+		_journal->sdu_done(gmapid, cookie);
+}
+
+
+void uplink_pipeline::_report_expired_sdu(
+		const ccsds::uslp::gmapid_t & gmapid, ccsds::uslp::payload_cookie_t cookie
+)
+{
+	LOG(warning) << "SDU " << gmapid << ", cookie " << cookie << " expired";
+
+	auto & event = _make_uplink_event();
+	event.gmapid = gmapid;
+	event.part_cookie.cookie = cookie;
+	event.part_cookie.part_no = 0;
+	event.part_cookie.final = true;
+	event.event_kind = sdu_uplink_event::event_kind_t::sdu_expired;
+	_stats.count(uslp_stats::counter_t::uplink_sdus_expired);
+	_publish_uplink_event(event);
+	_journal_sdu_done(gmapid, cookie);
+}
+
+
+void uplink_pipeline::_update_frames_queue(const radio_uplink_state & state)
+{
+	// Смотрим что радио говорит про каждый из своих буферов
+	// и находим соответствующие фреймы по кукам
+	const auto now = std::chrono::steady_clock::now();
+	if (state.cookie_in_wait)
+	{
+		const auto * finfo = _frames_in_wait.find(*state.cookie_in_wait);
+		if (finfo && finfo->state != frame_queue_entry_t::frame_state_t::in_wait)
+		{
+			LOG(debug) << "frame " << finfo->frame_cookie << " went to 'in_wait'";
+			_frames_in_wait.set_state(finfo->frame_cookie, frame_queue_entry_t::frame_state_t::in_wait, now);
+		}
+	}
+
+	if (state.cookie_in_progress)
+	{
+		const auto * finfo = _frames_in_wait.find(*state.cookie_in_progress);
+		if (finfo && finfo->state != frame_queue_entry_t::frame_state_t::in_progress)
+		{
+			LOG(debug) << "frame " << finfo->frame_cookie << " went to 'in_progress'";
+			_frames_in_wait.set_state(finfo->frame_cookie, frame_queue_entry_t::frame_state_t::in_progress, now);
+		}
+	}
+
+	// Фреймы в терминальных состояниях в таблице больше не нужны
+	if (state.cookie_done)
+	{
+		if (auto finfo = _frames_in_wait.extract(*state.cookie_done))
+		{
+			LOG(debug) << "frame " << finfo->frame_cookie << " is radiated";
+			finfo->state = frame_queue_entry_t::frame_state_t::radiated;
+			_stats.record(
+					uslp_stats::stage_t::uplink_frame_to_radiated,
+					std::chrono::steady_clock::now() - finfo->send_time
+			);
+			_stats.count(uslp_stats::counter_t::uplink_frames_radiated);
+			_report_frame_sdus(*finfo, sdu_uplink_event::event_kind_t::sdu_radiated);
+		}
+	}
+
+	if (state.cookie_failed)
+	{
+		if (auto finfo = _frames_in_wait.extract(*state.cookie_failed))
+		{
+			LOG(error) << "frame " << finfo->frame_cookie << " radiation failed";
+			finfo->state = frame_queue_entry_t::frame_state_t::failed;
+			_stats.count(uslp_stats::counter_t::uplink_frames_failed);
+			_report_frame_sdus(*finfo, sdu_uplink_event::event_kind_t::sdu_radiation_failed);
+		}
+	}
+}
+
+
+void uplink_pipeline::_report_frame_sdus(
+		const frame_queue_entry_t & finfo, sdu_uplink_event::event_kind_t event_kind
+)
+{
+	for (const auto & sdu_cookie: finfo.sdu_cookies)
+	{
+		if (event_kind == sdu_uplink_event::event_kind_t::sdu_radiated)
+		{
+			LOG(info) << "radiated payload part: " << finfo.sdu_mapid << ", "
+					<< "cookie: " << sdu_cookie.cookie << ", "
+					<< "part: " << sdu_cookie.part_no // << " "
+					<< (sdu_cookie.final ? " (final)" : "")
+			;
+		}
+		else
+		{
+			LOG(error) << "payload part radiation failed: " << finfo.sdu_mapid << ", "
+					<< "cookie: " << sdu_cookie.cookie << ", "
+					<< "part: " << sdu_cookie.part_no // << " "
+					<< (sdu_cookie.final ? " (final)" : "")
+			;
+		}
+
+		auto & event = _make_uplink_event();
+		event.gmapid = finfo.sdu_mapid;
+		event.part_cookie = sdu_cookie;
+		event.event_kind = event_kind;
+		_publish_uplink_event(event);
+
+		// SDU ушел в эфир целиком или его уже не собрать - в любом случае повторять его
+		// после перезапуска не надо. Клиент сам решит, слать ли его еще раз
+		if (sdu_cookie.final || event_kind != sdu_uplink_event::event_kind_t::sdu_radiated)
+			_journal_sdu_done(finfo.sdu_mapid, sdu_cookie.cookie);
+	}
+}
+
+
+void uplink_pipeline::_decide_next_uplink_frame(const radio_uplink_state & state)
+{
+	// Сбрасываем фреймы по таймауту
+	clear_frames_queue();
+	// Разгребаем что там нам пишло
+	_update_frames_queue(state);
+
+	// Фреймы с поднятыми из журнала SDU не должны уйти раньше, чем клиенты о них узнают
+	if (!_restored_events.empty())
+	{
+		LOG(trace) << "restored SDU events are not published yet, holding uplink";
+		return;
+	}
+
+	// Принимаем решение об отправке следующих фреймов
+	size_t credits = _uplink_credits(state);
+	if (0 == credits)
+	{
+		LOG(trace) << "uplink window is full";
+		return;
+	}
+
+	LOG(trace) << "radio is ready to accept " << credits << " frames!";
+	// Мы можем отправлять. Но хотим ли?
+	for (; credits > 0; credits--)
+	{
+		if (!_send_next_uplink_frame())
+		{
+			LOG(trace) << "CCSDS stack is not ready to emit frame";
+			break;
+		}
+	}
+}
+
+
+size_t uplink_pipeline::_uplink_credits(const radio_uplink_state & state) const
+{
+	// Окно занимают фреймы, которые с нашей точки зрения лежат в отправном буфере
+	// радио или находятся по пути туда
+	size_t outstanding = _frames_in_wait.count(frame_queue_entry_t::frame_state_t::sent_to_radio)
+			+ _frames_in_wait.count(frame_queue_entry_t::frame_state_t::in_wait)
+	;
+
+	// Отправной буфер радио может быть занят и не нашим фреймом
+	if (state.cookie_in_wait && !_frames_in_wait.find(*state.cookie_in_wait))
+	{
+		LOG(trace) << "radio uplink buffer is occupied by a foreign frame";
+		outstanding++;
+	}
+
+	return outstanding < _uplink_window ? _uplink_window - outstanding : 0;
+}
+
+
+void uplink_pipeline::_feed_stack()
+{
+	// Протухшие SDU не должны занимать эфир
+	expire_sdus();
+
+	map_scheduler::pending_sdu sdu;
+	while (_scheduler.pop(sdu))
+	{
+		try
+		{
+			auto * channel = _ostack.get_map_channel(sdu.gmapid);
+			channel->push_sdu(sdu.cookie, sdu.data.data(), sdu.data.size(), sdu.qos);
+			LOG(debug) << "SDU " << sdu.gmapid << ", cookie " << sdu.cookie << " went to stack";
+		}
+		catch (std::exception & e)
+		{
+			// SDU уже принят, так что клиент узнает об этом как о неудачной отправке
+			LOG(error) << "stack refused SDU " << sdu.gmapid << ", "
+					<< "cookie: " << sdu.cookie << ": " << e.what()
+			;
+
+			_scheduler.sdu_sent(sdu.gmapid, sdu.cookie);
+			auto & event = _make_uplink_event();
+			event.gmapid = sdu.gmapid;
+			event.part_cookie.cookie = sdu.cookie;
+			event.part_cookie.part_no = 0;
+			event.part_cookie.final = true;
+			event.event_kind = sdu_uplink_event::event_kind_t::sdu_radiation_failed;
+			event.comment = e.what();
+			_publish_uplink_event(event);
+			_journal_sdu_done(sdu.gmapid, sdu.cookie);
+		}
+	}
+}
+
+
+void uplink_pipeline::_account_sent_sdus(const ccsds::uslp::pchannel_frame_params_t & frame_params)
+{
+	_scheduler.frame_popped(frame_params.channel_id);
+	for (const auto & part_cookie: frame_params.payload_cookies)
+	{
+		if (!part_cookie.final)
+			continue;
+
+		const auto accept_time = _scheduler.sdu_sent(frame_params.channel_id, part_cookie.cookie);
+		if (!accept_time)
+			continue;
+
+		const auto stage = frame_params.channel_id.map_id() == UPLINK_TELECOMMAND_MAPID
+				? uslp_stats::stage_t::command_sdu_accepted_to_sent
+				: uslp_stats::stage_t::ip_sdu_accepted_to_sent
+		;
+		_stats.record(stage, std::chrono::steady_clock::now() - *accept_time);
+	}
+}
+
+
+bool uplink_pipeline::_send_next_uplink_frame()
+{
+	_feed_stack();
+
+	ccsds::uslp::pchannel_frame_params_t frame_params;
+	if (!_ostack.peek_frame(frame_params))
+	{
+		// Стек опустел, значит все поданные в него SDU ушли
+		_scheduler.stack_drained();
+		_feed_stack();
+		if (!_ostack.peek_frame(frame_params))
+			return false;
+	}
+
+	LOG(debug) << "ccsds stack is ready to emit frame for "
+			<< "channel " << frame_params.channel_id << ", "
+			<< "ccsds frame no " << (frame_params.frame_seq_no
+						? std::to_string(frame_params.frame_seq_no->value())
+						: std::string("<no-frame-seq-no>")
+				)
+	;
+
+	// Отправляем!
+	auto & message = _uplink_frame_message;
+	message.pchannel = _pchannel;
+	message.frame_cookie = _next_rf_uplink_frame_cookie;
+	message.data.resize(_frame_size);
+	_ostack.pop_frame(message.data.data(), message.data.size());
+	_output.send_message(message);
+	_stats.count(uslp_stats::counter_t::uplink_frames_sent);
+	_account_sent_sdus(frame_params);
+
+	// К следующему номеру радиокуки
+	if (0 == ++_next_rf_uplink_frame_cookie)
+		_next_rf_uplink_frame_cookie = 1; // ноль запрещен
+
+	// Запоминаем фрейм
+	_frames_in_wait.insert(frame_queue_entry_t{
+		message.frame_cookie,
+		frame_params.channel_id,
+		frame_params.payload_cookies,
+		std::chrono::steady_clock::now(),
+		frame_queue_entry_t::frame_state_t::sent_to_radio
+	});
+
+	// готово
+	return true;
+}
@@ -0,0 +1,215 @@
+#ifndef ITS_SERVER_USLP_SRC_UPLINK_PIPELINE_HPP_
+#define ITS_SERVER_USLP_SRC_UPLINK_PIPELINE_HPP_
+
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "stack.hpp"
+#include "bus_messages.hpp"
+#include "bus_io.hpp"
+#include "frame_table.hpp"
+#include "map_scheduler.hpp"
+#include "stats.hpp"
+#include "sdu_journal.hpp"
+
+
+//! Комментарий к sdu_rejected, когда очередь MAP канала переполнена
+#define ITS_SDU_REJECTED_QUEUE_FULL "queue_full"
+//! Комментарий к sdu_accepted для SDU, поднятых из журнала после перезапуска
+#define ITS_SDU_ACCEPTED_RESTORED "restored"
+//! Комментарий к sdu_accepted, когда SDU не влез в журнал и перезапуск не переживет
+#define ITS_SDU_ACCEPTED_NOT_JOURNALED "not_journaled"
+//! Через сколько после открытия журнала рассказывать клиентам о поднятых из него SDU (мс)
+/*! Журнал открывается сразу после подключения к шине. Брокер к этому моменту
+ *  еще не подписался на наш сокет, и отправленное сразу zmq молча выкинет */
+#define ITS_SDU_RESTORED_EVENTS_DELAY (500)
+
+
+//! Аплинк тракт: приём SDU в выходной стек и планирование фреймов для радио
+/*! Владеет выходным стеком и таблицей отправленных фреймов. Все методы
+ *  должны вызываться из одного потока */
+class uplink_pipeline
+{
+public:
+	uplink_pipeline(ostack & ostack_, bus_output & output_, uslp_stats & stats_);
+	//! Тракт физического канала номер pchannel с настройками config
+	uplink_pipeline(
+			const pchannel_config & config, size_t pchannel,
+			ostack & ostack_, bus_output & output_, uslp_stats & stats_
+	);
+
+	//! Сколько фрейм может пробыть у радио в in_wait или in_progress
+	/*! Пока фрейм стоит в очереди радио (sent_to_radio), он ждет и фреймы перед
+	 *  ним, поэтому ему дается такой таймаут на каждый фрейм окна */
+	template <typename DURATION>
+	void frame_done_timeout(const DURATION & timeout)
+	{
+		_frame_done_timeout = std::chrono::duration_cast<std::chrono::milliseconds>(timeout);
+	}
+
+	std::chrono::milliseconds frame_done_timeout() const { return _frame_done_timeout; }
+
+	//! Сколько фреймов может быть отправлено в радио, но еще не взято им в эфир
+	/*! Пока радио занято, следующие фреймы ждут своей очереди в его сокете,
+	 *  поэтому радио не простаивает, пока мы реагируем на его uplink_state.
+	 *  Не меньше одного */
+	void uplink_window(size_t value) { _uplink_window = value ? value : 1; }
+	size_t uplink_window() const { return _uplink_window; }
+
+	//! Планировщик SDU между MAP каналами
+	/*! По умолчанию телекоманды строго приоритетнее IP */
+	map_scheduler & scheduler() { return _scheduler; }
+
+	//! Период публикации заполненности очередей SDU. Ноль - не публиковать
+	template <typename DURATION>
+	void queue_report_period(const DURATION & period)
+	{
+		_queue_report_period = std::chrono::duration_cast<std::chrono::milliseconds>(period);
+	}
+
+	std::chrono::milliseconds queue_report_period() const { return _queue_report_period; }
+
+	//! Как публиковать события SDU
+	enum class event_publishing_t
+	{
+		single,		//!< Отдельным uslp.uplink_sdu_event на каждую часть SDU
+		batch,		//!< Одним uslp.uplink_event_batch за цикл опроса
+		both,		//!< И так и так, пока не все клиенты научились пачкам
+	};
+
+	void event_publishing(event_publishing_t value) { _event_publishing = value; }
+	event_publishing_t event_publishing() const { return _event_publishing; }
+
+	//! Журнал принятых SDU, переживающий перезапуск сервера
+	/*! SDU, оставшиеся в журнале с прошлого запуска, сразу встают в очередь
+	 *  планировщика, а клиенты снова получают на них sdu_accepted с комментарием
+	 *  ITS_SDU_ACCEPTED_RESTORED через ITS_SDU_RESTORED_EVENTS_DELAY после
+	 *  открытия журнала (см. publish_restored_events()). Если для нового SDU в журнале нет места,
+	 *  он все равно принимается, но с комментарием ITS_SDU_ACCEPTED_NOT_JOURNALED.
+	 *  Открывать после настройки планировщика */
+	void open_journal(const std::string & path, size_t capacity);
+	sdu_journal * journal() { return _journal.get(); }
+
+	//! Данные запроса забираются в очередь планировщика
+	void on_sdu_uplink_request(sdu_uplink_request & request);
+	void on_radio_uplink_state(const radio_uplink_state & state);
+
+	//! Сброс фреймов, судьба которых не решилась за отведенное время
+	void clear_frames_queue();
+
+	//! Публикация заполненности очередей SDU, если пришло её время
+	void report_queues();
+
+	//! Выкидывание из очередей SDU с истекшим сроком жизни (sdu_expired)
+	void expire_sdus();
+
+	//! Публикация событий SDU, поднятых из журнала, когда шина успела подключиться
+	/*! Пока они не опубликованы, фреймы в радио не отправляются, а SDU не протухают,
+	 *  чтобы клиент не услышал о судьбе SDU раньше, чем о её приёме. Зовется в цикле опроса */
+	void publish_restored_events();
+
+	//! Публикация событий SDU, накопленных в пачку. Зовется в конце цикла опроса
+	void flush_events();
+
+	//! Сжатие и сброс на диск журнала SDU, если он есть. Зовется периодически
+	void maintain_journal();
+
+	//! Сколько можно спать в ожидании сообщений, чтобы не проспать таймаут фрейма,
+	//! отчет об очередях или события поднятых из журнала SDU
+	std::chrono::milliseconds poll_timeout(std::chrono::milliseconds max_timeout) const;
+
+protected:
+	void _update_frames_queue(const radio_uplink_state & state);
+	//! Таймаут фреймов в sent_to_radio, от отправки
+	std::chrono::milliseconds _sent_frame_timeout() const
+	{
+		return _frame_done_timeout * static_cast<std::chrono::milliseconds::rep>(_uplink_window);
+	}
+	void _decide_next_uplink_frame(const radio_uplink_state & state);
+	//! Сколько еще фреймов можно отправить в радио прямо сейчас
+	size_t _uplink_credits(const radio_uplink_state & state) const;
+	//! Отправка очередного фрейма стека в радио. false, если стеку нечего отправлять
+	bool _send_next_uplink_frame();
+	//! Подача стеку SDU, которые ему пора отправлять по мнению планировщика
+	void _feed_stack();
+	//! Учет SDU, чьи последние части ушли фреймом
+	void _account_sent_sdus(const ccsds::uslp::pchannel_frame_params_t & frame_params);
+	//! Чистый экземпляр события SDU для отправки на шину
+	sdu_uplink_event & _make_uplink_event();
+	//! Публикация события, полученного от _make_uplink_event()
+	void _publish_uplink_event(const sdu_uplink_event & event);
+	//! Отказ клиенту в приёме SDU
+	void _reject_sdu(const sdu_uplink_request & request, const std::string & comment);
+	//! Оповещение клиента о том, что SDU выкинут по сроку жизни
+	void _report_expired_sdu(const ccsds::uslp::gmapid_t & gmapid, ccsds::uslp::payload_cookie_t cookie);
+	//! Сообщение клиенту о приёме SDU
+	void _report_accepted_sdu(
+			const ccsds::uslp::gmapid_t & gmapid, ccsds::uslp::payload_cookie_t cookie, const char * comment
+	);
+	//! Судьба SDU решилась, журналу его больше помнить не надо
+	void _journal_sdu_done(const ccsds::uslp::gmapid_t & gmapid, ccsds::uslp::payload_cookie_t cookie);
+	//! Оповещение клиентов о судьбе SDU, летевших указанным фреймом
+	void _report_frame_sdus(
+			const frame_queue_entry_t & finfo, sdu_uplink_event::event_kind_t event_kind
+	);
+
+private:
+	//! Номер физического канала тракта и размер его фрейма
+	size_t _pchannel = 0;
+	size_t _frame_size = RADIO_FRAME_SIZE;
+
+	//! Кука для следующего отправляемого сообщения для радио (не должно быть нулём)
+	uint64_t _next_rf_uplink_frame_cookie = 1;
+
+	//! Информация о фреймах, которые мы отправили в большой мир и теперь следим за их
+	//! судьбой
+	frame_table _frames_in_wait;
+
+	//! Таймаут, который мы даем фреймам на то, чтобы их судьба как-то решилась,
+	//! с момента, как радио за них взялось
+	std::chrono::milliseconds _frame_done_timeout = std::chrono::milliseconds(5000);
+
+	//! Максимум фреймов в состояниях sent_to_radio и in_wait
+	size_t _uplink_window = 1;
+
+	//! SDU, ожидающие подачи в стек
+	map_scheduler _scheduler;
+
+	std::chrono::milliseconds _queue_report_period = std::chrono::milliseconds(1000);
+	std::chrono::steady_clock::time_point _last_queue_report;
+
+	event_publishing_t _event_publishing = event_publishing_t::single;
+
+	//! Переиспользуемые экземпляры исходящих сообщений
+	/*! Память под них и их буферы выделяется один раз */
+	sdu_uplink_event _uplink_event_message;
+	sdu_uplink_event_batch _uplink_event_batch;
+	radio_uplink_frame _uplink_frame_message;
+	uplink_queue_state _queue_state_message;
+	std::vector<map_scheduler::expired_sdu> _expired_sdus;
+
+	//! Пусто, если SDU не журналируются
+	std::unique_ptr<sdu_journal> _journal;
+
+	//! Событие SDU, поднятого из журнала, ждущее публикации
+	struct restored_event_t
+	{
+		ccsds::uslp::gmapid_t gmapid;
+		ccsds::uslp::payload_cookie_t cookie;
+		//! sdu_expired, иначе sdu_accepted с ITS_SDU_ACCEPTED_RESTORED
+		bool expired;
+	};
+
+	std::vector<restored_event_t> _restored_events;
+	//! Когда их можно публиковать
+	std::chrono::steady_clock::time_point _restored_events_time;
+
+	ostack & _ostack;
+	bus_output & _output;
+	uslp_stats & _stats;
+};
+
+
+#endif /* ITS_SERVER_USLP_SRC_UPLINK_PIPELINE_HPP_ */
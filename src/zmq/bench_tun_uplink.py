@@ -0,0 +1,248 @@
+import os
+import sys
+import time
+import shlex
+import socket
+import struct
+import logging
+import subprocess
+
+import zmq
+
+from senders_common import SenderCore
+from ccsds.epp import EppHeader
+from bench_uslp_downlink import percentile
+
+
+""" Нагрузочный тест uplink тракта TUN сервера в пакетах в секунду
+
+    Скрипт шлет UDP датаграммы на адрес из подсети туннеля (--peer), ядро
+    заворачивает их в туннель, TUN сервер читает их оттуда и публикует
+    в uslp.uplink_sdu_request.*. Скрипт ловит эти сообщения и считает,
+    сколько пакетов в секунду сервер успевает перекладывать на шину при разной
+    предложенной нагрузке (--rates, пакетов в секунду, 0 - сколько влезет)
+    и с какой задержкой от sendto до публикации.
+
+    Туннель создается в отдельном сетевом пространстве имен, чтобы не трогать
+    маршруты машины. Скрипт сам туда не ходит, его нужно запускать в нем целиком:
+
+        sudo ip netns add its-tun-bench
+        sudo ip netns exec its-tun-bench ip link set lo up
+        sudo -E ip netns exec its-tun-bench python3 broker.py &
+        sudo -E ip netns exec its-tun-bench python3 bench_tun_uplink.py --server .../server-tun
+
+    С --server скрипт сам запускает TUN сервер (в том же пространстве имен)
+    для каждой нагрузки и печатает еще и процессорное время, которое тот потратил.
+    Иначе меряет уже запущенный сервер. Опции сервера можно добавить через
+    --server-args, например "--aggregate --aggregate-hold-ms 5".
+
+    Для каждой нагрузки печатается, сколько SDU и сколько кадров пришлось
+    на один IP пакет. SDU со сборками (server-tun --aggregate) разбираются
+    на пакеты. Кадры считаются по radio.uplink_frame, так что их видно, только
+    если на шине работают USLP сервер и радио (или imitator_radio.py)
+"""
+
+
+_log = logging.getLogger(__name__)
+
+
+BENCH_PAYLOAD = struct.Struct("<QQ")
+""" Начало полезной нагрузки датаграммы: порядковый номер и время отправки в нс """
+
+UDP_HEADER_SIZE = 8
+
+TUN_LINK_AGGREGATE = 0x5
+""" Тип шима сборки пакетов server-tun (tun_link.hpp) """
+
+
+def split_aggregate(data: bytes):
+    """ Пакеты из сборки server-tun: за шимом пакеты с длинами в 1 или 2 байта """
+    retval = []
+    offset = 1
+    while offset < len(data):
+        length = data[offset]
+        offset += 1
+        if length & 0x80:
+            if offset >= len(data):
+                break
+            length = (length & 0x7F) << 8 | data[offset]
+            offset += 1
+        retval.append(data[offset:offset + length])
+        offset += length
+
+    return retval
+
+
+def parse_sdu(payload: bytes):
+    """ Порядковые номера и время отправки из EPP пакета с IPv4/UDP датаграммами """
+    epp_header_size = EppHeader.probe_header_size(payload[0])
+    data = payload[epp_header_size:]
+    if data and (data[0] >> 4) == TUN_LINK_AGGREGATE:
+        packets = split_aggregate(data)
+    else:
+        packets = [data]
+
+    retval = []
+    for packet in packets:
+        parsed = parse_ip_packet(packet)
+        if parsed is not None:
+            retval.append(parsed)
+
+    return retval
+
+
+def parse_ip_packet(ip_packet: bytes):
+    """ Порядковый номер и время отправки из IPv4/UDP датаграммы """
+    if len(ip_packet) < 20 or (ip_packet[0] >> 4) != 4:
+        return None
+
+    ip_header_size = (ip_packet[0] & 0x0F) * 4
+    udp_payload = ip_packet[ip_header_size + UDP_HEADER_SIZE:]
+    if len(udp_payload) < BENCH_PAYLOAD.size:
+        return None
+
+    return BENCH_PAYLOAD.unpack(udp_payload[:BENCH_PAYLOAD.size])
+
+
+def measure(core: SenderCore, args, rate: int):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, 4 * 1024 * 1024)
+    padding = bytes(max(0, args.size - BENCH_PAYLOAD.size))
+
+    poller = zmq.Poller()
+    poller.register(core.sub_socket, zmq.POLLIN)
+
+    latencies = []
+    sent = 0
+    received = 0
+    sdus = 0
+    frames = 0
+    first_recv_time = None
+    last_recv_time = None
+    start_time = time.perf_counter()
+    stop_time = start_time + args.duration
+    drain_deadline = None
+
+    while True:
+        now = time.perf_counter()
+        if now < stop_time:
+            # Догоняем расписание нагрузки. Без rate шлем пачку и сразу забираем ответы
+            due = args.burst if rate == 0 else int((now - start_time) * rate) - sent
+            for _ in range(min(due, args.burst)):
+                data = BENCH_PAYLOAD.pack(sent, time.perf_counter_ns()) + padding
+                try:
+                    sock.sendto(data, (args.peer, args.port))
+                except BlockingIOError:
+                    break
+                sent += 1
+        elif drain_deadline is None:
+            drain_deadline = now + args.drain_time
+
+        if drain_deadline is not None and (received >= sent or time.perf_counter() > drain_deadline):
+            break
+
+        events = dict(poller.poll(timeout=1))
+        while core.sub_socket in events:
+            parts = core.sub_socket.recv_multipart()
+            recv_ns = time.perf_counter_ns()
+            if parts[0].startswith(b"radio.uplink_frame"):
+                frames += 1
+                events = dict(poller.poll(timeout=0))
+                continue
+
+            parsed = parse_sdu(parts[2])
+            if parsed:
+                sdus += 1
+            for _, send_ns in parsed:
+                latencies.append((recv_ns - send_ns) / 1000.0)
+                received += 1
+                last_recv_time = time.perf_counter()
+                if first_recv_time is None:
+                    first_recv_time = last_recv_time
+
+            events = dict(poller.poll(timeout=0))
+
+    sock.close()
+    sent_elapsed = min(args.duration, time.perf_counter() - start_time)
+    recv_elapsed = (last_recv_time - first_recv_time) if received > 1 else float("nan")
+    return sent / sent_elapsed, received / recv_elapsed, sent, received, sorted(latencies), sdus, frames
+
+
+def main(argv):
+    core = SenderCore("tun uplink packets per second benchmark")
+    core.arg_parser.add_argument("--server", type=str, default=None, help="server-tun binary to launch")
+    core.arg_parser.add_argument("--tun", type=str, default="tun100")
+    core.arg_parser.add_argument("--addr", type=str, default="10.0.0.1/24", help="tun address for launched server")
+    core.arg_parser.add_argument("--mtu", type=int, default=1500, help="tun mtu for launched server")
+    core.arg_parser.add_argument("--peer", type=str, default="10.0.0.2", help="address behind the tunnel")
+    core.arg_parser.add_argument("--port", type=int, default=2000)
+    core.arg_parser.add_argument("--size", type=int, default=64, help="udp payload size")
+    core.arg_parser.add_argument("--rates", type=str, default="1000,5000,10000,20000,0",
+                                 help="offered packets/s, 0 - as fast as possible")
+    core.arg_parser.add_argument("--burst", type=int, default=256, help="at most packets sent per poll iteration")
+    core.arg_parser.add_argument("--duration", type=float, default=5.0)
+    core.arg_parser.add_argument("--drain-time", type=float, default=2.0, help="seconds to wait for stragglers")
+    core.arg_parser.add_argument("--channel", type=str, default="66.0.1", help="uplink channel of launched server")
+    core.arg_parser.add_argument("--server-args", type=str, default="", help="extra options for launched server")
+
+    core.setup_log()
+    args = core.parse_args(argv)
+
+    core.sub_socket.setsockopt(zmq.SUBSCRIBE, b"uslp.uplink_sdu_request")
+    core.sub_socket.setsockopt(zmq.SUBSCRIBE, b"radio.uplink_frame")
+    core.connect_sockets()
+
+    results = []
+    for rate in [int(r) for r in args.rates.split(",")]:
+        if args.server is None:
+            results.append((rate, measure(core, args, rate), None))
+            continue
+
+        env = dict(os.environ)
+        env["ITS_GBUS_BSCP_ENDPOINT"] = args.bus_bscp
+        env["ITS_GBUS_BPCS_ENDPOINT"] = args.bus_bpcs
+        env.setdefault("ITS_LOG_LEVEL", "warning")
+        server = subprocess.Popen([
+            args.server, "--tun", args.tun, "--addr", args.addr, "--mtu", str(args.mtu),
+            "--up-channel", args.channel, "--down-channel", args.channel
+        ] + shlex.split(args.server_args), env=env)
+        try:
+            time.sleep(1.0)  # Чтобы сервер поднял туннель и подключился к шине
+            result = measure(core, args, rate)
+        finally:
+            server.terminate()
+            # wait4, а не wait - нужно процессорное время сервера
+            _, _, rusage = os.wait4(server.pid, 0)
+            server.returncode = 0
+        results.append((rate, result, rusage.ru_utime + rusage.ru_stime))
+
+        # Выкидываем то, что сервер успел прислать напоследок
+        while core.sub_socket.poll(100, zmq.POLLIN):
+            core.sub_socket.recv_multipart()
+
+    core.close()
+
+    print("udp payload %d bytes" % args.size)
+    for rate, (sent_pps, recv_pps, sent, received, latencies, sdus, frames), cpu_time in results:
+        print("offered %-8s sent %9.1f pkt/s, forwarded %9.1f pkt/s, %d of %d (%d lost), "
+              "latency p50 %.1f us, p99 %.1f us" % (
+                  rate if rate else "max", sent_pps, recv_pps, received, sent, sent - received,
+                  percentile(latencies, 0.50), percentile(latencies, 0.99)
+              ))
+        if received:
+            print("%-16s %.3f SDUs per packet, %s frames per packet" % (
+                "", sdus / received, "%.3f" % (frames / received) if frames else "n/a"
+            ))
+        if cpu_time is not None:
+            print("%-16s server cpu time %.3f s for whole run" % ("", cpu_time))
+
+    if not any(result[3] for _, result, _ in results):
+        _log.error("no SDUs were received. is server-tun running in this network namespace?")
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    argv = sys.argv[1:]
+    exit(main(argv))
@@ -0,0 +1,122 @@
+import sys
+import time
+import json
+import logging
+
+import zmq
+
+from senders_common import SenderCore
+
+
+""" Нагрузочный тест диспетчера сообщений USLP сервера
+
+    Скрипт публикует uslp.uplink_sdu_request с маленькими SDU, держа в полете
+    не больше --window запросов, и ждет на каждый из них событие sdu_accepted
+    (или sdu_rejected) в uslp.uplink_sdu_event.*. Каждый запрос это одно
+    входящее и одно исходящее сообщение USLP сервера, поэтому результат
+    показывает, сколько сообщений в секунду сервер прокачивает через диспетчер.
+
+    Радио-сервер при этом лучше не запускать: тогда SDU просто копятся в стеке
+    и в тест не подмешивается отправка фреймов.
+"""
+
+
+_log = logging.getLogger(__name__)
+
+
+def percentile(sorted_values, fraction: float):
+    if not sorted_values:
+        return float("nan")
+
+    index = min(len(sorted_values) - 1, int(len(sorted_values) * fraction))
+    return sorted_values[index]
+
+
+def main(argv):
+    core = SenderCore("uslp dispatcher benchmark")
+    core.arg_parser.add_argument("--count", type=int, default=20000, help="sdu requests to send in total")
+    core.arg_parser.add_argument("--window", type=int, default=64, help="max requests in flight")
+    core.arg_parser.add_argument("--sdu-size", type=int, default=16)
+    core.arg_parser.add_argument("--sc-id", type=int, default=0x42)
+    core.arg_parser.add_argument("--vc-id", type=int, default=0)
+    core.arg_parser.add_argument("--map-id", type=int, default=1)
+    core.arg_parser.add_argument("--timeout", type=float, default=2.0, help="seconds to wait for a reply")
+
+    core.setup_log()
+    args = core.parse_args(argv)
+
+    channel = "%d.%d.%d" % (args.sc_id, args.vc_id, args.map_id)
+    core.sub_socket.setsockopt(zmq.SUBSCRIBE, b"uslp.uplink_sdu_event." + channel.encode("utf-8"))
+    core.connect_sockets()
+
+    poller = zmq.Poller()
+    poller.register(core.sub_socket, zmq.POLLIN)
+
+    request_topic = "uslp.uplink_sdu_request." + channel
+    payload = bytes(args.sdu_size)
+
+    send_times = {}
+    latencies = []
+    rejected = 0
+    sent = 0
+    first_send_time = time.perf_counter()
+    last_reply_time = first_send_time
+
+    while sent < args.count or send_times:
+        while sent < args.count and len(send_times) < args.window:
+            cookie = sent + 1
+            meta = {
+                "sc_id": args.sc_id,
+                "vchannel_id": args.vc_id,
+                "map_id": args.map_id,
+                "qos": "expedited",
+                "cookie": cookie,
+            }
+            send_times[cookie] = time.perf_counter_ns()
+            core.pub_message(request_topic, meta, payload)
+            sent += 1
+
+        events = dict(poller.poll(timeout=int(args.timeout * 1000)))
+        if core.sub_socket not in events:
+            _log.error("no reply for %d seconds, %d requests lost", args.timeout, len(send_times))
+            break
+
+        while core.sub_socket in events:
+            parts = core.sub_socket.recv_multipart()
+            recv_ns = time.perf_counter_ns()
+            meta = json.loads(parts[1])
+            if meta["event"] not in ("sdu_accepted", "sdu_rejected"):
+                events = dict(poller.poll(timeout=0))
+                continue
+
+            send_ns = send_times.pop(meta["cookie"]["cookie"], None)
+            if send_ns is not None:
+                latencies.append((recv_ns - send_ns) / 1000.0)
+                if meta["event"] == "sdu_rejected":
+                    rejected += 1
+
+            last_reply_time = time.perf_counter()
+            events = dict(poller.poll(timeout=0))
+
+    core.close()
+
+    if not latencies:
+        _log.error("no replies were received. is server-uslp running?")
+        return 1
+
+    elapsed = last_reply_time - first_send_time
+    latencies.sort()
+    print("requests sent:   %d" % sent)
+    print("replies:         %d (%d rejected, %d lost)" % (len(latencies), rejected, sent - len(latencies)))
+    print("throughput:      %.1f requests/s (%.1f bus messages/s)" % (
+        len(latencies) / elapsed, 2 * len(latencies) / elapsed
+    ))
+    print("latency p50:     %.1f us" % percentile(latencies, 0.50))
+    print("latency p99:     %.1f us" % percentile(latencies, 0.99))
+    print("latency max:     %.1f us" % latencies[-1])
+    return 0
+
+
+if __name__ == "__main__":
+    argv = sys.argv[1:]
+    exit(main(argv))
@@ -0,0 +1,165 @@
+import sys
+import time
+import struct
+import logging
+
+import zmq
+
+from senders_common import SenderCore
+from ccsds.epp import EppHeader, EppProtocolId
+
+
+""" Нагрузочный тест downlink тракта USLP сервера
+
+    Скрипт изображает радио-сервер: публикует пачками сообщения radio.downlink_frame
+    с USLP фреймами, в каждом из которых лежит один EPP пакет с порядковым номером
+    и временем отправки. USLP сервер выпускает эти пакеты в uslp.downlink_sdu.*,
+    скрипт их ловит и считает пропускную способность и задержку от публикации фрейма
+    до публикации SDU.
+
+    Для сравнения режимов диспетчера USLP сервер запускается с разными значениями
+    ITS_USLP_BATCH_LIMIT
+"""
+
+
+_log = logging.getLogger(__name__)
+
+
+USLP_TFVN = 0x0C
+""" Версия фрейма USLP """
+EPP_IDLE_BYTE = 0xE0
+""" Однобайтовый idle пакет EPP, им забиваем хвост фрейма """
+
+BENCH_PAYLOAD = struct.Struct("<QQ")
+""" Полезная нагрузка пакета: порядковый номер и время отправки в нс """
+
+
+def make_uslp_frame(frame_size: int, sc_id: int, vc_id: int, map_id: int, vc_count: int, payload: bytes):
+    """ Сборка USLP фрейма без insert zone, OCF и контрольной суммы
+        c двухбайтным счетчиком фреймов виртуального канала """
+
+    header = bytearray()
+    id_word = 0
+    id_word |= (USLP_TFVN & 0x0F) << 28
+    id_word |= (sc_id & 0xFFFF) << 12
+    id_word |= (vc_id & 0x3F) << 5
+    id_word |= (map_id & 0x0F) << 1
+    header += struct.pack(">L", id_word)
+    header += struct.pack(">H", frame_size - 1)
+    header.append(0x02)  # без bypass, без OCF, длина счетчика фреймов - 2 байта
+    header += struct.pack(">H", vc_count & 0xFFFF)
+
+    # Заголовок TFDF: правило 000 (пакеты), UPID 0, первый пакет в самом начале
+    header.append(0x00)
+    header += struct.pack(">H", 0x0000)
+
+    frame = header + payload
+    if len(frame) > frame_size:
+        raise ValueError("payload of size %d does not fit to frame of size %d" % (len(payload), frame_size))
+
+    frame += bytes([EPP_IDLE_BYTE]) * (frame_size - len(frame))
+    return bytes(frame)
+
+
+def make_epp_packet(payload: bytes):
+    header = EppHeader()
+    header.protocol_id = EppProtocolId.PRIVATE
+    header.accomodate_to_payload_size(len(payload))
+    return header.write() + payload
+
+
+def percentile(sorted_values, fraction: float):
+    if not sorted_values:
+        return float("nan")
+
+    index = min(len(sorted_values) - 1, int(len(sorted_values) * fraction))
+    return sorted_values[index]
+
+
+def main(argv):
+    core = SenderCore("uslp downlink dispatch benchmark")
+    core.arg_parser.add_argument("--count", type=int, default=10000, help="frames to send in total")
+    core.arg_parser.add_argument("--burst", type=int, default=100, help="frames in one burst")
+    core.arg_parser.add_argument("--burst-period", type=float, default=0.1, help="seconds between bursts")
+    core.arg_parser.add_argument("--frame-size", type=int, default=200)
+    core.arg_parser.add_argument("--sc-id", type=int, default=0x42)
+    core.arg_parser.add_argument("--vc-id", type=int, default=0)
+    core.arg_parser.add_argument("--map-id", type=int, default=1)
+    core.arg_parser.add_argument("--drain-time", type=float, default=2.0, help="seconds to wait for stragglers")
+
+    core.setup_log()
+    args = core.parse_args(argv)
+
+    core.sub_socket.setsockopt(
+        zmq.SUBSCRIBE, b"uslp.downlink_sdu.%d.%d.%d" % (args.sc_id, args.vc_id, args.map_id)
+    )
+    core.connect_sockets()
+
+    poller = zmq.Poller()
+    poller.register(core.sub_socket, zmq.POLLIN)
+
+    latencies = []
+    received = 0
+    sent = 0
+    first_send_time = None
+    last_recv_time = None
+    next_burst_time = time.perf_counter()
+    drain_deadline = None
+
+    while True:
+        now = time.perf_counter()
+        if sent < args.count and now >= next_burst_time:
+            for _ in range(min(args.burst, args.count - sent)):
+                send_ns = time.perf_counter_ns()
+                payload = make_epp_packet(BENCH_PAYLOAD.pack(sent, send_ns))
+                frame = make_uslp_frame(args.frame_size, args.sc_id, args.vc_id, args.map_id, sent, payload)
+                meta = {
+                    "checksum_valid": True,
+                    "cookie": sent + 1,
+                    "frame_no": sent & 0xFFFF,
+                }
+                core.pub_message("radio.downlink_frame", meta, frame)
+                sent += 1
+
+            if first_send_time is None:
+                first_send_time = now
+
+            next_burst_time += args.burst_period
+            if sent >= args.count:
+                drain_deadline = time.perf_counter() + args.drain_time
+
+        if drain_deadline is not None and (received >= sent or time.perf_counter() > drain_deadline):
+            break
+
+        events = dict(poller.poll(timeout=1))
+        while core.sub_socket in events:
+            parts = core.sub_socket.recv_multipart()
+            recv_ns = time.perf_counter_ns()
+            packet = parts[2]
+            header_size = EppHeader.probe_header_size(packet[0])
+            seq_no, send_ns = BENCH_PAYLOAD.unpack(packet[header_size:header_size + BENCH_PAYLOAD.size])
+            latencies.append((recv_ns - send_ns) / 1000.0)
+            received += 1
+            last_recv_time = time.perf_counter()
+            events = dict(poller.poll(timeout=0))
+
+    core.close()
+
+    if not received:
+        _log.error("no SDUs were received. is server-uslp running?")
+        return 1
+
+    elapsed = last_recv_time - first_send_time
+    latencies.sort()
+    print("frames sent:     %d" % sent)
+    print("sdus received:   %d (%d lost)" % (received, sent - received))
+    print("throughput:      %.1f frames/s" % (received / elapsed))
+    print("latency p50:     %.1f us" % percentile(latencies, 0.50))
+    print("latency p99:     %.1f us" % percentile(latencies, 0.99))
+    print("latency max:     %.1f us" % latencies[-1])
+    return 0
+
+
+if __name__ == "__main__":
+    argv = sys.argv[1:]
+    exit(main(argv))
@@ -0,0 +1,330 @@
+import os
+import sys
+import time
+import json
+import logging
+import subprocess
+
+import zmq
+
+from senders_common import SenderCore
+from bench_uslp_downlink import make_uslp_frame, make_epp_packet
+
+
+""" Нагрузочный тест uplink тракта USLP сервера с разными размерами окна
+
+    Скрипт изображает радио-сервер с одним отправным буфером: забирает фрейм
+    из сокета только когда буфер свободен, "излучает" его --tx-time секунд
+    и сообщает о каждом изменении своего состояния в radio.uplink_state.
+    Чтобы USLP стеку всегда было что отправлять, перед измерением скрипт
+    закидывает в него --sdu-count SDU.
+
+    Если указан --server, скрипт сам запускает USLP сервер для каждого размера
+    окна из --windows (через ITS_USLP_UPLINK_WINDOW) и печатает сводную таблицу.
+    Иначе измеряет уже запущенный сервер один раз.
+
+    Кроме пропускной способности скрипт меряет задержку решения по аплинку:
+    время от освобождения отправного буфера радио до прихода следующего фрейма.
+    С --downlink-burst скрипт параллельно заваливает сервер даунлинк фреймами,
+    чтобы проверить, что задержка аплинка от этого не растет
+    (с --threaded сервер запускается с ITS_USLP_THREADED=1)
+
+    С --command-period скрипт раз в столько секунд шлет телекоманду в MAP
+    --command-map-id поверх забитого SDU канала --map-id и меряет, сколько
+    она ждет излучения (от отправки запроса до sdu_radiated её последней части).
+    Расписание MAP каналов сервера задается через --map-schedule
+    (ITS_USLP_MAP_SCHEDULE)
+
+    Скрипт считает все сообщения с событиями SDU, которые публикует сервер,
+    а для запущенного им сервера еще и процессорное время, которое тот потратил.
+    С --sdu-events batch (ITS_USLP_SDU_EVENTS) сервер шлет события пачками
+    в uslp.uplink_event_batch, так можно сравнить оба способа
+"""
+
+
+_log = logging.getLogger(__name__)
+
+
+class StubRadio:
+
+    def __init__(self, core: SenderCore, tx_time: float):
+        self.core = core
+        self.tx_time = tx_time
+        self.slot_freed_time = None
+        self.decision_latencies = []
+        self.cookie_in_wait = None
+        self.cookie_in_progress = None
+        self.cookie_sent = None
+        self.tx_end_time = None
+        self.frames_sent = 0
+
+    def send_uplink_state(self):
+        now = time.time()
+        seconds = int(now)
+        meta = {
+            "time_s": seconds,
+            "time_us": int((now - seconds) * 1000_000),
+            "cookie_in_wait": self.cookie_in_wait,
+            "cookie_in_progress": self.cookie_in_progress,
+            "cookie_sent": self.cookie_sent,
+            "cookie_dropped": None,
+        }
+        self.core.pub_message("radio.uplink_state", meta)
+
+    def poll(self, timeout: float):
+        # Свободен ли отправной буфер? Если нет, то и сокет не трогаем
+        if self.cookie_in_wait is None:
+            if self.core.sub_socket.poll(int(timeout * 1000), zmq.POLLIN):
+                parts = self.core.sub_socket.recv_multipart()
+                meta = json.loads(parts[1])
+                self.cookie_in_wait = meta["cookie"]
+                if self.slot_freed_time is not None:
+                    self.decision_latencies.append((time.perf_counter() - self.slot_freed_time) * 1000_000)
+                    self.slot_freed_time = None
+                self.send_uplink_state()
+        else:
+            time.sleep(min(timeout, 0.0001))
+
+        now = time.perf_counter()
+        if self.cookie_in_progress is not None and now >= self.tx_end_time:
+            self.cookie_sent = self.cookie_in_progress
+            self.cookie_in_progress = None
+            self.frames_sent += 1
+            self.send_uplink_state()
+
+        if self.cookie_in_progress is None and self.cookie_in_wait is not None:
+            self.cookie_in_progress = self.cookie_in_wait
+            self.cookie_in_wait = None
+            self.tx_end_time = now + self.tx_time
+            self.send_uplink_state()
+            # Отправной буфер освободился, с этого момента ждем следующий фрейм
+            self.slot_freed_time = time.perf_counter()
+
+
+def feed_sdus(core: SenderCore, args):
+    topic = "uslp.uplink_sdu_request.%d.%d.%d" % (args.sc_id, args.vc_id, args.map_id)
+    payload = bytes(args.sdu_size)
+    for cookie in range(1, args.sdu_count + 1):
+        meta = {
+            "sc_id": args.sc_id,
+            "vchannel_id": args.vc_id,
+            "map_id": args.map_id,
+            "qos": "expedited",
+            "cookie": cookie,
+        }
+        core.pub_message(topic, meta, payload)
+
+
+class DownlinkLoad:
+    """ Поток даунлинк фреймов, изображающий полностью загруженный даунлинк """
+
+    def __init__(self, core: SenderCore, args):
+        self.core = core
+        self.args = args
+        self.frame_no = 0
+        payload = make_epp_packet(bytes(args.downlink_sdu_size))
+        self.frame = make_uslp_frame(args.frame_size, args.sc_id, 0, 1, 0, payload)
+
+    def poll(self):
+        for _ in range(self.args.downlink_burst):
+            meta = {
+                "checksum_valid": True,
+                "cookie": self.frame_no + 1,
+                "frame_no": self.frame_no & 0xFFFF,
+            }
+            self.core.pub_message("radio.downlink_frame", meta, self.frame)
+            self.frame_no += 1
+
+
+class CommandProbe:
+    """ Телекоманды поверх загруженного канала и задержка их излучения
+
+        Заодно считает все события SDU и сообщения, которыми они пришли
+    """
+
+    def __init__(self, core: SenderCore, args):
+        self.core = core
+        self.args = args
+        self.topic = "uslp.uplink_sdu_request.%d.%d.%d" % (args.sc_id, args.vc_id, args.command_map_id)
+        self.payload = bytes(args.command_size)
+        # Куки телекоманд не пересекаются с куками нагрузки
+        self.next_cookie = 1 << 40
+        self.sent_times = {}
+        self.latencies = []
+        self.next_send_time = None
+        self.event_messages = 0
+        self.events = 0
+
+        # Свой сокет, чтобы события не мешались с фреймами для радио
+        self.event_socket = core.zmq_ctx.socket(zmq.SUB)
+        self.event_socket.setsockopt(zmq.SUBSCRIBE, b"uslp.uplink_sdu_event.")
+        self.event_socket.setsockopt(zmq.SUBSCRIBE, b"uslp.uplink_event_batch")
+        self.event_socket.connect(args.bus_bpcs)
+
+    def reset_counters(self):
+        self.event_messages = 0
+        self.events = 0
+
+    def poll(self):
+        now = time.perf_counter()
+        sending = self.args.command_period > 0
+        if sending and (self.next_send_time is None or now >= self.next_send_time):
+            meta = {
+                "sc_id": self.args.sc_id,
+                "vchannel_id": self.args.vc_id,
+                "map_id": self.args.command_map_id,
+                "qos": "expedited",
+                "cookie": self.next_cookie,
+            }
+            self.sent_times[self.next_cookie] = now
+            self.core.pub_message(self.topic, meta, self.payload)
+            self.next_cookie += 1
+            self.next_send_time = now + self.args.command_period
+
+        while self.event_socket.poll(0, zmq.POLLIN):
+            parts = self.event_socket.recv_multipart()
+            meta = json.loads(parts[1])
+            events = meta["events"] if parts[0] == b"uslp.uplink_event_batch" else [meta]
+            self.event_messages += 1
+            self.events += len(events)
+            for event in events:
+                self.on_event(event)
+
+    def on_event(self, event):
+        cookie = event["cookie"]
+        if event["map_id"] != self.args.command_map_id:
+            return
+        if event["event"] != "sdu_radiated" or not cookie["is_final_part"]:
+            return
+
+        sent_time = self.sent_times.pop(cookie["cookie"], None)
+        if sent_time is not None:
+            self.latencies.append((time.perf_counter() - sent_time) * 1000)
+
+    def close(self):
+        self.event_socket.close()
+
+
+def percentile(sorted_values, fraction: float):
+    if not sorted_values:
+        return float("nan")
+
+    index = min(len(sorted_values) - 1, int(len(sorted_values) * fraction))
+    return sorted_values[index]
+
+
+def measure(core: SenderCore, args):
+    radio = StubRadio(core, args.tx_time)
+    downlink = DownlinkLoad(core, args)
+    commands = CommandProbe(core, args)
+    feed_sdus(core, args)
+
+    # Пинаем сервер, чтобы он начал отправлять
+    radio.send_uplink_state()
+
+    # Даем разогнаться, потом меряем
+    warmup_deadline = time.perf_counter() + args.warmup
+    while time.perf_counter() < warmup_deadline:
+        radio.poll(0.001)
+
+    start_frames = radio.frames_sent
+    radio.decision_latencies.clear()
+    commands.reset_counters()
+    start_time = time.perf_counter()
+    deadline = start_time + args.duration
+    while time.perf_counter() < deadline:
+        downlink.poll()
+        commands.poll()
+        radio.poll(0.001)
+
+    elapsed = time.perf_counter() - start_time
+    commands.close()
+    latencies = sorted(radio.decision_latencies)
+    events = (commands.event_messages, commands.events)
+    return (radio.frames_sent - start_frames) / elapsed, latencies, sorted(commands.latencies), events
+
+
+def main(argv):
+    core = SenderCore("uslp uplink window benchmark")
+    core.arg_parser.add_argument("--server", type=str, default=None, help="server-uslp binary to launch")
+    core.arg_parser.add_argument("--windows", type=str, default="1,2,3,4,5,6,7,8")
+    core.arg_parser.add_argument("--tx-time", type=float, default=0.005, help="seconds to radiate one frame")
+    core.arg_parser.add_argument("--duration", type=float, default=5.0)
+    core.arg_parser.add_argument("--warmup", type=float, default=0.5)
+    core.arg_parser.add_argument("--sdu-count", type=int, default=20000)
+    core.arg_parser.add_argument("--sdu-size", type=int, default=150)
+    core.arg_parser.add_argument("--sc-id", type=int, default=0x42)
+    core.arg_parser.add_argument("--vc-id", type=int, default=0)
+    core.arg_parser.add_argument("--map-id", type=int, default=1)
+    core.arg_parser.add_argument("--threaded", action="store_true", help="launch server with ITS_USLP_THREADED=1")
+    core.arg_parser.add_argument("--downlink-burst", type=int, default=0, help="downlink frames per poll iteration")
+    core.arg_parser.add_argument("--downlink-sdu-size", type=int, default=180)
+    core.arg_parser.add_argument("--frame-size", type=int, default=200)
+    core.arg_parser.add_argument("--command-period", type=float, default=0, help="seconds between telecommands, 0 - none")
+    core.arg_parser.add_argument("--command-map-id", type=int, default=0)
+    core.arg_parser.add_argument("--command-size", type=int, default=20)
+    core.arg_parser.add_argument("--map-schedule", type=str, default=None, help="ITS_USLP_MAP_SCHEDULE for the server")
+    core.arg_parser.add_argument("--sdu-events", type=str, default=None, choices=["single", "batch", "both"],
+                                 help="ITS_USLP_SDU_EVENTS for the server")
+
+    core.setup_log()
+    args = core.parse_args(argv)
+
+    core.sub_socket.setsockopt(zmq.SUBSCRIBE, b"radio.uplink_frame")
+    # Даунлинк SDU не слушаем, чтобы не тратить на них время
+    core.connect_sockets()
+
+    ideal = 1.0 / args.tx_time
+    results = []
+    if args.server is None:
+        results.append((None, measure(core, args), None))
+    else:
+        for window in [int(w) for w in args.windows.split(",")]:
+            env = dict(os.environ)
+            env["ITS_USLP_UPLINK_WINDOW"] = str(window)
+            env["ITS_USLP_THREADED"] = "1" if args.threaded else "0"
+            env["ITS_GBUS_BSCP_ENDPOINT"] = args.bus_bscp
+            env["ITS_GBUS_BPCS_ENDPOINT"] = args.bus_bpcs
+            if args.map_schedule is not None:
+                env["ITS_USLP_MAP_SCHEDULE"] = args.map_schedule
+            if args.sdu_events is not None:
+                env["ITS_USLP_SDU_EVENTS"] = args.sdu_events
+            server = subprocess.Popen([args.server], env=env)
+            try:
+                time.sleep(0.5)  # Чтобы сервер успел подключиться к шине
+                result = measure(core, args)
+            finally:
+                server.terminate()
+                # wait4, а не wait - нужно процессорное время сервера
+                _, _, rusage = os.wait4(server.pid, 0)
+                server.returncode = 0
+            results.append((window, result, rusage.ru_utime + rusage.ru_stime))
+
+            # Выкидываем фреймы, которые сервер успел прислать напоследок
+            while core.sub_socket.poll(100, zmq.POLLIN):
+                core.sub_socket.recv_multipart()
+
+    core.close()
+
+    print("tx time %.1f ms, at most %.1f frames/s" % (args.tx_time * 1000, ideal))
+    for window, (frames_per_second, latencies, command_latencies, events), cpu_time in results:
+        print("window %-8s %8.1f frames/s (%.0f%% of air time), decision latency p50 %.1f us, p99 %.1f us" % (
+            window if window is not None else "-", frames_per_second, 100 * frames_per_second / ideal,
+            percentile(latencies, 0.50), percentile(latencies, 0.99)
+        ))
+        if args.command_period > 0:
+            print("%-15s %d telecommands radiated, latency p50 %.1f ms, p99 %.1f ms" % (
+                "", len(command_latencies), percentile(command_latencies, 0.50), percentile(command_latencies, 0.99)
+            ))
+        event_messages, event_count = events
+        print("%-15s %d SDU events in %d bus messages (%.1f per message)" % (
+            "", event_count, event_messages, event_count / event_messages if event_messages else 0
+        ))
+        if cpu_time is not None:
+            print("%-15s server cpu time %.3f s for whole run" % ("", cpu_time))
+    return 0
+
+
+if __name__ == "__main__":
+    argv = sys.argv[1:]
+    exit(main(argv))
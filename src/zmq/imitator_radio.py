@@ -133,7 +133,11 @@ class RadioServerImitator:
             # Будем спать не дольше чем можем и не больше миллисекунды
             # Чтобы успевать отправлять rssi
             zmq_timeout_ms = max(zmq_timeout_ms, ms_untill_deadline)
-            if self.sub_socket.poll(zmq_timeout_ms, zmq.POLLIN):
+            if self.uplink_in_wait is not None:
+                # Как и настоящее радио не забираем следующие сообщения,
+                # пока отправной буфер занят. Пусть ждут в очереди сокета
+                time.sleep(self.ZMQ_POLL_TIMEOUT)
+            elif self.sub_socket.poll(zmq_timeout_ms, zmq.POLLIN):
                 self.process_input_message()
 
             # Собственно отправляем RSSI и статистику и прочую шушеру
@@ -31,6 +31,8 @@ def main(args):
     )
     core.arg_parser.add_argument(
         "--cookie", nargs='?', type=int, default=0, help="sdu cookie", dest="cookie")
+    core.arg_parser.add_argument(
+        "--ttl-ms", nargs='?', type=int, default=None, help="sdu time to live in server queue", dest="ttl_ms")
 
     args = core.parse_args(argv)
     _log.info("using channel sc_id=0x%X, vc_id=0x%X, map_id=0x%X", args.sc_id, args.vc_id, args.map_id)
@@ -43,6 +45,8 @@ def main(args):
         "sc_id": args.sc_id, "vchannel_id": args.vc_id, "map_id": args.map_id,
         "cookie": args.cookie, "qos": args.qos.value
     }
+    if args.ttl_ms is not None:
+        metadata["ttl_ms"] = args.ttl_ms
 
     data = bytes([i % 0xFF for i in range(0, 500)])
 